@@ -46,6 +46,8 @@ int
 BatchStats::initialize(ErrorHandler *errh)
 {
     stats.initialize(get_passing_threads(),Vector<int>(MAX_BATCH_SIZE,0));
+    if (MetricRegistry *reg = MetricRegistry::find(router()))
+        reg->add(this, "batch_size", "Number of packets per batch.", &_sizes);
     return 0;
 }
 
@@ -59,6 +61,7 @@ Packet*
 BatchStats::simple_action(Packet* p)
 {
     (*stats)[1]++;
+    _sizes.record(1);
     return p;
 }
 
@@ -67,6 +70,7 @@ PacketBatch*
 BatchStats::simple_action_batch(PacketBatch* b)
 {
     (*stats)[b->count()]++;
+    _sizes.record(b->count());
     return b;
 }
 #endif
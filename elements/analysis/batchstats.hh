@@ -4,6 +4,7 @@
 #include <click/batchelement.hh>
 #include <click/multithread.hh>
 #include <click/vector.hh>
+#include <click/metrics.hh>
 CLICK_DECLS
 
 /*
@@ -15,6 +16,26 @@ BatchStats
 
 keep statistics about batching
 
+=d
+
+Counts the batches that pass through it by size.
+
+If the configuration contains a Metrics element, the sizes are also exported
+as the batch_size histogram.
+
+=h median read-only
+
+Returns the most frequent batch size.
+
+=h average read-only
+
+Returns the average batch size.
+
+=h dump read-only
+
+Returns the number of batches of each size.
+
+=a Metrics
  */
 
 class BatchStats : public BatchElement { public:
@@ -38,6 +59,7 @@ class BatchStats : public BatchElement { public:
 private:
 
     per_thread_omem<Vector<int>> stats;
+    MetricHistogram _sizes;
     enum{H_MEDIAN,H_AVERAGE,H_DUMP};
     static String read_handler(Element *e, void *thunk);
 };
@@ -0,0 +1,523 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * fqcodel.{cc,hh} -- fair queueing with per-flow CoDel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "fqcodel.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/packet_anno.hh>
+#include <click/integers.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+CLICK_DECLS
+
+FQCoDel::FQCoDel()
+    : _limit(10240), _memory_limit(32 << 20), _nflows(1024), _quantum(1514),
+      _flow_anno(-1), _perturb(0), _flows(0), _length(0), _backlog(0),
+      _memory(0), _maxpacket(0), _highwater_length(0), _codel_drops(0),
+      _overlimit_drops(0), _overmemory_drops(0), _new_flow_count(0)
+{
+    _new.head = _new.tail = _old.head = _old.tail = none;
+    _new.len = _old.len = 0;
+}
+
+FQCoDel::~FQCoDel()
+{
+}
+
+void *
+FQCoDel::cast(const char *n)
+{
+    if (strcmp(n, Notifier::EMPTY_NOTIFIER) == 0)
+	return static_cast<Notifier *>(&_empty_note);
+    return BatchElement::cast(n);
+}
+
+int
+FQCoDel::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _target = Timestamp::make_msec(0, 5);
+    _interval = Timestamp::make_msec(0, 100);
+    if (Args(conf, this, errh)
+	.read("LIMIT", _limit)
+	.read("MEMORY_LIMIT", _memory_limit)
+	.read("FLOWS", _nflows)
+	.read("QUANTUM", _quantum)
+	.read("TARGET", _target)
+	.read("INTERVAL", _interval)
+	.read("FLOW_ANNO", AnnoArg(4), _flow_anno)
+	.complete() < 0)
+	return -1;
+
+    if (_limit == 0 || _memory_limit == 0)
+	return errh->error("LIMIT and MEMORY_LIMIT must be positive");
+    if (_nflows == 0 || _nflows >= none)
+	return errh->error("bad number of FLOWS");
+    if (_quantum <= 0)
+	return errh->error("QUANTUM must be positive");
+    if (!_interval)
+	return errh->error("INTERVAL must be positive");
+    _empty_note.initialize(Notifier::EMPTY_NOTIFIER, router());
+    return 0;
+}
+
+int
+FQCoDel::initialize(ErrorHandler *errh)
+{
+    _flows = (Flow *) CLICK_LALLOC(sizeof(Flow) * _nflows);
+    if (!_flows)
+	return errh->error("out of memory");
+    for (uint32_t i = 0; i < _nflows; i++) {
+	Flow &f = _flows[i];
+	f.head = f.tail = 0;
+	f.backlog = 0;
+	f.deficit = 0;
+	f.next = none;
+	f.list = l_none;
+	f.dropping = false;
+	f.count = f.lastcount = 0;
+	f.first_above_time = Timestamp();
+	f.drop_next = Timestamp();
+    }
+    _perturb = click_random();
+    return 0;
+}
+
+void
+FQCoDel::cleanup(CleanupStage)
+{
+    if (_flows) {
+	for (uint32_t i = 0; i < _nflows; i++)
+	    while (Packet *p = _flows[i].head) {
+		_flows[i].head = p->next();
+		p->kill();
+	    }
+	CLICK_LFREE(_flows, sizeof(Flow) * _nflows);
+    }
+}
+
+static inline uint32_t
+rol32(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+// Bob Jenkins' final mix of three words.
+static inline uint32_t
+mix3(uint32_t a, uint32_t b, uint32_t c)
+{
+    c ^= b; c -= rol32(b, 14);
+    a ^= c; a -= rol32(c, 11);
+    b ^= a; b -= rol32(a, 25);
+    c ^= b; c -= rol32(b, 16);
+    a ^= c; a -= rol32(c, 4);
+    b ^= a; b -= rol32(a, 14);
+    c ^= b; c -= rol32(b, 24);
+    return c;
+}
+
+inline uint32_t
+FQCoDel::classify(Packet *p) const
+{
+    uint32_t h;
+    if (_flow_anno >= 0)
+	h = mix3(p->anno_u32(_flow_anno), 0, _perturb);
+    else if (p->has_network_header()
+	     && p->network_length() >= (int) sizeof(click_ip)
+	     && p->ip_header()->ip_v == 4) {
+	const click_ip *iph = p->ip_header();
+	uint32_t ports = 0;
+	int hl = iph->ip_hl << 2;
+	if ((iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP
+	     || iph->ip_p == IP_PROTO_UDPLITE || iph->ip_p == IP_PROTO_SCTP)
+	    && !IP_ISFRAG(iph) && p->network_length() >= hl + 4)
+	    memcpy(&ports, p->network_header() + hl, 4);
+	h = mix3(iph->ip_src.s_addr, iph->ip_dst.s_addr,
+		 (ports ^ iph->ip_p) + _perturb);
+    } else
+	h = 0;
+    return ((uint64_t) h * _nflows) >> 32;
+}
+
+inline void
+FQCoDel::DropList::append(Packet *p)
+{
+    p->set_next(0);
+    if (tail)
+	tail->set_next(p);
+    else
+	head = p;
+    tail = p;
+    ++n;
+}
+
+inline void
+FQCoDel::list_append(FlowList &l, uint32_t idx, uint8_t which)
+{
+    Flow &f = _flows[idx];
+    f.next = none;
+    f.list = which;
+    if (l.tail == none)
+	l.head = idx;
+    else
+	_flows[l.tail].next = idx;
+    l.tail = idx;
+    ++l.len;
+}
+
+inline uint32_t
+FQCoDel::list_pop(FlowList &l)
+{
+    uint32_t idx = l.head;
+    if ((l.head = _flows[idx].next) == none)
+	l.tail = none;
+    _flows[idx].list = l_none;
+    --l.len;
+    return idx;
+}
+
+inline Packet *
+FQCoDel::pop(Flow &f)
+{
+    Packet *p = f.head;
+    if (p) {
+	if (!(f.head = p->next()))
+	    f.tail = 0;
+	f.backlog -= p->length();
+	_backlog -= p->length();
+	_memory -= p->buffer_length();
+	--_length;
+	p->set_next(0);
+    }
+    return p;
+}
+
+inline void
+FQCoDel::enqueue(Packet *p, const Timestamp &now, DropList &drops)
+{
+    uint32_t idx = classify(p);
+    Flow &f = _flows[idx];
+    uint32_t len = p->length();
+
+    SET_FIRST_TIMESTAMP_ANNO(p, now);
+    p->set_next(0);
+    if (f.tail)
+	f.tail->set_next(p);
+    else
+	f.head = p;
+    f.tail = p;
+    f.backlog += len;
+    _backlog += len;
+    _memory += p->buffer_length();
+    if (len > _maxpacket)
+	_maxpacket = len;
+
+    if (f.list == l_none) {
+	list_append(_new, idx, l_new);
+	f.deficit = _quantum;
+	++_new_flow_count;
+    }
+
+    if (++_length > _highwater_length)
+	_highwater_length = _length;
+    if (_length > _limit || _memory > _memory_limit)
+	drop_from_fattest(drops);
+}
+
+// Drop from the head of the flow with the largest backlog until half of it
+// is gone, to make room for new packets at a small cost per packet.
+void
+FQCoDel::drop_from_fattest(DropList &drops)
+{
+    bool overmemory = _memory > _memory_limit;
+    uint32_t fattest = 0, max_backlog = 0;
+    for (uint32_t i = 0; i < _nflows; i++)
+	if (_flows[i].backlog > max_backlog) {
+	    max_backlog = _flows[i].backlog;
+	    fattest = i;
+	}
+
+    Flow &f = _flows[fattest];
+    uint32_t threshold = max_backlog / 2, dropped = 0;
+    for (uint32_t i = 0; i < max_overlimit_drops; i++) {
+	Packet *p = pop(f);
+	if (!p)
+	    break;
+	dropped += p->length();
+	drops.append(p);
+	if (overmemory)
+	    ++_overmemory_drops;
+	else
+	    ++_overlimit_drops;
+	if (dropped >= threshold)
+	    break;
+    }
+}
+
+inline bool
+FQCoDel::should_drop(Flow &f, Packet *p, const Timestamp &now)
+{
+    if (!p) {
+	f.first_above_time = Timestamp();
+	return false;
+    }
+    Timestamp sojourn = now - FIRST_TIMESTAMP_ANNO(p);
+    if (sojourn < _target || _backlog <= _maxpacket) {
+	// Below target, or too few bytes left to build a standing queue.
+	f.first_above_time = Timestamp();
+	return false;
+    }
+    if (!f.first_above_time)
+	f.first_above_time = now + _interval;
+    else if (now >= f.first_above_time)
+	return true;
+    return false;
+}
+
+// The next drop time, @a t + INTERVAL / sqrt(@a count).
+Timestamp
+FQCoDel::control_law(const Timestamp &t, uint32_t count) const
+{
+    uint64_t interval = _interval.nsecval();
+    uint64_t root = int_sqrt((uint64_t) count << 20);
+    uint64_t ns = interval * 1024 / (root ? root : 1);
+    return t + Timestamp::make_nsec(ns / Timestamp::nsec_per_sec,
+				    ns % Timestamp::nsec_per_sec);
+}
+
+// CoDel's dequeue, on a single flow (RFC 8289, section 5).
+Packet *
+FQCoDel::codel_dequeue(Flow &f, const Timestamp &now, DropList &drops)
+{
+    Packet *p = pop(f);
+    if (!p) {
+	f.dropping = false;
+	return 0;
+    }
+
+    bool drop = should_drop(f, p, now);
+    if (f.dropping) {
+	if (!drop)
+	    f.dropping = false;
+	else
+	    while (f.dropping && now >= f.drop_next) {
+		++f.count;
+		drops.append(p);
+		++_codel_drops;
+		p = pop(f);
+		if (!should_drop(f, p, now))
+		    f.dropping = false;
+		else
+		    f.drop_next = control_law(f.drop_next, f.count);
+	    }
+    } else if (drop) {
+	drops.append(p);
+	++_codel_drops;
+	p = pop(f);
+	should_drop(f, p, now);
+	f.dropping = true;
+	// Resume near the previous drop rate if we were dropping recently.
+	uint32_t delta = f.count - f.lastcount;
+	if (delta > 1 && now - f.drop_next < _interval * 16)
+	    f.count = delta;
+	else
+	    f.count = 1;
+	f.lastcount = f.count;
+	f.drop_next = control_law(now, f.count);
+    }
+    return p;
+}
+
+Packet *
+FQCoDel::dequeue(const Timestamp &now, DropList &drops)
+{
+    while (1) {
+	FlowList *l = _new.len ? &_new : &_old;
+	if (!l->len)
+	    return 0;
+	uint32_t idx = l->head;
+	Flow &f = _flows[idx];
+
+	if (f.deficit <= 0) {
+	    f.deficit += _quantum;
+	    list_pop(*l);
+	    list_append(_old, idx, l_old);
+	    continue;
+	}
+
+	Packet *p = codel_dequeue(f, now, drops);
+	if (!p) {
+	    // An emptied new flow goes to the old list, so that it cannot
+	    // regain priority by sending a packet per round.
+	    list_pop(*l);
+	    if (l == &_new && _old.len)
+		list_append(_old, idx, l_old);
+	    continue;
+	}
+	f.deficit -= p->length();
+	return p;
+    }
+}
+
+void
+FQCoDel::emit_drops(DropList &drops)
+{
+    if (!drops.head)
+	return;
+#if HAVE_BATCH
+    PacketBatch *batch = PacketBatch::start_head(drops.head);
+    batch->make_tail(drops.tail, drops.n);
+    checked_output_push_batch(1, batch);
+#else
+    Packet *p = drops.head;
+    while (p) {
+	Packet *next = p->next();
+	p->set_next(0);
+	checked_output_push(1, p);
+	p = next;
+    }
+#endif
+}
+
+void
+FQCoDel::push(int, Packet *p)
+{
+    DropList drops;
+    Timestamp now = Timestamp::now_steady();
+    _lock.acquire();
+    enqueue(p, now, drops);
+    if (_length && !_empty_note.active())
+	_empty_note.wake();
+    _lock.release();
+    emit_drops(drops);
+}
+
+#if HAVE_BATCH
+void
+FQCoDel::push_batch(int, PacketBatch *batch)
+{
+    DropList drops;
+    Timestamp now = Timestamp::now_steady();
+    _lock.acquire();
+    FOR_EACH_PACKET_SAFE(batch, p)
+	enqueue(p, now, drops);
+    if (_length && !_empty_note.active())
+	_empty_note.wake();
+    _lock.release();
+    emit_drops(drops);
+}
+#endif
+
+Packet *
+FQCoDel::pull(int)
+{
+    DropList drops;
+    Timestamp now = Timestamp::now_steady();
+    _lock.acquire();
+    Packet *p = dequeue(now, drops);
+    if (!p)
+	_empty_note.sleep();
+    _lock.release();
+    emit_drops(drops);
+    return p;
+}
+
+#if HAVE_BATCH
+PacketBatch *
+FQCoDel::pull_batch(int, unsigned max)
+{
+    DropList drops;
+    PacketBatch *batch = 0;
+    Packet *last = 0;
+    unsigned n = 0;
+    Timestamp now = Timestamp::now_steady();
+
+    _lock.acquire();
+    while (n < max) {
+	Packet *p = dequeue(now, drops);
+	if (!p) {
+	    _empty_note.sleep();
+	    break;
+	}
+	if (last)
+	    last->set_next(p);
+	else
+	    batch = PacketBatch::start_head(p);
+	last = p;
+	++n;
+    }
+    _lock.release();
+
+    emit_drops(drops);
+    if (batch)
+	batch->make_tail(last, n);
+    return batch;
+}
+#endif
+
+String
+FQCoDel::read_handler(Element *e, void *thunk)
+{
+    FQCoDel *fq = static_cast<FQCoDel *>(e);
+    uint64_t v[h_stats];
+    fq->_lock.acquire();
+    v[h_length] = fq->_length;
+    v[h_bytes] = fq->_backlog;
+    v[h_highwater_length] = fq->_highwater_length;
+    v[h_codel_drops] = fq->_codel_drops;
+    v[h_overlimit_drops] = fq->_overlimit_drops;
+    v[h_overmemory_drops] = fq->_overmemory_drops;
+    v[h_drops] = v[h_codel_drops] + v[h_overlimit_drops]
+	+ v[h_overmemory_drops];
+    v[h_new_flow_count] = fq->_new_flow_count;
+    v[h_sparse_flows] = fq->_new.len;
+    v[h_bulk_flows] = fq->_old.len;
+    fq->_lock.release();
+
+    int what = (intptr_t) thunk;
+    if (what != h_stats)
+	return String(v[what]);
+    static const char * const names[] = {
+	"length", "bytes", "highwater_length", "drops", "codel_drops",
+	"overlimit_drops", "overmemory_drops", "new_flow_count",
+	"sparse_flows", "bulk_flows"
+    };
+    StringAccum sa;
+    for (int i = 0; i < h_stats; i++)
+	sa << names[i] << ' ' << v[i] << '\n';
+    return sa.take_string();
+}
+
+void
+FQCoDel::add_handlers()
+{
+    add_read_handler("length", read_handler, h_length);
+    add_read_handler("bytes", read_handler, h_bytes);
+    add_read_handler("highwater_length", read_handler, h_highwater_length);
+    add_read_handler("drops", read_handler, h_drops);
+    add_read_handler("codel_drops", read_handler, h_codel_drops);
+    add_read_handler("overlimit_drops", read_handler, h_overlimit_drops);
+    add_read_handler("overmemory_drops", read_handler, h_overmemory_drops);
+    add_read_handler("new_flow_count", read_handler, h_new_flow_count);
+    add_read_handler("sparse_flows", read_handler, h_sparse_flows);
+    add_read_handler("bulk_flows", read_handler, h_bulk_flows);
+    add_read_handler("stats", read_handler, h_stats);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(int64)
+EXPORT_ELEMENT(FQCoDel)
+ELEMENT_MT_SAFE(FQCoDel)
@@ -0,0 +1,238 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_FQCODEL_HH
+#define CLICK_FQCODEL_HH
+#include <click/batchelement.hh>
+#include <click/notifier.hh>
+#include <click/timestamp.hh>
+#include <click/sync.hh>
+CLICK_DECLS
+
+/*
+=c
+
+FQCoDel([I<keywords> LIMIT, MEMORY_LIMIT, FLOWS, QUANTUM, TARGET, INTERVAL, FLOW_ANNO])
+
+=s aqm
+
+fair queueing with per-flow CoDel
+
+=d
+
+Stores packets in per-flow queues and emits them on pull, following the
+FQ-CoDel algorithm of RFC 8290. Each packet is hashed into one of FLOWS
+queues by its IP addresses, protocol and ports. Flows are served with
+deficit round robin, with priority for new flows that have not yet used up
+their first quantum ("sparse" flows), and each flow runs its own instance of
+CoDel on the time its packets spent in the queue.
+
+All flows share a single packet pool of LIMIT packets and MEMORY_LIMIT bytes
+of packet buffers. When an arriving packet exceeds either bound, packets are
+dropped from the head of the flow with the largest backlog until that flow
+has lost half its bytes, or 64 packets.
+
+Packets dropped by CoDel or for lack of room are emitted on output 1, if
+present, and killed otherwise. A pull dequeues a whole batch at once and
+reads the clock once for it.
+
+FQCoDel stores each packet's arrival time in its "first timestamp"
+annotation. Packets without an IP header all fall in the same flow, unless
+FLOW_ANNO is set.
+
+Keyword arguments are:
+
+=over 8
+
+=item LIMIT
+
+Integer. Maximum number of packets queued, over all flows. Default is 10240.
+
+=item MEMORY_LIMIT
+
+Integer. Maximum number of bytes of packet buffers queued, over all flows.
+Default is 32 MB.
+
+=item FLOWS
+
+Integer. Number of flow queues. Default is 1024.
+
+=item QUANTUM
+
+Integer. Bytes a flow may send in each round. Default is 1514.
+
+=item TARGET
+
+Time. Acceptable minimum sojourn time. Default is 5 ms.
+
+=item INTERVAL
+
+Time. Width of CoDel's sliding minimum window. Default is 100 ms.
+
+=item FLOW_ANNO
+
+Annotation. If set, the 4-byte value at that annotation, such as a hash
+computed by a NIC, selects the flow instead of the packet's headers.
+
+=back
+
+FQCoDel may be pushed and pulled from different threads.
+
+=h length read-only
+
+Number of packets queued.
+
+=h bytes read-only
+
+Number of bytes queued.
+
+=h highwater_length read-only
+
+Maximum number of packets ever queued.
+
+=h drops read-only
+
+Total number of packets dropped.
+
+=h codel_drops read-only
+
+Number of packets dropped by CoDel.
+
+=h overlimit_drops read-only
+
+Number of packets dropped because LIMIT was reached.
+
+=h overmemory_drops read-only
+
+Number of packets dropped because MEMORY_LIMIT was reached.
+
+=h new_flow_count read-only
+
+Number of times a flow became active and was served as a new flow.
+
+=h sparse_flows read-only
+
+Number of flows currently waiting in the new-flow list.
+
+=h bulk_flows read-only
+
+Number of flows currently waiting in the old-flow list.
+
+=h stats read-only
+
+All of the above, one "NAME VALUE" pair per line.
+
+=e
+
+  FromDevice(eth0) -> ... -> FQCoDel -> ToDevice(eth1);
+
+=a CoDel, Queue, DRRSched
+
+T. Hoeiland-Joergensen, P. McKenney, D. Taht, J. Gettys and E. Dumazet.
+I<The Flow Queue CoDel Packet Scheduler and Active Queue Management
+Algorithm>. RFC 8290, 2018. */
+
+class FQCoDel : public BatchElement { public:
+
+    FQCoDel() CLICK_COLD;
+    ~FQCoDel() CLICK_COLD;
+
+    const char *class_name() const	{ return "FQCoDel"; }
+    const char *port_count() const	{ return "1/1-2"; }
+    const char *processing() const	{ return "h/lh"; }
+    void *cast(const char *);
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+    Packet *pull(int);
+#if HAVE_BATCH
+    void push_batch(int, PacketBatch *);
+    PacketBatch *pull_batch(int, unsigned);
+#endif
+
+  private:
+
+    enum { none = 0xFFFFFFFFU, max_overlimit_drops = 64 };
+    enum { l_none = 0, l_new, l_old };
+
+    struct Flow {
+	Packet *head;
+	Packet *tail;
+	uint32_t backlog;	// bytes
+	int32_t deficit;
+	uint32_t next;		// in the new or old flow list
+	uint8_t list;
+	bool dropping;
+	uint32_t count;
+	uint32_t lastcount;
+	Timestamp first_above_time;
+	Timestamp drop_next;
+    };
+
+    struct FlowList {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t len;
+    };
+
+    // Packets removed under the lock, emitted or killed after it.
+    struct DropList {
+	Packet *head;
+	Packet *tail;
+	int n;
+	DropList() : head(0), tail(0), n(0) { }
+	inline void append(Packet *p);
+    };
+
+    uint32_t _limit;
+    uint32_t _memory_limit;
+    uint32_t _nflows;
+    int32_t _quantum;
+    Timestamp _target;
+    Timestamp _interval;
+    int _flow_anno;
+    uint32_t _perturb;
+
+    Flow *_flows;
+    FlowList _new;
+    FlowList _old;
+    uint32_t _length;
+    uint32_t _backlog;
+    uint32_t _memory;
+    uint32_t _maxpacket;
+
+    uint32_t _highwater_length;
+    uint64_t _codel_drops;
+    uint64_t _overlimit_drops;
+    uint64_t _overmemory_drops;
+    uint64_t _new_flow_count;
+
+    Spinlock _lock;
+    ActiveNotifier _empty_note;
+
+    inline uint32_t classify(Packet *p) const;
+    inline void enqueue(Packet *p, const Timestamp &now, DropList &drops);
+    void drop_from_fattest(DropList &drops);
+    Packet *dequeue(const Timestamp &now, DropList &drops);
+
+    inline void list_append(FlowList &l, uint32_t idx, uint8_t which);
+    inline uint32_t list_pop(FlowList &l);
+
+    inline Packet *pop(Flow &f);
+    inline bool should_drop(Flow &f, Packet *p, const Timestamp &now);
+    Packet *codel_dequeue(Flow &f, const Timestamp &now, DropList &drops);
+    Timestamp control_law(const Timestamp &t, uint32_t count) const;
+
+    void emit_drops(DropList &drops);
+
+    enum { h_length, h_bytes, h_highwater_length, h_drops, h_codel_drops,
+	   h_overlimit_drops, h_overmemory_drops, h_new_flow_count,
+	   h_sparse_flows, h_bulk_flows, h_stats };
+    static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -293,6 +293,9 @@ ARPQuerier::handle_ip(Packet *p, bool response)
     // Easy case: requires only read lock
   retry_read_lock:
     r = _arpt->lookup(dst_ip, dst_eth, _poll_timeout_j);
+    if (!response && (r >= 0 || dst_ip.addr() == 0xFFFFFFFFU
+		      || dst_ip == _my_bcast_ip || dst_ip.is_multicast()))
+	++_stats->hits;
     if (r >= 0) {
 	assert(!dst_eth->is_broadcast());
 	if (r > 0)
@@ -313,6 +316,8 @@ ARPQuerier::handle_ip(Packet *p, bool response)
 	// ... and send packet below.
     } else {
 	// Zero or unknown address: do not send the packet.
+	if (!response)
+	    ++_stats->misses;
 	if (!dst_ip) {
 	    if (!_zero_warned) {
 		click_chatter("%s: would query for 0.0.0.0; missing dest IP addr annotation?", declaration().c_str());
@@ -326,6 +331,8 @@ ARPQuerier::handle_ip(Packet *p, bool response)
 		goto retry_read_lock;
 	    if (r < 0)
 		q->kill();
+	    else
+		++_stats->queued;
 	    if (r > 0)
 		send_query_for(q, false); // q is on the ARP entry's queue
 	    // if r >= 0, do not q->kill() since it is stored in some ARP entry.
@@ -414,7 +421,33 @@ void
 ARPQuerier::push_batch(int port, PacketBatch *batch)
 {
     if (port == 0) {
-        EXECUTE_FOR_EACH_PACKET_DROPPABLE(handle_ip,batch,[](Packet*){});
+        // Look up each destination once per batch: later packets to the same
+        // destination get a copy of the first one's Ethernet header.
+        BatchHop hops[max_batch_hops];
+        int nhops = 0;
+        auto fnt = [this, &hops, &nhops](Packet *p) -> Packet * {
+            IPAddress dst_ip = p->dst_ip_anno();
+            for (int i = 0; i < nhops; ++i)
+                if (hops[i].ip == dst_ip) {
+                    WritablePacket *q = p->push_mac_header(sizeof(click_ether));
+                    if (!q) {
+                        ++_drops;
+                        return 0;
+                    }
+                    memcpy(q->ether_header(), &hops[i].ethh, sizeof(click_ether));
+                    ++_stats->hits;
+                    return q;
+                }
+            Packet *q = handle_ip(p, false);
+            // a returned packet was resolved, not saved in the table
+            if (q && nhops < max_batch_hops) {
+                hops[nhops].ip = dst_ip;
+                memcpy(&hops[nhops].ethh, q->ether_header(), sizeof(click_ether));
+                ++nhops;
+            }
+            return q;
+        };
+        EXECUTE_FOR_EACH_PACKET_DROPPABLE(fnt, batch, [](Packet*){});
         if (batch)
             output(0).push_batch(batch);
     } else {
@@ -441,6 +474,17 @@ ARPQuerier::read_handler(Element *e, void *thunk)
 	return String(q->_arpt->count());
     case h_length:
 	return String(q->_arpt->length());
+    case h_hits:
+    case h_misses:
+    case h_queued: {
+	uint32_t n = 0;
+	for (unsigned i = 0; i < q->_stats.weight(); ++i) {
+	    const stats_t &s = q->_stats.get_value(i);
+	    n += (uintptr_t) thunk == h_hits ? s.hits
+		: ((uintptr_t) thunk == h_misses ? s.misses : s.queued);
+	}
+	return String(n);
+    }
     default:
 	return String();
     }
@@ -457,6 +501,8 @@ ARPQuerier::write_handler(const String &str, Element *e, void *thunk, ErrorHandl
 	return q->_arpt->write_handler(str, q->_arpt, (void *) (uintptr_t) ARPTable::h_delete, errh);
     case h_clear:
 	q->_arp_queries = q->_drops = q->_arp_responses = 0;
+	for (unsigned i = 0; i < q->_stats.weight(); ++i)
+	    q->_stats.set_value(i, stats_t());
 	q->_arpt->clear();
 	return 0;
     default:
@@ -471,6 +517,9 @@ ARPQuerier::add_handlers()
     add_read_handler("stats", read_handler, h_stats);
     add_read_handler("count", read_handler, h_count);
     add_read_handler("length", read_handler, h_length);
+    add_read_handler("hits", read_handler, h_hits);
+    add_read_handler("misses", read_handler, h_misses);
+    add_read_handler("queued", read_handler, h_queued);
     add_data_handlers("queries", Handler::OP_READ, &_arp_queries);
     add_data_handlers("responses", Handler::OP_READ, &_arp_responses);
     add_data_handlers("drops", Handler::OP_READ, &_drops);
@@ -5,6 +5,7 @@
 #include <click/ipaddress.hh>
 #include <click/sync.hh>
 #include <click/timer.hh>
+#include <clicknet/ether.h>
 #include "arptable.hh"
 CLICK_DECLS
 
@@ -116,6 +117,10 @@ annotations set from the corresponding input packets.
 
 ARPQuerier will send at most 10 queries a second for any IP address.
 
+In batch mode, ARPQuerier resolves each distinct destination IP annotation of
+a batch once, and copies the resulting Ethernet header onto the other packets
+of the batch with the same destination.
+
 =h ipaddr rw
 
 Returns or sets the ARPQuerier's source IP address.
@@ -145,6 +150,19 @@ Returns the number of responses received.
 
 Returns the number of packets dropped.
 
+=h hits r
+
+Returns the number of IP packets sent with a known, broadcast, or multicast
+Ethernet destination.
+
+=h misses r
+
+Returns the number of IP packets whose destination was not in the table.
+
+=h queued r
+
+Returns the number of IP packets saved waiting for an ARP response.
+
 =h count r
 
 Returns the number of entries in the ARP table.
@@ -210,6 +228,14 @@ class ARPQuerier : public BatchElement { public:
     atomic_uint32_t _drops;
     atomic_uint32_t _arp_responses;
     atomic_uint32_t _broadcasts;
+    struct stats_t {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t queued;
+	stats_t() : hits(0), misses(0), queued(0) {
+	}
+    };
+    mutable per_thread<stats_t> _stats;
     bool _my_arpt;
     bool _zero_warned;
 
@@ -225,7 +251,15 @@ class ARPQuerier : public BatchElement { public:
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
 
     enum { h_table, h_table_xml, h_stats, h_insert, h_delete, h_clear,
-	   h_count, h_length };
+	   h_count, h_length, h_hits, h_misses, h_queued };
+
+#if HAVE_BATCH
+    enum { max_batch_hops = 8 };
+    struct BatchHop {
+	IPAddress ip;
+	click_ether ethh;
+    };
+#endif
 
 };
 
@@ -34,10 +34,13 @@ ARPTable::ARPTable()
     : _entry_capacity(0), _packet_capacity(2048), _entry_packet_capacity(0), _capacity_slim_factor(2), _expire_timer(this)
 {
     _entry_count = _packet_count = _drops = 0;
+    _index = make_index(16);
 }
 
 ARPTable::~ARPTable()
 {
+    if (_index)
+	CLICK_LFREE(_index, index_size(_index->mask + 1));
 }
 
 int
@@ -66,12 +69,107 @@ void
 ARPTable::cleanup(CleanupStage)
 {
     clear();
+    _rcu.synchronize();
+}
+
+ARPTable::Index *
+ARPTable::make_index(uint32_t capacity)
+{
+    Index *x = (Index *) CLICK_LALLOC(index_size(capacity));
+    if (x) {
+	x->mask = capacity - 1;
+	x->used = 0;
+	memset(x->slot, 0, capacity * sizeof(ARPEntry *));
+    }
+    return x;
+}
+
+int
+ARPTable::publish(ARPEntry *ae)
+{
+    Index *x = _index;
+    if ((x->used + 1) * 2 > x->mask + 1) {
+	// Rebuild without tombstones, at most a quarter full.
+	uint32_t capacity = 16;
+	while (capacity < 4 * (_table.size() + 1))
+	    capacity *= 2;
+	Index *nx = make_index(capacity);
+	if (nx) {
+	    for (Table::iterator it = _table.begin(); it; ++it)
+		if (it.get() != ae) {
+		    uint32_t i = index_hash(it->_ip);
+		    while (nx->slot[i & nx->mask])
+			++i;
+		    nx->slot[i & nx->mask] = it.get();
+		    ++nx->used;
+		}
+	    click_write_fence();
+	    _index = nx;
+	    _rcu.retire(x, index_size(x->mask + 1));
+	    x = nx;
+	}
+    }
+    uint32_t i = index_hash(ae->_ip);
+    while (x->slot[i & x->mask] && x->slot[i & x->mask] != tombstone())
+	++i;
+    if (!x->slot[i & x->mask]) {
+	// Probes stop at an empty slot, so one must always remain.
+	if (x->used == x->mask)
+	    return -ENOMEM;
+	++x->used;
+    }
+    click_write_fence();	// the entry is complete before readers see it
+    x->slot[i & x->mask] = ae;
+    return 0;
+}
+
+void
+ARPTable::free_entry(void *thunk, uintptr_t arg)
+{
+    static_cast<ARPTable *>(thunk)->_alloc.deallocate(reinterpret_cast<void *>(arg));
+}
+
+void
+ARPTable::retire(ARPEntry *ae)
+{
+    Index *x = _index;
+    for (uint32_t i = index_hash(ae->_ip); x->slot[i & x->mask]; ++i)
+	if (x->slot[i & x->mask] == ae) {
+	    x->slot[i & x->mask] = tombstone();
+	    break;
+	}
+    // Readers may still hold the entry: free it after a grace period.
+    _rcu.defer(free_entry, this, reinterpret_cast<uintptr_t>(ae));
+}
+
+int
+ARPTable::mark_poll(IPAddress ip, click_jiffies_t now)
+{
+    int r = 0;
+    _lock.acquire();
+    if (Table::iterator it = _table.find(ip))
+	if (it->allow_poll(now)) {
+	    it->mark_poll(now);
+	    r = 1;
+	}
+    _lock.release();
+    return r;
 }
 
 void
 ARPTable::clear()
 {
     // Walk the arp cache table and free any stored packets and arp entries.
+    _lock.acquire();
+    Index *x = _index;
+    if (Index *nx = make_index(16)) {
+	click_write_fence();
+	_index = nx;
+	_rcu.retire(x, index_size(x->mask + 1));
+    } else
+	for (uint32_t i = 0; i <= x->mask; ++i)
+	    if (x->slot[i])
+		x->slot[i] = tombstone();
     for (Table::iterator it = _table.begin(); it; ) {
 	ARPEntry *ae = _table.erase(it);
 	while (Packet *p = ae->_head) {
@@ -79,10 +177,12 @@ ARPTable::clear()
 	    p->kill();
 	    ++_drops;
 	}
-	_alloc.deallocate(ae);
+	_rcu.defer(free_entry, this, reinterpret_cast<uintptr_t>(ae));
     }
     _entry_count = _packet_count = 0;
     _age.__clear();
+    _rcu.commit();
+    _lock.release();
 }
 
 void
@@ -96,7 +196,12 @@ ARPTable::take_state(Element *e, ErrorHandler *errh)
 	return;
     }
 
+    // Entries waiting for a grace period belong to arpt's allocator.
+    arpt->_rcu.synchronize();
     _table.swap(arpt->_table);
+    Index *x = _index;
+    _index = arpt->_index;
+    arpt->_index = x;
     _age.swap(arpt->_age);
     _entry_count = arpt->_entry_count;
     _packet_count = arpt->_packet_count;
@@ -126,7 +231,7 @@ ARPTable::slim(click_jiffies_t now)
 	    ++_drops;
 	}
 
-	_alloc.deallocate(ae);
+	retire(ae);
 	--_entry_count;
     }
 
@@ -155,9 +260,10 @@ ARPTable::run_timer(Timer *timer)
 {
     // Expire any old entries, and make sure there's room for at least one
     // packet.
-    _lock.acquire_write();
+    _lock.acquire();
     slim(click_jiffies());
-    _lock.release_write();
+    _rcu.commit();
+    _lock.release();
     if (_timeout_j)
 	timer->schedule_after_sec(_timeout_j / CLICK_HZ + 1);
 }
@@ -165,12 +271,12 @@ ARPTable::run_timer(Timer *timer)
 ARPTable::ARPEntry *
 ARPTable::ensure(IPAddress ip, click_jiffies_t now)
 {
-    _lock.acquire_write();
+    _lock.acquire();
     Table::iterator it = _table.find(ip);
     if (!it) {
 	void *x = _alloc.allocate();
 	if (!x) {
-	    _lock.release_write();
+	    _lock.release();
 	    return 0;
 	}
 
@@ -181,6 +287,12 @@ ARPTable::ensure(IPAddress ip, click_jiffies_t now)
 	ARPEntry *ae = new(x) ARPEntry(ip);
 	ae->_live_at_j = now;
 	ae->_polled_at_j = ae->_live_at_j - CLICK_HZ;
+	if (publish(ae) < 0) {
+	    --_entry_count;
+	    _alloc.deallocate(x);
+	    _lock.release();
+	    return 0;
+	}
 	_table.set(it, ae);
 
 	_age.push_back(ae);
@@ -196,10 +308,9 @@ ARPTable::insert(IPAddress ip, const EtherAddress &eth, Packet **head)
     if (!ae)
 	return -ENOMEM;
 
-    ae->_eth = eth;
-    ae->_known = !eth.is_broadcast();
-
     ae->_live_at_j = now;
+    ae->set_eth(eth);
+
     ae->_num_polls_since_reply = 0;
     ae->_polled_at_j = ae->_live_at_j - CLICK_HZ;
 
@@ -216,7 +327,8 @@ ARPTable::insert(IPAddress ip, const EtherAddress &eth, Packet **head)
     }
 
     _table.balance();
-    _lock.release_write();
+    _rcu.commit();
+    _lock.release();
     return 0;
 }
 
@@ -229,7 +341,7 @@ ARPTable::append_query(IPAddress ip, Packet *p)
 	return -ENOMEM;
 
     if (ae->known(now, _timeout_j)) {
-	_lock.release_write();
+	_lock.release();
 	return -EAGAIN;
     }
 
@@ -255,7 +367,7 @@ ARPTable::append_query(IPAddress ip, Packet *p)
 
     if (_entry_packet_capacity && ae->_entry_packet_count >= _entry_packet_capacity) {
 	_drops++;
-	_lock.release_write();
+	_lock.release();
 	return -ENOMEM;
     }
 
@@ -279,14 +391,15 @@ ARPTable::append_query(IPAddress ip, Packet *p)
 	r = 0;
 
     _table.balance();
-    _lock.release_write();
+    _rcu.commit();
+    _lock.release();
     return r;
 }
 
 IPAddress
 ARPTable::reverse_lookup(const EtherAddress &eth)
 {
-    _lock.acquire_read();
+    _lock.acquire();
 
     IPAddress ip;
     for (Table::iterator it = _table.begin(); it; ++it)
@@ -295,7 +408,7 @@ ARPTable::reverse_lookup(const EtherAddress &eth)
 	    break;
 	}
 
-    _lock.release_read();
+    _lock.release();
     return ip;
 }
 
@@ -307,11 +420,13 @@ ARPTable::read_handler(Element *e, void *user_data)
     click_jiffies_t now = click_jiffies();
     switch (reinterpret_cast<uintptr_t>(user_data)) {
     case h_table:
+	arpt->_lock.acquire();
 	for (ARPEntry *ae = arpt->_age.front(); ae; ae = ae->_age_link.next()) {
 	    int ok = ae->known(now, arpt->_timeout_j);
 	    sa << ae->_ip << ' ' << ok << ' ' << ae->_eth << ' '
 	       << Timestamp::make_jiffies(now - ae->_live_at_j) << '\n';
 	}
+	arpt->_lock.release();
 	break;
     }
     return sa.take_string();
@@ -7,6 +7,7 @@
 #include <click/sync.hh>
 #include <click/timer.hh>
 #include <click/list.hh>
+#include <click/multithread.hh>
 CLICK_DECLS
 
 /*
@@ -57,6 +58,12 @@ service attack.
 Time value.  The amount of time after which an ARP entry will expire.  Default
 is 5 minutes.  Zero means ARP entries never expire.
 
+Lookups never lock or write to the table. Entries are also published in an
+open-addressing index that readers scan under an epoch-based RCU; updates are
+serialized by a writer lock, and removed entries are freed only once no
+reader can still see them. A forwarding thread therefore only stores to its
+own epoch slot, except for the rare lookup that decides to poll a stale entry.
+
 =h table r
 
 Return a table of the ARP entries.  The returned string has four
@@ -178,15 +185,41 @@ class ARPTable : public Element { public:
 	Packet *_tail;
 	uint32_t _entry_packet_count;
 	List_member<ARPEntry> _age_link;
+	// _eth and _known, stored in one word for lock-free readers
+	volatile uint64_t _published_eth;
 	typedef IPAddress key_type;
 	typedef IPAddress key_const_reference;
 	ARPEntry(IPAddress ip)
 	    : _ip(ip), _hashnext(), _eth(EtherAddress::make_broadcast()),
-	      _known(false), _num_polls_since_reply(0), _head(), _tail(), _entry_packet_count(0) {
+	      _known(false), _num_polls_since_reply(0), _head(), _tail(), _entry_packet_count(0),
+	      _published_eth(0) {
 	}
 	key_const_reference hashkey() const {
 	    return _ip;
 	}
+	void set_eth(const EtherAddress &eth) {
+	    _eth = eth;
+	    _known = !eth.is_broadcast();
+	    union {
+		uint64_t w;
+		uint8_t b[8];
+	    } u;
+	    memcpy(u.b, eth.data(), 6);
+	    u.b[6] = _known;
+	    u.b[7] = 0;
+	    _published_eth = u.w;
+	}
+	bool published_eth(EtherAddress *eth) const {
+	    union {
+		uint64_t w;
+		uint8_t b[8];
+	    } u;
+	    u.w = _published_eth;
+	    if (!u.b[6])
+		return false;
+	    memcpy(eth->data(), u.b, 6);
+	    return true;
+	}
 	bool expired(click_jiffies_t now, uint32_t timeout_j) const {
 	    return click_jiffies_less(_live_at_j + timeout_j, now)
 		&& timeout_j;
@@ -208,7 +241,7 @@ class ARPTable : public Element { public:
 
   private:
 
-    ReadWriteLock _lock;
+    Spinlock _lock;		// serializes writers only
 
     typedef HashContainer<ARPEntry> Table;
     Table _table;
@@ -225,30 +258,75 @@ class ARPTable : public Element { public:
     SizedHashAllocator<sizeof(ARPEntry)> _alloc;
     Timer _expire_timer;
 
+    // Read-side index: linear probing over every entry of _table. Slots go
+    // from empty to an entry to a tombstone; the index is rebuilt, never
+    // rehashed in place, once half its slots are used.
+    struct Index {
+	uint32_t mask;
+	uint32_t used;
+	ARPEntry *slot[1];
+    };
+    Index *volatile _index;
+    epoch_rcu _rcu;
+
+    static ARPEntry *tombstone() {
+	return reinterpret_cast<ARPEntry *>(uintptr_t(1));
+    }
+    static uint32_t index_hash(IPAddress ip) {
+	uint32_t h = ip.addr() * 0x9E3779B1U;
+	return h ^ (h >> 16);
+    }
+    static size_t index_size(uint32_t capacity) {
+	return sizeof(Index) + (capacity - 1) * sizeof(ARPEntry *);
+    }
+    static Index *make_index(uint32_t capacity);
+    inline ARPEntry *find_published(IPAddress ip) const;
+    int publish(ARPEntry *ae);
+    void retire(ARPEntry *ae);
+    static void free_entry(void *thunk, uintptr_t arg);
+    int mark_poll(IPAddress ip, click_jiffies_t now);
+
     ARPEntry *ensure(IPAddress ip, click_jiffies_t now);
     void slim(click_jiffies_t now);
 
 };
 
+inline ARPTable::ARPEntry *
+ARPTable::find_published(IPAddress ip) const
+{
+    const Index *x = _index;
+    for (uint32_t i = index_hash(ip); ; ++i) {
+	ARPEntry *ae = x->slot[i & x->mask];
+	if (!ae)
+	    return 0;
+	else if (ae != tombstone() && ae->_ip == ip)
+	    return ae;
+    }
+}
+
 inline int
 ARPTable::lookup(IPAddress ip, EtherAddress *eth, uint32_t poll_timeout_j)
 {
-    _lock.acquire_read();
     int r = -1;
-    if (Table::iterator it = _table.find(ip)) {
-	click_jiffies_t now = click_jiffies();
-	if (it->known(now, _timeout_j)) {
-	    *eth = it->_eth;
+    click_jiffies_t now = 0;
+    _rcu.read_begin();
+    if (ARPEntry *ae = find_published(ip)) {
+	EtherAddress e;
+	now = click_jiffies();
+	if (ae->published_eth(&e) && !ae->expired(now, _timeout_j)) {
+	    *eth = e;
 	    if (poll_timeout_j
-		&& !click_jiffies_less(now, it->_live_at_j + poll_timeout_j)
-		&& it->allow_poll(now)) {
-		it->mark_poll(now);
+		&& !click_jiffies_less(now, ae->_live_at_j + poll_timeout_j)
+		&& ae->allow_poll(now))
 		r = 1;
-	    } else
+	    else
 		r = 0;
 	}
     }
-    _lock.release_read();
+    _rcu.read_end();
+    // Only the thread that wins the poll writes to the entry.
+    if (r > 0)
+	r = mark_poll(ip, now);
     return r;
 }
 
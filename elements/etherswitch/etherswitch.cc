@@ -25,16 +25,16 @@
 #include <click/error.hh>
 #include <click/confparse.hh>
 #include <click/string.hh>
+#include <click/packetbatch.hh>
 CLICK_DECLS
 
 EtherSwitch::EtherSwitch()
-    : _table(AddrInfo(-1, Timestamp())), _timeout(300)
+    : _table(0), _epoch(0), _timeout(300), _timer(this)
 {
 }
 
 EtherSwitch::~EtherSwitch()
 {
-    _table.clear();
 }
 
 int
@@ -46,12 +46,132 @@ EtherSwitch::configure(Vector<String> &conf, ErrorHandler *errh)
         return errh->error("bad timeout");
 
     int n = noutputs();
+    if (n >= 0xFFFF)
+	return errh->error("too many ports");
     _pfrs.resize(n);
     for (int i = 0; i < n; i++)
         _pfrs[i].configure(i, n);
     return 0;
 }
 
+int
+EtherSwitch::initialize(ErrorHandler *errh)
+{
+    if (!rebuild(1024))
+	return errh->error("out of memory");
+    _timer.initialize(this);
+    _timer.schedule_after_sec(1);
+    return 0;
+}
+
+void
+EtherSwitch::cleanup(CleanupStage)
+{
+    _rcu.synchronize();
+    if (_table)
+	CLICK_LFREE(_table, table_size(_table->mask + 1));
+    _table = 0;
+}
+
+/** @brief Replace the table with one holding its unexpired entries, at most
+ * a quarter full. Called with _lock held. */
+EtherSwitch::Table *
+EtherSwitch::rebuild(uint32_t min_capacity)
+{
+    Table *old = _table;
+    uint32_t live = old ? old->live : 0;
+    uint32_t capacity = min_capacity;
+    while (capacity < 4 * (live + 1))
+	capacity *= 2;
+    Table *t = (Table *) CLICK_LALLOC(table_size(capacity));
+    if (!t)
+	return 0;
+    t->mask = capacity - 1;
+    t->used = t->live = 0;
+    memset(t->slot, 0, capacity * sizeof(Slot));
+    if (old)
+	for (uint32_t i = 0; i <= old->mask; ++i) {
+	    const Slot &o = old->slot[i];
+	    uint64_t w = o.addr_port;
+	    if (!w || w == tombstone || _epoch - o.seen > _timeout)
+		continue;
+	    uint32_t j = addr_hash(w & addr_mask);
+	    while (t->slot[j & t->mask].addr_port)
+		++j;
+	    t->slot[j & t->mask].addr_port = w;
+	    t->slot[j & t->mask].seen = o.seen;
+	    ++t->used;
+	    ++t->live;
+	}
+    click_write_fence();
+    _table = t;
+    if (old) {
+	_rcu.retire(old, table_size(old->mask + 1));
+	_rcu.commit();
+    }
+    return t;
+}
+
+/** @brief Associate an address with a port. Called with _lock held. */
+void
+EtherSwitch::learn(uint64_t addr_port)
+{
+    uint64_t key = addr_port & addr_mask;
+    uint32_t epoch = _epoch;
+    Table *t = _table;
+    Slot *free = 0;
+    uint32_t i;
+    for (i = addr_hash(key); t->slot[i & t->mask].addr_port; ++i) {
+	Slot *s = &t->slot[i & t->mask];
+	uint64_t w = s->addr_port;
+	if (w == tombstone) {
+	    if (!free)
+		free = s;
+	} else if ((w & addr_mask) == key) {
+	    // the address moved to another port
+	    s->seen = epoch;
+	    s->addr_port = addr_port;
+	    return;
+	}
+    }
+    if (!free) {
+	if ((t->used + 1) * 2 > t->mask + 1) {
+	    if (!(t = rebuild(t->mask + 1)))
+		return;
+	    for (i = addr_hash(key); t->slot[i & t->mask].addr_port; ++i)
+		/* nada */;
+	}
+	free = &t->slot[i & t->mask];
+	++t->used;
+    }
+    free->seen = epoch;
+    click_write_fence();	// readers see a complete slot
+    free->addr_port = addr_port;
+    ++t->live;
+}
+
+void
+EtherSwitch::run_timer(Timer *)
+{
+    _lock.acquire();
+    uint32_t epoch = ++_epoch;
+    Table *t = _table;
+    for (uint32_t i = 0; i <= t->mask; ++i) {
+	Slot &s = t->slot[i];
+	uint64_t w = s.addr_port;
+	if (w && w != tombstone && epoch - s.seen > _timeout) {
+	    s.addr_port = tombstone;
+	    --t->live;
+	}
+    }
+    // drop tombstones once they outnumber live entries
+    if (t->used > 2 * t->live + 16)
+	rebuild(16);
+    _rcu.commit();
+    _lock.release();
+    _timer.reschedule_after_sec(1);
+}
+
 void
 EtherSwitch::broadcast(int source, Packet *p)
 {
@@ -66,7 +186,28 @@ EtherSwitch::broadcast(int source, Packet *p)
       w--;
     }
   }
+  if (pfr.w == 0)
+    p->kill();
+}
+
+#if HAVE_BATCH
+void
+EtherSwitch::broadcast(int source, PacketBatch *batch)
+{
+  PortForwardRule &pfr = _pfrs[source];
+  int n = pfr.bv.size();
+  int w = pfr.w;
+  for (int i = 0; i < n && w > 0; i++) {
+    if (pfr.bv[i]) {
+      PacketBatch *b = (w > 1 ? batch->clone_batch() : batch);
+      output(i).push_batch(b);
+      w--;
+    }
+  }
+  if (pfr.w == 0)
+    batch->kill();
 }
+#endif
 
 int
 EtherSwitch::remove_port_forwarding(String portmaps, ErrorHandler *errh)
@@ -108,25 +249,10 @@ EtherSwitch::reset_port_forwarding()
 void
 EtherSwitch::push(int source, Packet *p)
 {
-    click_ether* e = (click_ether*) p->data();
-    int outport = -1;		// Broadcast
-
-    // 0 timeout means dumb switch
-    if (_timeout != 0) {
-	_table.set(EtherAddress(e->ether_shost), AddrInfo(source, p->timestamp_anno()));
-
-	// Set outport if dst is unicast, we have info about it, and the
-	// info is still valid.
-	EtherAddress dst(e->ether_dhost);
-	if (!dst.is_group()) {
-	    if (Table::iterator dst_info = _table.find(dst)) {
-		if (p->timestamp_anno() < dst_info.value().stamp + Timestamp(_timeout, 0))
-		    outport = dst_info.value().port;
-		else
-		    _table.erase(dst_info);
-	    }
-	}
-    }
+  _rcu.read_begin();
+  int outport = lookup(source, (const click_ether *) p->data());
+  _rcu.read_end();
+  learn_flush();
 
   if (outport < 0)
     broadcast(source, p);
@@ -136,6 +262,41 @@ EtherSwitch::push(int source, Packet *p)
       p->kill();
 }
 
+#if HAVE_BATCH
+void
+EtherSwitch::push_batch(int source, PacketBatch *batch)
+{
+    // Split the batch by output port: n is flood, n + 1 is filtered.
+    int n = noutputs();
+    PacketBatch *out[n + 2];
+    memset(out, 0, sizeof(out));
+    _rcu.read_begin();
+    auto fnt = [this, source, n](Packet *p) -> int {
+	int outport = lookup(source, (const click_ether *) p->data());
+	if (outport < 0)
+	    return n;
+	else if (!(_pfrs[source].bv)[outport])
+	    return n + 1;
+	else
+	    return outport;
+    };
+    auto on_finish = [&out](int port, PacketBatch *b) {
+	out[port] = b;
+    };
+    CLASSIFY_EACH_PACKET(n + 2, fnt, batch, on_finish);
+    _rcu.read_end();
+    learn_flush();
+
+    for (int i = 0; i < n; i++)
+	if (out[i])
+	    output(i).push_batch(out[i]);
+    if (out[n])
+	broadcast(source, out[n]);
+    if (out[n + 1])
+	out[n + 1]->kill();
+}
+#endif
+
 String
 EtherSwitch::reader(Element* f, void *thunk)
 {
@@ -143,8 +304,17 @@ EtherSwitch::reader(Element* f, void *thunk)
     switch ((intptr_t) thunk) {
     case 0: {
 	StringAccum sa;
-	for (Table::iterator iter = sw->_table.begin(); iter.live(); iter++)
-	    sa << iter.key() << ' ' << iter.value().port << '\n';
+	sw->_lock.acquire();
+	const Table *t = sw->_table;
+	for (uint32_t i = 0; t && i <= t->mask; ++i) {
+	    uint64_t w = t->slot[i].addr_port;
+	    if (w && w != tombstone && sw->_epoch - t->slot[i].seen <= sw->_timeout) {
+		uint16_t ea[3] = { (uint16_t) w, (uint16_t) (w >> 16), (uint16_t) (w >> 32) };
+		sa << EtherAddress(reinterpret_cast<const unsigned char *>(ea))
+		   << ' ' << (int) (w >> 48) - 1 << '\n';
+	    }
+	}
+	sw->_lock.release();
 	return sa.take_string();
     }
     case 1:
@@ -157,6 +327,8 @@ EtherSwitch::reader(Element* f, void *thunk)
 		   << i << ": " << (sw->_pfrs[i].bv).unparse() << '\n';
 	return sa.take_string();
     }
+    case 3:
+	return String(sw->_table ? sw->_table->live : 0);
     default:
 	return String();
     }
@@ -194,11 +366,13 @@ EtherSwitch::add_handlers()
 {
     add_read_handler("table", reader, 0);
     add_read_handler("timeout", reader, 1);
+    add_read_handler("count", reader, 3);
     add_read_handler("port_forwarding", reader, 2);
     add_write_handler("timeout", writer, 0);
     add_write_handler("remove_port_forwarding", writer, 1);
     add_write_handler("reset_port_forwarding", writer, 2);
 }
 
-EXPORT_ELEMENT(EtherSwitch)
 CLICK_ENDDECLS
+EXPORT_ELEMENT(EtherSwitch)
+ELEMENT_MT_SAFE(EtherSwitch)
@@ -1,10 +1,13 @@
 #ifndef CLICK_ETHERSWITCH_HH
 #define CLICK_ETHERSWITCH_HH
-#include <click/element.hh>
+#include <click/batchelement.hh>
 #include <click/etheraddress.hh>
-#include <click/hashtable.hh>
 #include <click/bitvector.hh>
 #include <click/vector.hh>
+#include <click/sync.hh>
+#include <click/multithread.hh>
+#include <click/timer.hh>
+#include <clicknet/ether.h>
 CLICK_DECLS
 
 /*
@@ -31,6 +34,13 @@ the one corresponding to the packet's input port.  The TIMEOUT parameter
 affects how long port associations last.  If it is 0, then the element does
 not learn addresses, and acts like a dumb hub.
 
+EtherSwitch may run on several threads at once. Lookups in the address table
+take no lock. Each thread buffers the addresses it has to learn, and merges
+them into the table at the end of each batch, unless another thread is
+updating the table at that moment. Ages are counted in whole seconds by a
+timer, rather than from packet timestamps. A batch is split by output port,
+and flooded packets are cloned, not copied.
+
 Keyword arguments are:
 
 =over 8
@@ -38,8 +48,9 @@ Keyword arguments are:
 =item TIMEOUT
 
 The timeout for port associations, in seconds.  Any port mapping (i.e.,
-binding between an address and a port number) is dropped after TIMEOUT seconds
-of inactivity.  If 0, the element acts like a dumb hub.  Default is 300.
+binding between an address and a port number) is dropped between TIMEOUT and
+TIMEOUT+1 seconds after the address was last seen.  If 0, the element acts
+like a dumb hub.  Default is 300.
 
 =back
 
@@ -52,6 +63,10 @@ addresses.
 
 Returns the current port association table.
 
+=h count read-only
+
+Returns the number of addresses in the table.
+
 =h timeout read/write
 
 Returns or sets the TIMEOUT argument.
@@ -61,7 +76,7 @@ Returns or sets the TIMEOUT argument.
 ListenEtherSwitch, EtherSpanTree
 */
 
-class EtherSwitch : public Element { public:
+class EtherSwitch : public BatchElement { public:
 
   EtherSwitch() CLICK_COLD;
   ~EtherSwitch() CLICK_COLD;
@@ -72,21 +87,51 @@ class EtherSwitch : public Element { public:
   const char *flow_code() const			{ return "#/[^#]"; }
 
     int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
     void add_handlers() CLICK_COLD;
 
   void push(int port, Packet* p);
+#if HAVE_BATCH
+  void push_batch(int port, PacketBatch *batch);
+#endif
 
-    struct AddrInfo {
-	int port;
-	Timestamp stamp;
-	inline AddrInfo(int p, const Timestamp &t);
-    };
+    void run_timer(Timer *);
 
   private:
 
-    typedef HashTable<EtherAddress, AddrInfo> Table;
-    Table _table;
+    // An address and its port + 1 share one word, so that readers never see
+    // an address with another address's port.
+    enum { learn_buffer_size = 32 };
+    static const uint64_t addr_mask = 0xFFFFFFFFFFFFULL;
+    static const uint64_t tombstone = ~0ULL;
+
+    struct Slot {
+	volatile uint64_t addr_port;
+	volatile uint32_t seen;		// _epoch when last seen
+    };
+    // Linear probing; rebuilt, never rehashed in place, when half full.
+    struct Table {
+	uint32_t mask;
+	uint32_t used;			// live slots and tombstones
+	uint32_t live;
+	Slot slot[1];
+    };
+    struct LearnBuffer {
+	int n;
+	uint64_t addr_port[learn_buffer_size];
+	LearnBuffer() : n(0) {
+	}
+    };
+
+    Table *volatile _table;
+    epoch_rcu _rcu;
+    Spinlock _lock;			// serializes table writers
+    volatile uint32_t _epoch;		// seconds since initialization
     uint32_t _timeout;
+    per_thread<LearnBuffer> _learn;
+    Timer _timer;
+
     struct PortForwardRule {
         Bitvector bv; /* Each bit is a port used in determining forwarding to of packets */
         int w; /* Sum of bv */
@@ -104,7 +149,27 @@ class EtherSwitch : public Element { public:
     };
     Vector<PortForwardRule> _pfrs;
 
+    static uint64_t addr_key(const uint8_t *ea) {
+	const uint16_t *s = reinterpret_cast<const uint16_t *>(ea);
+	return s[0] | ((uint64_t) s[1] << 16) | ((uint64_t) s[2] << 32);
+    }
+    static uint32_t addr_hash(uint64_t key) {
+	uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+	return h >> 32;
+    }
+    static size_t table_size(uint32_t capacity) {
+	return sizeof(Table) + (capacity - 1) * sizeof(Slot);
+    }
+    inline const Slot *find(uint64_t key, uint64_t &addr_port) const;
+    inline int lookup(int source, const click_ether *e);
+    void learn(uint64_t addr_port);
+    inline void learn_flush();
+    Table *rebuild(uint32_t min_capacity);
+
     void broadcast(int source, Packet*);
+#if HAVE_BATCH
+    void broadcast(int source, PacketBatch *);
+#endif
     int remove_port_forwarding(String portmaps, ErrorHandler *errh);
     void reset_port_forwarding();
 
@@ -114,10 +179,75 @@ class EtherSwitch : public Element { public:
 
 };
 
-inline
-EtherSwitch::AddrInfo::AddrInfo(int p, const Timestamp& s)
-    : port(p), stamp(s)
+/** @brief Return the slot of address @a key, or null, and store the
+ * slot's address and port word in @a addr_port. The aging timer may
+ * tombstone the slot at any time, so callers must use @a addr_port rather
+ * than read the slot again. */
+inline const EtherSwitch::Slot *
+EtherSwitch::find(uint64_t key, uint64_t &addr_port) const
+{
+    const Table *t = _table;
+    for (uint32_t i = addr_hash(key); ; ++i) {
+	const Slot *s = &t->slot[i & t->mask];
+	uint64_t w = s->addr_port;
+	if (!w)
+	    return 0;
+	else if ((w & addr_mask) == key && w != tombstone) {
+	    addr_port = w;
+	    return s;
+	}
+    }
+}
+
+/** @brief Learn the source of @a e and return the output port for its
+ * destination, or -1 to flood. Must be called between _rcu.read_begin() and
+ * _rcu.read_end(). */
+inline int
+EtherSwitch::lookup(int source, const click_ether *e)
+{
+    // 0 timeout means dumb switch
+    if (_timeout == 0)
+	return -1;
+
+    uint32_t epoch = _epoch;
+    if (!(e->ether_shost[0] & 1)) {
+	uint64_t addr_port = addr_key(e->ether_shost) | ((uint64_t) (source + 1) << 48);
+	uint64_t w;
+	const Slot *s = find(addr_port & addr_mask, w);
+	if (s && w == addr_port) {
+	    // refreshed at most once per second, by whichever thread sees it
+	    if (s->seen != epoch)
+		const_cast<Slot *>(s)->seen = epoch;
+	} else {
+	    LearnBuffer &lb = *_learn;
+	    int i = 0;
+	    while (i < lb.n && lb.addr_port[i] != addr_port)
+		++i;
+	    if (i == lb.n && lb.n < learn_buffer_size)
+		lb.addr_port[lb.n++] = addr_port;
+	}
+    }
+
+    // Use the destination's port if it is unicast, known, and still valid.
+    if (!(e->ether_dhost[0] & 1)) {
+	uint64_t w;
+	if (const Slot *s = find(addr_key(e->ether_dhost), w))
+	    if (epoch - s->seen <= _timeout)
+		return (w >> 48) - 1;
+    }
+    return -1;
+}
+
+inline void
+EtherSwitch::learn_flush()
 {
+    LearnBuffer &lb = *_learn;
+    if (lb.n && _lock.attempt()) {
+	for (int i = 0; i < lb.n; ++i)
+	    learn(lb.addr_port[i]);
+	_lock.release();
+	lb.n = 0;
+    }
 }
 
 CLICK_ENDDECLS
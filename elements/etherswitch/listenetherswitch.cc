@@ -22,6 +22,7 @@
 #include <clicknet/ether.h>
 #include <click/etheraddress.hh>
 #include <click/glue.hh>
+#include <click/packetbatch.hh>
 CLICK_DECLS
 
 ListenEtherSwitch::ListenEtherSwitch()
@@ -35,25 +36,10 @@ ListenEtherSwitch::~ListenEtherSwitch()
 void
 ListenEtherSwitch::push(int source, Packet *p)
 {
-    const click_ether* e = (const click_ether*) p->data();
-    int outport = -1;		// Broadcast
-
-    // 0 timeout means dumb switch
-    if (_timeout != 0) {
-	_table.set(EtherAddress(e->ether_shost), AddrInfo(source, p->timestamp_anno()));
-
-	// Set outport if dst is unicast, we have info about it, and the
-	// info is still valid.
-	EtherAddress dst(e->ether_dhost);
-	if (!dst.is_group()) {
-	    if (Table::iterator dst_info = _table.find(dst)) {
-		if (p->timestamp_anno() < dst_info.value().stamp + Timestamp(_timeout, 0))
-		    outport = dst_info.value().port;
-		else
-		    _table.erase(dst_info);
-	    }
-	}
-    }
+    _rcu.read_begin();
+    int outport = lookup(source, (const click_ether *) p->data());
+    _rcu.read_end();
+    learn_flush();
 
     if (outport < 0)
 	broadcast(source, p);
@@ -65,6 +51,15 @@ ListenEtherSwitch::push(int source, Packet *p)
     }
 }
 
+#if HAVE_BATCH
+void
+ListenEtherSwitch::push_batch(int source, PacketBatch *batch)
+{
+    FOR_EACH_PACKET_SAFE(batch, p)
+	push(source, p);
+}
+#endif
+
 ELEMENT_REQUIRES(EtherSwitch)
 EXPORT_ELEMENT(ListenEtherSwitch)
 CLICK_ENDDECLS
@@ -34,6 +34,9 @@ class ListenEtherSwitch : public EtherSwitch { public:
     const char *port_count() const		{ return "-/=+"; }
 
     void push(int port, Packet* p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
 
 };
 
@@ -57,6 +57,7 @@ DirectIPLookup::Table::initialize()
 void
 DirectIPLookup::Table::cleanup()
 {
+    _rcu.synchronize();
     CLICK_LFREE(_tbl_0_23, (sizeof(uint16_t) + sizeof(uint8_t)) * (1 << 24));
     CLICK_LFREE(_tbl_24_31, (sizeof(uint16_t) + sizeof(uint8_t)) * _tbl_24_31_capacity);
     CLICK_LFREE(_vport, sizeof(VirtualPort) * _vport_capacity);
@@ -85,6 +86,11 @@ DirectIPLookup::Table::prefix_hash(uint32_t prefix, uint32_t len)
 void
 DirectIPLookup::Table::flush()
 {
+    // Bzeroed lookup tables resolve 0.0.0.0/0 to _vport[0]. Clear them
+    // first, and let readers drain, before recycling chunks and vports.
+    memset(_tbl_0_23, 0, (sizeof(uint16_t) + sizeof(uint8_t)) * (1 << 24));
+    _rcu.synchronize();
+
     memset(_rt_hashtbl, -1, sizeof(int) * PREF_HASHSIZE);
 
     // _vport[0] is our "discard" port
@@ -107,9 +113,6 @@ DirectIPLookup::Table::flush()
     _rtable_size = 1;
     _rt_empty_head = -1;
 
-    // Bzeroed lookup tables resolve 0.0.0.0/0 to _vport[0]
-    memset(_tbl_0_23, 0, (sizeof(uint16_t) + sizeof(uint8_t)) * (1 << 24));
-
     _tbl_24_31_size = 0;
     _tbl_24_31_empty_head = 0x8000;
 }
@@ -142,8 +145,8 @@ DirectIPLookup::Table::vport_find(IPAddress gw, int16_t port)
 	if (!new_vport)
 	    return -ENOMEM;
 	memcpy(new_vport, _vport, sizeof(VirtualPort) * _vport_capacity);
-	CLICK_LFREE(_vport, sizeof(VirtualPort) * _vport_capacity);
-	_vport = new_vport;
+	_rcu.retire(_vport, sizeof(VirtualPort) * _vport_capacity);
+	__atomic_store_n(&_vport, new_vport, __ATOMIC_RELEASE);
 	_vport_capacity *= 2;
     }
     if (_vport_empty_head < 0) {
@@ -171,12 +174,28 @@ DirectIPLookup::Table::vport_unref(uint16_t vport_i)
 	if (next >= 0)
 	    _vport[next].ll_prev = prev;
 
-	// Add the entry to empty vports list
-	_vport[vport_i].ll_next = _vport_empty_head;
-	_vport_empty_head = vport_i;
+	// Readers may still resolve to this entry, so only add it to the
+	// empty vports list after a grace period
+	_rcu.defer(vport_free, this, vport_i);
     }
 }
 
+void
+DirectIPLookup::Table::vport_free(void *thunk, uintptr_t vport_i)
+{
+    Table *t = static_cast<Table *>(thunk);
+    t->_vport[vport_i].ll_next = t->_vport_empty_head;
+    t->_vport_empty_head = vport_i;
+}
+
+void
+DirectIPLookup::Table::tbl_24_31_free(void *thunk, uintptr_t sec)
+{
+    Table *t = static_cast<Table *>(thunk);
+    t->_tbl_24_31[sec << 8] = t->_tbl_24_31_empty_head;
+    t->_tbl_24_31_empty_head = sec;
+}
+
 int
 DirectIPLookup::Table::find_entry(uint32_t prefix, uint32_t plen) const
 {
@@ -253,9 +272,9 @@ DirectIPLookup::Table::add_route(const IPRoute& route, bool allow_replace, IPRou
 	    if (!new_tbl)
 		return -ENOMEM;
 	    memcpy(new_tbl, _tbl_24_31, sizeof(uint16_t) * _tbl_24_31_capacity);
-	    memcpy(new_tbl + _tbl_24_31_capacity, _tbl_24_31_plen, sizeof(uint8_t) * _tbl_24_31_capacity);
-	    CLICK_LFREE(_tbl_24_31, (sizeof(uint16_t) + sizeof(uint8_t)) * _tbl_24_31_capacity);
-	    _tbl_24_31 = new_tbl;
+	    memcpy(new_tbl + 2 * _tbl_24_31_capacity, _tbl_24_31_plen, sizeof(uint8_t) * _tbl_24_31_capacity);
+	    _rcu.retire(_tbl_24_31, (sizeof(uint16_t) + sizeof(uint8_t)) * _tbl_24_31_capacity);
+	    __atomic_store_n(&_tbl_24_31, new_tbl, __ATOMIC_RELEASE);
 	    _tbl_24_31_plen = (uint8_t *) (new_tbl + 2 * _tbl_24_31_capacity);
 	    _tbl_24_31_capacity *= 2;
 	}
@@ -344,6 +363,7 @@ DirectIPLookup::Table::add_route(const IPRoute& route, bool allow_replace, IPRou
 			    _tbl_24_31_plen[sec_i + j] = _tbl_0_23_plen[i];
 			}
 		    }
+		    click_write_fence();	// chunk complete before it is visible
 		    _tbl_0_23[i] = (sec_i >> 8) | 0x8000;
 		} else {
 		    _tbl_0_23[i] = vport_i;
@@ -466,9 +486,8 @@ DirectIPLookup::Table::remove_route(const IPRoute& route, IPRoute* old_route, Er
 		    // Yup, adjust entries in primary tables...
 		    _tbl_0_23[i] = _tbl_24_31[sec_i];
 		    _tbl_0_23_plen[i] = _tbl_24_31_plen[sec_i];
-		    // ... and free up the entry (adding it to free space list)
-		    _tbl_24_31[sec_i] = _tbl_24_31_empty_head;
-		    _tbl_24_31_empty_head = sec_i >> 8;
+		    // ... and free up the entry once no reader can be in it
+		    _rcu.defer(tbl_24_31_free, this, sec_i >> 8);
 		}
 	    } else {
 		if (plen == _tbl_0_23_plen[i]) {
@@ -489,10 +508,6 @@ DirectIPLookup::Table::remove_route(const IPRoute& route, IPRoute* old_route, Er
 
 DirectIPLookup::DirectIPLookup()
 {
-#if HAVE_BATCH
-	// TODO: Remove this when push_batch() will actually be implemented
-	in_batch_mode = BATCH_MODE_NO;
-#endif
 }
 
 DirectIPLookup::~DirectIPLookup()
@@ -533,25 +548,62 @@ int
 DirectIPLookup::lookup_route(IPAddress dest, IPAddress &gw) const
 {
     uint32_t ip_addr = ntohl(dest.addr());
-    uint16_t vport_i = _t._tbl_0_23[ip_addr >> 8];
+    _t._rcu.read_begin();
+    uint16_t vport_i = _t.entry(&_t._tbl_0_23[ip_addr >> 8]);
 
     if (vport_i & 0x8000)
-        vport_i = _t._tbl_24_31[((vport_i & 0x7fff) << 8) | (ip_addr & 0xff)];
+        vport_i = _t.entry(&_t.tbl_24_31()[((vport_i & 0x7fff) << 8) | (ip_addr & 0xff)]);
+
+    const VirtualPort *vport = _t.vport();
+    gw = vport[vport_i].gw;
+    int port = vport[vport_i].port;
+    _t._rcu.read_end();
+    return port;
+}
 
-    gw = _t._vport[vport_i].gw;
-    return _t._vport[vport_i].port;
+void
+DirectIPLookup::lookup_route_batch(const IPAddress *dest, IPAddress *gw,
+				   int *port, int n) const
+{
+    uint16_t vport_i[n];
+
+    // Issue all first-level loads before depending on any of them, then all
+    // second-level loads.
+    _t._rcu.read_begin();
+    for (int i = 0; i < n; i++)
+	__builtin_prefetch(&_t._tbl_0_23[ntohl(dest[i].addr()) >> 8]);
+    for (int i = 0; i < n; i++)
+	vport_i[i] = _t.entry(&_t._tbl_0_23[ntohl(dest[i].addr()) >> 8]);
+    // Loaded after the entries that index them, see Table::tbl_24_31()
+    const uint16_t *tbl_24_31 = _t.tbl_24_31();
+    for (int i = 0; i < n; i++)
+	if (vport_i[i] & 0x8000)
+	    __builtin_prefetch(&tbl_24_31[((vport_i[i] & 0x7fff) << 8) | (ntohl(dest[i].addr()) & 0xff)]);
+    for (int i = 0; i < n; i++)
+	if (vport_i[i] & 0x8000)
+	    vport_i[i] = _t.entry(&tbl_24_31[((vport_i[i] & 0x7fff) << 8) | (ntohl(dest[i].addr()) & 0xff)]);
+    const VirtualPort *vport = _t.vport();
+    for (int i = 0; i < n; i++) {
+	gw[i] = vport[vport_i[i]].gw;
+	port[i] = vport[vport_i[i]].port;
+    }
+    _t._rcu.read_end();
 }
 
 int
 DirectIPLookup::add_route(const IPRoute& route, bool allow_replace, IPRoute* old_route, ErrorHandler *errh)
 {
-    return _t.add_route(route, allow_replace, old_route, errh);
+    int r = _t.add_route(route, allow_replace, old_route, errh);
+    _t._rcu.commit();
+    return r;
 }
 
 int
 DirectIPLookup::remove_route(const IPRoute& route, IPRoute* old_route, ErrorHandler *errh)
 {
-    return _t.remove_route(route, old_route, errh);
+    int r = _t.remove_route(route, old_route, errh);
+    _t._rcu.commit();
+    return r;
 }
 
 int
@@ -569,11 +621,19 @@ DirectIPLookup::dump_routes()
     return _t.dump();
 }
 
+String
+DirectIPLookup::rcu_backlog_handler(Element *e, void *)
+{
+    DirectIPLookup *t = static_cast<DirectIPLookup *>(e);
+    return String(t->_t._rcu.backlog());
+}
+
 void
 DirectIPLookup::add_handlers()
 {
     IPRouteTable::add_handlers();
     add_write_handler("flush", flush_handler, 0, Handler::BUTTON);
+    add_read_handler("rcu_backlog", rcu_backlog_handler);
 }
 
 CLICK_ENDDECLS
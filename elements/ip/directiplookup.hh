@@ -1,6 +1,7 @@
 // -*- c-basic-offset: 4 -*-
 #ifndef CLICK_DIRECTIPLOOKUP_HH
 #define CLICK_DIRECTIPLOOKUP_HH
+#include <click/multithread.hh>
 #include "iproutetable.hh"
 CLICK_DECLS
 
@@ -30,6 +31,12 @@ accesses, regardless on the number of routing table entries. Individual
 entries can be dynamically added to or removed from the routing table with
 relatively low CPU overhead, allowing for high update rates.
 
+Updates may run while other threads forward packets, and lookups never take a
+lock. Table entries are changed one at a time, and a /25-or-smaller chunk is
+fully built before the entry pointing to it is set. Freed chunks, virtual
+ports, and outgrown arrays are only reused once every lookup that might still
+reference them has finished.
+
 DirectIPLookup implements the I<DIR-24-8-BASIC> lookup scheme described by
 Gupta, Lin, and McKeown in the paper cited below.
 
@@ -65,6 +72,16 @@ operation.
 
 Clears the entire routing table in a single atomic operation.
 
+=h update_latency read-only
+
+Returns `C<COUNT MEAN MAX>': the number of route updates made through
+handlers, and their mean and maximum latency in nanoseconds.
+
+=h rcu_backlog read-only
+
+Returns the number of freed chunks, virtual ports, and arrays still waiting
+for concurrent lookups to finish.
+
 =n
 
 See IPRouteTable for a performance comparison of the various IP routing
@@ -102,9 +119,11 @@ class DirectIPLookup : public IPRouteTable { public:
     int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
     int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
     int lookup_route(IPAddress, IPAddress&) const;
+    void lookup_route_batch(const IPAddress*, IPAddress*, int*, int) const;
     String dump_routes();
 
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
+    static String rcu_backlog_handler(Element *, void *);
 
     enum {
 	RT_SIZE_MAX = 256 * 1024, // accomodate a full BGP view and more
@@ -155,6 +174,9 @@ class DirectIPLookup : public IPRouteTable { public:
 	uint32_t _tbl_24_31_capacity;
 	uint32_t _vport_capacity;
 
+	// Defers reuse of memory that concurrent lookups may still read
+	epoch_rcu _rcu;
+
 	Table()
 	    : _tbl_0_23(0), _tbl_24_31(0), _vport(0), _rtable(0),
 	      _rt_hashtbl(0), _tbl_0_23_plen(0), _tbl_24_31_plen(0) {
@@ -167,6 +189,19 @@ class DirectIPLookup : public IPRouteTable { public:
 	int initialize();
 	void cleanup();
 
+	// Growing _tbl_24_31 or _vport publishes a larger copy. Lookups load
+	// table entries, then these pointers, with acquire semantics, so a new
+	// index is never used against an old, smaller array.
+	static uint16_t entry(const uint16_t *e) {
+	    return __atomic_load_n(e, __ATOMIC_ACQUIRE);
+	}
+	const uint16_t *tbl_24_31() const {
+	    return __atomic_load_n(&_tbl_24_31, __ATOMIC_ACQUIRE);
+	}
+	const VirtualPort *vport() const {
+	    return __atomic_load_n(&_vport, __ATOMIC_ACQUIRE);
+	}
+
 	static inline uint32_t prefix_hash(uint32_t, uint32_t);
 
 	int find_entry(uint32_t, uint32_t) const;
@@ -174,6 +209,8 @@ class DirectIPLookup : public IPRouteTable { public:
 
 	int vport_find(IPAddress gw, int16_t port);
 	void vport_unref(uint16_t);
+	static void vport_free(void *, uintptr_t);
+	static void tbl_24_31_free(void *, uintptr_t);
 
 	int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
 	int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
@@ -21,6 +21,7 @@
 #include <click/glue.hh>
 #include <click/error.hh>
 #include <click/confparse.hh>
+#include <click/args.hh>
 #include <click/router.hh>
 CLICK_DECLS
 
@@ -35,11 +36,20 @@ IPClassifier::~IPClassifier()
 int
 IPClassifier::configure(Vector<String> &conf, ErrorHandler *errh)
 {
+    bool jit = false, batch_match = false;
+    if (Args(this, errh).bind(conf)
+	.read("JIT", jit)
+	.read("BATCH_MATCH", batch_match)
+	.consume() < 0)
+	return -1;
+
     if (conf.size() != noutputs())
 	return errh->error("need %d arguments, one per output port", noutputs());
 
     // leverage IPFilter's parsing
     Vector<String> new_conf;
+    new_conf.push_back("JIT " + String(jit));
+    new_conf.push_back("BATCH_MATCH " + String(batch_match));
     for (int i = 0; i < conf.size(); i++)
 	new_conf.push_back(String(i) + " " + conf[i]);
     int r = IPFilter::configure(new_conf, errh);
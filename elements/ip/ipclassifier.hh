@@ -5,7 +5,7 @@ CLICK_DECLS
 
 /*
 =c
-IPClassifier(PATTERN_1, ..., PATTERN_N)
+IPClassifier(PATTERN_1, ..., PATTERN_N [, I<keywords> JIT, BATCH_MATCH])
 
 =s ip
 classifies IP packets by contents
@@ -172,6 +172,22 @@ will ever match a pattern. Usually, this is because an earlier pattern is
 more general, or because your pattern is contradictory ('src port www and
 src port ftp').
 
+Keyword arguments are:
+
+=over 8
+
+=item JIT
+
+Boolean. If true, compile the patterns to native machine code; see
+IPFilter(n). Default is false.
+
+=item BATCH_MATCH
+
+Boolean. If true, classify batches of packets together; see IPFilter(n).
+Default is false.
+
+=back
+
 =n
 
 Valid IP port names: 'echo', 'discard', 'daytime', 'chargen', 'ftp-data',
@@ -228,6 +244,9 @@ is using to classify packets. At each step in the program, four bytes
 of packet data are ANDed with a mask and compared against four bytes of
 classifier pattern.
 
+=h jit read-only
+Returns true if packets are matched by native code, false otherwise.
+
 =h pattern0 rw
 Returns or sets the element's pattern 0. There are as many C<pattern>
 handlers as there are output ports.
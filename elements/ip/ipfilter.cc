@@ -161,7 +161,7 @@ IPFilter::static_cleanup()
     delete dbs[1];
 }
 
-IPFilter::IPFilter() : _caching(false), _cache()
+IPFilter::IPFilter() : _jit(false), _batch_match(false), _caching(false), _cache()
 {
 }
 
@@ -1323,8 +1323,11 @@ int
 IPFilter::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     // Consume key-value argument before parsing the rules
+    bool jit = false, batch_match = false;
     if (Args(this, errh).bind(conf)
         .read("CACHING", _caching)
+        .read("JIT", jit)
+        .read("BATCH_MATCH", batch_match)
         .consume() < 0)
         return -1;
 
@@ -1337,6 +1340,14 @@ IPFilter::configure(Vector<String> &conf, ErrorHandler *errh)
 
     if (!errh->nerrors()) {
         _zprog = zprog;
+        _batch_match = batch_match;
+        _jit = jit;
+        if (!_jit)
+            _native.clear();
+        else if (_native.compile(_zprog, offset_net, offset_transp) < 0) {
+            errh->warning("native compilation unavailable, using the interpreter");
+            _jit = false;
+        }
         return 0;
     }
 
@@ -1352,6 +1363,9 @@ IPFilter::read_handler(Element *e, void *thunk)
         case H_PROGRAM: {
             return ipf->_zprog.unparse();
         }
+        case H_JIT: {
+            return String(ipf->_native.function() != 0);
+        }
         case H_CACHE_HITS: {
             if (!ipf->_caching){
                 return "-1";
@@ -1400,6 +1414,7 @@ void
 IPFilter::add_handlers()
 {
     add_read_handler("program", read_handler, H_PROGRAM);
+    add_read_handler("jit", read_handler, H_JIT);
     add_read_handler("cache_hits_count", read_handler, H_CACHE_HITS);
     add_read_handler("cache_misses_count", read_handler, H_CACHE_MISSES);
     add_read_handler("cache_total_count", read_handler, H_CACHE_TOTAL);
@@ -1475,10 +1490,69 @@ IPFilter::length_checked_match(const IPFilterProgram &zprog, const Packet *p, in
     }
 }
 
+void
+IPFilter::match_batch(Packet * const *p, int n, int *outputs)
+{
+    using Classification::Wordwise::batch_width;
+    if (_zprog.output_everything() >= 0) {
+        for (int i = 0; i < n; ++i)
+            outputs[i] = _zprog.output_everything();
+        return;
+    }
+
+    const unsigned char *mac[batch_width], *neth[batch_width], *transph[batch_width];
+    const unsigned char * const *base[3] = { mac, neth, transph };
+    uint32_t members = 0;
+    for (int i = 0; i < n; ++i) {
+        int packet_length = p[i]->network_length(),
+        network_header_length = p[i]->network_header_length();
+        if (packet_length > network_header_length)
+            packet_length += offset_transp - network_header_length;
+        else
+            packet_length += offset_net;
+
+        if (packet_length < (int) _zprog.safe_length())
+            outputs[i] = length_checked_match(_zprog, p[i], packet_length);
+        else {
+            mac[i] = p[i]->mac_header() - 2;
+            neth[i] = p[i]->network_header();
+            transph[i] = p[i]->transport_header();
+            members |= 1U << i;
+        }
+    }
+    _zprog.match_batch(base, offset_net, offset_transp, members, outputs);
+}
+
 #if HAVE_BATCH
 void
 IPFilter::push_batch(int, PacketBatch *batch)
 {
+    // Batches longer than BATCH_MAX_PULL are matched one packet at a time.
+    if (_batch_match && !_caching && batch->count() <= BATCH_MAX_PULL) {
+        using Classification::Wordwise::batch_width;
+        int outputs[BATCH_MAX_PULL];
+        Packet *group[batch_width];
+        int n = 0, *next_output = outputs;
+        FOR_EACH_PACKET(batch, p) {
+            group[n++] = p;
+            if (n == batch_width) {
+                match_batch(group, n, next_output);
+                next_output += n;
+                n = 0;
+            }
+        }
+        if (n)
+            match_batch(group, n, next_output);
+        next_output = outputs;
+        CLASSIFY_EACH_PACKET(
+            (noutputs() + 1),
+            [&next_output](Packet *) { return *next_output++; },
+            batch,
+            checked_output_push_batch
+        );
+        return;
+    }
+
     CLASSIFY_EACH_PACKET(
         (noutputs() + 1),
         match,
@@ -9,7 +9,7 @@ CLICK_DECLS
 /*
 =c
 
-IPFilter([CACHING,] ACTION_1 PATTERN_1, ..., ACTION_N PATTERN_N)
+IPFilter([CACHING,] [JIT,] [BATCH_MATCH,] ACTION_1 PATTERN_1, ..., ACTION_N PATTERN_N)
 
 =s ip
 
@@ -45,6 +45,23 @@ Arguments:
 
 Boolean. Enables or disables caching. Defaults to false (i.e., no caching).
 
+=item JIT
+
+Boolean. If true, the filter program is compiled to native machine code
+whenever the element is configured or reconfigured, and packets are matched by
+that code instead of the interpreter. Packets shorter than the program's safe
+length are still handled by the interpreter. Native compilation is only
+available at user level on x86-64; elsewhere a warning is printed and the
+interpreter is used. Defaults to false.
+
+=item BATCH_MATCH
+
+Boolean. If true, push_batch classifies up to 32 packets at a time: each
+program step is evaluated once for all packets that reached it, using AVX2 or
+AVX-512 gathers when Click is compiled for them, and the batch is then split
+once per output. Takes precedence over JIT for batches, and is ignored when
+CACHING is true. Defaults to false.
+
 =n
 
 Every IPFilter element has an equivalent corresponding IPClassifier element
@@ -116,6 +133,9 @@ is using to classify packets. At each step in the program, four bytes
 of packet data are ANDed with a mask and compared against four bytes of
 classifier pattern.
 
+=h jit read-only
+Returns true if packets are matched by native code, false otherwise.
+
 =h cache_hits_count read-only
 If CACHING is enabled, the IPFilter element stores the last rule in a cache.
 This handler returns the number of cache hits (i.e., number of input packets
@@ -184,6 +204,7 @@ class IPFilter : public BatchElement { public:
                   const Element *context, ErrorHandler *errh);
     inline int match(const IPFilterProgram &zprog, const Packet *p);
     inline int match(Packet *p);
+    void match_batch(Packet * const *p, int n, int *outputs);
 
     enum {
         TYPE_NONE   = 0,        // data types
@@ -319,13 +340,16 @@ class IPFilter : public BatchElement { public:
     };
 
     IPFilterProgram _zprog;
+    Classification::Wordwise::NativeProgram _native;
+    bool _jit;
+    bool _batch_match;
     bool _caching;
     IPFilterCache _cache;
 
     static String read_handler(Element *e, void *thunk);
 
     enum {
-        H_PROGRAM,
+        H_PROGRAM, H_JIT,
         H_CACHE_HITS, H_CACHE_MISSES, H_CACHE_TOTAL,
         H_CACHE_HITS_RATIO, H_CACHE_MISSES_RATIO
     };
@@ -433,6 +457,21 @@ IPFilter::match(const IPFilterProgram &zprog, const Packet *p)
     const unsigned char *neth_data = p->network_header();
     const unsigned char *transph_data = p->transport_header();
 
+    if (_jit && &zprog == &_zprog) {
+        _native.read_begin();
+        Classification::Wordwise::NativeProgram::match_function f = _native.function();
+        int port = f ? f(p->mac_header() - 2, neth_data, transph_data) : -1;
+        _native.read_end();
+        if (f) {
+            if (_caching) {
+                IPFlow5ID new_flow_id(p);
+                _cache.last_flow_id = &new_flow_id;
+                _cache.last_port = port;
+            }
+            return port;
+        }
+    }
+
     const uint32_t *pr = zprog.begin();
     const uint32_t *pp;
     uint32_t data;
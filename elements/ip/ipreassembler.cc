@@ -31,15 +31,21 @@
 #include <click/ipflowid.hh>
 CLICK_DECLS
 
-#define PACKET_CHUNK(p)		(*((ChunkLink *)((p)->anno_u8() + IPREASSEMBLER_ANNO_OFFSET)))
+#define PACKET_CHUNK(p)		(*((IPReassembler::ChunkLink *)((p)->anno_u8() + IPREASSEMBLER_ANNO_OFFSET)))
 #define PACKET_DLEN(p)		((p)->transport_length())
 #define IP_BYTE_OFF(iph)	((ntohs((iph)->ip_off) & IP_OFFMASK) << 3)
 
+// A held fragment's data may have been trimmed by later overlapping
+// fragments; its chunk gives the range it still covers.
+static inline const unsigned char *
+chunk_data(const Packet *p)
+{
+    return p->transport_header() + (PACKET_CHUNK(p).off - IP_BYTE_OFF(p->ip_header()));
+}
+
 IPReassembler::IPReassembler()
-    : _stat_frags_seen(0), _stat_good_assem(0), _stat_failed_assem(0), _stat_bad_pkts(0)
+    : _shards(0), _nshards(0), _locked(false)
 {
-    for (int i = 0; i < NMAP; i++)
-	_map[i] = 0;
     static_assert(IPREASSEMBLER_ANNO_OFFSET + IPREASSEMBLER_ANNO_SIZE <= Packet::anno_size, "anno too big");
     static_assert(sizeof(ChunkLink) == IPREASSEMBLER_ANNO_SIZE, "sizeof(ChunkLink) is expected to equal IPREASSEMBLER_ANNO_SIZE.");
 }
@@ -52,43 +58,67 @@ int
 IPReassembler::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     _mem_high_thresh = 256 * 1024;
+    _timeout = 30;
     int mtu_anno = -1;
     if (Args(conf, this, errh)
 	.read("HIMEM", _mem_high_thresh)
+	.read("TIMEOUT", _timeout)
 	.read("MAX_MTU_ANNO", AnnoArg(2), mtu_anno)
 	.complete() < 0)
 	return -1;
+    if (_timeout <= 0)
+	return errh->error("TIMEOUT must be positive");
     _mtu_anno = mtu_anno;
-    _mem_low_thresh = (_mem_high_thresh >> 2) * 3;
     return 0;
 }
 
 int
 IPReassembler::initialize(ErrorHandler *)
 {
-    _mem_used = 0;
-    _reap_time = 0;
+    int nthreads = get_passing_threads().weight();
+    _locked = nthreads > 1;
+    _nshards = 1;
+    while (_nshards < nthreads)
+	_nshards <<= 1;
+    _shards = new Shard[_nshards];
+    for (int i = 0; i < _nshards; i++) {
+	Shard &s = _shards[i];
+	s.mem_used = 0;
+	s.stat_frags_seen = s.stat_good_assem = s.stat_failed_assem = 0;
+	s.stat_bad_pkts = s.stat_evictions = s.stat_timeouts = 0;
+    }
+    _shard_high_thresh = _mem_high_thresh / _nshards;
+    _shard_low_thresh = (_shard_high_thresh >> 2) * 3;
     return 0;
 }
 
 void
 IPReassembler::cleanup(CleanupStage)
 {
-    for (int i = 0; i < NMAP; i++)
-	while (_map[i]) {
-	    WritablePacket *next = (WritablePacket *)(_map[i]->next());
-	    _map[i]->kill();
-	    _map[i] = next;
+    for (int i = 0; i < _nshards; i++) {
+	Shard &s = _shards[i];
+	for (Table::iterator it = s.table.begin(); it; ) {
+	    Datagram *d = s.table.erase(it);
+	    while (Packet *q = d->_frags) {
+		d->_frags = q->next();
+		q->kill();
+	    }
+	    d->~Datagram();
+	    s.alloc.deallocate(d);
 	}
+    }
+    delete[] _shards;
+    _shards = 0;
+    _nshards = 0;
 }
 
 void
-IPReassembler::check_error(ErrorHandler *errh, int bucket, const Packet *p, const char *format, ...)
+IPReassembler::check_error(ErrorHandler *errh, int shard, const Packet *p, const char *format, ...)
 {
     va_list val;
     va_start(val, format);
     StringAccum sa;
-    sa << "buck " << bucket << ": ";
+    sa << "shard " << shard << ": ";
     if (p->has_network_header()) {
 	const click_ip *iph = p->ip_header();
 	sa << iph->ip_src << " > " << iph->ip_dst << " [" << ntohs(iph->ip_id) << ':' << PACKET_DLEN(p) << ((iph->ip_off & htons(IP_MF)) ? "+]: " : "]: ");
@@ -103,42 +133,44 @@ IPReassembler::check(ErrorHandler *errh)
 {
     if (!errh)
 	errh = ErrorHandler::default_handler();
-    uint32_t mem_used = 0;
-    for (int b = 0; b < NMAP; b++)
-	for (WritablePacket *q = _map[b]; q; q = (WritablePacket *)(q->next()))
-	    if (q->has_network_header()) {
-		const click_ip *qip = q->ip_header();
-		if (bucketno(qip) != b)
-		    check_error(errh, b, q, "in wrong bucket");
-		mem_used += IPH_MEM_USED + q->transport_length();
-		ChunkLink *chunk = &PACKET_CHUNK(q);
-		int off = 0;
-#if VERBOSE_DEBUG
-		check_error(errh, b, q, "");
-		StringAccum sa;
-		while (chunk && (!off || off < q->transport_length())) {
-		    sa << " (" << chunk->off << ',' << chunk->lastoff << ')';
-		    off = chunk->lastoff;
-		    chunk = next_chunk(q, chunk);
+    for (int i = 0; i < _nshards; i++) {
+	Shard &s = _shards[i];
+	lock(s);
+	uint32_t mem_used = 0;
+	int nage = 0;
+	for (Datagram *d = s.age.front(); d; d = d->_age_link.next())
+	    ++nage;
+	if (nage != (int) s.table.size())
+	    errh->error("shard %d: %d datagrams, %d in age list", i, (int) s.table.size(), nage);
+	for (Table::iterator it = s.table.begin(); it; ++it) {
+	    Datagram *d = it.get();
+	    uint32_t mem = DATAGRAM_MEM_USED;
+	    int covered = 0, off = 0;
+	    for (Packet *q = d->_frags; q; q = q->next()) {
+		if (!q->has_network_header()) {
+		    errh->error("shard %d: missing IP header", i);
+		    break;
 		}
-		errh->message("  %s", sa.c_str());
-		chunk = &PACKET_CHUNK(q);
-		off = 0;
-#endif
-		while (chunk) {
-		    if (chunk->off >= chunk->lastoff
-			|| chunk->lastoff > q->transport_length()
-			|| (off != 0 && chunk->off < off + 8)) {
-			check_error(errh, b, q, "bad chunk (%d, %d) at %d", chunk->off, chunk->lastoff, off);
-			break;
-		    }
-		    off = chunk->lastoff;
-		    chunk = next_chunk(q, chunk);
-		}
-	    } else
-		errh->error("buck %d: missing IP header", b);
-    if (mem_used != _mem_used)
-	errh->error("bad mem_used: have %u, claim %u", mem_used, _mem_used);
+		const ChunkLink &chunk = PACKET_CHUNK(q);
+		if (&shard(FragKey(q->ip_header())) != &s || !(FragKey(q->ip_header()) == d->_key))
+		    check_error(errh, i, q, "in wrong datagram");
+		if (chunk.off >= chunk.lastoff || chunk.off < off
+		    || (d->_last >= 0 && chunk.lastoff > d->_last))
+		    check_error(errh, i, q, "bad chunk (%d, %d) at %d", chunk.off, chunk.lastoff, off);
+		off = chunk.lastoff;
+		covered += chunk.lastoff - chunk.off;
+		mem += q->buffer_length();
+	    }
+	    if (covered != d->_covered)
+		errh->error("shard %d: bad covered: have %d, claim %d", i, covered, d->_covered);
+	    if (mem != d->_mem)
+		errh->error("shard %d: bad datagram mem: have %u, claim %u", i, mem, d->_mem);
+	    mem_used += d->_mem;
+	}
+	if (mem_used != s.mem_used)
+	    errh->error("shard %d: bad mem_used: have %u, claim %u", i, mem_used, s.mem_used);
+	unlock(s);
+    }
     return 0;
 }
 
@@ -147,125 +179,247 @@ IPReassembler::debug_dump(Element *e, void *)
 {
     IPReassembler *r = (IPReassembler *) e;
     r->check();
+    uint32_t frags_seen = 0, good = 0, failed = 0, bad = 0;
+    for (int i = 0; i < r->_nshards; i++) {
+	frags_seen += r->_shards[i].stat_frags_seen;
+	good += r->_shards[i].stat_good_assem;
+	failed += r->_shards[i].stat_failed_assem;
+	bad += r->_shards[i].stat_bad_pkts;
+    }
     StringAccum sa;
     sa <<
-	"frags seen total:    " << r->_stat_frags_seen << "\n"
-	"good reassemblies:   " << r->_stat_good_assem << "\n"
-	"failed reassemblies: " << r->_stat_failed_assem << "\n"
-	"bad fragments seen:  " << r->_stat_bad_pkts << "\n"
+	"frags seen total:    " << frags_seen << "\n"
+	"good reassemblies:   " << good << "\n"
+	"failed reassemblies: " << failed << "\n"
+	"bad fragments seen:  " << bad << "\n"
 	"cached chunk data:\n";
-    for (int b = 0; b < NMAP; b++)
-	for (WritablePacket *q = r->_map[b]; q; q = (WritablePacket *)(q->next()))
-	    if (const click_ip *qip = q->ip_header()) {
-		sa << ' ' << IPFlowID(qip) << ' ' << ntohs(qip->ip_id);
-		ChunkLink *chunk = &PACKET_CHUNK(q);
-		while (chunk &&
-		       (chunk->lastoff > chunk->off) &&
-		       (chunk->lastoff <= q->transport_length())) {
-		    sa << " (" << chunk->off << ',' << chunk->lastoff << ')';
-		    chunk = next_chunk(q, chunk);
-		}
-		sa << '\n';
-	    }
+    for (int i = 0; i < r->_nshards; i++) {
+	Shard &s = r->_shards[i];
+	r->lock(s);
+	for (Datagram *d = s.age.front(); d; d = d->_age_link.next()) {
+	    const click_ip *qip = d->_frags->ip_header();
+	    sa << ' ' << IPFlowID(qip) << ' ' << ntohs(qip->ip_id);
+	    for (Packet *q = d->_frags; q; q = q->next())
+		sa << " (" << PACKET_CHUNK(q).off << ',' << PACKET_CHUNK(q).lastoff << ')';
+	    sa << '\n';
+	}
+	r->unlock(s);
+    }
     return sa.take_string();
 }
 
-WritablePacket *
-IPReassembler::find_queue(Packet *p, WritablePacket ***store_pprev)
+int
+IPReassembler::add_fragment(Shard &s, Datagram *d, Packet *p, int p_off, int p_lastoff)
 {
-    const click_ip *iph = p->ip_header();
-    int bucket = bucketno(iph);
-    WritablePacket **pprev = &_map[bucket];
-    WritablePacket *q;
-    for (q = *pprev; q; pprev = (WritablePacket **)&q->next(), q = *pprev) {
-	const click_ip *qiph = q->ip_header();
-	if (same_segment(iph, qiph)) {
-	    *store_pprev = pprev;
-	    return q;
+    bool more = p->ip_header()->ip_off & htons(IP_MF);
+    bool bad = false;
+    if (d->_last >= 0)
+	bad = p_lastoff > d->_last || (!more && p_lastoff != d->_last);
+    else if (!more && d->_frags) {
+	// the last fragment must not end before data already held
+	Packet *tail = d->_frags;
+	while (tail->next())
+	    tail = tail->next();
+	bad = PACKET_CHUNK(tail).lastoff > p_lastoff;
+    }
+    if (bad) {
+	p->kill();
+	return -1;
+    }
+
+    // The latest data wins: trim or remove the held fragments that p
+    // overlaps. Data stays in the fragments' own buffers.
+    Packet **pprev = &d->_frags;
+    while (Packet *q = *pprev) {
+	ChunkLink &chunk = PACKET_CHUNK(q);
+	if (chunk.lastoff <= p_off) {
+	    pprev = &q->next();
+	    continue;
+	} else if (chunk.off >= p_lastoff)
+	    break;
+	if (chunk.off < p_off) {
+	    if (chunk.lastoff > p_lastoff) {
+		// q spans p: a clone keeps the part of q after p
+		Packet *tail = q->clone();
+		if (!tail) {
+		    p->kill();
+		    return -1;
+		}
+		PACKET_CHUNK(tail).off = p_lastoff;
+		tail->set_next(q->next());
+		q->set_next(tail);
+		d->_covered += chunk.lastoff - p_lastoff;
+		d->_mem += tail->buffer_length();
+		s.mem_used += tail->buffer_length();
+	    }
+	    d->_covered -= chunk.lastoff - p_off;
+	    chunk.lastoff = p_off;
+	    pprev = &q->next();
+	} else if (chunk.lastoff > p_lastoff) {
+	    d->_covered -= p_lastoff - chunk.off;
+	    chunk.off = p_lastoff;
+	    break;
+	} else {
+	    *pprev = q->next();
+	    d->_covered -= chunk.lastoff - chunk.off;
+	    d->_mem -= q->buffer_length();
+	    s.mem_used -= q->buffer_length();
+	    q->kill();
 	}
     }
-    *store_pprev = &_map[bucket];
+
+    PACKET_CHUNK(p).off = p_off;
+    PACKET_CHUNK(p).lastoff = p_lastoff;
+    p->set_next(*pprev);
+    *pprev = p;
+    d->_covered += p_lastoff - p_off;
+    d->_mem += p->buffer_length();
+    s.mem_used += p->buffer_length();
+    if (!more)
+	d->_last = p_lastoff;
+    if (p->network_length() > d->_max_frag)
+	d->_max_frag = p->network_length();
     return 0;
 }
 
 Packet *
-IPReassembler::emit_whole_packet(WritablePacket *q, WritablePacket **q_pprev,
-				 Packet *p_in)
+IPReassembler::assemble(Packet *frags, int last, bool partial,
+			const Timestamp &tstamp, uint16_t max_frag)
 {
-    ++_stat_good_assem;
-    *q_pprev = (WritablePacket *)q->next();
+    bool more = last < 0;
+    if (more)
+	for (Packet *q = frags; q; q = q->next())
+	    last = PACKET_CHUNK(q).lastoff;
+
+    // The first fragment's buffer receives the whole packet: this is the
+    // only copy of the data.
+    Packet *head = frags;
+    frags = head->next();
+    head->set_next(0);
+    ChunkLink head_chunk = PACKET_CHUNK(head);
+    WritablePacket *q;
+    if (head_chunk.off == 0) {
+	if ((q = head->uniqueify())) {
+	    q->take(q->transport_length() - head_chunk.lastoff);
+	    if ((q = q->put(last - head_chunk.lastoff)) && partial)
+		memset(q->transport_header() + head_chunk.lastoff, 0, last - head_chunk.lastoff);
+	}
+    } else {
+	// no first fragment: build a header from the lowest one
+	int hlen = head->ip_header_length();
+	if ((q = Packet::make(head->headroom() + head->ip_header_offset(), head->ip_header(), hlen + last, 0))) {
+	    q->set_ip_header((click_ip *) q->data(), hlen);
+	    q->copy_annotations(head);
+	    memset(q->transport_header(), 0, last);
+	    memcpy(q->transport_header() + head_chunk.off, chunk_data(head),
+		   head_chunk.lastoff - head_chunk.off);
+	}
+	head->kill();
+    }
+
+    while (Packet *f = frags) {
+	frags = f->next();
+	if (q) {
+	    const ChunkLink &chunk = PACKET_CHUNK(f);
+	    memcpy(q->transport_header() + chunk.off, chunk_data(f), chunk.lastoff - chunk.off);
+	}
+	f->kill();
+    }
+    if (!q) {
+	click_chatter("out of memory");
+	return 0;
+    }
 
     click_ip *q_iph = q->ip_header();
     q_iph->ip_len = htons(q->network_length());
+    q_iph->ip_off &= ~htons(IP_OFFMASK | IP_MF); // leave DF, RF
+    if (more)
+	q_iph->ip_off |= htons(IP_MF);
     q_iph->ip_sum = 0;
     q_iph->ip_sum = click_in_cksum((const unsigned char *)q_iph, q_iph->ip_hl << 2);
 
     // zero out the annotations we used
     memset(&PACKET_CHUNK(q), 0, sizeof(ChunkLink));
-    q->set_timestamp_anno(p_in->timestamp_anno());
-    q->set_next(0);
+    q->set_timestamp_anno(tstamp);
+    if (_mtu_anno >= 0)
+	q->set_anno_u16(_mtu_anno, max_frag);
+    return q;
+}
 
-    p_in->kill();
-    _mem_used -= IPH_MEM_USED + q->transport_length();
+Packet *
+IPReassembler::detach(Shard &s, Datagram *d, bool partial)
+{
+    s.table.erase(d->_key);
+    s.age.erase(d);
+    s.mem_used -= d->_mem;
+    Packet *frags = d->_frags;
+    Packet *q = 0;
+    if (!partial || noutputs() > 1)
+	q = assemble(frags, d->_last, partial, d->_tstamp, d->_max_frag);
+    else
+	while (Packet *f = frags) {
+	    frags = f->next();
+	    f->kill();
+	}
+    d->~Datagram();
+    s.alloc.deallocate(d);
     return q;
 }
 
 void
-IPReassembler::make_queue(Packet *p, WritablePacket **q_pprev)
+IPReassembler::expire(Shard &s, int now, Packet *&dead)
 {
-    int p_off = IP_BYTE_OFF(p->ip_header());
-    int p_lastoff = p_off + PACKET_DLEN(p);
-    WritablePacket *q;
-
-    if (p_off == 0) {
-	q = p->uniqueify();
-	if (!q) {
-	    click_chatter("out of memory");
-	    return;
-	}
-    } else {
-	q = Packet::make(p->headroom() + p->ip_header_offset(), 0, 20 + p_lastoff, 0);
-	if (!q) {
-	    p->kill();
-	    click_chatter("out of memory");
-	    return;
+    // Every packet has the same timeout, so the age list, ordered by last
+    // activity, is also ordered by expiry time.
+    int kill_time = now - _timeout;
+    while (Datagram *d = s.age.front()) {
+	if (d->_active >= kill_time)
+	    break;
+	++s.stat_timeouts;
+	++s.stat_failed_assem;
+	if (Packet *q = detach(s, d, true)) {
+	    q->set_next(dead);
+	    dead = q;
 	}
-	q->set_ip_header((click_ip *)q->data(), 20);
-	memcpy(q->ip_header(), p->ip_header(), 20);
-	// copy data
-	memcpy(q->transport_header() + p_off, p->transport_header(), PACKET_DLEN(p));
-	p->kill();
     }
+}
 
-    _mem_used += IPH_MEM_USED + p_lastoff;
-
-    click_ip *q_iph = q->ip_header();
-    q_iph->ip_off = (q_iph->ip_off & ~htons(IP_OFFMASK)); // leave MF, DF, RF
-
-    if (_mtu_anno >= 0)
-	q->set_anno_u16(_mtu_anno, q->network_length());
-
-    PACKET_CHUNK(q).off = p_off;
-    PACKET_CHUNK(q).lastoff = p_lastoff;
-
-    // link it up
-    q->set_next(*q_pprev);
-    *q_pprev = q;
-
-    check();
+void
+IPReassembler::evict(Shard &s, Packet *&dead)
+{
+    while (s.mem_used > _shard_low_thresh) {
+	Datagram *d = s.age.front();
+	if (!d)
+	    break;
+	++s.stat_evictions;
+	++s.stat_failed_assem;
+	if (Packet *q = detach(s, d, true)) {
+	    q->set_next(dead);
+	    dead = q;
+	}
+    }
 }
 
-IPReassembler::ChunkLink *
-IPReassembler::next_chunk(WritablePacket *q, ChunkLink *chunk)
+void
+IPReassembler::emit_dead(Packet *dead, bool batch)
 {
-    if (chunk->lastoff >= q->transport_length())
-	return 0;
-    else
-	return (ChunkLink *)(q->transport_header() + chunk->lastoff);
+#if HAVE_BATCH
+    if (batch) {
+	checked_output_push_batch(1, PacketBatch::make_from_simple_list(dead));
+	return;
+    }
+#else
+    (void) batch;
+#endif
+    while (Packet *q = dead) {
+	dead = q->next();
+	q->set_next(0);
+	checked_output_push(1, q);
+    }
 }
 
 Packet *
-IPReassembler::simple_action(Packet *p)
+IPReassembler::reassemble(Packet *p, bool batch)
 {
     // check common case: not a fragment
     assert(p->has_network_header());
@@ -273,16 +427,18 @@ IPReassembler::simple_action(Packet *p)
     if (!IP_ISFRAG(iph))
 	return p;
 
-    ++_stat_frags_seen;
-
-    // reap if necessary
     int now = p->timestamp_anno().sec();
     if (!now) {
 	p->timestamp_anno().assign_now();
 	now = p->timestamp_anno().sec();
     }
-    if (now >= _reap_time)
-	reap(now);
+
+    FragKey key(iph);
+    Shard &s = shard(key);
+    Packet *dead = 0, *q = 0;
+    lock(s);
+    ++s.stat_frags_seen;
+    expire(s, now, dead);
 
     // calculate packet edges
     int p_off = IP_BYTE_OFF(iph);
@@ -293,180 +449,107 @@ IPReassembler::simple_action(Packet *p)
     if (p_lastoff > 0xFFFF || p_lastoff <= p_off
 	|| ((p_lastoff & 7) != 0 && (iph->ip_off & htons(IP_MF)) != 0)
 	|| PACKET_DLEN(p) < p_lastoff - p_off) {
+	++s.stat_bad_pkts;
 	p->kill();
-	++_stat_bad_pkts;
-	return 0;
+	goto out;
     }
     p->take(PACKET_DLEN(p) - (p_lastoff - p_off));
 
-    // otherwise, we need to keep the packet
-
-    // clean up memory if necessary
-    if (_mem_used > _mem_high_thresh)
-	reap_overfull(now);
-
-    // get its Packet queue
-    WritablePacket **q_pprev;
-    WritablePacket *q = find_queue(p, &q_pprev);
-    if (!q) {			// make a new queue
-	make_queue(p, q_pprev);
-	return 0;
-    }
-    WritablePacket *q_bucket_next = (WritablePacket *)(q->next());
-
-    if (_mtu_anno >= 0 && q->anno_u16(_mtu_anno) < p->network_length())
-	q->set_anno_u16(_mtu_anno, p->network_length());
-
-    // extend the packet if necessary
-    if (p_lastoff + 8 > q->transport_length()) {
-	// error if packet already completed
-	if (!(q->ip_header()->ip_off & htons(IP_MF))) {
-	    p->kill();
-	    return 0;
-	}
-	// Figure out how much space to request. Add 8 extra bytes to ensure
-	// room for a ChunkLink, and request extra space if this packet has MF
-	// set. XXX This algorithm could result in a number of intermediate
-	// packet copies linear in the final packet length.
-	int old_transport_length = q->transport_length();
-	assert((old_transport_length & 7) == 0);
-	int want_space = p_lastoff - old_transport_length + 8;
-	if (iph->ip_off & htons(IP_MF))
-	    want_space += (p_lastoff - p_off);
-	// request space
-	if (!(q = q->put(want_space))) {
-	    click_chatter("out of memory");
-	    *q_pprev = q_bucket_next;
-	    _mem_used -= IPH_MEM_USED + old_transport_length;
-	    p->kill();
-	    return 0;
-	}
-	// get rid of extra space
-	q->take(q->transport_length() - p_lastoff);
-	// hook up packet, and add final chunk
-	*q_pprev = q;
-	ChunkLink *last_chunk = (ChunkLink *)(q->transport_header() + old_transport_length);
-	last_chunk->off = last_chunk->lastoff = p_lastoff;
-	_mem_used += p_lastoff - old_transport_length;
-    }
-
-    // find chunks before and after p
-    ChunkLink *chunk = &PACKET_CHUNK(q);
-    while (chunk->lastoff < p_off)
-	chunk = next_chunk(q, chunk);
-    ChunkLink *last = chunk;
-    while (last && last->lastoff < p_lastoff)
-	last = next_chunk(q, last);
-
-    // patch chunks
-    assert(chunk && last);
-    if (p_lastoff < last->off) {
-	ChunkLink *new_chunk = (ChunkLink *)(q->transport_header() + p_lastoff);
-	*new_chunk = *last;
-	chunk->lastoff = p_lastoff;
-    } else
-	chunk->lastoff = last->lastoff;
-    if (p_off < chunk->off)
-	chunk->off = p_off;
-
-    // copy p's data into q
-    memcpy(q->transport_header() + p_off, p->transport_header(), p_lastoff - p_off);
-
-    // copy p's annotations and IP header if it is the first packet
-    if (p_off == 0) {
-	uint16_t old_ip_off = q->ip_header()->ip_off;
-	int header_delta = p->ip_header_offset() - q->ip_header_offset() + p->ip_header_length() - q->ip_header_length();
-	if (header_delta > 0)
-	    q = q->push(header_delta);
-	else if (header_delta < 0)
-	    q->pull(-header_delta);
-	q->set_ip_header((click_ip *)(q->data() + p->ip_header_offset()), p->ip_header_length());
-        if (p->has_mac_header())
-	    q->set_mac_header((q->data() + p->mac_header_offset()), p->mac_header_length());
-	memcpy(q->data(), p->data(), p->ip_header_offset() + p->ip_header_length());
-	q->ip_header()->ip_off = old_ip_off;
-	ChunkLink old_chunk = PACKET_CHUNK(q);
-	if (_mtu_anno >= 0) {
-	    uint16_t old_mtu = q->anno_u16(_mtu_anno);
-	    q->copy_annotations(p);
-	    q->set_anno_u16(_mtu_anno, old_mtu);
+    {
+	Table::iterator it = s.table.find(key);
+	Datagram *d;
+	if (!it) {
+	    void *x = s.alloc.allocate();
+	    if (!x) {
+		click_chatter("out of memory");
+		p->kill();
+		goto out;
+	    }
+	    d = new(x) Datagram(key);
+	    d->_mem = DATAGRAM_MEM_USED;
+	    s.mem_used += DATAGRAM_MEM_USED;
+	    s.table.set(it, d);
+	    s.table.balance();
 	} else {
-	    q->copy_annotations(p);
+	    d = it.get();
+	    s.age.erase(d);
+	}
+	s.age.push_back(d);
+	d->_active = now;
+	d->_tstamp = p->timestamp_anno();
+
+	if (add_fragment(s, d, p, p_off, p_lastoff) < 0) {
+	    ++s.stat_bad_pkts;
+	    if (!d->_frags)
+		detach(s, d, true);
+	} else if (d->complete()) {
+	    ++s.stat_good_assem;
+	    q = detach(s, d, false);
 	}
-	PACKET_CHUNK(q) = old_chunk;
     }
 
-    // clear MF if incoming packet has it cleared
-    if (!(iph->ip_off & htons(IP_MF)))
-	q->ip_header()->ip_off &= ~htons(IP_MF);
-
-    // Are we done with this packet?
-    if ((q->ip_header()->ip_off & htons(IP_MF)) == 0
-	&& PACKET_CHUNK(q).off == 0
-	&& PACKET_CHUNK(q).lastoff == q->transport_length())
-	return emit_whole_packet(q, q_pprev, p);
+    // clean up memory if necessary
+    if (s.mem_used > _shard_high_thresh)
+	evict(s, dead);
 
-    // Otherwise, done for now
-    //check();
-    p->kill();
-    return 0;
+  out:
+    unlock(s);
+    if (dead)
+	emit_dead(dead, batch);
+    return q;
 }
 
-void
-IPReassembler::reap_overfull(int now)
+Packet *
+IPReassembler::simple_action(Packet *p)
 {
-    check();
-
-    // First throw away fragments at least 10 seconds old, then at least 5
-    // seconds old, then any fragments.
-    for (int delta = 10; delta >= 0; delta -= 5)
-	for (int bucket = 0; bucket < NMAP; bucket++) {
-	    WritablePacket **pprev = &_map[bucket];
-	    for (WritablePacket *q = *pprev; q; q = *pprev)
-		if (!delta || q->timestamp_anno().sec() < now - delta) {
-		    *pprev = (WritablePacket *)q->next();
-		    _mem_used -= IPH_MEM_USED + q->transport_length();
-		    q->set_next(0);
-		    checked_output_push(1, q);
-		    ++_stat_failed_assem;
-		    if (_mem_used <= _mem_low_thresh)
-			return;
-		} else
-		    pprev = (WritablePacket **)&q->next();
-	}
+    return reassemble(p, false);
+}
 
-    click_chatter("IPReassembler: cannot free enough memory!");
+#if HAVE_BATCH
+PacketBatch *
+IPReassembler::simple_action_batch(PacketBatch *batch)
+{
+    auto fnt = [this](Packet *p) { return reassemble(p, true); };
+    EXECUTE_FOR_EACH_PACKET_DROPPABLE(fnt, batch, [](Packet *) {});
+    return batch;
 }
+#endif
 
-void
-IPReassembler::reap(int now)
+String
+IPReassembler::read_handler(Element *e, void *thunk)
 {
-    // look at all queues. If no activity for 30 seconds, kill that queue
-
-    int kill_time = now - REAP_TIMEOUT;
-
-    for (int i = 0; i < NMAP; i++) {
-	WritablePacket **q_pprev = &_map[i];
-	for (WritablePacket *q = *q_pprev; q; ) {
-	    if (q->timestamp_anno().sec() < kill_time) {
-		*q_pprev = (WritablePacket *)q->next();
-		q->set_next(0);
-		_mem_used -= IPH_MEM_USED + q->transport_length();
-		checked_output_push(1, q);
-	    } else
-		q_pprev = (WritablePacket **)&q->next();
-	    q = *q_pprev;
+    IPReassembler *r = static_cast<IPReassembler *>(e);
+    uint32_t x = 0;
+    for (int i = 0; i < r->_nshards; i++) {
+	Shard &s = r->_shards[i];
+	switch ((intptr_t) thunk) {
+	case h_datagrams:
+	    x += s.table.size();
+	    break;
+	case h_mem_used:
+	    x += s.mem_used;
+	    break;
+	case h_evictions:
+	    x += s.stat_evictions;
+	    break;
+	case h_timeouts:
+	    x += s.stat_timeouts;
+	    break;
 	}
     }
-
-    _reap_time = now + REAP_INTERVAL;
+    return String(x);
 }
 
 void
 IPReassembler::add_handlers()
 {
+    add_read_handler("datagrams", read_handler, h_datagrams);
+    add_read_handler("mem_used", read_handler, h_mem_used);
+    add_read_handler("evictions", read_handler, h_evictions);
+    add_read_handler("timeouts", read_handler, h_timeouts);
     add_read_handler("dump", debug_dump);
 }
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(IPReassembler)
+ELEMENT_MT_SAFE(IPReassembler)
@@ -1,10 +1,14 @@
 // -*- c-basic-offset: 4 -*-
 #ifndef CLICK_IPREASSEMBLER_HH
 #define CLICK_IPREASSEMBLER_HH
-#include <click/element.hh>
+#include <click/batchelement.hh>
 #include <click/glue.hh>
 #include <clicknet/ip.h>
-#include <click/timer.hh>
+#include <click/hashcontainer.hh>
+#include <click/hashallocator.hh>
+#include <click/list.hh>
+#include <click/sync.hh>
+#include <click/timestamp.hh>
 CLICK_DECLS
 
 /*
@@ -21,14 +25,26 @@ Reassembles fragmented IP packets
 Expects IP packets as input to port 0. If input packets are fragments,
 IPReassembler holds them until it has enough fragments to recreate a complete
 packet. When a complete packet is constructed, it is emitted onto output 0. If
-a set of fragments making a single packet is incomplete and dormant for 30
-seconds, the fragments are generally dropped. If IPReassembler has two
+a set of fragments making a single packet is incomplete and dormant for
+TIMEOUT seconds, the fragments are generally dropped. If IPReassembler has two
 outputs, however, a single packet containing all the received fragments at
 their proper offsets is pushed onto output 1.
 
-IPReassembler's memory usage is bounded. When memory consumption rises above
-HIMEM bytes, IPReassembler throws away old fragments until memory consumption
-drops below 3/4*HIMEM bytes. Default HIMEM is 256K.
+Fragments are held as they arrived, chained in offset order, and copied only
+once, into the first fragment's buffer, when the packet is complete. When
+fragments overlap, the data of the latest one wins.
+
+IPReassembler may be traversed by several threads. Its fragment table is then
+split into shards, one per thread rounded up to a power of two, and each
+fragment is steered to a shard by a hash of its source, destination, protocol
+and IP ID, so all the fragments of a packet meet in the same shard. Each shard
+has its own lock, which is never contended when the fragments of a packet
+arrive on the same thread, as they do with RSS.
+
+IPReassembler's memory usage is bounded. Each shard may hold HIMEM divided by
+the number of shards bytes. When a shard rises above its share,
+IPReassembler throws away the least recently active packets until the shard
+drops below 3/4 of its share. Default HIMEM is 256K.
 
 Output packets have the same MAC header as the fragment that contains
 offset 0.  Other than that, input MAC headers are ignored.
@@ -45,6 +61,12 @@ Keyword arguments are:
 
 The upper bound for memory consumption, in bytes. Default is 256K.
 
+=item TIMEOUT
+
+Integer. Packets with no new fragment for TIMEOUT seconds are expired.
+Time is taken from the fragments' timestamp annotations, which are set to the
+current time when zero. Default is 30.
+
 =item MAX_MTU_ANNO
 
 Optional. A 2 byte annotation that will be filled with the maximum size of any
@@ -60,9 +82,29 @@ second output.
 
 IPReassembler destroys its input packets' "next packet" annotations.
 
+=h datagrams read-only
+
+Returns the number of packets in the process of reassembly.
+
+=h mem_used read-only
+
+Returns the number of bytes held.
+
+=h evictions read-only
+
+Returns the number of packets thrown away to bound memory usage.
+
+=h timeouts read-only
+
+Returns the number of packets expired after TIMEOUT seconds.
+
+=h dump read-only
+
+Returns statistics and the fragments currently held.
+
 =a IPFragmenter */
 
-class IPReassembler : public Element { public:
+class IPReassembler : public BatchElement { public:
 
     IPReassembler() CLICK_COLD;
     ~IPReassembler() CLICK_COLD;
@@ -78,6 +120,9 @@ class IPReassembler : public Element { public:
     int check(ErrorHandler * = 0);
 
     Packet *simple_action(Packet *);
+#if HAVE_BATCH
+    PacketBatch *simple_action_batch(PacketBatch *);
+#endif
 
     void add_handlers() CLICK_COLD;
 
@@ -86,54 +131,121 @@ class IPReassembler : public Element { public:
 	uint16_t lastoff;
     } __attribute__((packed));
 
-  private:
-
-    enum { REAP_TIMEOUT = 30, // seconds
-	   REAP_INTERVAL = 10, // seconds
-	   IPH_MEM_USED = 40 };
-
-    enum { NMAP = 256 };
-    WritablePacket *_map[NMAP];
+    struct FragKey {
+	uint32_t src;
+	uint32_t dst;
+	uint16_t id;
+	uint8_t p;
+	FragKey(const click_ip *iph)
+	    : src(iph->ip_src.s_addr), dst(iph->ip_dst.s_addr),
+	      id(iph->ip_id), p(iph->ip_p) {
+	}
+	inline hashcode_t hashcode() const;
+	bool operator==(const FragKey &x) const {
+	    return src == x.src && dst == x.dst && id == x.id && p == x.p;
+	}
+    };
+
+    struct Datagram {
+	FragKey _key;
+	Datagram *_hashnext;
+	List_member<Datagram> _age_link;
+	Packet *_frags;		// chained through next(), by offset
+	int _last;		// payload length, or -1 before the last fragment
+	int _covered;		// payload bytes held
+	uint32_t _mem;
+	int _active;		// time of the latest fragment, in seconds
+	Timestamp _tstamp;
+	uint16_t _max_frag;
+	typedef FragKey key_type;
+	typedef const FragKey &key_const_reference;
+	Datagram(const FragKey &key)
+	    : _key(key), _hashnext(), _frags(), _last(-1), _covered(0),
+	      _mem(0), _active(0), _max_frag(0) {
+	}
+	key_const_reference hashkey() const {
+	    return _key;
+	}
+	bool complete() const {
+	    return _last >= 0 && _covered == _last;
+	}
+    };
 
-    int _reap_time;
+  private:
 
-    uint32_t _stat_frags_seen;
-    uint32_t _stat_good_assem;
-    uint32_t _stat_failed_assem;
-    uint32_t _stat_bad_pkts;
+    enum { DATAGRAM_MEM_USED = sizeof(Datagram) };
+
+    typedef HashContainer<Datagram> Table;
+    typedef List<Datagram, &Datagram::_age_link> AgeList;
+
+    struct Shard {
+	Spinlock lock;
+	Table table;
+	AgeList age;		// least recently active first
+	SizedHashAllocator<sizeof(Datagram)> alloc;
+	uint32_t mem_used;
+	uint32_t stat_frags_seen;
+	uint32_t stat_good_assem;
+	uint32_t stat_failed_assem;
+	uint32_t stat_bad_pkts;
+	uint32_t stat_evictions;
+	uint32_t stat_timeouts;
+    } CLICK_CACHE_ALIGN;
+
+    Shard *_shards;
+    int _nshards;
+    bool _locked;
+    int _timeout;
 
-    uint32_t _mem_used;
     uint32_t _mem_high_thresh;	// defaults to 256K
-    uint32_t _mem_low_thresh;	// defaults to 3/4 * _mem_high_thresh
+    uint32_t _shard_high_thresh;
+    uint32_t _shard_low_thresh;	// 3/4 * _shard_high_thresh
     int8_t _mtu_anno;
 
-    static inline int bucketno(const click_ip *);
-    static inline bool same_segment(const click_ip *, const click_ip *);
-    static String debug_dump(Element *e, void *);
-
-    WritablePacket *find_queue(Packet *, WritablePacket ***);
-    void make_queue(Packet *, WritablePacket **);
-    static ChunkLink *next_chunk(WritablePacket *, ChunkLink *);
-    Packet *emit_whole_packet(WritablePacket *, WritablePacket **, Packet *);
-    void reap_overfull(int);
-    void reap(int);
+    Shard &shard(const FragKey &key) const {
+	return _shards[key.hashcode() & (_nshards - 1)];
+    }
+    inline void lock(Shard &s) const;
+    inline void unlock(Shard &s) const;
+
+    Packet *reassemble(Packet *, bool batch);
+    int add_fragment(Shard &, Datagram *, Packet *, int p_off, int p_lastoff);
+    Packet *detach(Shard &, Datagram *, bool partial);
+    void expire(Shard &, int now, Packet *&dead);
+    void evict(Shard &, Packet *&dead);
+    Packet *assemble(Packet *frags, int last, bool partial, const Timestamp &, uint16_t max_frag);
+    void emit_dead(Packet *dead, bool batch);
+
+    enum { h_datagrams, h_mem_used, h_evictions, h_timeouts };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static String debug_dump(Element *e, void *) CLICK_COLD;
     static void check_error(ErrorHandler *, int, const Packet *, const char *, ...);
 
 };
 
 
-inline int
-IPReassembler::bucketno(const click_ip *h)
+inline hashcode_t
+IPReassembler::FragKey::hashcode() const
+{
+    // The low bits pick the shard, and the hash table uses the whole value.
+    uint32_t h = src * 0x9E3779B1U ^ dst;
+    h = (h ^ (h >> 15)) * 0x85EBCA77U;
+    h ^= (id | (p << 16)) * 0xC2B2AE3DU;
+    return h ^ (h >> 13);
+}
+
+inline void
+IPReassembler::lock(Shard &s) const
 {
-    return (h->ip_id % NMAP);
+    if (_locked)
+	s.lock.acquire();
 }
 
-inline bool
-IPReassembler::same_segment(const click_ip *h, const click_ip *h2)
+inline void
+IPReassembler::unlock(Shard &s) const
 {
-    return h->ip_id == h2->ip_id && h->ip_p == h2->ip_p
-	&& h->ip_src.s_addr == h2->ip_src.s_addr
-	&& h->ip_dst.s_addr == h2->ip_dst.s_addr;
+    if (_locked)
+	s.lock.release();
 }
 
 CLICK_ENDDECLS
@@ -36,6 +36,11 @@
 #include <click/error.hh>
 #include <click/algorithm.hh>
 #include <click/heap.hh>
+#include <click/router.hh>
+#include <click/master.hh>
+#if HAVE_DPDK
+# include <click/dpdkdevice.hh>
+#endif
 
 #ifdef CLICK_LINUXMODULE
 #include <click/cxxprotect.h>
@@ -71,9 +76,12 @@ IPMapper::rewrite_flowid(IPRewriterInput *, const IPFlowID &, IPFlowID &,
 //
 
 IPRewriterBase::IPRewriterBase()
-    : _gc_timer(), _set_aggregate(false)
+    : _gc_timer(), _set_aggregate(false), _steering(0), _shared_index(0)
 {
     _gc_interval_sec = default_gc_interval;
+#if HAVE_DPDK
+    _rss_port = -1;
+#endif
 
     _mem_units_no = (click_max_cpu_ids() == 0)? 1 : click_max_cpu_ids();
 
@@ -108,6 +116,9 @@ IPRewriterBase::~IPRewriterBase()
         }
         delete [] _timeouts;
     }
+
+    delete _steering;
+    delete _shared_index;
 }
 
 
@@ -175,6 +186,35 @@ IPRewriterBase::parse_input_spec(const String &line, IPRewriterInput &is,
     return 0;
 }
 
+int
+IPRewriterBase::parse_rss_key(const String &str, ErrorHandler *errh)
+{
+    // Hexadecimal bytes, optionally separated by colons
+    Vector<uint8_t> key;
+    int nibbles = 0;
+    uint8_t byte = 0;
+    for (const char *s = str.begin(); s != str.end(); ++s) {
+	int v;
+	if (*s >= '0' && *s <= '9')
+	    v = *s - '0';
+	else if (*s >= 'a' && *s <= 'f')
+	    v = *s - 'a' + 10;
+	else if (*s >= 'A' && *s <= 'F')
+	    v = *s - 'A' + 10;
+	else if (*s == ':' && !(nibbles & 1))
+	    continue;
+	else
+	    return errh->error("bad RSS_KEY");
+	byte = (byte << 4) | v;
+	if (++nibbles % 2 == 0)
+	    key.push_back(byte);
+    }
+    if ((nibbles & 1) || !_steering->set_key(key.begin(), key.size()))
+	return errh->error("bad RSS_KEY, expected at least %d bytes",
+			   ToeplitzHash::ipv4_tuple_size + 4);
+    return 0;
+}
+
 int
 IPRewriterBase::configure(Vector<String> &conf, ErrorHandler *errh)
 {
@@ -182,6 +222,10 @@ IPRewriterBase::configure(Vector<String> &conf, ErrorHandler *errh)
     uint32_t timeouts[2];
     bool has_timeout[2] = {false,false};
     int32_t heapcap;
+    bool rss_steering = false, shared_index = false, has_shared_index = false;
+    String rss_key;
+    int rss_queues = master()->nthreads(), rss_reta_size = 128, rss_port = -1;
+    uint32_t shared_index_capacity = 65536;
 
     if (Args(this, errh).bind(conf)
 	.read("CAPACITY", AnyArg(), capacity_word)
@@ -191,9 +235,37 @@ IPRewriterBase::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("REAP_INTERVAL", SecondsArg(), _gc_interval_sec)
 	.read("REAP_TIME", Args::deprecated, SecondsArg(), _gc_interval_sec)
 	.read("SET_AGGREGATE", _set_aggregate)
+	.read("RSS_STEERING", rss_steering)
+	.read("RSS_KEY", StringArg(), rss_key)
+	.read("RSS_QUEUES", rss_queues)
+	.read("RSS_RETA_SIZE", rss_reta_size)
+	.read("RSS_PORT", rss_port)
+	.read("SHARED_INDEX", shared_index).read_status(has_shared_index)
+	.read("SHARED_INDEX_CAPACITY", shared_index_capacity)
 	.consume() < 0)
 	return -1;
 
+    if (rss_steering) {
+	_steering = new IPRewriterSteering;
+	if (rss_key && parse_rss_key(rss_key, errh) < 0)
+	    return -1;
+	if (rss_port >= 0) {
+#if HAVE_DPDK
+	    _rss_port = rss_port;
+#else
+	    return errh->error("RSS_PORT requires DPDK support");
+#endif
+	} else if (rss_queues <= 0 || rss_reta_size <= 0
+		   || (rss_reta_size & (rss_reta_size - 1)))
+	    return errh->error("bad RSS_QUEUES or RSS_RETA_SIZE");
+	else
+	    _steering->set_reta(rss_reta_size, rss_queues);
+    }
+    if (shared_index && !shares_replies())
+	return errh->error("SHARED_INDEX is not supported by %s", class_name());
+    if ((has_shared_index ? shared_index : rss_steering) && shares_replies())
+	_shared_index = new IPRewriterSharedIndex(shared_index_capacity);
+
 
     for (unsigned i=0; i<_mem_units_no; i++) {
         if (has_timeout[0])
@@ -249,6 +321,21 @@ IPRewriterBase::initialize(ErrorHandler *errh)
 	if (_input_specs[i].kind == IPRewriterInput::i_mapper)
 	    _input_specs[i].u.mapper->notify_rewriter(this, &_input_specs[i], &cerrh);
     }
+#if HAVE_DPDK
+    // Devices are started by the FromDPDKDevice elements, which initialize
+    // before rewriters.
+    if (_steering && _rss_port >= 0) {
+	Vector<uint8_t> key;
+	Vector<unsigned> reta;
+	if (DPDKDevice::get_rss_conf(_rss_port, key, reta) != 0)
+	    return errh->error("cannot read the RSS configuration of port %d", _rss_port);
+	if (key.size() && !_steering->set_key(key.begin(), key.size()))
+	    return errh->error("port %d has an unsupported RSS key", _rss_port);
+	if (reta.size() & (reta.size() - 1))
+	    return errh->error("port %d has an unsupported redirection table size", _rss_port);
+	_steering->set_reta(reta);
+    }
+#endif
     for (int i = 0; i < _gc_timer.weight(); i ++) {
         Timer& gc_timer = _gc_timer.get_value(i);
         new(&gc_timer) Timer(gc_timer_hook, this); //Reconstruct as Timer does not allow assignment
@@ -335,6 +422,8 @@ IPRewriterBase::store_flow(IPRewriterFlow *flow, int input,
 	map.rehash(map.bucket_count() + 1);
     if (reply_map_ptr != &map && reply_map_ptr->unbalanced())
 	reply_map_ptr->rehash(reply_map_ptr->bucket_count() + 1);
+    if (reply_element->_shared_index)
+	reply_element->_shared_index->insert(flow);
     return &flow->entry(false);
 }
 
@@ -375,8 +464,18 @@ IPRewriterBase::shrink_heap(bool clear_all, int thid)
     click_jiffies_t now_j = click_jiffies();
     shift_heap_best_effort(now_j);
     Vector<IPRewriterFlow *> &best_effort_heap = _heap[thid]->_heaps[0];
-    while (best_effort_heap.size() && best_effort_heap[0]->expired(now_j))
-	best_effort_heap[0]->destroy(_heap[thid]);
+    while (best_effort_heap.size() && best_effort_heap[0]->expired(now_j)) {
+	// Keep mappings whose replies other threads are still translating
+	IPRewriterFlow *mf = best_effort_heap[0];
+	IPRewriterBase *reply_element = mf->owner()->reply_element;
+	click_jiffies_t used_j, expiry_j;
+	if (reply_element->_shared_index
+	    && reply_element->_shared_index->used(mf, used_j)
+	    && click_jiffies_less(now_j, (expiry_j = mf->owner()->owner->shared_expiry(mf, used_j))))
+	    mf->change_expiry(_heap[thid], false, expiry_j);
+	else
+	    mf->destroy(_heap[thid]);
+    }
 
     int32_t capacity = clear_all ? 0 : _heap[thid]->_capacity;
     while (_heap[thid]->size() > capacity) {
@@ -422,6 +521,21 @@ IPRewriterBase::read_handler(Element *e, void *user_data)
     case h_capacity:
 	sa << rw->_heap[click_current_cpu_id()]->_capacity;
 	break;
+    case h_rss_steered:
+	sa << (rw->_steering ? rw->_steering->steered() : 0);
+	break;
+    case h_rss_unsteered:
+	sa << (rw->_steering ? rw->_steering->unsteered() : 0);
+	break;
+    case h_shared_size:
+	sa << (rw->_shared_index ? rw->_shared_index->size() : 0);
+	break;
+    case h_shared_hits:
+	sa << (rw->_shared_index ? rw->_shared_index->hits() : 0);
+	break;
+    case h_shared_failures:
+	sa << (rw->_shared_index ? rw->_shared_index->insert_failures() : 0);
+	break;
     default:
 	for (int i = 0; i < rw->_input_specs.size(); ++i) {
 	    if (what != h_patterns && what != i)
@@ -515,6 +629,15 @@ IPRewriterBase::add_rewriter_handlers(bool writable_patterns)
     add_read_handler("capacity", read_handler, h_capacity);
     add_write_handler("capacity", write_handler, h_capacity);
     add_write_handler("clear", write_handler, h_clear);
+    if (_steering) {
+	add_read_handler("rss_steered", read_handler, h_rss_steered);
+	add_read_handler("rss_unsteered", read_handler, h_rss_unsteered);
+    }
+    if (_shared_index) {
+	add_read_handler("shared_index_size", read_handler, h_shared_size);
+	add_read_handler("shared_index_hits", read_handler, h_shared_hits);
+	add_read_handler("shared_index_failures", read_handler, h_shared_failures);
+    }
     for (int i = 0; i < ninputs(); ++i) {
 	String name = "pattern" + String(i);
 	add_read_handler(name, read_handler, i);
@@ -558,6 +681,6 @@ IPRewriterBase::llrpc(unsigned command, void *data)
 	return Element::llrpc(command, data);
 }
 
-ELEMENT_REQUIRES(IPRewriterMapping IPRewriterPattern)
+ELEMENT_REQUIRES(IPRewriterMapping IPRewriterPattern IPRewriterSteering)
 ELEMENT_PROVIDES(IPRewriterBase)
 CLICK_ENDDECLS
@@ -3,6 +3,7 @@
 #define CLICK_IPREWRITERBASE_HH
 #include <click/timer.hh>
 #include "elements/ip/iprwmapping.hh"
+#include "elements/ip/iprwsteering.hh"
 #include <click/batchelement.hh>
 #include <click/bitvector.hh>
 
@@ -28,7 +29,7 @@ class IPRewriterInput { public:
     } u;
 
     IPRewriterInput()
-	: kind(i_drop), foutput(-1), routput(-1), count(0), failures(0) {
+	: owner(0), kind(i_drop), foutput(-1), routput(-1), count(0), failures(0) {
 	u.pattern = 0;
     }
 
@@ -140,6 +141,38 @@ class IPRewriterBase : public BatchElement { public:
 
     int llrpc(unsigned command, void *data);
 
+    /** @brief Return true if this rewriter translates replies through the
+     * shared index, and so accepts SHARED_INDEX. */
+    virtual bool shares_replies() const {
+	return false;
+    }
+    /** @brief Return the expiry of @a flow, whose last reply was translated
+     * by another thread at @a used_j. */
+    virtual click_jiffies_t shared_expiry(const IPRewriterFlow *flow,
+					  click_jiffies_t used_j) {
+	(void) flow;
+	return used_j + _timeouts[click_current_cpu_id()][0];
+    }
+
+    /** @brief Set the reply annotation of @a flow, including in the shared
+     * reply index. */
+    inline void set_reply_anno(IPRewriterFlow *flow, uint8_t reply_anno);
+    /** @brief Remove @a flow from the shared reply index, so that every
+     * reply is translated by the owning thread. */
+    inline void unshare_flow(const IPRewriterFlow *flow);
+
+    /** @brief Translate @a p using the shared reply index.
+     * @return the output port, or -1 if no other thread owns a mapping
+     *
+     * Called on a flow table miss, so that the reply of a mapping created by
+     * another thread is translated instead of starting a new mapping. */
+    inline int apply_shared(WritablePacket *p, const IPFlowID &flowid,
+			    int ip_p, unsigned annos) const {
+	if (!_shared_index)
+	    return -1;
+	return _shared_index->apply(p, flowid, ip_p, annos);
+    }
+
   protected:
 
     unsigned _mem_units_no;
@@ -154,6 +187,12 @@ class IPRewriterBase : public BatchElement { public:
 
     bool _set_aggregate;
 
+    IPRewriterSteering *_steering;
+    IPRewriterSharedIndex *_shared_index;
+#if HAVE_DPDK
+    int _rss_port;
+#endif
+
     enum {
 	default_timeout = 300,	   // 5 minutes
 	default_guarantee = 5,	   // 5 seconds
@@ -173,10 +212,13 @@ class IPRewriterBase : public BatchElement { public:
 
     int parse_input_spec(const String &str, IPRewriterInput &is,
 			 int input_number, ErrorHandler *errh);
+    int parse_rss_key(const String &str, ErrorHandler *errh);
 
     enum {			// < 0 because individual patterns are >= 0
 	h_nmappings = -1, h_mapping_failures = -2, h_patterns = -3,
-	h_size = -4, h_capacity = -5, h_clear = -6
+	h_size = -4, h_capacity = -5, h_clear = -6,
+	h_rss_steered = -7, h_rss_unsteered = -8, h_shared_size = -9,
+	h_shared_hits = -10, h_shared_failures = -11
     };
     static String read_handler(Element *e, void *user_data) CLICK_COLD;
     static int write_handler(const String &str, Element *e, void *user_data, ErrorHandler *errh) CLICK_COLD;
@@ -229,7 +271,8 @@ IPRewriterInput::rewrite_flowid(const IPFlowID &flowid,
 	    reply_map = &reply_element->_map[click_current_cpu_id()];
 	else
 	    reply_map = reply_element->get_map(mapid);
-	i = u.pattern->rewrite_flowid(flowid, rewritten_flowid, *reply_map);
+	i = u.pattern->rewrite_flowid(flowid, rewritten_flowid, *reply_map,
+				      owner ? owner->_steering : 0);
 	goto check_for_failure;
     }
     case i_mapper:
@@ -259,6 +302,24 @@ IPRewriterBase::unmap_flow(IPRewriterFlow *flow, Map &map,
     it = reply_map_ptr->find(flow->entry(1).hashkey());
     if (it.get() == &flow->entry(1))
 	reply_map_ptr->erase(it);
+
+    if (IPRewriterSharedIndex *index = flow->owner()->reply_element->_shared_index)
+	index->remove(flow);
+}
+
+inline void
+IPRewriterBase::set_reply_anno(IPRewriterFlow *flow, uint8_t reply_anno)
+{
+    flow->set_reply_anno(reply_anno);
+    if (IPRewriterSharedIndex *index = flow->owner()->reply_element->_shared_index)
+	index->set_reply_anno(flow, reply_anno);
+}
+
+inline void
+IPRewriterBase::unshare_flow(const IPRewriterFlow *flow)
+{
+    if (IPRewriterSharedIndex *index = flow->owner()->reply_element->_shared_index)
+	index->remove(flow);
 }
 
 CLICK_ENDDECLS
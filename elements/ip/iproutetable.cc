@@ -90,6 +90,11 @@ IPRoute::unparse() const
 }
 
 
+IPRouteTable::IPRouteTable()
+    : _nupdates(0)
+{
+}
+
 void *
 IPRouteTable::cast(const char *name)
 {
@@ -180,66 +185,53 @@ IPRouteTable::push(int port, Packet *p)
 	output(output_port).push(p);
 }
 
+void
+IPRouteTable::lookup_route_batch(const IPAddress *addr, IPAddress *gw,
+				 int *port, int n) const
+{
+    for (int i = 0; i < n; i++)
+	port[i] = lookup_route(addr[i], gw[i]);
+}
+
 #if HAVE_BATCH
 void
-IPRouteTable::push_batch(int port, PacketBatch *batch)
+IPRouteTable::push_batch(int, PacketBatch *batch)
 {
-	unsigned short outports = noutputs();
-	PacketBatch* out[outports];
-	bzero(out,sizeof(PacketBatch*)*outports);
-	PacketBatch* next = ((batch != NULL)? static_cast<PacketBatch*>(batch->next()) : NULL );
-	PacketBatch* p = batch;
-	PacketBatch* last = NULL;
-	int last_o = -1;
-	int passed = 0;
-	int count  = 0;
-
-	for ( ;p != NULL; p=next,next=(p==0?0:static_cast<PacketBatch*>(p->next())) ) {
-		// The actual job of this element
-		int o = process(port, p);
-
-		if (o < 0 || o>=(outports)) o = (outports - 1);
-
-		if (o == last_o) {
-			passed ++;
-		}
-		else {
-			if ( !last ) {
-				out[o] = p;
-				p->set_count(1);
-				p->set_tail(p);
-			}
-			else {
-				out[last_o]->set_tail(last);
-				out[last_o]->set_count(out[last_o]->count() + passed);
-				if (!out[o]) {
-					out[o] = p;
-					out[o]->set_count(1);
-					out[o]->set_tail(p);
-				}
-				else {
-					out[o]->append_packet(p);
-				}
-				passed = 0;
-			}
-		}
-		last = p;
-		last_o = o;
-		count++;
-	}
+    // Batches longer than BATCH_MAX_PULL are looked up one packet at a time.
+    int n = batch->count();
+    if (n > BATCH_MAX_PULL) {
+	auto fnt = [this](Packet *p) { return process(0, p); };
+	CLASSIFY_EACH_PACKET(noutputs() + 1, fnt, batch, checked_output_push_batch);
+	return;
+    }
 
-	if (passed) {
-		out[last_o]->set_tail(last);
-		out[last_o]->set_count(out[last_o]->count() + passed);
+    IPAddress addr[BATCH_MAX_PULL], gw[BATCH_MAX_PULL];
+    int port[BATCH_MAX_PULL];
+
+    int i = 0;
+    FOR_EACH_PACKET(batch, p)
+	addr[i++] = p->dst_ip_anno();
+
+    lookup_route_batch(addr, gw, port, n);
+
+    i = 0;
+    FOR_EACH_PACKET(batch, p) {
+	if (port[i] >= 0) {
+	    assert(port[i] < noutputs());
+	    if (gw[i])
+		p->set_dst_ip_anno(gw[i]);
+	} else {
+	    static int complained = 0;
+	    if (++complained <= 5)
+		click_chatter("IPRouteTable: no route for %s", addr[i].unparse().c_str());
 	}
+	i++;
+    }
 
-	int i = 0;
-	for (; i < outports; i++) {
-		if (out[i]) {
-			out[i]->tail()->set_next(NULL);
-			checked_output_push_batch(i, out[i]);
-		}
-	}
+    // Packets without a route fall off the last batch and are killed.
+    int *next_port = port;
+    auto fnt = [&next_port](Packet *) { return *next_port++; };
+    CLASSIFY_EACH_PACKET(noutputs() + 1, fnt, batch, checked_output_push_batch);
 }
 #endif
 
@@ -254,12 +246,18 @@ IPRouteTable::run_command(int command, const String &str, Vector<IPRoute>* old_r
 	return errh->error("bad OUTPUT");
 
     int r, before = errh->nerrors();
+    Timestamp start = Timestamp::now_steady();
     if (command == CMD_ADD)
 	r = add_route(route, false, &old_route, errh);
     else if (command == CMD_SET)
 	r = add_route(route, true, &old_route, errh);
     else
 	r = remove_route(route, &old_route, errh);
+    Timestamp latency = Timestamp::now_steady() - start;
+    _nupdates++;
+    _update_time += latency;
+    if (latency > _update_max)
+	_update_max = latency;
 
     // save old route if in a transaction
     if (r >= 0 && old_routes) {
@@ -370,6 +368,17 @@ IPRouteTable::lookup_handler(int, String& s, Element* e, const Handler*, ErrorHa
 	return errh->error("expected IP address");
 }
 
+String
+IPRouteTable::update_latency_handler(Element *e, void *)
+{
+    IPRouteTable *t = static_cast<IPRouteTable *>(e);
+    StringAccum sa;
+    sa << t->_nupdates << ' '
+       << (t->_nupdates ? t->_update_time.nsecval() / t->_nupdates : 0) << ' '
+       << t->_update_max.nsecval();
+    return sa.take_string();
+}
+
 void
 IPRouteTable::add_handlers()
 {
@@ -378,6 +387,7 @@ IPRouteTable::add_handlers()
     add_write_handler("remove", remove_route_handler);
     add_write_handler("ctrl", ctrl_handler);
     add_read_handler("table", table_handler, 0, Handler::f_expensive);
+    add_read_handler("update_latency", update_latency_handler);
     set_handler("lookup", Handler::f_read | Handler::f_read_param, lookup_handler);
 }
 
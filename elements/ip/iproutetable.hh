@@ -3,6 +3,7 @@
 #define CLICK_IPROUTETABLE_HH
 #include <click/glue.hh>
 #include <click/batchelement.hh>
+#include <click/timestamp.hh>
 CLICK_DECLS
 
 /*
@@ -108,6 +109,16 @@ Looks up the route associated with address C<dst>. Should set C<gw_return> to
 the resulting gateway and return the relevant output port (or negative if
 there is no route). The default implementation returns -1.
 
+=item C<void B<lookup_route_batch>(const IPAddress *dst, IPAddress *gw_return, int *port_return, int n) const>
+
+Looks up the routes for the C<n> addresses in C<dst>, storing each gateway in
+C<gw_return> and each output port (or a negative value) in C<port_return>.
+The default implementation calls B<lookup_route> once per address. Subclasses
+override it to overlap the memory accesses of several lookups, for instance by
+prefetching every first-level entry before resolving any of them. The default
+B<push_batch> hands each whole batch of up to BATCH_MAX_PULL packets to this
+function, so C<n> never exceeds BATCH_MAX_PULL.
+
 =item C<String B<dump_routes>()>
 
 Returns a textual description of the current routing table. The default
@@ -155,6 +166,14 @@ up to the `C<ctrl>' handler.
 This read handler callback function returns the element's routing table via
 the B<dump_routes> function. Normally hooked up to the `C<table>' handler.
 
+=item C<static String B<update_latency_handler>(Element *, void *)>
+
+This read handler callback function returns `C<COUNT MEAN MAX>': the number of
+routes changed through the B<add>, B<set>, B<remove>, and B<ctrl> handlers, and
+the mean and maximum time, in nanoseconds, that B<add_route> or
+B<remove_route> took for them. Normally hooked up to the `C<update_latency>'
+handler.
+
 =back
 
 =a RadixIPLookup, DirectIPLookup, RangeIPLookup, StaticIPLookup,
@@ -187,6 +206,8 @@ struct IPRoute {
 
 class IPRouteTable : public BatchElement { public:
 
+    IPRouteTable() CLICK_COLD;
+
     void* cast(const char*);
     int configure(Vector<String>&, ErrorHandler*) CLICK_COLD;
     void add_handlers() CLICK_COLD;
@@ -194,6 +215,7 @@ class IPRouteTable : public BatchElement { public:
     virtual int add_route(const IPRoute& route, bool allow_replace, IPRoute* replaced_route, ErrorHandler* errh);
     virtual int remove_route(const IPRoute& route, IPRoute* removed_route, ErrorHandler* errh);
     virtual int lookup_route(IPAddress addr, IPAddress& gw) const = 0;
+    virtual void lookup_route_batch(const IPAddress* addr, IPAddress* gw, int* port, int n) const;
     virtual String dump_routes();
 
     void push(int, Packet      *p);
@@ -206,6 +228,7 @@ class IPRouteTable : public BatchElement { public:
     static int ctrl_handler(const String&, Element*, void*, ErrorHandler*);
     static int lookup_handler(int operation, String&, Element*, const Handler*, ErrorHandler*);
     static String table_handler(Element*, void*);
+    static String update_latency_handler(Element*, void*);
 
   private:
 
@@ -215,6 +238,11 @@ class IPRouteTable : public BatchElement { public:
     // The actual processing of this element is abstracted from the push operation.
     // This allows both push and push_batch to exploit the same processing.
     int process(int port, Packet *p);
+
+    // Latency of updates made through handlers
+    unsigned _nupdates;
+    Timestamp _update_time;
+    Timestamp _update_max;
 };
 
 inline StringAccum&
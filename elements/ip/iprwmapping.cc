@@ -58,19 +58,27 @@ IPRewriterFlow::IPRewriterFlow(IPRewriterInput *owner, const IPFlowID &flowid,
 
 void
 IPRewriterFlow::apply(WritablePacket *p, bool direction, unsigned annos)
+{
+    apply(p, _e[!direction].hashkey(), direction,
+	  _ip_csum_delta, _udp_csum_delta, annos);
+    if (direction && (annos & 2))
+	p->set_anno_u8(annos >> 2, _reply_anno);
+}
+
+void
+IPRewriterFlow::apply(WritablePacket *p, const IPFlowID &revflow,
+		      bool direction, uint16_t ip_csum_delta,
+		      uint16_t udp_csum_delta, unsigned annos)
 {
     assert(p->has_network_header());
     click_ip *iph = p->ip_header();
 
     // IP header
-    const IPFlowID &revflow = _e[!direction].hashkey();
     iph->ip_src = revflow.daddr();
     iph->ip_dst = revflow.saddr();
     if (annos & 1)
 	p->set_dst_ip_anno(revflow.saddr());
-    if (direction && (annos & 2))
-	p->set_anno_u8(annos >> 2, _reply_anno);
-    update_csum(&iph->ip_sum, direction, _ip_csum_delta);
+    update_csum(&iph->ip_sum, direction, ip_csum_delta);
 
     // end if not first fragment
     if (!IP_FIRSTFRAG(iph))
@@ -81,13 +89,13 @@ IPRewriterFlow::apply(WritablePacket *p, bool direction, unsigned annos)
 	click_tcp *tcph = p->tcp_header();
 	tcph->th_sport = revflow.dport();
 	tcph->th_dport = revflow.sport();
-	update_csum(&tcph->th_sum, direction, _udp_csum_delta);
+	update_csum(&tcph->th_sum, direction, udp_csum_delta);
     } else if (iph->ip_p == IP_PROTO_UDP) {
 	click_udp *udph = p->udp_header();
 	udph->uh_sport = revflow.dport();
 	udph->uh_dport = revflow.sport();
 	if (udph->uh_sum)	// 0 checksum is no checksum
-	    update_csum(&udph->uh_sum, direction, _udp_csum_delta);
+	    update_csum(&udph->uh_sum, direction, udp_csum_delta);
     }
 }
 
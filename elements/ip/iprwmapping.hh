@@ -140,6 +140,9 @@ class IPRewriterFlow { public:
 				   uint16_t csum_delta);
 
     void apply(WritablePacket *p, bool direction, unsigned annos);
+    static void apply(WritablePacket *p, const IPFlowID &revflow,
+		      bool direction, uint16_t ip_csum_delta,
+		      uint16_t udp_csum_delta, unsigned annos);
 
     void unparse(StringAccum &sa, bool direction, click_jiffies_t now) const;
     void unparse_ports(StringAccum &sa, bool direction, click_jiffies_t now) const;
@@ -171,6 +174,7 @@ class IPRewriterFlow { public:
 
     friend class IPRewriterBase;
     friend class IPRewriterEntry;
+    friend class IPRewriterSharedIndex;
 
   private:
 
@@ -23,6 +23,7 @@
 #include "iprwpattern.hh"
 #include "elements/ip/iprwmapping.hh"
 #include "elements/ip/iprwpatterns.hh"
+#include "elements/ip/iprwsteering.hh"
 #include <clicknet/ip.h>
 #include <clicknet/tcp.h>
 #include <clicknet/udp.h>
@@ -219,7 +220,8 @@ IPRewriterPattern::parse_with_ports(const String &conf, IPRewriterInput *input,
 int
 IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
 				  IPFlowID &rewritten_flowid,
-				  const HashContainer<IPRewriterEntry> &reply_map)
+				  const HashContainer<IPRewriterEntry> &reply_map,
+				  const IPRewriterSteering *steering)
 {
     rewritten_flowid = flowid;
     if (_saddr)
@@ -235,11 +237,18 @@ IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
 	IPFlowID lookup = rewritten_flowid.reverse();
 	uint32_t base = (_is_napt ? ntohs(_sport) : ntohl(_saddr.addr()));
 
+	// With RSS steering, only accept a variation whose reply is received
+	// by this thread. Fall back to any free variation if there is none.
+	int thread = -1;
+	if (steering && steering->steerable())
+	    thread = click_current_cpu_id();
+
 	uint32_t val;
 	if (_same_first
 	    && (val = ntohs(flowid.sport()) - base) <= _variation_top) {
 	    lookup.set_dport(flowid.sport());
-	    if (!reply_map.find(lookup))
+	    if (!reply_map.find(lookup)
+		&& (thread < 0 || steering->thread(lookup) == thread))
 		goto found_variation;
 	}
 
@@ -248,14 +257,18 @@ IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
 	else
 	    val = click_random(0, _variation_top);
 
-	for (uint32_t count = 0; count <= _variation_top;
-	     ++count, val = (val == _variation_top ? 0 : val + 1)) {
-	    if (_is_napt)
-		lookup.set_dport(htons(base + val));
-	    else
-		lookup.set_daddr(htonl(base + val));
-	    if (!reply_map.find(lookup))
-		goto found_variation;
+	for (int pass = (thread < 0); pass < 2; ++pass) {
+	    for (uint32_t count = 0; count <= _variation_top;
+		 ++count, val = (val == _variation_top ? 0 : val + 1)) {
+		if (_is_napt)
+		    lookup.set_dport(htons(base + val));
+		else
+		    lookup.set_daddr(htonl(base + val));
+		if (!reply_map.find(lookup)
+		    && (pass || steering->thread(lookup) == thread))
+		    goto found_variation;
+	    }
+	    thread = -1;
 	}
 
 	return IPRewriterBase::rw_drop;
@@ -266,6 +279,8 @@ IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
 	else
 	    rewritten_flowid.set_saddr(lookup.daddr());
 	_next_variation = val + 1;
+	if (steering)
+	    steering->count(thread >= 0);
     }
 
     return IPRewriterBase::rw_addmap;
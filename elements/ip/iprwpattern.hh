@@ -8,6 +8,7 @@ CLICK_DECLS
 class IPRewriterFlow;
 class IPRewriterEntry;
 class IPRewriterInput;
+class IPRewriterSteering;
 
 class IPRewriterPattern { public:
 
@@ -38,7 +39,8 @@ class IPRewriterPattern { public:
     }
 
     int rewrite_flowid(const IPFlowID &flowid, IPFlowID &rewritten_flowid,
-		       const HashContainer<IPRewriterEntry> &reply_map);
+		       const HashContainer<IPRewriterEntry> &reply_map,
+		       const IPRewriterSteering *steering = 0);
 
     String unparse() const;
 
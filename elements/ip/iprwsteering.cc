@@ -0,0 +1,230 @@
+// -*- mode: c++; c-basic-offset: 4 -*-
+/*
+ * iprwsteering.{cc,hh} -- RSS-aware steering and shared reply index for
+ * IPRewriter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "iprwsteering.hh"
+#include "elements/ip/iprwmapping.hh"
+#include <click/packet.hh>
+CLICK_DECLS
+
+//
+// IPRewriterSteering
+//
+
+IPRewriterSteering::IPRewriterSteering()
+    : _reta_mask(0)
+{
+    _reta_thread.push_back(0);
+}
+
+void
+IPRewriterSteering::set_reta(const Vector<unsigned> &reta)
+{
+    assert(reta.size() > 0 && (reta.size() & (reta.size() - 1)) == 0);
+    _reta_thread.resize(reta.size());
+    _reta_mask = reta.size() - 1;
+    _thread_has_queue.assign(click_max_cpu_ids(), false);
+    for (int i = 0; i < reta.size(); ++i) {
+	_reta_thread[i] = reta[i];
+	if (reta[i] < (unsigned) _thread_has_queue.size())
+	    _thread_has_queue[reta[i]] = true;
+    }
+}
+
+void
+IPRewriterSteering::set_reta(int reta_size, int nqueues)
+{
+    Vector<unsigned> reta(reta_size, 0);
+    for (int i = 0; i < reta_size; ++i)
+	reta[i] = i % nqueues;
+    set_reta(reta);
+}
+
+uint64_t
+IPRewriterSteering::steered() const
+{
+    uint64_t n = 0;
+    for (unsigned i = 0; i < _stats.weight(); ++i)
+	n += _stats.get_value(i).steered;
+    return n;
+}
+
+uint64_t
+IPRewriterSteering::unsteered() const
+{
+    uint64_t n = 0;
+    for (unsigned i = 0; i < _stats.weight(); ++i)
+	n += _stats.get_value(i).unsteered;
+    return n;
+}
+
+//
+// IPRewriterSharedIndex
+//
+
+IPRewriterSharedIndex::IPRewriterSharedIndex(uint32_t capacity)
+{
+    uint32_t n = bucket_size;
+    while (n < capacity && n < 0x80000000U)
+	n <<= 1;
+    _mask = n - 1;
+    _tags = CLICK_ALIGNED_NEW(atomic_uint32_t, n);
+    _slots = new slot_t[n];
+    for (uint32_t i = 0; i < n; ++i) {
+	_tags[i] = tag_empty;
+	_slots[i].seq = 0;
+	_slots[i].flow = 0;
+    }
+    _size = 0;
+}
+
+IPRewriterSharedIndex::~IPRewriterSharedIndex()
+{
+    CLICK_ALIGNED_DELETE(_tags, atomic_uint32_t, _mask + 1);
+    delete[] _slots;
+}
+
+bool
+IPRewriterSharedIndex::insert(const IPRewriterFlow *flow)
+{
+    const IPRewriterEntry &reply = flow->entry(true);
+    uint32_t h = reply.flowid().hashcode();
+    for (int which = 0; which < 2; ++which) {
+	uint32_t b = bucket(h, which);
+	for (uint32_t i = b; i < b + bucket_size; ++i) {
+	    if (_tags[i] != tag_empty
+		|| _tags[i].compare_swap(tag_empty, tag_busy) != tag_empty)
+		continue;
+	    slot_t &s = _slots[i];
+	    ++s.seq;
+	    click_fence();
+	    s.key = reply.flowid();
+	    s.rec.revflow = flow->entry(false).flowid();
+	    s.rec.ip_csum_delta = flow->_ip_csum_delta;
+	    s.rec.udp_csum_delta = flow->_udp_csum_delta;
+	    s.rec.output = reply.output();
+	    s.rec.ip_p = flow->ip_p();
+	    s.rec.reply_anno = flow->reply_anno();
+	    s.flow = flow;
+	    s.used_j = 0;
+	    click_fence();
+	    ++s.seq;
+	    click_fence();
+	    _tags[i] = live_tag(h);
+	    ++_size;
+	    return true;
+	}
+    }
+    ++_stats->insert_failures;
+    return false;
+}
+
+IPRewriterSharedIndex::slot_t *
+IPRewriterSharedIndex::find(const IPRewriterFlow *flow) const
+{
+    uint32_t h = flow->entry(true).flowid().hashcode();
+    uint32_t tag = live_tag(h);
+    for (int which = 0; which < 2; ++which) {
+	uint32_t b = bucket(h, which);
+	for (uint32_t i = b; i < b + bucket_size; ++i)
+	    if (_tags[i] == tag && _slots[i].flow == flow)
+		return &_slots[i];
+    }
+    return 0;
+}
+
+void
+IPRewriterSharedIndex::remove(const IPRewriterFlow *flow)
+{
+    if (slot_t *s = find(flow)) {
+	++s->seq;
+	click_fence();
+	s->flow = 0;
+	_tags[s - _slots] = tag_empty;
+	click_fence();
+	++s->seq;
+	--_size;
+    }
+}
+
+void
+IPRewriterSharedIndex::set_reply_anno(const IPRewriterFlow *flow,
+				      uint8_t reply_anno)
+{
+    if (slot_t *s = find(flow)) {
+	++s->seq;
+	click_fence();
+	s->rec.reply_anno = reply_anno;
+	click_fence();
+	++s->seq;
+    }
+}
+
+bool
+IPRewriterSharedIndex::used(const IPRewriterFlow *flow,
+			    click_jiffies_t &used_j) const
+{
+    slot_t *s = find(flow);
+    if (!s || !s->used_j)
+	return false;
+    used_j = s->used_j;
+    return true;
+}
+
+int
+IPRewriterSharedIndex::apply(WritablePacket *p, const IPFlowID &flowid,
+			     int ip_p, unsigned annos) const
+{
+    record_t rec;
+    int i = lookup_slot(flowid, ip_p, rec);
+    if (i < 0)
+	return -1;
+    IPRewriterFlow::apply(p, rec.revflow, true,
+			  rec.ip_csum_delta, rec.udp_csum_delta, annos);
+    if (annos & 2)
+	p->set_anno_u8(annos >> 2, rec.reply_anno);
+
+    // The owner reads this before expiring the mapping; it is odd, so never
+    // 0.  Skip the store when it would not change, so that busy slots stay
+    // shared in cache.
+    click_jiffies_t now_j = click_jiffies() | 1;
+    if (_slots[i].used_j != now_j)
+	_slots[i].used_j = now_j;
+    ++_stats->hits;
+    return rec.output;
+}
+
+uint64_t
+IPRewriterSharedIndex::hits() const
+{
+    uint64_t n = 0;
+    for (unsigned i = 0; i < _stats.weight(); ++i)
+	n += _stats.get_value(i).hits;
+    return n;
+}
+
+uint64_t
+IPRewriterSharedIndex::insert_failures() const
+{
+    uint64_t n = 0;
+    for (unsigned i = 0; i < _stats.weight(); ++i)
+	n += _stats.get_value(i).insert_failures;
+    return n;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(IPRewriterMapping)
+ELEMENT_PROVIDES(IPRewriterSteering)
@@ -0,0 +1,226 @@
+// -*- mode: c++; c-basic-offset: 4 -*-
+#ifndef CLICK_IPRW_STEERING_HH
+#define CLICK_IPRW_STEERING_HH
+#include <click/ipflowid.hh>
+#include <click/toeplitz.hh>
+#include <click/atomic.hh>
+#include <click/machine.hh>
+#include <click/sync.hh>
+#include <click/vector.hh>
+#include <click/glue.hh>
+CLICK_DECLS
+class IPRewriterFlow;
+class WritablePacket;
+
+/**
+ * RSS model used to pick translations whose reply lands on the current thread
+ *
+ * The reply to a rewritten flow is received on the queue selected by the
+ * Toeplitz hash of its flow ID. IPRewriterSteering maps every redirection
+ * table entry to the thread that polls the corresponding queue, so
+ * IPRewriterPattern can choose a source port (or address) whose reply hashes
+ * back to the thread that owns the mapping.
+ */
+class IPRewriterSteering { public:
+
+    IPRewriterSteering();
+
+    /** @brief Set the RSS key. Return false if it is too short. */
+    bool set_key(const uint8_t *key, int len) {
+	return _hash.set_key(key, len);
+    }
+
+    /** @brief Set the redirection table.
+     * @param reta queue of each redirection table entry
+     *
+     * Queue q is polled by thread q. The size of @a reta must be a power of
+     * two. */
+    void set_reta(const Vector<unsigned> &reta);
+
+    /** @brief Set a redirection table spreading @a nqueues queues
+     * round-robin over @a reta_size entries, like DPDKDevice does. */
+    void set_reta(int reta_size, int nqueues);
+
+    /** @brief Return the thread receiving packets of flow @a flowid. */
+    int thread(const IPFlowID &flowid) const {
+	return _reta_thread[_hash.hash_ipv4(flowid) & _reta_mask];
+    }
+
+    /** @brief Return true if some queue of the current thread is in the
+     * redirection table. */
+    bool steerable() const {
+	int t = click_current_cpu_id();
+	return t < _thread_has_queue.size() && _thread_has_queue[t];
+    }
+
+    struct stats_t {
+	uint64_t steered;
+	uint64_t unsteered;
+	stats_t() : steered(0), unsteered(0) {
+	}
+    };
+
+    void count(bool steered) const {
+	if (steered)
+	    ++_stats->steered;
+	else
+	    ++_stats->unsteered;
+    }
+    uint64_t steered() const;
+    uint64_t unsteered() const;
+
+  private:
+
+    ToeplitzHash _hash;
+    Vector<int> _reta_thread;
+    uint32_t _reta_mask;
+    Vector<bool> _thread_has_queue;
+    mutable per_thread<stats_t> _stats;
+
+};
+
+/**
+ * Lock-free index of reply mappings shared by all threads
+ *
+ * When a reply is received by a thread that does not own its mapping, that
+ * thread cannot touch the owner's flow table. Instead, every owner publishes
+ * the reply half of its mappings here, and any thread can translate the
+ * packet from a consistent copy.
+ *
+ * Each key hashes to two buckets of eight slots; the tags of a bucket share a
+ * cache line. Slots are claimed with a compare-and-swap on their tag and
+ * carry a sequence number that readers check before and after copying, so
+ * lookups never write shared memory except for a slot's last-use time. A
+ * mapping is changed or removed only by the thread that inserted it, which
+ * also consults the last-use time before letting the mapping expire. When
+ * both buckets are full the mapping is not indexed.
+ */
+class IPRewriterSharedIndex { public:
+
+    struct record_t {
+	IPFlowID revflow;
+	uint16_t ip_csum_delta;
+	uint16_t udp_csum_delta;
+	uint32_t output;
+	uint8_t ip_p;
+	uint8_t reply_anno;
+    };
+
+    IPRewriterSharedIndex(uint32_t capacity);
+    ~IPRewriterSharedIndex();
+
+    bool insert(const IPRewriterFlow *flow);
+    void remove(const IPRewriterFlow *flow);
+    void set_reply_anno(const IPRewriterFlow *flow, uint8_t reply_anno);
+    inline bool lookup(const IPFlowID &flowid, int ip_p,
+		       record_t &rec) const;
+
+    /** @brief Return true if another thread translated a reply of @a flow,
+     * setting @a used_j to the last time it did. */
+    bool used(const IPRewriterFlow *flow, click_jiffies_t &used_j) const;
+
+    /** @brief Translate @a p, a reply of a mapping owned by another thread.
+     * @return the output port, or -1 if the mapping is not indexed */
+    int apply(WritablePacket *p, const IPFlowID &flowid, int ip_p,
+	      unsigned annos) const;
+
+    uint32_t capacity() const {
+	return _mask + 1;
+    }
+    uint32_t size() const {
+	return _size;
+    }
+
+    struct stats_t {
+	uint64_t hits;
+	uint64_t insert_failures;
+	stats_t() : hits(0), insert_failures(0) {
+	}
+    };
+    uint64_t hits() const;
+    uint64_t insert_failures() const;
+
+  private:
+
+    enum {
+	bucket_size = 8,
+	tag_empty = 0, tag_busy = 1
+    };
+
+    struct slot_t {
+	atomic_uint32_t seq;
+	IPFlowID key;
+	record_t rec;
+	const IPRewriterFlow *flow;
+	click_jiffies_t used_j;	// written by readers, 0 if never used
+    };
+
+    atomic_uint32_t *_tags;
+    slot_t *_slots;
+    uint32_t _mask;
+    atomic_uint32_t _size;
+    mutable per_thread<stats_t> _stats;
+
+    static uint32_t live_tag(uint32_t h) {
+	return h | 2;
+    }
+    uint32_t bucket(uint32_t h, int which) const {
+	if (which)
+	    h = (h >> 16) | (h << 16);
+	return (h & _mask) & ~(uint32_t) (bucket_size - 1);
+    }
+    inline int lookup_bucket(uint32_t b, uint32_t tag, const IPFlowID &flowid,
+			     int ip_p, record_t &rec) const;
+    inline int lookup_slot(const IPFlowID &flowid, int ip_p,
+			   record_t &rec) const;
+    slot_t *find(const IPRewriterFlow *flow) const;
+
+    IPRewriterSharedIndex(const IPRewriterSharedIndex &);
+    IPRewriterSharedIndex &operator=(const IPRewriterSharedIndex &);
+
+};
+
+inline int
+IPRewriterSharedIndex::lookup_bucket(uint32_t b, uint32_t tag,
+				     const IPFlowID &flowid, int ip_p,
+				     record_t &rec) const
+{
+    for (uint32_t i = b; i < b + bucket_size; ++i) {
+	if (_tags[i] != tag)
+	    continue;
+	slot_t &s = _slots[i];
+	uint32_t seq = s.seq;
+	if (seq & 1)
+	    continue;
+	click_fence();
+	IPFlowID key = s.key;
+	rec = s.rec;
+	click_fence();
+	if (s.seq == seq && _tags[i] == tag && key == flowid
+	    && (!ip_p || !rec.ip_p || rec.ip_p == ip_p))
+	    return i;
+    }
+    return -1;
+}
+
+inline int
+IPRewriterSharedIndex::lookup_slot(const IPFlowID &flowid, int ip_p,
+				   record_t &rec) const
+{
+    uint32_t h = flowid.hashcode();
+    uint32_t tag = live_tag(h);
+    int i = lookup_bucket(bucket(h, 0), tag, flowid, ip_p, rec);
+    if (i < 0)
+	i = lookup_bucket(bucket(h, 1), tag, flowid, ip_p, rec);
+    return i;
+}
+
+inline bool
+IPRewriterSharedIndex::lookup(const IPFlowID &flowid, int ip_p,
+			      record_t &rec) const
+{
+    return lookup_slot(flowid, ip_p, rec) >= 0;
+}
+
+CLICK_ENDDECLS
+#endif
@@ -32,6 +32,7 @@ class RadixIPLookup::Radix { public:
 
     static Radix *make_radix(int level);
     static void free_radix(Radix *r, int level);
+    static void free_root(void *r, uintptr_t);
 
     int change(uint32_t addr, uint32_t mask, int key, bool set, int level);
 
@@ -47,7 +48,33 @@ class RadixIPLookup::Radix { public:
 	}
 	return cur;
     }
-    
+
+    // Walk n lookups in lockstep, one level per round, prefetching each
+    // walk's next child so the misses of different walks overlap.
+    static inline void lookup_batch(const Radix *root, int def, const uint32_t *addr,
+				    int *key, int n) {
+	const Radix *r[n];
+	for (int j = 0; j < n; j++) {
+	    r[j] = root;
+	    key[j] = def;
+	    if (root)
+		__builtin_prefetch(&root->_children[(addr[j] >> _bitshift[0]) & (_nbuckets[0] - 1)]);
+	}
+	for (int level = 0, active = n; active; level++) {
+	    active = 0;
+	    for (int j = 0; j < n; j++)
+		if (r[j]) {
+		    const Child &c = r[j]->_children[(addr[j] >> _bitshift[level]) & (_nbuckets[level] - 1)];
+		    if (c.key)
+			key[j] = c.key;
+		    if ((r[j] = c.child)) {
+			__builtin_prefetch(&r[j]->_children[(addr[j] >> _bitshift[level + 1]) & (_nbuckets[level + 1] - 1)]);
+			active++;
+		    }
+		}
+	}
+    }
+
 private:
 
 
@@ -86,7 +113,7 @@ const int RadixIPLookup::Radix::_nbuckets [5] = {65536, 16, 16, 16, 16};
     
 int
 RadixIPLookup::find_lookup_key(IPAddress gw, int32_t port) {
-    for(int i=0; i  < _lookup.size(); i++) {
+    for(int i=0; i  < _nlookup; i++) {
 	if(_lookup[i].gw == gw  &&
 	   _lookup[i].port == port) 
 	    return (i + 1);
@@ -115,6 +142,12 @@ RadixIPLookup::Radix::free_radix(Radix* r, int level)
     delete[] (unsigned char *)r;
 }
 
+void
+RadixIPLookup::Radix::free_root(void *r, uintptr_t)
+{
+    free_radix(static_cast<Radix *>(r), 0);
+}
+
 int
 RadixIPLookup::Radix::change(uint32_t addr, uint32_t mask, int key, bool set, int level)
 {
@@ -124,10 +157,11 @@ RadixIPLookup::Radix::change(uint32_t addr, uint32_t mask, int key, bool set, in
 
     // check if change only affects children
     if (mask & ((1U << shift) - 1)) {
-	if (!_children[i1].child
-	    && (_children[i1].child = make_radix(level + 1))) {
-	    ;
-	}
+	if (!_children[i1].child)
+	    if (Radix *r = make_radix(level + 1)) {
+		click_write_fence();	// zeroed before lookups can reach it
+		_children[i1].child = r;
+	    }
 	if (_children[i1].child)
 	    return _children[i1].child->change(addr, mask, key, set, level+1);
 	else
@@ -161,7 +195,7 @@ RadixIPLookup::Radix::change(uint32_t addr, uint32_t mask, int key, bool set, in
 
 
 RadixIPLookup::RadixIPLookup()
-    : _vfree(-1), _default_key(0), _radix(Radix::make_radix(0))
+    : _vfree(-1), _nlookup(0), _default_key(0), _radix(Radix::make_radix(0))
 {
 }
 
@@ -175,6 +209,7 @@ RadixIPLookup::cleanup(CleanupStage)
 {
     int level = 0;
     _v.clear();
+    _rcu.synchronize();
     Radix::free_radix(_radix, level);
     _radix = 0;
 }
@@ -184,6 +219,7 @@ RadixIPLookup::add_handlers()
 {
     IPRouteTable::add_handlers();
     add_write_handler("flush", flush_handler, 0, Handler::BUTTON);
+    add_read_handler("rcu_backlog", rcu_backlog_handler);
 }
 
 String
@@ -204,9 +240,16 @@ RadixIPLookup::add_route(const IPRoute &route, bool set, IPRoute *old_route, Err
 {
     int found = (_vfree < 0 ? _v.size() : _vfree), last_key;
     int lookup_key = find_lookup_key(route.gw, route.port);
-    if(!lookup_key) 
-	lookup_key = _lookup.size() + 1;
-		    
+    if (!lookup_key) {
+	if (_nlookup == lookup_capacity)
+	    return -ENOMEM;
+	// Fill in the entry before any radix key can refer to it
+	_lookup[_nlookup].gw = route.gw;
+	_lookup[_nlookup].port = route.port;
+	click_write_fence();
+	lookup_key = _nlookup + 1;
+    }
+
     if (route.mask) {
 	uint32_t addr = ntohl(route.addr.addr());
 	uint32_t mask = ntohl(route.mask.addr());
@@ -225,10 +268,8 @@ RadixIPLookup::add_route(const IPRoute &route, bool set, IPRoute *old_route, Err
     if (last_key && !set)
 	return -EEXIST;
 
-    if (lookup_key == (_lookup.size() + 1)) {
-	GWPort gw_port = {route.gw, route.port};
-	_lookup.push_back(gw_port);
-    }
+    if (lookup_key == _nlookup + 1)
+	_nlookup++;
 
     if (found == _v.size())
 	_v.push_back(route);
@@ -280,7 +321,9 @@ int
 RadixIPLookup::lookup_route(IPAddress addr, IPAddress &gw) const
 {
     int level = 0;    
+    _rcu.read_begin();
     int key = Radix::lookup(_radix, _default_key, ntohl(addr.addr()), level);
+    _rcu.read_end();
     int lookup_key = get_lookup_key(key);
     if (lookup_key) {
 	gw = _lookup[lookup_key - 1].gw;
@@ -291,15 +334,40 @@ RadixIPLookup::lookup_route(IPAddress addr, IPAddress &gw) const
     }
 }
 
+void
+RadixIPLookup::lookup_route_batch(const IPAddress *addr, IPAddress *gw,
+				  int *port, int n) const
+{
+    uint32_t a[n];
+    int key[n];
+    for (int i = 0; i < n; i++)
+	a[i] = ntohl(addr[i].addr());
+    _rcu.read_begin();
+    Radix::lookup_batch(_radix, _default_key, a, key, n);
+    _rcu.read_end();
+    for (int i = 0; i < n; i++)
+	if (int lookup_key = get_lookup_key(key[i])) {
+	    gw[i] = _lookup[lookup_key - 1].gw;
+	    port[i] = _lookup[lookup_key - 1].port;
+	} else {
+	    gw[i] = 0;
+	    port[i] = -1;
+	}
+}
+
 void
 RadixIPLookup::flush_table()
 {
-    int level = 0;
+    // Lookups may still be walking the old trie
+    Radix *old = _radix;
+    Radix *r = Radix::make_radix(0);
+    click_write_fence();
+    _radix = r;
+    _default_key = 0;
+    _rcu.defer(Radix::free_root, old, 0);
+    _rcu.commit();
     _v.clear();
-    Radix::free_radix(_radix, level);
-    _radix = Radix::make_radix(0);
     _vfree = -1;
-    _default_key = 0;
 }
 
 int
@@ -310,6 +378,13 @@ RadixIPLookup::flush_handler(const String &, Element *e, void *, ErrorHandler *)
     return 0;
 }
 
+String
+RadixIPLookup::rcu_backlog_handler(Element *e, void *)
+{
+    RadixIPLookup *t = static_cast<RadixIPLookup *>(e);
+    return String(t->_rcu.backlog());
+}
+
 CLICK_ENDDECLS
 ELEMENT_REQUIRES(IPRouteTable)
 EXPORT_ELEMENT(RadixIPLookup)
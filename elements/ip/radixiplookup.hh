@@ -3,6 +3,7 @@
 #define CLICK_RADIXIPLOOKUP_HH
 #include <click/glue.hh>
 #include <click/element.hh>
+#include <click/multithread.hh>
 #include "iproutetable.hh"
 CLICK_DECLS
 
@@ -31,6 +32,13 @@ gateway IP address, and an output port.
 
 Uses the IPRouteTable interface; see IPRouteTable for description.
 
+Routes may be changed while other threads forward packets; lookups never take
+a lock. New trie nodes are zeroed before they are linked in, and each bucket
+changes with a single store. Flushing swaps in an empty trie and frees the old
+one once every lookup that might still walk it has finished.
+
+At most 255 distinct (GW, OUT) pairs can be used.
+
 =h table read-only
 
 Outputs a human-readable version of the current routing table.
@@ -59,6 +67,20 @@ add a route, and `C<remove ADDR/MASK>' to remove a route. You can supply
 multiple commands, one per line; all commands are executed as one atomic
 operation.
 
+=h flush write-only
+
+Clears the entire routing table.
+
+=h update_latency read-only
+
+Returns `C<COUNT MEAN MAX>': the number of route updates made through
+handlers, and their mean and maximum latency in nanoseconds.
+
+=h rcu_backlog read-only
+
+Returns the number of flushed tries still waiting for concurrent lookups to
+finish.
+
 =n
 
 See IPRouteTable for a performance comparison of the various IP routing
@@ -85,6 +107,7 @@ class RadixIPLookup : public IPRouteTable { public:
     int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
     int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
     int lookup_route(IPAddress, IPAddress&) const;
+    void lookup_route_batch(const IPAddress*, IPAddress*, int*, int) const;
     int find_lookup_key(IPAddress gw, int port);
     String dump_routes();
 
@@ -112,6 +135,7 @@ class RadixIPLookup : public IPRouteTable { public:
     void flush_table();
 
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
+    static String rcu_backlog_handler(Element *, void *);
 
     class Radix;
 
@@ -120,11 +144,16 @@ class RadixIPLookup : public IPRouteTable { public:
     int _vfree;
     
     // Compressed routing table holding unique values of (gw, port).
-    Vector<GWPort> _lookup;
+    // Entries are never moved or removed, so lookups can read them freely.
+    enum { lookup_capacity = 0xff };
+    GWPort _lookup[lookup_capacity];
+    int _nlookup;
 
     int _default_key;
     Radix *_radix;
 
+    epoch_rcu _rcu;
+
 };
 
 
@@ -27,22 +27,14 @@
 CLICK_DECLS
 
 RangeIPLookup::RangeIPLookup()
-    : _range_base((uint32_t *) CLICK_LALLOC((1 << KICKSTART_BITS) * sizeof(uint32_t))),
-      _range_len((uint32_t *) CLICK_LALLOC((1 << KICKSTART_BITS) * sizeof(uint32_t))),
-      _range_t((uint32_t *) CLICK_LALLOC(RANGES_MAX * sizeof(uint32_t))),
-      _active(false)
-{
-#if HAVE_BATCH
-    // TODO: Remove this when push_batch() will actually be implemented
-    in_batch_mode = BATCH_MODE_NO;
-#endif
+    : _ranges(0), _active(false)
+{
 }
 
 RangeIPLookup::~RangeIPLookup()
 {
-    CLICK_LFREE(_range_base, (1 << KICKSTART_BITS) * sizeof(uint32_t));
-    CLICK_LFREE(_range_len, (1 << KICKSTART_BITS) * sizeof(uint32_t));
-    CLICK_LFREE(_range_t, RANGES_MAX * sizeof(uint32_t));
+    if (_ranges)
+	CLICK_LFREE(_ranges, sizeof(Ranges));
 }
 
 int
@@ -51,14 +43,17 @@ RangeIPLookup::configure(Vector<String> &conf, ErrorHandler *errh)
     int r;
     if ((r = _helper.initialize()) < 0)
 	return r;
+    if (!_ranges && !(_ranges = (Ranges *) CLICK_LALLOC(sizeof(Ranges))))
+	return -ENOMEM;
     flush_table();
     return IPRouteTable::configure(conf, errh);
 }
 
 int
-RangeIPLookup::initialize(ErrorHandler *)
+RangeIPLookup::initialize(ErrorHandler *errh)
 {
-    expand();
+    if (expand() < 0)
+	return errh->error("out of memory");
     _active = true;
     return 0;
 }
@@ -66,6 +61,7 @@ RangeIPLookup::initialize(ErrorHandler *)
 void
 RangeIPLookup::cleanup(CleanupStage)
 {
+    // Also releases the range tables retired by publish()
     _helper.cleanup();
 }
 
@@ -99,16 +95,18 @@ RangeIPLookup::lookup_route(IPAddress dest, IPAddress &gw) const
     uint32_t i = ip_addr >> RANGE_SHIFT; // kickstart table index = MS bits
     uint16_t vport_i;
 
-    lowerbound = _range_base[i];
-    upperbound = lowerbound + _range_len[i];
+    _helper._rcu.read_begin();
+    const Ranges *r = ranges();
+    lowerbound = r->base[i];
+    upperbound = lowerbound + r->len[i];
     i = ip_addr & RANGE_MASK;		// Compare only masked LS bits
 
     // Binary search for a matching range
     while (upperbound > lowerbound) {
 	middle = (upperbound + lowerbound) >> 1;
-	if (i < (_range_t[middle] & RANGE_MASK))
+	if (i < (r->t[middle] & RANGE_MASK))
 	    upperbound = middle;
-	else if (i < (_range_t[middle + 1] & RANGE_MASK)) {
+	else if (i < (r->t[middle + 1] & RANGE_MASK)) {
 	    lowerbound = middle;
 	    break;
 	} else
@@ -116,9 +114,52 @@ RangeIPLookup::lookup_route(IPAddress dest, IPAddress &gw) const
     }
 
     // MS bits of the found range contain an index into the output port table
-    vport_i = _range_t[lowerbound] >> RANGE_SHIFT;
+    vport_i = r->t[lowerbound] >> RANGE_SHIFT;
     gw = _helper._vport[vport_i].gw;
-    return _helper._vport[vport_i].port;
+    int port = _helper._vport[vport_i].port;
+    _helper._rcu.read_end();
+    return port;
+}
+
+void
+RangeIPLookup::lookup_route_batch(const IPAddress *dest, IPAddress *gw,
+				  int *port, int n) const
+{
+    uint32_t lowerbound[n], upperbound[n];
+
+    // Fetch every kickstart entry, then the first probe of every binary
+    // search, before running any search to completion.
+    _helper._rcu.read_begin();
+    const Ranges *r = ranges();
+    for (int i = 0; i < n; i++) {
+	uint32_t k = ntohl(dest[i].addr()) >> RANGE_SHIFT;
+	__builtin_prefetch(&r->base[k]);
+	__builtin_prefetch(&r->len[k]);
+    }
+    for (int i = 0; i < n; i++) {
+	uint32_t k = ntohl(dest[i].addr()) >> RANGE_SHIFT;
+	lowerbound[i] = r->base[k];
+	upperbound[i] = lowerbound[i] + r->len[k];
+	__builtin_prefetch(&r->t[(upperbound[i] + lowerbound[i]) >> 1]);
+    }
+    for (int i = 0; i < n; i++) {
+	uint32_t lb = lowerbound[i], ub = upperbound[i], middle;
+	uint32_t a = ntohl(dest[i].addr()) & RANGE_MASK;
+	while (ub > lb) {
+	    middle = (ub + lb) >> 1;
+	    if (a < (r->t[middle] & RANGE_MASK))
+		ub = middle;
+	    else if (a < (r->t[middle + 1] & RANGE_MASK)) {
+		lb = middle;
+		break;
+	    } else
+		lb = middle + 1;
+	}
+	uint16_t vport_i = r->t[lb] >> RANGE_SHIFT;
+	gw[i] = _helper._vport[vport_i].gw;
+	port[i] = _helper._vport[vport_i].port;
+    }
+    _helper._rcu.read_end();
 }
 
 void
@@ -132,8 +173,9 @@ int
 RangeIPLookup::add_route(const IPRoute& route, bool allow_replace, IPRoute* old_route, ErrorHandler *errh)
 {
     int error = _helper.add_route(route, allow_replace, old_route, errh);
-    if (error == 0 && _active)
-	expand();
+    if (error == 0 && _active && expand() < 0)
+	error = errh->error("out of memory");
+    _helper._rcu.commit();
     return error;
 }
 
@@ -141,8 +183,9 @@ int
 RangeIPLookup::remove_route(const IPRoute& route, IPRoute* old_route, ErrorHandler *errh)
 {
     int error = _helper.remove_route(route, old_route, errh);
-    if (error == 0 && _active)
-	expand();
+    if (error == 0 && _active && expand() < 0)
+	error = errh->error("out of memory");
+    _helper._rcu.commit();
     return error;
 }
 
@@ -153,10 +196,16 @@ RangeIPLookup::remove_route(const IPRoute& route, IPRoute* old_route, ErrorHandl
  * 32 + 16 = 48 MBytes of directiplookup tables.  We should implement a
  * more efficient method for updating range-based lookup structures in
  * the future, which would not depend on huge directiplookup tables.
+ *
+ * The new table is built off to the side and published in one store, so
+ * that lookups never see a half-rewritten table.
  */
-void
+int
 RangeIPLookup::expand()
 {
+    Ranges *r = (Ranges *) CLICK_LALLOC(sizeof(Ranges));
+    if (!r)
+	return -ENOMEM;
     uint32_t range_t_index = 0;
     uint32_t tbl_0_23_index = 0;
     uint32_t range_base;
@@ -166,7 +215,7 @@ RangeIPLookup::expand()
 	uint16_t vport_i, vport_i1;
 
 	vport_i = 0xffff;       // Duh!
-	_range_base[range_base] = range_t_index;
+	r->base[range_base] = range_t_index;
 
 	for (range_len = 0;
 	  tbl_0_23_index < ((range_base + 1) << (24 - KICKSTART_BITS));
@@ -179,7 +228,7 @@ RangeIPLookup::expand()
 		    vport_i1 = _helper._tbl_24_31[tbl_24_31_index + j];
 		    if (vport_i != vport_i1) {
 			vport_i = vport_i1;
-			_range_t[range_t_index] =
+			r->t[range_t_index] =
 					vport_i << (32 - KICKSTART_BITS) |
 					(((tbl_0_23_index << 8) + j) &
 					(0xffffffff >> KICKSTART_BITS));
@@ -191,7 +240,7 @@ RangeIPLookup::expand()
 		vport_i1 = _helper._tbl_0_23[tbl_0_23_index];
 		if (vport_i != vport_i1) {
 		    vport_i = vport_i1;
-		    _range_t[range_t_index] =
+		    r->t[range_t_index] =
 					vport_i << (32 - KICKSTART_BITS) |
 					((tbl_0_23_index << 8) &
 					(0xffffffff >> KICKSTART_BITS));
@@ -200,31 +249,60 @@ RangeIPLookup::expand()
 		}
 	    }
 	}
-	_range_len[range_base] = range_len - 1;
+	r->len[range_base] = range_len - 1;
     }
 
+    // The binary search may probe one entry past the last range
+    memset(r->t + range_t_index, 0,
+	   (RANGES_MAX - range_t_index) * sizeof(uint32_t));
+    publish(r);
+
 #ifdef RANGEIPLOOKUP_VERBOSE
     click_chatter("Range expansion done: %d ranges using %d + %d bytes",
-		  range_t_index, sizeof(_range_base) + sizeof(_range_len),
+		  range_t_index, sizeof(r->base) + sizeof(r->len),
 		  range_t_index * sizeof(uint32_t));
 #endif
+    return 0;
 }
 
+/*
+ * Swap in a new range table.  The old one is freed once the next commit()
+ * has let every lookup that may still be searching it finish.
+ */
 void
+RangeIPLookup::publish(Ranges *r)
+{
+    Ranges *old = _ranges;
+    __atomic_store_n(&_ranges, r, __ATOMIC_RELEASE);
+    _helper._rcu.retire(old, sizeof(Ranges));
+}
+
+int
 RangeIPLookup::flush_table()
 {
+    if (!_active)
+	memset(_ranges, 0, sizeof(Ranges));
+    else {
+	// A zeroed table resolves every address to the discard vport.  Swap
+	// it in first: _helper.flush() then waits out the readers of the old
+	// table before recycling the vports it points to.
+	Ranges *r = (Ranges *) CLICK_LALLOC(sizeof(Ranges));
+	if (!r)
+	    return -ENOMEM;
+	memset(r, 0, sizeof(Ranges));
+	publish(r);
+    }
     _helper.flush();
-    memset(_range_base, 0, (1 << KICKSTART_BITS) * sizeof(*_range_base));
-    memset(_range_len, 0, (1 << KICKSTART_BITS) * sizeof(*_range_len));
-    memset(_range_t, 0, RANGES_MAX * sizeof(*_range_t));
+    return 0;
 }
 
 int
 RangeIPLookup::flush_handler(const String &, Element *e, void *,
-                                ErrorHandler *)
+                                ErrorHandler *errh)
 {
     RangeIPLookup *t = static_cast<RangeIPLookup *>(e);
-    t->flush_table();
+    if (t->flush_table() < 0)
+	return errh->error("out of memory");
     return 0;
 }
 
@@ -36,7 +36,9 @@ lookups per second can be achieved using modern commodity CPUs.
 
 RangeIPLookup maintains a large DirectIPLookup table as well as its own
 tables.  Although this subsidiary table is only accessed during route updates,
-it significantly adds to RangeIPLookup's total memory footprint.
+it significantly adds to RangeIPLookup's total memory footprint.  Each route
+update rebuilds the compact table in a fresh copy and swaps it in, so lookups
+running on other threads never see a partially rewritten table.
 
 =h table read-only
 
@@ -98,27 +100,39 @@ class RangeIPLookup : public IPRouteTable { public:
     int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
     int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
     int lookup_route(IPAddress, IPAddress&) const;
+    void lookup_route_batch(const IPAddress*, IPAddress*, int*, int) const;
     String dump_routes();
 
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
 
   protected:
 
-    void flush_table();
-    void expand();
+    int flush_table();
+    int expand();
 
     enum { KICKSTART_BITS = 12 };
     enum { RANGES_MAX = 256 * 1024 };
     enum { RANGE_MASK = 0xffffffff >> KICKSTART_BITS };
     enum { RANGE_SHIFT = 32 - KICKSTART_BITS };
 
-    uint32_t *_range_base;
-    uint32_t *_range_len;
-    uint32_t *_range_t;
+    // Rebuilt in full on every update, then swapped in; readers load
+    // _ranges once per lookup, inside an _helper._rcu read section.
+    struct Ranges {
+	uint32_t base[1 << KICKSTART_BITS];
+	uint32_t len[1 << KICKSTART_BITS];
+	uint32_t t[RANGES_MAX];
+    };
+
+    Ranges *_ranges;
     bool _active;
 
     DirectIPLookup::Table _helper;
 
+    inline const Ranges *ranges() const {
+	return __atomic_load_n(&_ranges, __ATOMIC_ACQUIRE);
+    }
+    void publish(Ranges *r);
+
 };
 
 CLICK_ENDDECLS
@@ -92,6 +92,7 @@ RoundRobinIPMapper::rewrite_flowid(IPRewriterInput *input,
 	++_last_pattern;
 	if (_last_pattern == _is.size())
 	    _last_pattern = 0;
+	is.owner = input->owner;
 	is.reply_element = input->reply_element;
 	int result = is.rewrite_flowid(flowid, rewritten_flowid, p, mapid);
 	if (result != IPRewriterBase::rw_drop
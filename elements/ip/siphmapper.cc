@@ -146,6 +146,7 @@ SourceIPHashMapper::rewrite_flowid(IPRewriterInput *input,
     tmp = tmp % INT_MAX;
 
     int v = _hasher->hash2ind (tmp);
+    _is[v].owner = input->owner;
     _is[v].reply_element = input->reply_element;
     input->foutput = _is[v].foutput;
     input->routput = _is[v].routput;
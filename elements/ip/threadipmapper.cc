@@ -89,6 +89,7 @@ ThreadIPMapper::rewrite_flowid(IPRewriterInput *input,
 
     int i = click_current_cpu_id();
 	IPRewriterInput &is = _is[i];
+	is.owner = input->owner;
 	is.reply_element = input->reply_element;
 	int result = is.rewrite_flowid(flowid, rewritten_flowid, p, mapid);
 	if (result != IPRewriterBase::rw_drop
@@ -0,0 +1,522 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * directip6lookup.{cc,hh} -- IPv6 route lookup using a compressed trie
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, subject to the conditions listed in the Click LICENSE
+ * file. These conditions include: you must preserve this copyright
+ * notice, and you cannot mention the copyright holders in advertising
+ * related to the Software without their permission.  The Software is
+ * provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This notice is a
+ * summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include <click/ip6address.hh>
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include "directip6lookup.hh"
+CLICK_DECLS
+
+DirectIP6Lookup::DirectIP6Lookup()
+    : _direct(0), _nexthop(0), _nexthop_size(1), _nroutes(0), _nnodes(0),
+      _deferred(false)
+{
+}
+
+DirectIP6Lookup::~DirectIP6Lookup()
+{
+}
+
+int
+DirectIP6Lookup::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _direct = (uintptr_t *) CLICK_LALLOC(sizeof(uintptr_t) << direct_bits);
+    _nexthop = (NextHop *) CLICK_LALLOC(sizeof(NextHop) * nexthop_capacity_limit);
+    if (!_direct || !_nexthop)
+	return errh->error("out of memory");
+    for (int i = 0; i < (1 << direct_bits); i++)
+	_direct[i] = 1;
+    _nexthop[0].gw = IP6Address();
+    _nexthop[0].port = -1;
+    _nexthop[0].refcount = 1;
+
+    // Build every trie once, after all routes are known.
+    _deferred = true;
+    int r = 0;
+    for (int i = 0; i < conf.size(); i++)
+	if (add_route_handler(conf[i], this, 0, errh) < 0)
+	    r = -1;
+    _deferred = false;
+    rebuild_slots(0, 1 << direct_bits);
+    return r;
+}
+
+void
+DirectIP6Lookup::cleanup(CleanupStage)
+{
+    if (_direct) {
+	flush_table();
+	for (int i = 0; i < (1 << direct_bits); i++)
+	    if (!(_direct[i] & 1))
+		retire(reinterpret_cast<Trie *>(_direct[i]));
+	_rcu.synchronize();
+	CLICK_LFREE(_direct, sizeof(uintptr_t) << direct_bits);
+	_direct = 0;
+    }
+    if (_nexthop) {
+	CLICK_LFREE(_nexthop, sizeof(NextHop) * nexthop_capacity_limit);
+	_nexthop = 0;
+    }
+}
+
+inline int
+DirectIP6Lookup::process(Packet *p, uint32_t nh)
+{
+    const NextHop &h = _nexthop[nh];
+    if (h.gw)
+	SET_DST_IP6_ANNO(p, h.gw);
+    return h.port;
+}
+
+void
+DirectIP6Lookup::push(int, Packet *p)
+{
+    _rcu.read_begin();
+    int port = process(p, lookup_nexthop(DST_IP6_ANNO(p)));
+    _rcu.read_end();
+    if (port >= 0)
+	output(port).push(p);
+    else
+	p->kill();
+}
+
+#if HAVE_BATCH
+void
+DirectIP6Lookup::push_batch(int, PacketBatch *batch)
+{
+    // Batches longer than BATCH_MAX_PULL are resolved one packet at a time.
+    if (batch->count() > BATCH_MAX_PULL) {
+	auto fnt = [this](Packet *p) {
+	    _rcu.read_begin();
+	    int port = process(p, lookup_nexthop(DST_IP6_ANNO(p)));
+	    _rcu.read_end();
+	    return port;
+	};
+	CLASSIFY_EACH_PACKET(noutputs() + 1, fnt, batch, checked_output_push_batch);
+	return;
+    }
+
+    int ports[BATCH_MAX_PULL];
+    int i = 0;
+    Packet *p = batch;
+
+    // Resolve the batch in groups, in three passes per group: prefetch the
+    // direct table entries, then the root node of every trie they point to,
+    // and only then walk the tries.
+    _rcu.read_begin();
+    while (p) {
+	Packet *group[batch_stage];
+	uint64_t hi[batch_stage], lo[batch_stage];
+	uintptr_t e[batch_stage];
+	int n = 0;
+	for (; p && n < batch_stage; p = p->next(), n++) {
+	    group[n] = p;
+	    split(DST_IP6_ANNO(p), hi[n], lo[n]);
+	    __builtin_prefetch(&_direct[hi[n] >> (64 - direct_bits)]);
+	}
+	for (int j = 0; j < n; j++) {
+	    e[j] = _direct[hi[j] >> (64 - direct_bits)];
+	    if (!(e[j] & 1))
+		__builtin_prefetch(reinterpret_cast<const Trie *>(e[j])->nodes());
+	}
+	for (int j = 0; j < n; j++, i++) {
+	    uint32_t nh;
+	    if (e[j] & 1)
+		nh = e[j] >> 1;
+	    else
+		nh = trie_lookup(reinterpret_cast<const Trie *>(e[j]), hi[j], lo[j]);
+	    ports[i] = process(group[j], nh);
+	}
+    }
+    _rcu.read_end();
+
+    int *next_port = ports;
+    auto fnt = [&next_port](Packet *) { return *next_port++; };
+    CLASSIFY_EACH_PACKET(noutputs() + 1, fnt, batch, checked_output_push_batch);
+}
+#endif
+
+int
+DirectIP6Lookup::lookup_route(const IP6Address &a, IP6Address &gw) const
+{
+    _rcu.read_begin();
+    const NextHop &h = _nexthop[lookup_nexthop(a)];
+    gw = h.gw;
+    int port = h.port;
+    _rcu.read_end();
+    return port;
+}
+
+int
+DirectIP6Lookup::find_nexthop(const IP6Address &gw, int port, ErrorHandler *errh)
+{
+    uint32_t safe = _rcu.safe_epoch();
+    int reuse = -1;
+    for (uint32_t i = 1; i < _nexthop_size; i++) {
+	NextHop &h = _nexthop[i];
+	if (h.refcount && h.port == port && h.gw == gw) {
+	    h.refcount++;
+	    return i;
+	} else if (!h.refcount && reuse < 0 && h.retired_epoch < safe)
+	    reuse = i;
+    }
+    if (reuse < 0) {
+	if (_nexthop_size == nexthop_capacity_limit)
+	    return errh->error("too many distinct gateways");
+	reuse = _nexthop_size++;
+    }
+    NextHop &h = _nexthop[reuse];
+    h.gw = gw;
+    h.port = port;
+    h.refcount = 1;
+    return reuse;
+}
+
+void
+DirectIP6Lookup::unref_nexthop(uint32_t nh)
+{
+    if (--_nexthop[nh].refcount == 0)
+	_nexthop[nh].retired_epoch = _rcu.epoch();
+}
+
+uint32_t
+DirectIP6Lookup::default_nexthop(int slot) const
+{
+    for (int len = direct_bits; len >= 0; len--) {
+	HashTable<int, uint32_t>::const_iterator it =
+	    _short_routes[len].find(slot >> (direct_bits - len));
+	if (it)
+	    return it.value();
+    }
+    return 0;
+}
+
+void
+DirectIP6Lookup::build_node(Vector<Node> &nodes, Vector<uint32_t> &leaves,
+			    int ni, int depth, uint32_t def,
+			    const Vector<const Route *> &routes)
+{
+    // Routes arrive sorted by prefix length, so longer prefixes overwrite
+    // the leaves of shorter ones.
+    uint32_t leaf[64];
+    Vector<const Route *> children[64];
+    for (int i = 0; i < 64; i++)
+	leaf[i] = def;
+    for (const Route * const *rp = routes.begin(); rp != routes.end(); ++rp) {
+	uint64_t hi, lo;
+	split((*rp)->addr, hi, lo);
+	unsigned c = chunk(hi, lo, depth);
+	if ((*rp)->prefix_len <= depth + stride) {
+	    unsigned span = 1U << (depth + stride - (*rp)->prefix_len);
+	    for (unsigned i = c; i < c + span; i++)
+		leaf[i] = (*rp)->nexthop;
+	} else
+	    children[c].push_back(*rp);
+    }
+
+    uint64_t vector = 0, leafvec = 0;
+    uint32_t base0 = leaves.size(), base1 = nodes.size();
+    bool any_leaf = false;
+    uint32_t last_leaf = 0;
+    for (int i = 0; i < 64; i++)
+	if (children[i].size())
+	    vector |= (uint64_t) 1 << i;
+	else if (!any_leaf || leaf[i] != last_leaf) {
+	    leafvec |= (uint64_t) 1 << i;
+	    leaves.push_back(leaf[i]);
+	    last_leaf = leaf[i];
+	    any_leaf = true;
+	}
+
+    Node &n = nodes[ni];
+    n.vector = vector;
+    n.leafvec = leafvec;
+    n.base0 = base0;
+    n.base1 = base1;
+
+    // Reserve the children contiguously before filling them in.
+    nodes.resize(base1 + __builtin_popcountll(vector));
+    for (int i = 0, k = base1; i < 64; i++)
+	if (children[i].size())
+	    build_node(nodes, leaves, k++, depth + stride, leaf[i], children[i]);
+}
+
+int
+DirectIP6Lookup::route_compar(const void *a, const void *b, void *)
+{
+    const Route *ra = *reinterpret_cast<const Route * const *>(a);
+    const Route *rb = *reinterpret_cast<const Route * const *>(b);
+    return ra->prefix_len - rb->prefix_len;
+}
+
+void
+DirectIP6Lookup::rebuild_slot(int slot)
+{
+    uint32_t def = default_nexthop(slot);
+    uintptr_t e = (def << 1) | 1;
+
+    HashTable<int, Vector<Route> >::iterator it = _long_routes.find(slot);
+    if (it && it.value().size()) {
+	Vector<const Route *> routes;
+	for (const Route *r = it.value().begin(); r != it.value().end(); ++r)
+	    routes.push_back(r);
+	click_qsort(routes.begin(), routes.size(), sizeof(const Route *), route_compar);
+
+	Vector<Node> nodes;
+	Vector<uint32_t> leaves;
+	nodes.push_back(Node());
+	build_node(nodes, leaves, 0, direct_bits, def, routes);
+
+	size_t size = sizeof(Trie) + nodes.size() * sizeof(Node)
+	    + leaves.size() * sizeof(uint32_t);
+	Trie *t = (Trie *) CLICK_LALLOC(size);
+	t->nnodes = nodes.size();
+	t->nleaves = leaves.size();
+	memcpy(t->nodes(), nodes.begin(), nodes.size() * sizeof(Node));
+	memcpy(t->nodes() + t->nnodes, leaves.begin(), leaves.size() * sizeof(uint32_t));
+	_nnodes += t->nnodes;
+	e = reinterpret_cast<uintptr_t>(t);
+    }
+
+    uintptr_t old = _direct[slot];
+    click_write_fence();	// the new trie is complete before it is visible
+    _direct[slot] = e;
+    if (!(old & 1))
+	retire(reinterpret_cast<Trie *>(old));
+}
+
+void
+DirectIP6Lookup::rebuild_slots(int first, int n)
+{
+    if (_deferred)
+	return;
+    for (int slot = first; slot < first + n; slot++)
+	rebuild_slot(slot);
+    _rcu.commit();
+}
+
+void
+DirectIP6Lookup::retire(Trie *t)
+{
+    _nnodes -= t->nnodes;
+    _rcu.defer(free_trie, t, 0);
+}
+
+void
+DirectIP6Lookup::free_trie(void *p, uintptr_t)
+{
+    Trie *t = reinterpret_cast<Trie *>(p);
+    CLICK_LFREE(t, sizeof(Trie) + t->nnodes * sizeof(Node)
+		+ t->nleaves * sizeof(uint32_t));
+}
+
+int
+DirectIP6Lookup::update_route(const IP6Address &addr_in, const IP6Address &mask,
+			      const IP6Address &gw, int port, bool replace,
+			      ErrorHandler *errh)
+{
+    int prefix_len = mask.mask_to_prefix_len();
+    if (prefix_len < 0)
+	return errh->error("bad mask %s", mask.unparse().c_str());
+    IP6Address addr = addr_in & mask;
+    int slot = ntohl(addr.data32()[0]) >> (32 - direct_bits);
+    bool remove = port < 0;
+
+    // Locate the route's next hop reference in the cleartext table.
+    uint32_t *nhp = 0;
+    Vector<Route> *v = 0;
+    int key = 0;
+    if (prefix_len <= direct_bits) {
+	key = slot >> (direct_bits - prefix_len);
+	if (HashTable<int, uint32_t>::iterator it = _short_routes[prefix_len].find(key))
+	    nhp = &it.value();
+	else if (!remove)
+	    nhp = &_short_routes[prefix_len].find_insert(key, 0).value();
+    } else {
+	v = &_long_routes.find_insert(slot).value();
+	for (key = 0; key < v->size(); key++)
+	    if ((*v)[key].prefix_len == prefix_len && (*v)[key].addr == addr)
+		break;
+	if (key < v->size())
+	    nhp = &(*v)[key].nexthop;
+	else if (!remove) {
+	    Route r;
+	    r.addr = addr;
+	    r.prefix_len = prefix_len;
+	    r.nexthop = 0;
+	    v->push_back(r);
+	    nhp = &v->back().nexthop;
+	}
+    }
+
+    if (remove) {
+	if (!nhp) {
+	    if (v && !v->size())
+		_long_routes.erase(slot);
+	    return errh->error("no route for %s/%d", addr.unparse().c_str(), prefix_len);
+	}
+	unref_nexthop(*nhp);
+	if (!v)
+	    _short_routes[prefix_len].erase(key);
+	else {
+	    (*v)[key] = v->back();
+	    v->pop_back();
+	    if (!v->size())
+		_long_routes.erase(slot);
+	}
+	_nroutes--;
+    } else {
+	if (*nhp && !replace)
+	    return errh->error("route for %s/%d already exists", addr.unparse().c_str(), prefix_len);
+	int nh = find_nexthop(gw, port, errh);
+	if (nh < 0) {
+	    if (!*nhp) {	// drop the entry we just inserted
+		if (!v)
+		    _short_routes[prefix_len].erase(key);
+		else if (v->pop_back(), !v->size())
+		    _long_routes.erase(slot);
+	    }
+	    return nh;
+	}
+	if (*nhp)
+	    unref_nexthop(*nhp);
+	else
+	    _nroutes++;
+	*nhp = nh;
+    }
+
+    if (prefix_len <= direct_bits)
+	rebuild_slots(key << (direct_bits - prefix_len), 1 << (direct_bits - prefix_len));
+    else
+	rebuild_slots(slot, 1);
+    return 0;
+}
+
+int
+DirectIP6Lookup::add_route(IP6Address addr, IP6Address mask, IP6Address gw,
+			   int port, ErrorHandler *errh)
+{
+    return update_route(addr, mask, gw, port, false, errh);
+}
+
+int
+DirectIP6Lookup::set_route(IP6Address addr, IP6Address mask, IP6Address gw,
+			   int port, ErrorHandler *errh)
+{
+    return update_route(addr, mask, gw, port, true, errh);
+}
+
+int
+DirectIP6Lookup::remove_route(IP6Address addr, IP6Address mask, ErrorHandler *errh)
+{
+    return update_route(addr, mask, IP6Address(), -1, false, errh);
+}
+
+void
+DirectIP6Lookup::flush_table()
+{
+    for (int len = 0; len <= direct_bits; len++)
+	_short_routes[len].clear();
+    _long_routes.clear();
+    for (uint32_t i = 1; i < _nexthop_size; i++)
+	if (_nexthop[i].refcount) {
+	    _nexthop[i].refcount = 0;
+	    _nexthop[i].retired_epoch = _rcu.epoch();
+	}
+    _nroutes = 0;
+}
+
+static int
+route_unparse_compar(const void *a, const void *b, void *)
+{
+    const String *sa = reinterpret_cast<const String *>(a);
+    const String *sb = reinterpret_cast<const String *>(b);
+    return String::compare(*sa, *sb);
+}
+
+String
+DirectIP6Lookup::dump_routes()
+{
+    Vector<String> lines;
+    for (int len = 0; len <= direct_bits; len++)
+	for (HashTable<int, uint32_t>::iterator it = _short_routes[len].begin(); it; ++it) {
+	    IP6Address addr;
+	    if (len)
+		addr.data32()[0] = htonl((uint32_t) it.key() << (32 - len));
+	    const NextHop &h = _nexthop[it.value()];
+	    StringAccum sa;
+	    sa << addr << '/' << len << '\t' << h.gw << '\t' << h.port << '\n';
+	    lines.push_back(sa.take_string());
+	}
+    for (HashTable<int, Vector<Route> >::iterator it = _long_routes.begin(); it; ++it)
+	for (const Route *r = it.value().begin(); r != it.value().end(); ++r) {
+	    const NextHop &h = _nexthop[r->nexthop];
+	    StringAccum sa;
+	    sa << r->addr << '/' << r->prefix_len << '\t' << h.gw << '\t' << h.port << '\n';
+	    lines.push_back(sa.take_string());
+	}
+    click_qsort(lines.begin(), lines.size(), sizeof(String), route_unparse_compar);
+
+    StringAccum sa;
+    if (lines.size())
+	sa << "# Active routes\n";
+    for (int i = 0; i < lines.size(); i++)
+	sa << lines[i];
+    return sa.take_string();
+}
+
+int
+DirectIP6Lookup::flush_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    DirectIP6Lookup *t = static_cast<DirectIP6Lookup *>(e);
+    t->flush_table();
+    t->rebuild_slots(0, 1 << direct_bits);
+    return 0;
+}
+
+String
+DirectIP6Lookup::nodes_handler(Element *e, void *)
+{
+    DirectIP6Lookup *t = static_cast<DirectIP6Lookup *>(e);
+    return String(t->_nnodes);
+}
+
+String
+DirectIP6Lookup::rcu_backlog_handler(Element *e, void *)
+{
+    DirectIP6Lookup *t = static_cast<DirectIP6Lookup *>(e);
+    return String(t->_rcu.backlog());
+}
+
+void
+DirectIP6Lookup::add_handlers()
+{
+    add_write_handler("add", add_route_handler, 0);
+    add_write_handler("set", add_route_handler, 1);
+    add_write_handler("remove", remove_route_handler);
+    add_write_handler("ctrl", ctrl_handler);
+    add_write_handler("flush", flush_handler, 0, Handler::f_button);
+    add_read_handler("table", table_handler, 0, Handler::f_expensive);
+    add_read_handler("nodes", nodes_handler);
+    add_read_handler("rcu_backlog", rcu_backlog_handler);
+    set_handler("lookup", Handler::f_read | Handler::f_read_param, lookup_handler);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(IP6RouteTable)
+EXPORT_ELEMENT(DirectIP6Lookup)
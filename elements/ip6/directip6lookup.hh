@@ -0,0 +1,232 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_DIRECTIP6LOOKUP_HH
+#define CLICK_DIRECTIP6LOOKUP_HH
+#include <click/hashtable.hh>
+#include <click/multithread.hh>
+#include "ip6routetable.hh"
+CLICK_DECLS
+
+/*
+=c
+
+DirectIP6Lookup(ADDR1/MASK1 [GW1] OUT1, ADDR2/MASK2 [GW2] OUT2, ...)
+
+=s ip6
+
+IPv6 routing lookup using a compressed multibit trie
+
+=d
+
+Expects a destination IPv6 address annotation with each packet. Looks up that
+address in its routing table, using longest-prefix-match, sets the destination
+annotation to the corresponding GW (if specified), and emits the packet on the
+indicated OUTput port. Packets with no matching route are dropped.
+
+Each argument is a route, specifying a destination and mask, an optional
+gateway IPv6 address, and an output port. No destination-mask pair should
+occur more than once.
+
+DirectIP6Lookup is meant for large IPv6 tables, such as a full BGP view, where
+LookupIP6Route's linear search is far too slow. The first 16 address bits
+index a direct table. Prefixes longer than /16 are stored in per-slot
+compressed tries with a stride of 6 bits, following the I<Poptrie> scheme of
+Asai and Ohara: each trie node holds two 64-bit bitmaps, and children and
+leaves are located by population count. A lookup therefore touches the direct
+table plus one node per 6 bits of prefix beyond /16, and runs of equal leaves
+are stored only once.
+
+Batches are looked up in stages, prefetching the direct table entries and the
+trie roots of the whole batch before any packet is resolved.
+
+Route updates never block packet processing. An update rebuilds the tries of
+the affected direct table slots off to the side and publishes them with a
+single pointer store. Replaced tries are freed once every thread that might
+still be reading them has finished its current batch.
+
+=h table read-only
+
+Outputs a human-readable version of the current routing table.
+
+=h lookup read-only, requires parameters
+
+Reports the OUTput port and GW corresponding to an address.
+
+=h add write-only
+
+Adds a route to the table. Format should be `C<ADDR/MASK [GW] OUT>'.
+Fails if a route for C<ADDR/MASK> already exists.
+
+=h set write-only
+
+Sets a route, whether or not a route for the same prefix already exists.
+
+=h remove write-only
+
+Removes a route from the table. Format should be `C<ADDR/MASK>'.
+
+=h ctrl write-only
+
+Adds or removes a route. Write `C<add>/C<set ADDR/MASK [GW] OUT>' to add a
+route, and `C<remove ADDR/MASK>' to remove a route.
+
+=h flush write-only
+
+Clears the entire routing table.
+
+=h nodes read-only
+
+Returns the number of trie nodes currently in use.
+
+=h rcu_backlog read-only
+
+Returns the number of replaced tries and next hops still waiting for their
+readers to finish.
+
+=n
+
+At most 32767 distinct (GW, OUT) pairs can be used at the same time.
+
+=a LookupIP6Route, DirectIPLookup
+
+Hirochika Asai and Yasuhiro Ohara. "Poptrie: A Compressed Trie with Population
+Count for Fast and Scalable Software IP Routing Table Lookup". In Proc.
+SIGCOMM 2015. */
+
+class DirectIP6Lookup : public IP6RouteTable { public:
+
+    DirectIP6Lookup() CLICK_COLD;
+    ~DirectIP6Lookup() CLICK_COLD;
+
+    const char *class_name() const	{ return "DirectIP6Lookup"; }
+    const char *port_count() const	{ return "1/-"; }
+    const char *processing() const	{ return PUSH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int port, Packet *p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch *batch);
+#endif
+
+    int add_route(IP6Address, IP6Address, IP6Address, int, ErrorHandler *);
+    int set_route(IP6Address, IP6Address, IP6Address, int, ErrorHandler *);
+    int remove_route(IP6Address, IP6Address, ErrorHandler *);
+    int lookup_route(const IP6Address &, IP6Address &) const;
+    String dump_routes();
+
+  private:
+
+    enum {
+	direct_bits = 16,
+	stride = 6,
+	nexthop_capacity_limit = 32768,
+	batch_stage = 32
+    };
+
+    struct Node {
+	uint64_t vector;	// children that are internal nodes
+	uint64_t leafvec;	// children that start a new run of leaves
+	uint32_t base0;		// index of first leaf
+	uint32_t base1;		// index of first internal child
+    };
+
+    struct Trie {
+	uint32_t nnodes;
+	uint32_t nleaves;
+	Node *nodes()			{ return reinterpret_cast<Node *>(this + 1); }
+	const Node *nodes() const	{ return reinterpret_cast<const Node *>(this + 1); }
+	const uint32_t *leaves() const	{ return reinterpret_cast<const uint32_t *>(nodes() + nnodes); }
+    };
+
+    struct NextHop {
+	IP6Address gw;
+	int port;
+	int refcount;
+	uint32_t retired_epoch;
+    };
+
+    struct Route {
+	IP6Address addr;
+	int prefix_len;
+	uint32_t nexthop;
+    };
+
+    // Direct table entries are either a leaf, (nexthop << 1) | 1, or a
+    // pointer to the Trie covering that slot. Nexthop 0 means no route.
+    uintptr_t *_direct;
+    NextHop *_nexthop;
+    uint32_t _nexthop_size;
+
+    HashTable<int, uint32_t> _short_routes[direct_bits + 1];
+    HashTable<int, Vector<Route> > _long_routes;
+    int _nroutes;
+    uint32_t _nnodes;
+    bool _deferred;
+
+    epoch_rcu _rcu;
+
+    static inline unsigned chunk(uint64_t hi, uint64_t lo, int depth) {
+	if (depth <= 58)
+	    return (hi >> (58 - depth)) & 63;
+	else if (depth < 64)
+	    return ((hi << (depth - 58)) | (lo >> (122 - depth))) & 63;
+	else if (depth <= 122)
+	    return (lo >> (122 - depth)) & 63;
+	else
+	    return (lo << (depth - 122)) & 63;
+    }
+
+    static inline void split(const IP6Address &a, uint64_t &hi, uint64_t &lo) {
+	const uint32_t *d = a.data32();
+	hi = ((uint64_t) ntohl(d[0]) << 32) | ntohl(d[1]);
+	lo = ((uint64_t) ntohl(d[2]) << 32) | ntohl(d[3]);
+    }
+
+    static inline uint32_t trie_lookup(const Trie *t, uint64_t hi, uint64_t lo) {
+	const Node *nodes = t->nodes(), *n = nodes;
+	for (int depth = direct_bits; ; depth += stride) {
+	    uint64_t bit = (uint64_t) 1 << chunk(hi, lo, depth);
+	    uint64_t below = (bit << 1) - 1;
+	    if (!(n->vector & bit))
+		return t->leaves()[n->base0 + __builtin_popcountll(n->leafvec & below) - 1];
+	    n = nodes + n->base1 + __builtin_popcountll(n->vector & below) - 1;
+	}
+    }
+
+    inline uint32_t lookup_nexthop(const IP6Address &a) const {
+	uint64_t hi, lo;
+	split(a, hi, lo);
+	uintptr_t e = _direct[hi >> (64 - direct_bits)];
+	if (e & 1)
+	    return e >> 1;
+	return trie_lookup(reinterpret_cast<const Trie *>(e), hi, lo);
+    }
+
+    inline int process(Packet *p, uint32_t nh);
+
+    int find_nexthop(const IP6Address &gw, int port, ErrorHandler *errh);
+    void unref_nexthop(uint32_t nh);
+    uint32_t default_nexthop(int slot) const;
+    void build_node(Vector<Node> &nodes, Vector<uint32_t> &leaves,
+		    int ni, int depth, uint32_t def,
+		    const Vector<const Route *> &routes);
+    static int route_compar(const void *, const void *, void *);
+    void rebuild_slot(int slot);
+    void rebuild_slots(int first, int n);
+    void retire(Trie *t);
+    static void free_trie(void *, uintptr_t);
+    int update_route(const IP6Address &addr, const IP6Address &mask,
+		     const IP6Address &gw, int port, bool replace,
+		     ErrorHandler *errh);
+    void flush_table();
+
+    static int flush_handler(const String &, Element *, void *, ErrorHandler *);
+    static String nodes_handler(Element *, void *);
+    static String rcu_backlog_handler(Element *, void *);
+
+};
+
+CLICK_ENDDECLS
+#endif
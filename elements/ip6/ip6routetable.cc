@@ -30,7 +30,7 @@ CLICK_DECLS
 void *
 IP6RouteTable::cast(const char *name)
 {
-    if (strcmp(name, "IPRouteTable") == 0)
+    if (strcmp(name, "IP6RouteTable") == 0)
 	return (void *)this;
     else
 	return Element::cast(name);
@@ -44,6 +44,15 @@ IP6RouteTable::add_route(IP6Address, IP6Address, IP6Address,
     return errh->error("cannot add routes to this routing table");
 }
 
+int
+IP6RouteTable::set_route(IP6Address dst, IP6Address mask, IP6Address gw,
+			 int port, ErrorHandler *errh)
+{
+    // by default, replace a route by removing any old version first
+    remove_route(dst, mask, ErrorHandler::silent_handler());
+    return add_route(dst, mask, gw, port, errh);
+}
+
 int
 IP6RouteTable::remove_route(IP6Address, IP6Address, ErrorHandler *errh)
 {
@@ -51,6 +60,12 @@ IP6RouteTable::remove_route(IP6Address, IP6Address, ErrorHandler *errh)
     return errh->error("cannot delete routes from this routing table");
 }
 
+int
+IP6RouteTable::lookup_route(const IP6Address &, IP6Address &) const
+{
+    return -1;			// by default, route lookups fail
+}
+
 String
 IP6RouteTable::dump_routes()
 {
@@ -58,7 +73,7 @@ IP6RouteTable::dump_routes()
 }
 
 int
-IP6RouteTable::add_route_handler(const String &conf, Element *e, void *, ErrorHandler *errh)
+IP6RouteTable::add_route_handler(const String &conf, Element *e, void *thunk, ErrorHandler *errh)
 {
     IP6RouteTable *r = static_cast<IP6RouteTable *>(e);
 
@@ -82,7 +97,9 @@ IP6RouteTable::add_route_handler(const String &conf, Element *e, void *, ErrorHa
 
     if (ok >= 0 && (port < 0 || port >= r->noutputs()))
         ok = errh->error("output port out of range");
-    if (ok >= 0)
+    if (ok >= 0 && thunk)
+        ok = r->set_route(dst, mask, gw, port, errh);
+    else if (ok >= 0)
         ok = r->add_route(dst, mask, gw, port, errh);
     return ok;
 }
@@ -113,11 +130,30 @@ IP6RouteTable::ctrl_handler(const String &conf_in, Element *e, void *thunk, Erro
     String conf = conf_in;
     String first_word = cp_shift_spacevec(conf);
     if (first_word == "add")
-	return add_route_handler(conf, e, thunk, errh);
+	return add_route_handler(conf, e, 0, errh);
+    else if (first_word == "set")
+	return add_route_handler(conf, e, (void *) 1, errh);
     else if (first_word == "remove")
 	return remove_route_handler(conf, e, thunk, errh);
     else
-	return errh->error("bad command, should be `add' or `remove'");
+	return errh->error("bad command, should be `add', `set', or `remove'");
+}
+
+int
+IP6RouteTable::lookup_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh)
+{
+    IP6RouteTable *r = static_cast<IP6RouteTable *>(e);
+    IP6Address a;
+    if (IP6AddressArg().parse(s, a, r)) {
+	IP6Address gw;
+	int port = r->lookup_route(a, gw);
+	if (gw)
+	    s = String(port) + " " + gw.unparse();
+	else
+	    s = String(port);
+	return 0;
+    } else
+	return errh->error("expected IPv6 address");
 }
 
 String
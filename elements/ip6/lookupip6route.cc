@@ -88,8 +88,8 @@ LookupIP6Route::initialize(ErrorHandler *)
   return 0;
 }
 
-void
-LookupIP6Route::push(int, Packet *p)
+int
+LookupIP6Route::process(Packet *p)
 {
   IP6Address a = DST_IP6_ANNO(p);
   IP6Address gw;
@@ -101,8 +101,7 @@ LookupIP6Route::push(int, Packet *p)
 	{
 	    SET_DST_IP6_ANNO(p, _last_gw);
 	}
-      output(_last_output).push(p);
-      return;
+      return _last_output;
     }
  #ifdef IP_RT_CACHE2
     else if (a == _last_addr2) {
@@ -116,8 +115,7 @@ LookupIP6Route::push(int, Packet *p)
       if (_last_gw2) {
 	  SET_DST_IP6_ANNO(p, _last_gw2);
       }
-      output(_last_output2).push(p);
-      return;
+      return _last_output2;
     }
 #endif
   }
@@ -136,13 +134,31 @@ LookupIP6Route::push(int, Packet *p)
     if (gw != IP6Address("::0")) {
 	SET_DST_IP6_ANNO(p, IP6Address(gw));
     }
-    output(ifi).push(p);
+    return ifi;
 
-  } else {
+  } else
+    return -1;
+}
+
+void
+LookupIP6Route::push(int, Packet *p)
+{
+  int port = process(p);
+  if (port >= 0)
+    output(port).push(p);
+  else
     p->kill();
-  }
 }
 
+#if HAVE_BATCH
+void
+LookupIP6Route::push_batch(int, PacketBatch *batch)
+{
+  auto fnt = [this](Packet *p) { return process(p); };
+  CLASSIFY_EACH_PACKET(noutputs() + 1, fnt, batch, checked_output_push_batch);
+}
+#endif
+
 int
 LookupIP6Route::add_route(IP6Address addr, IP6Address mask, IP6Address gw,
                           int output, ErrorHandler *errh)
@@ -151,14 +167,32 @@ LookupIP6Route::add_route(IP6Address addr, IP6Address mask, IP6Address gw,
     return errh->error("port number out of range"); // Can't happen...
 
   _t.add(addr, mask, gw, output);
+  _last_addr = IP6Address();
+#ifdef IP_RT_CACHE2
+  _last_addr2 = _last_addr;
+#endif
   return 0;
 }
 
+int
+LookupIP6Route::lookup_route(const IP6Address &a, IP6Address &gw) const
+{
+  int ifi;
+  if (_t.lookup(a, gw, ifi))
+    return ifi;
+  else
+    return -1;
+}
+
 int
 LookupIP6Route::remove_route(IP6Address addr, IP6Address mask,
 			     ErrorHandler *)
 {
   _t.del(addr, mask);
+  _last_addr = IP6Address();
+#ifdef IP_RT_CACHE2
+  _last_addr2 = _last_addr;
+#endif
   return 0;
 }
 
@@ -166,9 +200,11 @@ void
 LookupIP6Route::add_handlers()
 {
     add_write_handler("add", add_route_handler, 0);
+    add_write_handler("set", add_route_handler, 1);
     add_write_handler("remove", remove_route_handler, 0);
     add_write_handler("ctrl", ctrl_handler, 0);
     add_read_handler("table", table_handler, 0);
+    set_handler("lookup", Handler::f_read | Handler::f_read_param, lookup_handler);
 }
 
 CLICK_ENDDECLS
@@ -0,0 +1,577 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * aesgcm.{cc,hh} -- AES-GCM for ESP, with AES-NI and VAES implementations
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "aesgcm.hh"
+#if CLICK_USERLEVEL && defined(__x86_64__) && defined(__GNUC__)
+# define CLICK_AESGCM_X86 1
+# include <immintrin.h>
+# define AESNI_TARGET __attribute__((target("sse2,ssse3,aes,pclmul")))
+// Inlined into the VAES path so that it stays VEX-encoded throughout
+# define AESNI_INLINE AESNI_TARGET inline __attribute__((always_inline))
+# define VAES_TARGET __attribute__((target("sse2,ssse3,aes,pclmul,avx2,avx512f,avx512bw,vaes,vpclmulqdq")))
+#endif
+CLICK_DECLS
+
+int AESGCM::selected = -1;
+
+namespace {
+
+const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+inline uint8_t
+xtime(uint8_t x)
+{
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+inline uint64_t
+load_be64(const uint8_t *p)
+{
+    uint64_t x = 0;
+    for (int i = 0; i < 8; ++i)
+	x = (x << 8) | p[i];
+    return x;
+}
+
+inline void
+store_be64(uint8_t *p, uint64_t x)
+{
+    for (int i = 7; i >= 0; --i, x >>= 8)
+	p[i] = x;
+}
+
+inline void
+set_counter(uint8_t *block, uint32_t ctr)
+{
+    block[12] = ctr >> 24;
+    block[13] = ctr >> 16;
+    block[14] = ctr >> 8;
+    block[15] = ctr;
+}
+
+void
+aes_encrypt_block(const AESGCM::ctx_t &c, const uint8_t *in, uint8_t *out)
+{
+    uint8_t s[16], t[16];
+    for (int i = 0; i < 16; ++i)
+	s[i] = in[i] ^ c.rk[0][i];
+    for (int r = 1; r <= c.rounds; ++r) {
+	// SubBytes and ShiftRows; byte i is row i % 4, column i / 4
+	for (int i = 0; i < 16; ++i)
+	    t[i] = aes_sbox[s[(i + 4 * (i % 4)) % 16]];
+	if (r != c.rounds)
+	    for (int col = 0; col < 16; col += 4) {
+		uint8_t a0 = t[col], a1 = t[col + 1], a2 = t[col + 2], a3 = t[col + 3];
+		uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+		t[col] ^= all ^ xtime(a0 ^ a1);
+		t[col + 1] ^= all ^ xtime(a1 ^ a2);
+		t[col + 2] ^= all ^ xtime(a2 ^ a3);
+		t[col + 3] ^= all ^ xtime(a3 ^ a0);
+	    }
+	for (int i = 0; i < 16; ++i)
+	    s[i] = t[i] ^ c.rk[r][i];
+    }
+    memcpy(out, s, 16);
+}
+
+void
+aes_expand_key(AESGCM::ctx_t &c, const uint8_t *key, int nk)
+{
+    uint8_t *w = &c.rk[0][0];
+    int nwords = 4 * (c.rounds + 1);
+    uint8_t rcon = 1;
+    memcpy(w, key, 4 * nk);
+    for (int i = nk; i < nwords; ++i) {
+	uint8_t t[4];
+	memcpy(t, w + 4 * (i - 1), 4);
+	if (i % nk == 0) {
+	    uint8_t t0 = t[0];
+	    t[0] = aes_sbox[t[1]] ^ rcon;
+	    t[1] = aes_sbox[t[2]];
+	    t[2] = aes_sbox[t[3]];
+	    t[3] = aes_sbox[t0];
+	    rcon = xtime(rcon);
+	} else if (nk > 6 && i % nk == 4)
+	    for (int j = 0; j < 4; ++j)
+		t[j] = aes_sbox[t[j]];
+	for (int j = 0; j < 4; ++j)
+	    w[4 * i + j] = w[4 * (i - nk) + j] ^ t[j];
+    }
+}
+
+// x = x * h in GF(2^128), bit-serial (NIST SP 800-38D, Algorithm 1)
+void
+gf_mul(uint64_t *x, const uint64_t *h)
+{
+    uint64_t zh = 0, zl = 0, vh = h[0], vl = h[1];
+    for (int i = 0; i < 128; ++i) {
+	uint64_t bit = (i < 64 ? x[0] >> (63 - i) : x[1] >> (127 - i)) & 1;
+	uint64_t mask = -bit;
+	zh ^= vh & mask;
+	zl ^= vl & mask;
+	uint64_t lsb = vl & 1;
+	vl = (vl >> 1) | (vh << 63);
+	vh = (vh >> 1) ^ (-lsb & 0xE100000000000000ULL);
+    }
+    x[0] = zh;
+    x[1] = zl;
+}
+
+void
+ghash_generic(const AESGCM::ctx_t &c, uint64_t *y, const uint8_t *p, int len)
+{
+    for (int off = 0; off < len; off += 16) {
+	uint8_t block[16];
+	int k = len - off < 16 ? len - off : 16;
+	memset(block, 0, sizeof(block));
+	memcpy(block, p + off, k);
+	y[0] ^= load_be64(block);
+	y[1] ^= load_be64(block + 8);
+	gf_mul(y, c.h);
+    }
+}
+
+void
+crypt_generic(const AESGCM::ctx_t &c, bool encrypt, const uint8_t *iv,
+	      const uint8_t *aad, int aad_len, uint8_t *data, int len,
+	      uint8_t *tag)
+{
+    uint8_t ctr[16], ks[16];
+    memcpy(ctr, c.salt, AESGCM::salt_size);
+    memcpy(ctr + AESGCM::salt_size, iv, AESGCM::iv_size);
+
+    uint64_t y[2] = {0, 0};
+    ghash_generic(c, y, aad, aad_len);
+    for (int off = 0, n = 2; off < len; off += 16, ++n) {
+	int k = len - off < 16 ? len - off : 16;
+	if (!encrypt)
+	    ghash_generic(c, y, data + off, k);
+	set_counter(ctr, n);
+	aes_encrypt_block(c, ctr, ks);
+	for (int i = 0; i < k; ++i)
+	    data[off + i] ^= ks[i];
+	if (encrypt)
+	    ghash_generic(c, y, data + off, k);
+    }
+    y[0] ^= (uint64_t) aad_len * 8;
+    y[1] ^= (uint64_t) len * 8;
+    gf_mul(y, c.h);
+
+    set_counter(ctr, 1);
+    aes_encrypt_block(c, ctr, ks);
+    store_be64(tag, y[0]);
+    store_be64(tag + 8, y[1]);
+    for (int i = 0; i < 16; ++i)
+	tag[i] ^= ks[i];
+}
+
+#if CLICK_AESGCM_X86
+// GHASH on byte-reflected operands, after Gueron and Kounavis, "Intel
+// Carry-Less Multiplication Instruction and its Usage for Computing the GCM
+// Mode". Products are accumulated unreduced in lo/mid/hi so several blocks
+// share one reduction.
+
+AESNI_TARGET inline __m128i
+bswap128(__m128i x)
+{
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+					    10, 11, 12, 13, 14, 15));
+}
+
+AESNI_TARGET inline void
+clmul_acc(__m128i a, __m128i b, __m128i &lo, __m128i &mid, __m128i &hi)
+{
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x10));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+AESNI_TARGET inline __m128i
+ghash_reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    // shift the 256-bit product left by one bit
+    __m128i t7 = _mm_srli_epi32(lo, 31);
+    __m128i t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(hi, t8);
+    hi = _mm_or_si128(hi, t9);
+
+    // reduce modulo x^128 + x^7 + x^2 + x + 1
+    t7 = _mm_slli_epi32(lo, 31);
+    t8 = _mm_slli_epi32(lo, 30);
+    t9 = _mm_slli_epi32(lo, 25);
+    t7 = _mm_xor_si128(t7, _mm_xor_si128(t8, t9));
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+    __m128i t2 = _mm_srli_epi32(lo, 1);
+    t2 = _mm_xor_si128(t2, _mm_srli_epi32(lo, 2));
+    t2 = _mm_xor_si128(t2, _mm_srli_epi32(lo, 7));
+    t2 = _mm_xor_si128(t2, t8);
+    lo = _mm_xor_si128(lo, t2);
+    return _mm_xor_si128(hi, lo);
+}
+
+AESNI_TARGET inline __m128i
+ghash1(__m128i y, __m128i x, __m128i h)
+{
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+    clmul_acc(_mm_xor_si128(y, x), h, lo, mid, hi);
+    return ghash_reduce(lo, mid, hi);
+}
+
+// y = (y + x0) * H^8 + x1 * H^7 + ... + x7 * H
+AESNI_TARGET inline __m128i
+ghash8(__m128i y, const uint8_t *p, const __m128i *h8)
+{
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+    for (int j = 0; j < 8; ++j) {
+	__m128i x = bswap128(_mm_loadu_si128((const __m128i *) (p + 16 * j)));
+	if (j == 0)
+	    x = _mm_xor_si128(x, y);
+	clmul_acc(x, h8[j], lo, mid, hi);
+    }
+    return ghash_reduce(lo, mid, hi);
+}
+
+AESNI_TARGET inline __m128i
+aesni_encrypt1(const __m128i *rk, int rounds, __m128i b)
+{
+    b = _mm_xor_si128(b, rk[0]);
+    for (int r = 1; r < rounds; ++r)
+	b = _mm_aesenc_si128(b, rk[r]);
+    return _mm_aesenclast_si128(b, rk[rounds]);
+}
+
+struct aesni_state {
+    __m128i rk[15];
+    __m128i h8[8];
+    __m128i j0;
+    __m128i ctr;	// next counter block, byte-reflected
+    __m128i y;		// GHASH accumulator, byte-reflected
+};
+
+AESNI_INLINE void
+aesni_start(aesni_state &st, const AESGCM::ctx_t &c, const uint8_t *iv,
+	    const uint8_t *aad, int aad_len)
+{
+    for (int r = 0; r <= c.rounds; ++r)
+	st.rk[r] = _mm_loadu_si128((const __m128i *) c.rk[r]);
+    for (int j = 0; j < 8; ++j)
+	st.h8[j] = _mm_loadu_si128((const __m128i *) c.hpow[8 + j]);
+
+    uint8_t block[16];
+    memcpy(block, c.salt, AESGCM::salt_size);
+    memcpy(block + AESGCM::salt_size, iv, AESGCM::iv_size);
+    set_counter(block, 1);
+    st.j0 = _mm_loadu_si128((const __m128i *) block);
+    // In the reflected block, the 32-bit counter is the low dword.
+    st.ctr = _mm_add_epi32(bswap128(st.j0), _mm_set_epi32(0, 0, 0, 1));
+
+    st.y = _mm_setzero_si128();
+    for (int off = 0; off < aad_len; off += 16) {
+	int k = aad_len - off < 16 ? aad_len - off : 16;
+	memset(block, 0, sizeof(block));
+	memcpy(block, aad + off, k);
+	st.y = ghash1(st.y, bswap128(_mm_loadu_si128((const __m128i *) block)),
+		      st.h8[7]);
+    }
+}
+
+AESNI_INLINE void
+aesni_bulk(aesni_state &st, int rounds, bool encrypt, uint8_t *data,
+	   int &off, int len)
+{
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    for (; off + 128 <= len; off += 128) {
+	uint8_t *p = data + off;
+	__m128i b[8];
+	for (int j = 0; j < 8; ++j) {
+	    b[j] = _mm_xor_si128(bswap128(st.ctr), st.rk[0]);
+	    st.ctr = _mm_add_epi32(st.ctr, one);
+	}
+	if (!encrypt)
+	    st.y = ghash8(st.y, p, st.h8);
+	for (int r = 1; r < rounds; ++r)
+	    for (int j = 0; j < 8; ++j)
+		b[j] = _mm_aesenc_si128(b[j], st.rk[r]);
+	for (int j = 0; j < 8; ++j) {
+	    b[j] = _mm_aesenclast_si128(b[j], st.rk[rounds]);
+	    __m128i *q = (__m128i *) (p + 16 * j);
+	    _mm_storeu_si128(q, _mm_xor_si128(_mm_loadu_si128(q), b[j]));
+	}
+	if (encrypt)
+	    st.y = ghash8(st.y, p, st.h8);
+    }
+}
+
+AESNI_INLINE void
+aesni_finish(aesni_state &st, int rounds, bool encrypt, uint8_t *data,
+	     int off, int len, int aad_len, uint8_t *tag)
+{
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    const __m128i h = st.h8[7];
+    uint8_t block[16];
+    for (; off < len; off += 16) {
+	int k = len - off < 16 ? len - off : 16;
+	__m128i ks = aesni_encrypt1(st.rk, rounds, bswap128(st.ctr));
+	st.ctr = _mm_add_epi32(st.ctr, one);
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + off, k);
+	__m128i x = _mm_loadu_si128((const __m128i *) block);
+	if (!encrypt)
+	    st.y = ghash1(st.y, bswap128(x), h);
+	_mm_storeu_si128((__m128i *) block, _mm_xor_si128(x, ks));
+	memcpy(data + off, block, k);
+	if (encrypt) {
+	    memset(block + k, 0, sizeof(block) - k);
+	    st.y = ghash1(st.y, bswap128(_mm_loadu_si128((const __m128i *) block)), h);
+	}
+    }
+    store_be64(block, (uint64_t) aad_len * 8);
+    store_be64(block + 8, (uint64_t) len * 8);
+    st.y = ghash1(st.y, bswap128(_mm_loadu_si128((const __m128i *) block)), h);
+    __m128i t = _mm_xor_si128(bswap128(st.y), aesni_encrypt1(st.rk, rounds, st.j0));
+    _mm_storeu_si128((__m128i *) tag, t);
+}
+
+AESNI_TARGET void
+crypt_aesni(const AESGCM::ctx_t &c, bool encrypt, const uint8_t *iv,
+	    const uint8_t *aad, int aad_len, uint8_t *data, int len,
+	    uint8_t *tag)
+{
+    aesni_state st;
+    int off = 0;
+    aesni_start(st, c, iv, aad, aad_len);
+    aesni_bulk(st, c.rounds, encrypt, data, off, len);
+    aesni_finish(st, c.rounds, encrypt, data, off, len, aad_len, tag);
+}
+
+// GCC's AVX-512 broadcast and extract intrinsics start from an undefined
+// register, which -Wmaybe-uninitialized reports.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// y = (y + x0) * H^16 + x1 * H^15 + ... + x15 * H, four blocks per register
+VAES_TARGET inline __m128i
+ghash16(__m128i y, const uint8_t *p, const __m512i *h16, __m512i bswap)
+{
+    __m512i lo = _mm512_setzero_si512(), mid = lo, hi = lo;
+    for (int k = 0; k < 4; ++k) {
+	__m512i x = _mm512_shuffle_epi8(_mm512_loadu_si512(p + 64 * k), bswap);
+	if (k == 0)
+	    x = _mm512_xor_si512(x, _mm512_zextsi128_si512(y));
+	lo = _mm512_xor_si512(lo, _mm512_clmulepi64_epi128(x, h16[k], 0x00));
+	hi = _mm512_xor_si512(hi, _mm512_clmulepi64_epi128(x, h16[k], 0x11));
+	mid = _mm512_xor_si512(mid, _mm512_clmulepi64_epi128(x, h16[k], 0x10));
+	mid = _mm512_xor_si512(mid, _mm512_clmulepi64_epi128(x, h16[k], 0x01));
+    }
+    __m128i l = _mm512_extracti32x4_epi32(lo, 0), m = _mm512_extracti32x4_epi32(mid, 0),
+	h = _mm512_extracti32x4_epi32(hi, 0);
+#define FOLD_LANE(i)							\
+    l = _mm_xor_si128(l, _mm512_extracti32x4_epi32(lo, i));		\
+    m = _mm_xor_si128(m, _mm512_extracti32x4_epi32(mid, i));		\
+    h = _mm_xor_si128(h, _mm512_extracti32x4_epi32(hi, i));
+    FOLD_LANE(1)
+    FOLD_LANE(2)
+    FOLD_LANE(3)
+#undef FOLD_LANE
+    return ghash_reduce(l, m, h);
+}
+
+VAES_TARGET void
+crypt_vaes(const AESGCM::ctx_t &c, bool encrypt, const uint8_t *iv,
+	   const uint8_t *aad, int aad_len, uint8_t *data, int len,
+	   uint8_t *tag)
+{
+    aesni_state st;
+    int off = 0;
+    aesni_start(st, c, iv, aad, aad_len);
+
+    if (len >= 256) {
+	const __m512i bswap = _mm512_broadcast_i32x4(
+	    _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	__m512i rk[15], h16[4];
+	for (int r = 0; r <= c.rounds; ++r)
+	    rk[r] = _mm512_broadcast_i32x4(st.rk[r]);
+	for (int k = 0; k < 4; ++k)
+	    h16[k] = _mm512_loadu_si512(c.hpow[4 * k]);
+	const __m512i four = _mm512_set_epi32(0, 0, 0, 4, 0, 0, 0, 4,
+					      0, 0, 0, 4, 0, 0, 0, 4);
+	__m512i ctr = _mm512_add_epi32(_mm512_broadcast_i32x4(st.ctr),
+				       _mm512_set_epi32(0, 0, 0, 3, 0, 0, 0, 2,
+							0, 0, 0, 1, 0, 0, 0, 0));
+	for (; off + 256 <= len; off += 256) {
+	    uint8_t *p = data + off;
+	    __m512i b[4];
+	    for (int k = 0; k < 4; ++k) {
+		b[k] = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, bswap), rk[0]);
+		ctr = _mm512_add_epi32(ctr, four);
+	    }
+	    if (!encrypt)
+		st.y = ghash16(st.y, p, h16, bswap);
+	    for (int r = 1; r < c.rounds; ++r)
+		for (int k = 0; k < 4; ++k)
+		    b[k] = _mm512_aesenc_epi128(b[k], rk[r]);
+	    for (int k = 0; k < 4; ++k) {
+		b[k] = _mm512_aesenclast_epi128(b[k], rk[c.rounds]);
+		_mm512_storeu_si512(p + 64 * k,
+				    _mm512_xor_si512(_mm512_loadu_si512(p + 64 * k), b[k]));
+	    }
+	    if (encrypt)
+		st.y = ghash16(st.y, p, h16, bswap);
+	}
+	st.ctr = _mm512_castsi512_si128(ctr);
+    }
+
+    aesni_bulk(st, c.rounds, encrypt, data, off, len);
+    aesni_finish(st, c.rounds, encrypt, data, off, len, aad_len, tag);
+}
+#pragma GCC diagnostic pop
+#endif
+
+}
+
+bool
+AESGCM::set_key(const uint8_t *keymat, int len)
+{
+    int key_len = len - salt_size;
+    if (key_len != 16 && key_len != 32)
+	return false;
+    _ctx.rounds = key_len == 16 ? 10 : 14;
+    aes_expand_key(_ctx, keymat, key_len / 4);
+    memcpy(_ctx.salt, keymat + key_len, salt_size);
+
+    uint8_t zero[16], h[16];
+    memset(zero, 0, sizeof(zero));
+    aes_encrypt_block(_ctx, zero, h);
+    _ctx.h[0] = load_be64(h);
+    _ctx.h[1] = load_be64(h + 8);
+
+    // H^1 .. H^16, stored highest power first with the bytes reversed
+    uint64_t p[2] = {_ctx.h[0], _ctx.h[1]};
+    for (int i = 15; i >= 0; --i) {
+	uint8_t be[16];
+	store_be64(be, p[0]);
+	store_be64(be + 8, p[1]);
+	for (int j = 0; j < 16; ++j)
+	    _ctx.hpow[i][j] = be[15 - j];
+	gf_mul(p, _ctx.h);
+    }
+    return true;
+}
+
+bool
+AESGCM::supported(impl_t impl)
+{
+#if CLICK_AESGCM_X86
+    __builtin_cpu_init();
+    bool aesni = __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")
+	&& __builtin_cpu_supports("ssse3");
+    if (impl == impl_aesni)
+	return aesni;
+    if (impl == impl_vaes)
+	return aesni && __builtin_cpu_supports("vaes")
+	    && __builtin_cpu_supports("vpclmulqdq")
+	    && __builtin_cpu_supports("avx512f")
+	    && __builtin_cpu_supports("avx512bw");
+#endif
+    return impl == impl_generic;
+}
+
+AESGCM::impl_t
+AESGCM::implementation()
+{
+    if (selected < 0) {
+	if (supported(impl_vaes))
+	    selected = impl_vaes;
+	else if (supported(impl_aesni))
+	    selected = impl_aesni;
+	else
+	    selected = impl_generic;
+    }
+    return (impl_t) selected;
+}
+
+bool
+AESGCM::set_implementation(impl_t impl)
+{
+    if (!supported(impl))
+	return false;
+    selected = impl;
+    return true;
+}
+
+const char *
+AESGCM::implementation_name(impl_t impl)
+{
+    switch (impl) {
+    case impl_vaes:
+	return "vaes";
+    case impl_aesni:
+	return "aesni";
+    default:
+	return "generic";
+    }
+}
+
+void
+AESGCM::crypt(bool encrypt, const uint8_t *iv, const uint8_t *aad,
+	      int aad_len, uint8_t *data, int len, uint8_t *tag) const
+{
+    switch (implementation()) {
+#if CLICK_AESGCM_X86
+    case impl_vaes:
+	crypt_vaes(_ctx, encrypt, iv, aad, aad_len, data, len, tag);
+	break;
+    case impl_aesni:
+	crypt_aesni(_ctx, encrypt, iv, aad, aad_len, data, len, tag);
+	break;
+#endif
+    default:
+	crypt_generic(_ctx, encrypt, iv, aad, aad_len, data, len, tag);
+	break;
+    }
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(AESGCM)
@@ -0,0 +1,112 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_AESGCM_HH
+#define CLICK_AESGCM_HH
+#include <click/glue.hh>
+CLICK_DECLS
+
+/**
+ * AES-GCM authenticated encryption, as used by ESP (RFC 4106)
+ *
+ * The keying material is an AES-128 or AES-256 key followed by a 4-byte
+ * salt, so set_key() takes 20 or 36 bytes. Every packet carries an 8-byte
+ * explicit IV; the nonce is salt || IV, and the integrity check value (ICV)
+ * is 16 bytes.
+ *
+ * seal() and open() use the fastest implementation the CPU supports, chosen
+ * once at run time:
+ *
+ *  - VAES and VPCLMULQDQ on AVX-512 registers, sixteen blocks per iteration;
+ *  - AES-NI and PCLMULQDQ, eight blocks per iteration;
+ *  - portable C, everywhere else.
+ *
+ * The SIMD paths reduce GHASH once per iteration rather than once per block,
+ * multiplying each block by the matching precomputed power of H.
+ *
+ * The class has no constructor so that it can live inside structures that are
+ * cleared with memset; a zeroed AESGCM is not ready().
+ */
+class AESGCM { public:
+
+    enum {
+	block_size = 16,
+	salt_size = 4,
+	iv_size = 8,
+	icv_size = 16,
+	max_keymat_size = 32 + salt_size
+    };
+
+    enum impl_t { impl_generic = 0, impl_aesni, impl_vaes };
+
+    /** @brief Set the keying material: key || salt, 20 or 36 bytes.
+     * @return true on success */
+    bool set_key(const uint8_t *keymat, int len);
+
+    bool ready() const {
+	return _ctx.rounds != 0;
+    }
+    int key_bits() const {
+	return _ctx.rounds == 14 ? 256 : 128;
+    }
+
+    /** @brief Encrypt @a len bytes at @a data in place.
+     * @param iv 8-byte explicit IV
+     * @param aad additional authenticated data (the ESP SPI and sequence)
+     * @param icv receives the 16-byte ICV */
+    void seal(const uint8_t *iv, const uint8_t *aad, int aad_len,
+	      uint8_t *data, int len, uint8_t *icv) const;
+
+    /** @brief Decrypt @a len bytes at @a data in place.
+     * @return true if @a icv authenticates @a aad and the ciphertext
+     *
+     * The data is decrypted even when authentication fails. */
+    bool open(const uint8_t *iv, const uint8_t *aad, int aad_len,
+	      uint8_t *data, int len, const uint8_t *icv) const;
+
+    /** @brief Return the implementation used by seal() and open(). */
+    static impl_t implementation();
+    /** @brief Force implementation @a impl, for tests and benchmarks.
+     * @return false if the CPU does not support it */
+    static bool set_implementation(impl_t impl);
+    static bool supported(impl_t impl);
+    static const char *implementation_name(impl_t impl);
+
+    struct ctx_t {
+	uint8_t rk[15][16];	// round keys, in FIPS-197 byte order
+	int rounds;
+	uint8_t salt[salt_size];
+	uint64_t h[2];		// H = E(K, 0), big-endian halves
+	uint8_t hpow[16][16];	// H^(16-i), byte-reflected, for SIMD GHASH
+    };
+
+  private:
+
+    ctx_t _ctx;
+
+    static int selected;
+
+    void crypt(bool encrypt, const uint8_t *iv, const uint8_t *aad,
+	       int aad_len, uint8_t *data, int len, uint8_t *tag) const;
+
+};
+
+inline void
+AESGCM::seal(const uint8_t *iv, const uint8_t *aad, int aad_len,
+	     uint8_t *data, int len, uint8_t *icv) const
+{
+    crypt(true, iv, aad, aad_len, data, len, icv);
+}
+
+inline bool
+AESGCM::open(const uint8_t *iv, const uint8_t *aad, int aad_len,
+	     uint8_t *data, int len, const uint8_t *icv) const
+{
+    uint8_t tag[icv_size];
+    crypt(false, iv, aad, aad_len, data, len, tag);
+    uint8_t diff = 0;
+    for (int i = 0; i < icv_size; ++i)
+	diff |= tag[i] ^ icv[i];
+    return diff == 0;
+}
+
+CLICK_ENDDECLS
+#endif
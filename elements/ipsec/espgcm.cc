@@ -0,0 +1,284 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * espgcm.{cc,hh} -- ESP encapsulation and decapsulation with AES-GCM
+ * (RFC 4106)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#ifndef HAVE_IPSEC
+# error "Must #define HAVE_IPSEC in config.h"
+#endif
+#include "espgcm.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include <clicknet/ip.h>
+#include "esp.hh"
+CLICK_DECLS
+
+static inline SADataTuple *
+sa_data_anno(const Packet *p)
+{
+    return (SADataTuple *) (uintptr_t) IPSEC_SA_DATA_REFERENCE_ANNO(p);
+}
+
+//
+// IPsecESPGCMEncap
+//
+
+IPsecESPGCMEncap::IPsecESPGCMEncap()
+{
+    _drops = 0;
+}
+
+int
+IPsecESPGCMEncap::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    return Args(conf, this, errh).complete();
+}
+
+Packet *
+IPsecESPGCMEncap::encap(Packet *p, SADataTuple *sa, uint64_t seq)
+{
+    if (!sa || !sa->gcm.ready()) {
+	++_drops;
+	p->kill();
+	return 0;
+    }
+
+    // pad so that the pad length and next header fields end on a 4-byte
+    // boundary
+    int plen = p->length();
+    int padding = (4 - (plen + 2) % 4) % 4;
+    int len = plen + padding + 2;
+
+    WritablePacket *q = p->push(sizeof(esp_new));
+    if (q)
+	q = q->put(padding + 2 + AESGCM::icv_size);
+    if (!q) {
+	++_drops;
+	return 0;
+    }
+
+    esp_new *esp = reinterpret_cast<esp_new *>(q->data());
+    esp->esp_spi = htonl((uint32_t) IPSEC_SPI_ANNO(q));
+    esp->esp_rpl = htonl((uint32_t) seq);
+    for (int i = 0; i < AESGCM::iv_size; i++)
+	esp->esp_iv[i] = seq >> (56 - 8 * i);
+
+    uint8_t *payload = q->data() + sizeof(esp_new);
+    uint8_t *trailer = payload + plen;
+    for (int i = 0; i < padding; i++)
+	trailer[i] = i + 1;
+    trailer[padding] = padding;
+    trailer[padding + 1] = IP_PROTO_IPIP;
+
+    // the SPI and sequence number are the additional authenticated data
+    sa->gcm.seal(esp->esp_iv, q->data(), 8, payload, len, payload + len);
+    return q;
+}
+
+Packet *
+IPsecESPGCMEncap::simple_action(Packet *p)
+{
+    SADataTuple *sa = sa_data_anno(p);
+    return encap(p, sa, sa ? sa->gcm_seq.fetch_and_add(1) : 0);
+}
+
+#if HAVE_BATCH
+PacketBatch *
+IPsecESPGCMEncap::simple_action_batch(PacketBatch *batch)
+{
+    SADataTuple *run_sa = 0;
+    uint64_t seq = 0, end = 0;
+    auto fnt = [this, &run_sa, &seq, &end](Packet *p) -> Packet * {
+	SADataTuple *sa = sa_data_anno(p);
+	if (sa && (sa != run_sa || seq == end)) {
+	    // reserve the counters of the whole run of packets of this SA
+	    uint64_t n = 1;
+	    for (Packet *q = p->next(); q && sa_data_anno(q) == sa; q = q->next())
+		n++;
+	    run_sa = sa;
+	    seq = sa->gcm_seq.fetch_and_add(n);
+	    end = seq + n;
+	}
+	return encap(p, sa, seq++);
+    };
+    EXECUTE_FOR_EACH_PACKET_DROPPABLE(fnt, batch, [](Packet *) {});
+    return batch;
+}
+#endif
+
+String
+IPsecESPGCMEncap::read_handler(Element *e, void *thunk)
+{
+    IPsecESPGCMEncap *ee = static_cast<IPsecESPGCMEncap *>(e);
+    if (thunk)
+	return String(ee->_drops.value());
+    return AESGCM::implementation_name(AESGCM::implementation());
+}
+
+void
+IPsecESPGCMEncap::add_handlers()
+{
+    add_read_handler("implementation", read_handler, 0);
+    add_read_handler("drops", read_handler, 1);
+}
+
+//
+// IPsecESPGCMDecap
+//
+
+IPsecESPGCMDecap::IPsecESPGCMDecap()
+{
+    _auth_failures = 0;
+    _replay_drops = 0;
+}
+
+int
+IPsecESPGCMDecap::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    return Args(conf, this, errh).complete();
+}
+
+static inline uint32_t
+replay_window(const SADataTuple *sa)
+{
+    // the bitmap holds 32 sequence numbers
+    return sa->ooowin == 0 ? 1 : (sa->ooowin < 32 ? sa->ooowin : 32);
+}
+
+static inline bool
+replay_check(const SADataTuple *sa, uint32_t seq)
+{
+    if (seq > sa->lastseq)
+	return true;
+    uint32_t diff = sa->lastseq - seq;
+    return diff < replay_window(sa) && !(sa->bitmap & (1U << diff));
+}
+
+static inline void
+replay_update(SADataTuple *sa, uint32_t seq)
+{
+    if (seq > sa->lastseq) {
+	uint32_t diff = seq - sa->lastseq;
+	sa->bitmap = diff < replay_window(sa) ? (sa->bitmap << diff) | 1 : 1;
+	sa->lastseq = seq;
+    } else
+	sa->bitmap |= 1U << (sa->lastseq - seq);
+}
+
+void
+IPsecESPGCMDecap::reject(Packet *p, bool batch)
+{
+#if HAVE_BATCH
+    if (batch) {
+	checked_output_push_batch(1, PacketBatch::make_from_packet(p));
+	return;
+    }
+#else
+    (void) batch;
+#endif
+    checked_output_push(1, p);
+}
+
+Packet *
+IPsecESPGCMDecap::decap(Packet *p, bool batch)
+{
+    SADataTuple *sa = sa_data_anno(p);
+    int len = (int) p->length() - (int) sizeof(esp_new) - AESGCM::icv_size;
+    if (!sa || !sa->gcm.ready() || len < 2) {
+	++_auth_failures;
+	reject(p, batch);
+	return 0;
+    }
+
+    uint32_t seq = ntohl(reinterpret_cast<const esp_new *>(p->data())->esp_rpl);
+    if (!replay_check(sa, seq)) {
+	++_replay_drops;
+	reject(p, batch);
+	return 0;
+    }
+
+    WritablePacket *q = p->uniqueify();
+    if (!q)
+	return 0;
+    esp_new *esp = reinterpret_cast<esp_new *>(q->data());
+    uint8_t *payload = q->data() + sizeof(esp_new);
+    int padding = 0;
+    bool ok = sa->gcm.open(esp->esp_iv, q->data(), 8, payload, len,
+			   payload + len);
+    if (ok) {
+	// default padding specified by RFC 4303: 1, 2, 3, ...
+	padding = payload[len - 2];
+	ok = padding + 2 <= len;
+	for (int i = 0; ok && i < padding; i++)
+	    ok = payload[len - 2 - padding + i] == i + 1;
+    }
+    if (!ok) {
+	++_auth_failures;
+	reject(q, batch);
+	return 0;
+    }
+
+    replay_update(sa, seq);
+    q->pull(sizeof(esp_new));
+    q->take(padding + 2 + AESGCM::icv_size);
+    return q;
+}
+
+void
+IPsecESPGCMDecap::push(int, Packet *p)
+{
+    if (Packet *q = decap(p, false))
+	output(0).push(q);
+}
+
+#if HAVE_BATCH
+void
+IPsecESPGCMDecap::push_batch(int, PacketBatch *batch)
+{
+    auto fnt = [this](Packet *p) { return decap(p, true); };
+    EXECUTE_FOR_EACH_PACKET_DROPPABLE(fnt, batch, [](Packet *) {});
+    if (batch)
+	output(0).push_batch(batch);
+}
+#endif
+
+String
+IPsecESPGCMDecap::read_handler(Element *e, void *thunk)
+{
+    IPsecESPGCMDecap *de = static_cast<IPsecESPGCMDecap *>(e);
+    switch ((intptr_t) thunk) {
+    case 1:
+	return String(de->_auth_failures.value());
+    case 2:
+	return String(de->_replay_drops.value());
+    default:
+	return AESGCM::implementation_name(AESGCM::implementation());
+    }
+}
+
+void
+IPsecESPGCMDecap::add_handlers()
+{
+    add_read_handler("implementation", read_handler, 0);
+    add_read_handler("auth_failures", read_handler, 1);
+    add_read_handler("replay_drops", read_handler, 2);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(AESGCM)
+EXPORT_ELEMENT(IPsecESPGCMEncap)
+EXPORT_ELEMENT(IPsecESPGCMDecap)
+ELEMENT_MT_SAFE(IPsecESPGCMEncap)
@@ -0,0 +1,142 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_IPSECESPGCM_HH
+#define CLICK_IPSECESPGCM_HH
+#include <click/batchelement.hh>
+#include <click/atomic.hh>
+#include "sadatatuple.hh"
+CLICK_DECLS
+
+/*
+=c
+
+IPsecESPGCMEncap()
+
+=s ipsec
+
+encapsulates and encrypts packets with ESP and AES-GCM
+
+=d
+
+Encapsulates each IP packet in an ESP tunnel-mode payload protected with
+AES-GCM (RFC 4106), in a single pass. The security association is taken from
+the annotations set by IPsecRouteTable on its output 1: the SPI from the SPI
+annotation, and the key from the SA data reference annotation. The SA must
+have a 20 or 36-byte encryption key, an AES-128 or AES-256 key followed by the
+4-byte salt.
+
+The output starts with the ESP header (SPI, sequence number and 8-byte
+explicit IV), followed by the encrypted packet, padding to a multiple of four
+bytes, the pad length and next header (4, IP-in-IP) fields, and the 16-byte
+ICV. The sequence number and the IV come from a per-SA 64-bit counter that
+starts at the SA's replay counter; when a batch holds several packets of the
+same SA, their counters are reserved at once.
+
+Packets without a usable SA are dropped.
+
+Encryption uses VAES on AVX-512 registers, AES-NI, or portable C, whichever
+is the fastest the CPU supports.
+
+Follow IPsecESPGCMEncap with IPsecEncap(50) to add the outer IP header.
+
+=h implementation read-only
+
+Returns the AES-GCM implementation in use: "vaes", "aesni" or "generic".
+
+=h drops read-only
+
+Returns the number of packets dropped.
+
+=a IPsecESPGCMDecap, IPsecRouteTable, RadixIPsecLookup, IPsecEncap */
+
+class IPsecESPGCMEncap : public BatchElement { public:
+
+    IPsecESPGCMEncap() CLICK_COLD;
+
+    const char *class_name() const	{ return "IPsecESPGCMEncap"; }
+    const char *port_count() const	{ return PORTS_1_1; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    Packet *simple_action(Packet *);
+#if HAVE_BATCH
+    PacketBatch *simple_action_batch(PacketBatch *);
+#endif
+
+  private:
+
+    atomic_uint32_t _drops;
+
+    Packet *encap(Packet *p, SADataTuple *sa, uint64_t seq);
+    static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+/*
+=c
+
+IPsecESPGCMDecap()
+
+=s ipsec
+
+authenticates, decrypts and removes ESP with AES-GCM
+
+=d
+
+Verifies and decrypts ESP payloads produced by IPsecESPGCMEncap, and emits
+the inner IP packet. Input packets start with the ESP header; the SA is taken
+from the SA data reference annotation set by IPsecRouteTable on its output 0.
+
+A packet is rejected if it is too short, if its sequence number falls outside
+the SA's replay window or was already seen, if its ICV does not verify, or if
+its padding is malformed. The replay window only moves forward for packets
+that authenticate. Rejected packets are emitted on output 1 if it exists, and
+dropped otherwise.
+
+Decryption itself is thread-safe, but the replay window is not: the packets
+of an SA should be decapsulated by a single thread, as RSS does for an ESP
+flow.
+
+=h implementation read-only
+
+Returns the AES-GCM implementation in use.
+
+=h auth_failures read-only
+
+Returns the number of packets whose ICV or padding did not verify.
+
+=h replay_drops read-only
+
+Returns the number of packets rejected by replay protection.
+
+=a IPsecESPGCMEncap, IPsecRouteTable, RadixIPsecLookup, StripIPHeader */
+
+class IPsecESPGCMDecap : public BatchElement { public:
+
+    IPsecESPGCMDecap() CLICK_COLD;
+
+    const char *class_name() const	{ return "IPsecESPGCMDecap"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+#if HAVE_BATCH
+    void push_batch(int, PacketBatch *);
+#endif
+
+  private:
+
+    atomic_uint32_t _auth_failures;
+    atomic_uint32_t _replay_drops;
+
+    Packet *decap(Packet *p, bool batch);
+    void reject(Packet *p, bool batch);
+    static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
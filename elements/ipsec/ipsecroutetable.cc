@@ -39,6 +39,27 @@
 
 CLICK_DECLS
 
+// Keys are raw bytes, or hexadecimal digits after a "0x" prefix.
+static bool
+cp_ipsec_key(const String &s, String &key)
+{
+    if (s.length() < 2 || s[0] != '0' || (s[1] != 'x' && s[1] != 'X')) {
+	key = s;
+	return true;
+    }
+    if (s.length() == 2 || s.length() % 2 != 0)
+	return false;
+    StringAccum sa;
+    for (int i = 2; i < s.length(); i += 2) {
+	if (!isxdigit((unsigned char) s[i]) || !isxdigit((unsigned char) s[i + 1]))
+	    return false;
+	char buf[3] = {s[i], s[i + 1], 0};
+	sa << (char) strtol(buf, 0, 16);
+    }
+    key = sa.take_string();
+    return true;
+}
+
 //changed to support IPsec extensions
 bool
 cp_ipsec_route(String s, IPsecRoute *r_store, bool remove_route, Element *context)
@@ -89,13 +110,22 @@ cp_ipsec_route(String s, IPsecRoute *r_store, bool remove_route, Element *contex
 	.read_mp("OOSIZE", oowin)
 	.complete() < 0)
 	return false;
-    if (enc_key.length() != 16 || auth_key.length() != 16) {
+    if (!cp_ipsec_key(enc_key, enc_key) || !cp_ipsec_key(auth_key, auth_key)) {
+	click_chatter("key has bad hexadecimal digits");
+	return false;
+    }
+    // 16 bytes for AES-CBC, 20 or 36 for AES-GCM key || salt
+    if ((enc_key.length() != KEY_SIZE
+	 && enc_key.length() != 16 + AESGCM::salt_size
+	 && enc_key.length() != 32 + AESGCM::salt_size)
+	|| auth_key.length() != KEY_SIZE) {
 	click_chatter("key has bad length");
 	return false;
     }
 
     // Create new Security Association Table entry
-    sa_data = new SADataTuple(enc_key.data(), auth_key.data(), replay, oowin);
+    sa_data = new SADataTuple(enc_key.data(), auth_key.data(), replay, oowin,
+			      enc_key.length());
     ((IPsecRouteTable*)context)->_sa_table.insert(SPI(r.spi),*sa_data);
     //Set Tuple reference in the Routing entry
     r.sa_data = sa_data;
@@ -190,10 +220,9 @@ IPsecRouteTable::dump_routes()
     return String();
 }
 
-void
-IPsecRouteTable::push(int, Packet *p)
+int
+IPsecRouteTable::process(int, Packet *p)
 {
-
     IPAddress gw;
     uint32_t spi;
     SADataTuple * sa_data;
@@ -221,6 +250,7 @@ IPsecRouteTable::push(int, Packet *p)
 	      /*This not an IPSEC packet and it should be delivered to the host's linux network stack
                 In a typical setup one would send anything that is directed to port 2 to Linux */
                 port = 2;
+                break;
             }
             // This is an ipsec packet and belongs to a tunneled connection
 	    // so we set the proper annotation with reference to Security Data Table to be used by IPsec modules
@@ -229,9 +259,8 @@ IPsecRouteTable::push(int, Packet *p)
             sa_data = _sa_table.lookup(SPI(ntohl(esp->esp_spi)));
 	    if(sa_data == NULL) {
 		click_chatter("Invalid SPI %d, Dropping packet",ntohl(esp->esp_spi));
-	p->kill();
-                return;
-           }
+		return -1;
+	    }
 	   SET_IPSEC_SA_DATA_REFERENCE_ANNO(p, (uintptr_t)sa_data);
 	   break;
 	 }
@@ -239,14 +268,35 @@ IPsecRouteTable::push(int, Packet *p)
 	assert(port < noutputs());
 	if (gw)
 	    p->set_dst_ip_anno(gw);
-	output(port).push(p);
+	return port;
     } else {
 	static int complained = 0;
 	if (++complained <= 5)
 	    click_chatter("IPsecRouteTable: no route for %s", p->dst_ip_anno().unparse().c_str());
+	return -1;
+    }
+}
+
+void
+IPsecRouteTable::push(int port, Packet *p)
+{
+    int output_port = process(port, p);
+    if (output_port < 0) {
 	p->kill();
+	return;
     }
+    output(output_port).push(p);
+}
+
+#if HAVE_BATCH
+void
+IPsecRouteTable::push_batch(int port, PacketBatch *batch)
+{
+    // Dropped packets fall off the last batch and are killed.
+    auto fnt = [this, port](Packet *p) { return process(port, p); };
+    CLASSIFY_EACH_PACKET(noutputs() + 1, fnt, batch, checked_output_push_batch);
 }
+#endif
 
 
 int
@@ -387,4 +437,5 @@ IPsecRouteTable::add_handlers()
 }
 
 CLICK_ENDDECLS
+ELEMENT_REQUIRES(AESGCM)
 ELEMENT_PROVIDES(IPsecRouteTable)
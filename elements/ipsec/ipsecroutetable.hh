@@ -2,7 +2,7 @@
 #ifndef CLICK_IPSECROUTETABLE_HH
 #define CLICK_IPSECROUTETABLE_HH
 #include <click/glue.hh>
-#include <click/element.hh>
+#include <click/batchelement.hh>
 #include "satable.hh"
 #include "sadatatuple.hh"
 CLICK_DECLS
@@ -134,6 +134,11 @@ The default implementation of B<push> uses B<lookup_route> to perform IP
 routing lookup. Normally, subclasses implement their own B<push> methods,
 avoiding virtual function call overhead.
 
+=item C<void B<push_batch>(int port, PacketBatch *batch)>
+
+Does the same lookup for each packet of the batch, and pushes one batch per
+output port.
+
 =item C<static int B<add_route_handler>(const String &, Element *, void *, ErrorHandler *)>
 
 This write handler callback parses its input as an add-route request
@@ -166,6 +171,12 @@ tunneled traffic accordingly. All the routing table entries that refer to an IPS
 |SPI| |128-BIT ENCRYPTION_KEY| |128-BIT AUTHENTICATION_KEY| |REPLAY PROTECTION COUNTER| |OUT-OF-ORDER REPLAY WINDOW|
 The encryption and authentication keys will generally be specified using
 syntax such as C<\E<lt>0183 A947 1ABE 01FF FA04 103B B102<gt>>.
+They may also be written as hexadecimal digits after a C<0x> prefix, such as
+C<0xABCDEFFF001DEFD2354550FE40CD708E>; a key without the prefix is taken as
+raw bytes. An SA used by IPsecESPGCMEncap and
+IPsecESPGCMDecap takes an AES-GCM encryption key of 20 or 36 bytes: a 128 or
+256-bit key followed by the 4-byte salt (RFC 4106). Its authentication key is
+unused.
  This module uses 4 and 5 annotation space integers to pass Security Association Data between IPsec modules.
 
 =a RadixIPLookup, RangeIPsecLookup */
@@ -199,7 +210,7 @@ struct IPsecRoute {
 };
 
 
-class IPsecRouteTable : public Element { public:
+class IPsecRouteTable : public BatchElement { public:
 
     void* cast(const char*);
     int configure(Vector<String>&, ErrorHandler*) CLICK_COLD;
@@ -211,6 +222,9 @@ class IPsecRouteTable : public Element { public:
     virtual String dump_routes();
 
     void push(int port, Packet* p);
+#if HAVE_BATCH
+    void push_batch(int port, PacketBatch* batch);
+#endif
 
     static int add_route_handler(const String&, Element*, void*, ErrorHandler*);
     static int remove_route_handler(const String&, Element*, void*, ErrorHandler*);
@@ -224,6 +238,10 @@ class IPsecRouteTable : public Element { public:
     enum { CMD_ADD, CMD_SET, CMD_REMOVE };
     int run_command(int command, const String &, Vector<IPsecRoute>* old_routes, ErrorHandler*);
 
+    // Lookup shared by push and push_batch; returns the output port, or -1
+    // if the packet must be dropped.
+    int process(int port, Packet *p);
+
 };
 
 inline StringAccum&
@@ -5,6 +5,9 @@
 #include <click/etheraddress.hh>
 #include <click/bighashmap.hh>
 #include <click/glue.hh>
+#include <click/atomic.hh>
+#include <click/straccum.hh>
+#include "aesgcm.hh"
 CLICK_DECLS
 
 /*
@@ -27,6 +30,8 @@ CLICK_DECLS
  */
 
 #define KEY_SIZE 16
+/* AES-GCM keying material: up to a 256-bit key and the 4-byte salt */
+#define MAX_ENC_KEY_SIZE AESGCM::max_keymat_size
 
 /* Security Parameter Index (SPI) Class*/
 
@@ -72,7 +77,8 @@ class SADataTuple {
   public:
 
     //SA Data must be added here...
-    uint8_t Encryption_key[KEY_SIZE]; // The Data key
+    uint8_t Encryption_key[MAX_ENC_KEY_SIZE]; // The Data key
+    uint8_t Encryption_key_len;
     uint8_t Authentication_key[KEY_SIZE];//The Authentication key
     /*These fields below deal with replay protection*/
     uint32_t replay_start_counter;
@@ -80,15 +86,24 @@ class SADataTuple {
     uint8_t  ooowin;	/* out-of-order window size */
     uint32_t bitmap;	/* Support out-of-order receive support */
     uint32_t lastseq;	/* in host order */
+    /*AES-GCM SAs: key schedule, and the counter giving both the ESP
+      sequence number and the explicit IV, which must never repeat*/
+    AESGCM gcm;
+    atomic_uint64_t gcm_seq;
 
     SADataTuple() {
 	memset(this, 0, sizeof(*this));
     }
 
-    SADataTuple(const void * enc_key , const void * Auth_key, uint32_t counter, uint8_t o_oowin)
+    SADataTuple(const void * enc_key , const void * Auth_key, uint32_t counter, uint8_t o_oowin, int enc_key_len = KEY_SIZE)
      {
 		memset(this, 0, sizeof(*this));
-		memcpy(Encryption_key, enc_key, KEY_SIZE);
+		memcpy(Encryption_key, enc_key, enc_key_len);
+		Encryption_key_len = enc_key_len;
+		/*20 and 36-byte keys are AES-GCM key || salt (RFC 4106)*/
+		if (enc_key_len != KEY_SIZE)
+			gcm.set_key(Encryption_key, enc_key_len);
+		gcm_seq = counter;
 		memcpy(Authentication_key, Auth_key, KEY_SIZE);
 		replay_start_counter = counter;
 		ooowin = o_oowin;
@@ -103,18 +118,15 @@ class SADataTuple {
 
 String unparse_entries() const
      {
-         char buf[71];
-	 int i,j;
-	 sprintf(buf," |");
-	 for(i=0,j=0;i<16;i++,j+=2) {
-		sprintf(&buf[2+j],"%02x",Encryption_key[i]);
-	 }
-	 sprintf(&buf[34],"| |");
-	 for(i=0,j=0;i<16;i++,j+=2) {
-		sprintf(&buf[37+j],"%02x",Authentication_key[i]);
-	 }
-	 sprintf(&buf[69],"|");
-         return String(buf, 70);
+	 StringAccum sa;
+	 sa << " |";
+	 for (int i = 0; i < Encryption_key_len; i++)
+		sa.snprintf(3, "%02x", Encryption_key[i]);
+	 sa << "| |";
+	 for (int i = 0; i < KEY_SIZE; i++)
+		sa.snprintf(3, "%02x", Authentication_key[i]);
+	 sa << "|";
+	 return sa.take_string();
     }
 };
 
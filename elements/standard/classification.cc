@@ -23,6 +23,13 @@
 #include <click/error.hh>
 #include <click/straccum.hh>
 #include <click/standard/alignmentinfo.hh>
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+# include <immintrin.h>
+#endif
 CLICK_DECLS
 namespace Classification {
 namespace Wordwise {
@@ -1030,6 +1037,7 @@ CompressedProgram::compile(const Program &prog, bool perform_binary_search,
     // It often helps to do another bubblesort for things like ports.
 
     _zprog.clear();
+    _min_binary_search = perform_binary_search ? min_binary_search : (unsigned) -1;
     _output_everything = prog.output_everything();
     _safe_length = prog.safe_length();
     _align_offset = prog.align_offset();
@@ -1176,6 +1184,569 @@ Program::length_checked_match(const Packet *p)
     return -pos;
 }
 
+
+//
+// BATCH MATCHING
+//
+
+namespace {
+
+// The (state, members) pairs of a batch in flight.  Member sets are
+// disjoint, so there are never more than batch_width entries.
+class BatchWorklist { public:
+
+    BatchWorklist()
+	: _n(0) {
+    }
+
+    bool empty() const {
+	return _n == 0;
+    }
+
+    void add(int state, uint32_t members) {
+	if (!members)
+	    return;
+	for (int i = 0; i < _n; ++i)
+	    if (_state[i] == state) {
+		_members[i] |= members;
+		return;
+	    }
+	_state[_n] = state;
+	_members[_n] = members;
+	++_n;
+    }
+
+    // Remove and return the lowest state, so that every state is evaluated
+    // once with all the packets that can reach it.
+    int pop(uint32_t &members) {
+	int k = 0;
+	for (int i = 1; i < _n; ++i)
+	    if (_state[i] < _state[k])
+		k = i;
+	int state = _state[k];
+	members = _members[k];
+	--_n;
+	_state[k] = _state[_n];
+	_members[k] = _members[_n];
+	return state;
+    }
+
+  private:
+
+    int _state[batch_width];
+    uint32_t _members[batch_width];
+    int _n;
+
+};
+
+inline void
+set_batch_outputs(int *outputs, uint32_t members, int output)
+{
+    for (; members; members &= members - 1)
+	outputs[ffs_lsb(members) - 1] = output;
+}
+
+inline bool
+match_word_values(uint32_t data, const uint32_t *values, int nvalues,
+		  bool sorted)
+{
+    if (!sorted) {
+	for (int i = 0; i < nvalues; ++i)
+	    if (values[i] == data)
+		return true;
+	return false;
+    }
+    const uint32_t *l = values, *r = values + nvalues;
+    while (l < r) {
+	const uint32_t *m = l + (r - l) / 2;
+	if (*m == data)
+	    return true;
+	else if (*m < data)
+	    l = m + 1;
+	else
+	    r = m;
+    }
+    return false;
+}
+
+}
+
+uint32_t
+match_word_batch(const unsigned char * const *data, uint32_t members,
+		 int offset, uint32_t mask,
+		 const uint32_t *values, int nvalues, bool sorted)
+{
+    uint32_t yes = 0;
+#if defined(__AVX2__) || defined(__AVX512F__)
+    // Long value lists are binary searched; vector compares only pay off
+    // for a handful of values.
+    if (nvalues <= 4) {
+# if defined(__AVX512F__)
+	enum { lanes = 8 };
+# else
+	enum { lanes = 4 };
+# endif
+	int idx[batch_width];
+	int n = 0;
+	for (uint32_t m = members; m; m &= m - 1)
+	    idx[n++] = ffs_lsb(m) - 1;
+	for (int i = 0; i < n; i += lanes) {
+	    long long addr[lanes];
+	    for (int j = 0; j < lanes; ++j)
+		addr[j] = (long long) (data[idx[i + j < n ? i + j : i]] + offset);
+# if defined(__AVX512F__)
+	    __m256i w = _mm512_i64gather_epi32(_mm512_loadu_si512(addr), 0, 1);
+	    w = _mm256_and_si256(w, _mm256_set1_epi32(mask));
+	    __m256i eq = _mm256_setzero_si256();
+	    for (int v = 0; v < nvalues; ++v)
+		eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(w, _mm256_set1_epi32(values[v])));
+	    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+# else
+	    __m128i w = _mm256_i64gather_epi32((const int *) 0, _mm256_loadu_si256((const __m256i *) addr), 1);
+	    w = _mm_and_si128(w, _mm_set1_epi32(mask));
+	    __m128i eq = _mm_setzero_si128();
+	    for (int v = 0; v < nvalues; ++v)
+		eq = _mm_or_si128(eq, _mm_cmpeq_epi32(w, _mm_set1_epi32(values[v])));
+	    int bits = _mm_movemask_ps(_mm_castsi128_ps(eq));
+# endif
+	    for (int j = 0; j < lanes && i + j < n; ++j)
+		if (bits & (1 << j))
+		    yes |= 1U << idx[i + j];
+	}
+	return yes;
+    }
+#endif
+    for (uint32_t m = members; m; m &= m - 1) {
+	int i = ffs_lsb(m) - 1;
+	uint32_t word = *(const uint32_t *) (data[i] + offset) & mask;
+	if (match_word_values(word, values, nvalues, sorted))
+	    yes |= 1U << i;
+    }
+    return yes;
+}
+
+void
+Program::match_batch(Packet * const *p, int n, int *outputs)
+{
+    if (_output_everything >= 0) {
+	for (int i = 0; i < n; ++i)
+	    outputs[i] = _output_everything;
+	return;
+    }
+
+    const unsigned char *data[batch_width];
+    uint32_t members = 0;
+    for (int i = 0; i < n; ++i)
+	if (p[i]->length() < _safe_length)
+	    outputs[i] = length_checked_match(p[i]);
+	else {
+	    data[i] = p[i]->data() - _align_offset;
+	    members |= 1U << i;
+	}
+
+    BatchWorklist work;
+    work.add(0, members);
+    while (!work.empty()) {
+	int state = work.pop(members);
+	const Insn &in = _insn[state];
+	uint32_t yes = match_word_batch(data, members, in.offset, in.mask.u,
+					&in.value.u, 1, false);
+	for (int k = 0; k < 2; ++k) {
+	    uint32_t m = k ? yes : members & ~yes;
+	    if (in.j[k] > 0)
+		work.add(in.j[k], m);
+	    else
+		set_batch_outputs(outputs, m, -in.j[k]);
+	}
+    }
+}
+
+void
+CompressedProgram::match_batch(const unsigned char * const *base[3],
+			       int base1_offset, int base2_offset,
+			       uint32_t members, int *outputs) const
+{
+    if (_output_everything >= 0) {
+	set_batch_outputs(outputs, members, _output_everything);
+	return;
+    }
+
+    BatchWorklist work;
+    work.add(0, members);
+    while (!work.empty()) {
+	int state = work.pop(members);
+	const uint32_t *pr = _zprog.begin() + state;
+	int off = (int16_t) pr[0], b = 0;
+	int nvalues = pr[0] >> 17;
+	if (off >= base2_offset)
+	    b = 2, off -= base2_offset;
+	else if (off >= base1_offset)
+	    b = 1, off -= base1_offset;
+	uint32_t yes = match_word_batch(base[b], members, off, pr[3], pr + 4,
+					nvalues, (unsigned) nvalues >= _min_binary_search);
+	for (int k = 0; k < 2; ++k) {
+	    uint32_t m = k ? yes : members & ~yes;
+	    int32_t j = pr[1 + k];
+	    if (j > 0)
+		work.add(state + j, m);
+	    else
+		set_batch_outputs(outputs, m, -j);
+	}
+    }
+}
+
+
+//
+// NATIVE COMPILATION
+//
+
+struct NativeProgram::Test {
+    int base;
+    int32_t disp;
+    uint32_t mask;
+    int32_t j[2];
+    Vector<uint32_t> values;
+};
+
+class NativeProgram::Assembler { public:
+
+    // x86-64 code emitter.  Labels 0..ntests-1 are the tests themselves;
+    // output labels are allocated on demand by target().
+    Assembler(int ntests)
+	: _label_pos(ntests, -1) {
+    }
+
+    enum {
+	cc_b = 0x2, cc_e = 0x4, cc_ne = 0x5
+    };
+    enum {
+	binary_search_min = 4
+    };
+
+    const Vector<unsigned char> &code() const {
+	return _code;
+    }
+
+    int new_label() {
+	_label_pos.push_back(-1);
+	return _label_pos.size() - 1;
+    }
+    void bind(int label) {
+	_label_pos[label] = _code.size();
+    }
+    int target(int32_t j);
+
+    // mov eax, dword [base + disp32]; base is rdi, rsi or rdx
+    void load(int base, int32_t disp) {
+	static const unsigned char modrm[3] = { 0x87, 0x86, 0x82 };
+	byte(0x8B);
+	byte(modrm[base]);
+	word(disp);
+    }
+    void and_eax(uint32_t x) {
+	byte(0x25);
+	word(x);
+    }
+    void cmp_eax(uint32_t x) {
+	byte(0x3D);
+	word(x);
+    }
+    void jcc(int cc, int label) {
+	byte(0x0F);
+	byte(0x80 | cc);
+	ref(label);
+    }
+    void jmp(int label) {
+	byte(0xE9);
+	ref(label);
+    }
+    void ret(int32_t x) {
+	byte(0xB8);
+	word(x);
+	byte(0xC3);
+    }
+
+    void match_values(const uint32_t *v, int n, bool sorted,
+		      int yes, int no, int next);
+    void emit_outputs();
+    bool link();
+
+  private:
+
+    Vector<unsigned char> _code;
+    Vector<int> _label_pos;
+    Vector<int> _ref_pos;
+    Vector<int> _ref_label;
+    Vector<int32_t> _output;
+    Vector<int> _output_label;
+
+    void byte(unsigned char c) {
+	_code.push_back(c);
+    }
+    void word(uint32_t x) {
+	for (int i = 0; i < 4; ++i, x >>= 8)
+	    _code.push_back(x & 0xFF);
+    }
+    void ref(int label) {
+	_ref_pos.push_back(_code.size());
+	_ref_label.push_back(label);
+	word(0);
+    }
+
+};
+
+int
+NativeProgram::Assembler::target(int32_t j)
+{
+    if (j > 0)
+	return j;
+    for (int i = 0; i < _output.size(); ++i)
+	if (_output[i] == -j)
+	    return _output_label[i];
+    _output.push_back(-j);
+    _output_label.push_back(new_label());
+    return _output_label.back();
+}
+
+void
+NativeProgram::Assembler::match_values(const uint32_t *v, int n, bool sorted,
+				       int yes, int no, int next)
+{
+    if (sorted && n >= binary_search_min) {
+	int mid = n / 2;
+	int lower = new_label();
+	cmp_eax(v[mid]);
+	jcc(cc_e, yes);
+	jcc(cc_b, lower);
+	match_values(v + mid + 1, n - mid - 1, true, yes, no, -1);
+	bind(lower);
+	match_values(v, mid, true, yes, no, next);
+	return;
+    }
+
+    for (int k = 0; k < n; ++k) {
+	cmp_eax(v[k]);
+	if (k == n - 1 && yes == next) {
+	    jcc(cc_ne, no);
+	    return;
+	}
+	jcc(cc_e, yes);
+    }
+    if (no != next)
+	jmp(no);
+}
+
+void
+NativeProgram::Assembler::emit_outputs()
+{
+    for (int i = 0; i < _output.size(); ++i) {
+	bind(_output_label[i]);
+	ret(_output[i]);
+    }
+}
+
+bool
+NativeProgram::Assembler::link()
+{
+    for (int i = 0; i < _ref_pos.size(); ++i) {
+	int dst = _label_pos[_ref_label[i]];
+	if (dst < 0)
+	    return false;
+	uint32_t rel = dst - (_ref_pos[i] + 4);
+	for (int k = 0; k < 4; ++k, rel >>= 8)
+	    _code[_ref_pos[i] + k] = rel & 0xFF;
+    }
+    return true;
+}
+
+NativeProgram::NativeProgram()
+    : _function(0), _code(0), _code_size(0), _code_alloc(0)
+{
+}
+
+NativeProgram::~NativeProgram()
+{
+    // ~epoch_rcu unmaps everything retired, including the current code.
+    _function = 0;
+    retire();
+}
+
+bool
+NativeProgram::supported()
+{
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    return true;
+#else
+    return false;
+#endif
+}
+
+int
+NativeProgram::compile(const Program &prog)
+{
+    Vector<Test> tests(prog.ninsn(), Test());
+    for (int i = 0; i < prog.ninsn(); ++i) {
+	const Insn &in = prog.insn(i);
+	Test &t = tests[i];
+	t.base = 0;
+	t.disp = in.offset;
+	t.mask = in.mask.u;
+	t.j[0] = in.no();
+	t.j[1] = in.yes();
+	t.values.push_back(in.value.u);
+    }
+    return compile(tests, prog.output_everything());
+}
+
+int
+NativeProgram::compile(const CompressedProgram &zprog,
+		       int base1_offset, int base2_offset)
+{
+    const uint32_t *zbegin = zprog.begin();
+    Vector<int> index(zprog.end() - zbegin, 0);
+    int ntests = 0;
+    for (const uint32_t *pr = zbegin; pr < zprog.end(); pr += 4 + (pr[0] >> 17))
+	index[pr - zbegin] = ntests++;
+
+    Vector<Test> tests(ntests, Test());
+    for (const uint32_t *pr = zbegin; pr < zprog.end(); pr += 4 + (pr[0] >> 17)) {
+	Test &t = tests[index[pr - zbegin]];
+	int off = (int16_t) pr[0];
+	if (off >= base2_offset)
+	    t.base = 2, t.disp = off - base2_offset;
+	else if (off >= base1_offset)
+	    t.base = 1, t.disp = off - base1_offset;
+	else
+	    t.base = 0, t.disp = off;
+	t.mask = pr[3];
+	for (int k = 0; k < 2; ++k) {
+	    t.j[k] = pr[1 + k];
+	    if (t.j[k] > 0)
+		t.j[k] = index[pr - zbegin + t.j[k]];
+	}
+	for (uint32_t v = 0; v < (pr[0] >> 17); ++v)
+	    t.values.push_back(pr[4 + v]);
+    }
+    return compile(tests, zprog.output_everything());
+}
+
+int
+NativeProgram::compile(const Vector<Test> &tests, int output_everything)
+{
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    Assembler a(tests.size());
+    if (output_everything >= 0 || tests.size() == 0)
+	a.ret(output_everything);
+    else
+	for (int i = 0; i < tests.size(); ++i) {
+	    const Test &t = tests[i];
+	    a.bind(i);
+	    a.load(t.base, t.disp);
+	    if (t.mask != 0xFFFFFFFFU)
+		a.and_eax(t.mask);
+	    bool sorted = true;
+	    for (int k = 1; k < t.values.size() && sorted; ++k)
+		sorted = t.values[k - 1] < t.values[k];
+	    int yes = a.target(t.j[1]), no = a.target(t.j[0]);
+	    a.match_values(t.values.begin(), t.values.size(), sorted,
+			   yes, no, i + 1 < tests.size() ? i + 1 : -1);
+	}
+    a.emit_outputs();
+    if (!a.link()) {
+	clear();
+	return -EINVAL;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t alloc = (a.code().size() + page - 1) & ~(page - 1);
+    void *mem = mmap(0, alloc, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+	clear();
+	return -ENOMEM;
+    }
+    memcpy(mem, a.code().begin(), a.code().size());
+    if (mprotect(mem, alloc, PROT_READ | PROT_EXEC) < 0) {
+	int r = -errno;
+	munmap(mem, alloc);
+	clear();
+	return r;
+    }
+    publish(mem, a.code().size(), alloc);
+    return 0;
+#else
+    (void) tests, (void) output_everything;
+    return -EOPNOTSUPP;
+#endif
+}
+
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+static void
+unmap_code(void *code, uintptr_t alloc)
+{
+    munmap(code, alloc);
+}
+#endif
+
+void
+NativeProgram::publish(void *code, size_t size, size_t alloc)
+{
+    retire();
+    _code = code;
+    _code_size = size;
+    _code_alloc = alloc;
+    __atomic_store_n(&_function, reinterpret_cast<match_function>(code),
+		     __ATOMIC_RELEASE);
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    _rcu.commit();
+#endif
+}
+
+void
+NativeProgram::clear()
+{
+    __atomic_store_n(&_function, (match_function) 0, __ATOMIC_RELEASE);
+    retire();
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    _rcu.commit();
+#endif
+}
+
+void
+NativeProgram::take(NativeProgram &x)
+{
+    void *code = x._code;
+    size_t size = x._code_size, alloc = x._code_alloc;
+    __atomic_store_n(&x._function, (match_function) 0, __ATOMIC_RELEASE);
+    x._code = 0;
+    x._code_size = x._code_alloc = 0;
+    if (code)
+	publish(code, size, alloc);
+    else
+	clear();
+}
+
+void
+NativeProgram::synchronize()
+{
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    _rcu.synchronize();
+#endif
+}
+
+// Hand the current code to the epoch_rcu; it is unmapped after the grace
+// period of the commit() that follows.
+void
+NativeProgram::retire()
+{
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    if (_code)
+	_rcu.defer(unmap_code, _code, _code_alloc);
+#endif
+    _code = 0;
+    _code_size = _code_alloc = 0;
+}
+
 }}
 CLICK_ENDDECLS
 ELEMENT_PROVIDES(Classification)
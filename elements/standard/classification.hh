@@ -1,8 +1,14 @@
 #ifndef CLICK_CLASSIFICATION_HH
 #define CLICK_CLASSIFICATION_HH 1
 #define CLICK_CLASSIFICATION_WORDWISE_DOMINATOR_FASTPRED 1
+#if CLICK_USERLEVEL && defined(__x86_64__)
+# define CLICK_CLASSIFICATION_WORDWISE_NATIVE 1
+#endif
 #include <click/packet.hh>
 #include <click/vector.hh>
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+# include <click/multithread.hh>
+#endif
 CLICK_DECLS
 class ErrorHandler;
 namespace Classification {
@@ -27,6 +33,26 @@ namespace Wordwise {
 
 class DominatorOptimizer;
 
+enum {
+    batch_width = 32	// maximum number of packets per match_batch() call
+};
+
+/** @brief Test one word of a group of packets.
+ * @param data packet data pointers, indexed by packet
+ * @param members bitmask of the packets in @a data to test
+ * @param offset offset of the tested word from each data pointer
+ * @param mask mask applied to the word before comparison
+ * @param values comparison values
+ * @param nvalues number of comparison values
+ * @param sorted true if @a values is sorted, allowing binary search
+ * @return the subset of @a members whose masked word equals any value
+ *
+ * Uses AVX-512 or AVX2 gathers when the compiler targets them, testing 8 or
+ * 4 packets per instruction; otherwise tests packets one at a time. */
+uint32_t match_word_batch(const unsigned char * const *data, uint32_t members,
+			  int offset, uint32_t mask,
+			  const uint32_t *values, int nvalues, bool sorted);
+
 
 struct Insn {
     uint16_t offset;
@@ -214,6 +240,14 @@ class Program { public:
     void warn_unused_outputs(int noutputs, ErrorHandler *errh) const;
 
     int match(const Packet *p);
+    /** @brief Classify @a n packets at once, storing their outputs in
+     * @a outputs.
+     * @pre @a n <= batch_width
+     *
+     * Packets travel through the program together: each instruction is
+     * evaluated once for all packets that reached it, with
+     * match_word_batch(). */
+    void match_batch(Packet * const *p, int n, int *outputs);
 
     String unparse() const;
 
@@ -239,7 +273,7 @@ class CompressedProgram { public:
 
     CompressedProgram()
 	: _output_everything(-j_never), _safe_length((unsigned) -1),
-	  _align_offset(0) {
+	  _align_offset(0), _min_binary_search((unsigned) -1) {
     }
 
     unsigned align_offset() const {
@@ -264,6 +298,16 @@ class CompressedProgram { public:
 
     void warn_unused_outputs(int noutputs, ErrorHandler *errh) const;
 
+    /** @brief Classify the packets in @a members at once.
+     * @param base per-packet data pointers for each of the three offset
+     *   ranges, as for NativeProgram::compile()
+     * @param members bitmask of packets to classify; each must be at least
+     *   safe_length() long
+     * @param outputs filled with the output of each packet in @a members */
+    void match_batch(const unsigned char * const *base[3],
+		     int base1_offset, int base2_offset,
+		     uint32_t members, int *outputs) const;
+
     String unparse() const;
 
   private:
@@ -272,6 +316,105 @@ class CompressedProgram { public:
     int _output_everything;
     unsigned _safe_length;
     unsigned _align_offset;
+    unsigned _min_binary_search;
+
+};
+
+
+/** @brief A wordwise program compiled to native machine code.
+ *
+ * NativeProgram translates the tests of a Program or CompressedProgram into
+ * straight-line branch code in an executable arena, removing the per-test
+ * dispatch of the interpreters.  Each test is a load of a 32-bit word at a
+ * constant displacement from one of up to three base pointers, an AND with
+ * the mask, and a chain of compares (or a binary search, for long sorted
+ * value lists) jumping directly to the next test or to an output.
+ *
+ * The generated code never checks the packet length.  Callers must use it
+ * only for packets at least safe_length() bytes long and run the interpreter
+ * otherwise.
+ *
+ * compile() publishes the new code with a single release store, so it may be
+ * called while other threads are matching packets.  Readers bracket their
+ * use of function() with read_begin() and read_end(); code that compile() or
+ * clear() replaces is retired through an epoch_rcu and unmapped only once
+ * every reader that could have loaded it has left, however many times the
+ * program is replaced in the meantime.
+ *
+ * Native compilation is only available at user level on x86-64; elsewhere
+ * compile() fails and function() always returns null. */
+class NativeProgram { public:
+
+    typedef int (*match_function)(const unsigned char *base0,
+				  const unsigned char *base1,
+				  const unsigned char *base2);
+
+    NativeProgram();
+    ~NativeProgram();
+
+    static bool supported();
+
+    /** @brief Compile @a prog.
+     *
+     * The resulting function expects packet data minus the program's
+     * alignment offset as @a base0.  Returns 0 on success, or a negative
+     * error code with function() reset to null. */
+    int compile(const Program &prog);
+    /** @brief Compile @a zprog.
+     *
+     * Test offsets at or above @a base1_offset (resp. @a base2_offset) are
+     * taken relative to @a base1 (resp. @a base2), after subtracting that
+     * offset; smaller offsets are relative to @a base0. */
+    int compile(const CompressedProgram &zprog,
+		int base1_offset, int base2_offset);
+    /** @brief Stop using native code; function() returns null. */
+    void clear();
+    /** @brief Publish the code of @a x, which must have no readers, in
+     * place of ours, and leave @a x empty. */
+    void take(NativeProgram &x);
+    /** @brief Wait until no reader can still run code replaced or cleared
+     * before this call. */
+    void synchronize();
+
+    /** @brief Enter a read-side section; function() may be called and
+     * its result run until the matching read_end(). */
+    inline void read_begin() const {
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+	_rcu.read_begin();
+#endif
+    }
+    inline void read_end() const {
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+	_rcu.read_end();
+#endif
+    }
+
+    match_function function() const {
+	return __atomic_load_n(&_function, __ATOMIC_ACQUIRE);
+    }
+    size_t code_size() const {
+	return _code_size;
+    }
+
+  private:
+
+    match_function volatile _function;
+    void *_code;
+    size_t _code_size;
+    size_t _code_alloc;
+#if CLICK_CLASSIFICATION_WORDWISE_NATIVE
+    epoch_rcu _rcu;
+#endif
+
+    struct Test;
+    class Assembler;
+
+    int compile(const Vector<Test> &tests, int output_everything);
+    void publish(void *code, size_t size, size_t alloc);
+    void retire();
+
+    NativeProgram(const NativeProgram &);
+    NativeProgram &operator=(const NativeProgram &);
 
 };
 
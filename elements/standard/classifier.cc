@@ -23,6 +23,7 @@
 #include <click/glue.hh>
 #include <click/error.hh>
 #include <click/confparse.hh>
+#include <click/args.hh>
 #include <click/straccum.hh>
 #if !HAVE_INDIFFERENT_ALIGNMENT
 #include <click/router.hh>
@@ -31,6 +32,7 @@
 CLICK_DECLS
 
 Classifier::Classifier()
+    : _jit(false), _batch_match(false)
 {
 }
 
@@ -222,6 +224,13 @@ Classifier::parse_program(Classification::Wordwise::Program &prog,
 int
 Classifier::configure(Vector<String> &conf, ErrorHandler *errh)
 {
+    bool jit = false, batch_match = false;
+    if (Args(this, errh).bind(conf)
+	.read("JIT", jit)
+	.read("BATCH_MATCH", batch_match)
+	.consume() < 0)
+	return -1;
+
     if (conf.size() != noutputs())
 	return errh->error("need %d arguments, one per output port", noutputs());
 
@@ -230,7 +239,20 @@ Classifier::configure(Vector<String> &conf, ErrorHandler *errh)
 
     if (!errh->nerrors()) {
 	prog.warn_unused_outputs(noutputs(), errh);
+	Classification::Wordwise::NativeProgram native;
+	if (jit && native.compile(prog) < 0) {
+	    errh->warning("native compilation unavailable, using the interpreter");
+	    jit = false;
+	}
+	// The old code must not run once _prog, and so safe_length(), has
+	// changed: retire it and wait for its readers before the swap.
+	_native.clear();
+	_native.synchronize();
 	_prog = prog;
+	_batch_match = batch_match;
+	_jit = jit;
+	if (_jit)
+	    _native.take(native);
 	return 0;
     } else
 	return -1;
@@ -243,18 +265,50 @@ Classifier::program_string(Element *element, void *)
     return c->_prog.unparse();
 }
 
+String
+Classifier::jit_handler(Element *element, void *)
+{
+    Classifier *c = static_cast<Classifier *>(element);
+    return String(c->_native.function() != 0);
+}
+
 void
 Classifier::add_handlers()
 {
     add_read_handler("program", Classifier::program_string, 0, Handler::CALM);
+    add_read_handler("jit", Classifier::jit_handler, 0);
 }
 
 #if HAVE_BATCH
 void
 Classifier::push_batch(int, PacketBatch * batch)
 {
+    // Batches longer than BATCH_MAX_PULL are matched one packet at a time.
+    if (_batch_match && batch->count() <= BATCH_MAX_PULL) {
+	using Classification::Wordwise::batch_width;
+	int outputs[BATCH_MAX_PULL];
+	Packet *group[batch_width];
+	int n = 0, *next_output = outputs;
+	FOR_EACH_PACKET(batch, p) {
+	    group[n++] = p;
+	    if (n == batch_width) {
+		_prog.match_batch(group, n, next_output);
+		next_output += n;
+		n = 0;
+	    }
+	}
+	if (n)
+	    _prog.match_batch(group, n, next_output);
+	next_output = outputs;
+	CLASSIFY_EACH_PACKET((noutputs() + 1),
+			     [&next_output](Packet *) { return *next_output++; },
+			     batch,
+			     checked_output_push_batch);
+	return;
+    }
+
 	CLASSIFY_EACH_PACKET(	(noutputs() + 1),
-							_prog.match,
+							match,
 							batch,
 							checked_output_push_batch);
 
@@ -264,7 +318,7 @@ Classifier::push_batch(int, PacketBatch * batch)
 inline void
 Classifier::push(int, Packet *p)
 {
-    checked_output_push(_prog.match(p), p);
+    checked_output_push(match(p), p);
 }
 
 CLICK_ENDDECLS
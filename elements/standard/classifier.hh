@@ -7,7 +7,7 @@ CLICK_DECLS
 
 /*
  * =c
- * Classifier(pattern1, ..., patternN)
+ * Classifier(pattern1, ..., patternN [, I<keywords> JIT, BATCH_MATCH])
  * =s classification
  * classifies packets by contents
  * =d
@@ -32,6 +32,29 @@ CLICK_DECLS
  *
  * As a special case, a pattern consisting of "-" matches every packet.
  *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item JIT
+ *
+ * Boolean. If true, compile the program to native machine code when the
+ * element is configured (and again on every live reconfiguration), and
+ * classify packets with that code instead of the interpreter. Packets
+ * shorter than the program's safe length still use the interpreter. Native
+ * compilation is only available at user level on x86-64; elsewhere a warning
+ * is printed and the interpreter is used. Default is false.
+ *
+ * =item BATCH_MATCH
+ *
+ * Boolean. If true, push_batch classifies up to 32 packets at a time: each
+ * program step is evaluated once for all packets that reached it, using
+ * AVX2 or AVX-512 gathers when Click is compiled for them, and the batch is
+ * then split once per output. Takes precedence over JIT for batches. Default
+ * is false.
+ *
+ * =back
+ *
  * The patterns are scanned in order, and the packet is sent to the output
  * corresponding to the first matching pattern. Thus more specific patterns
  * should come before less specific ones. You will get a warning if no packet
@@ -71,6 +94,9 @@ CLICK_DECLS
  *   safe length 22
  *   alignment offset 0
  *
+ * =h jit read-only
+ * Returns true if packets are classified by native code, false otherwise.
+ *
  * =a IPClassifier, IPFilter */
 
 class Classifier : public BatchElement { public:
@@ -92,6 +118,8 @@ class Classifier : public BatchElement { public:
 #endif
     void push(int, Packet *);
 
+    inline int match(Packet *p);
+
     Classification::Wordwise::Program empty_program(ErrorHandler *errh) const;
     static void parse_program(Classification::Wordwise::Program &prog,
 			      Vector<String> &conf, ErrorHandler *errh);
@@ -99,10 +127,32 @@ class Classifier : public BatchElement { public:
   protected:
 
     Classification::Wordwise::Program _prog;
+    Classification::Wordwise::NativeProgram _native;
+    bool _jit;
+    bool _batch_match;
 
     static String program_string(Element *, void *);
+    static String jit_handler(Element *, void *);
 
 };
 
+inline int
+Classifier::match(Packet *p)
+{
+    if (_jit) {
+	_native.read_begin();
+	Classification::Wordwise::NativeProgram::match_function f = _native.function();
+	// _prog is read after f: configure() only changes it while no code
+	// is published
+	if (f && p->length() < _prog.safe_length())
+	    f = 0;
+	int output = f ? f(p->data() - _prog.align_offset(), 0, 0) : -1;
+	_native.read_end();
+	if (f)
+	    return output;
+    }
+    return _prog.match(p);
+}
+
 CLICK_ENDDECLS
 #endif
@@ -0,0 +1,549 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * hqos.{cc,hh} -- hierarchical traffic shaper and scheduler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "hqos.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include <click/integers.hh>
+CLICK_DECLS
+
+HQoS::HQoS()
+    : _nsubports(1), _npipes(1), _nclasses(4), _nqueues(1), _capacity(64),
+      _quantum(1500), _pipe_anno(AGGREGATE_ANNO_OFFSET),
+      _class_anno(PAINT_ANNO_OFFSET), _queue_anno(-1),
+      _queues(0), _pipes(0), _subports(0), _head(none), _tail(none),
+      _port_blocked(false), _blocked_len(0), _wheel_now(0), _parked(0),
+      _timer(this)
+{
+    memset(_stats, 0, sizeof(_stats));
+}
+
+HQoS::~HQoS()
+{
+}
+
+void *
+HQoS::cast(const char *n)
+{
+    if (strcmp(n, Notifier::EMPTY_NOTIFIER) == 0)
+	return static_cast<Notifier *>(&_empty_note);
+    return BatchElement::cast(n);
+}
+
+static void
+assign_rate(TokenRate &rate, unsigned r, unsigned burst)
+{
+    if (!r)
+	rate.assign(true);
+    else {
+	if (!burst)
+	    burst = r / 50 > 16384 ? r / 50 : 16384;
+	rate.assign(r, burst);
+    }
+}
+
+int
+HQoS::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    unsigned rate, burst = 0;
+    unsigned subport_rate = 0, subport_burst = 0;
+    unsigned pipe_rate = 0, pipe_burst = 0;
+    if (Args(conf, this, errh)
+	.read_mp("RATE", BandwidthArg(), rate)
+	.read("BURST", burst)
+	.read("SUBPORTS", _nsubports)
+	.read("SUBPORT_RATE", BandwidthArg(), subport_rate)
+	.read("SUBPORT_BURST", subport_burst)
+	.read("PIPES", _npipes)
+	.read("PIPE_RATE", BandwidthArg(), pipe_rate)
+	.read("PIPE_BURST", pipe_burst)
+	.read("CLASSES", _nclasses)
+	.read("QUEUES", _nqueues)
+	.read("QUANTUM", _quantum)
+	.read("CAPACITY", _capacity)
+	.read("PIPE_ANNO", AnnoArg(4), _pipe_anno)
+	.read("CLASS_ANNO", AnnoArg(1), _class_anno)
+	.read("QUEUE_ANNO", AnnoArg(1), _queue_anno)
+	.complete() < 0)
+	return -1;
+
+    if (rate == 0)
+	return errh->error("RATE must be positive");
+    if (_nsubports == 0 || _npipes == 0 || _nqueues == 0 || _capacity == 0)
+	return errh->error("SUBPORTS, PIPES, QUEUES and CAPACITY must be positive");
+    if (_nclasses == 0 || _nclasses > max_classes)
+	return errh->error("CLASSES must be between 1 and %d", (int) max_classes);
+    if (_nqueues > 256)
+	return errh->error("at most 256 QUEUES per class");
+    if ((uint64_t) _nsubports * _npipes >= none / 2
+	|| (uint64_t) _nsubports * _npipes * _nclasses * _nqueues > (1U << 28))
+	return errh->error("too many queues");
+    if (_quantum <= 0)
+	return errh->error("QUANTUM must be positive");
+
+    assign_rate(_port_rate, rate, burst);
+    assign_rate(_subport_rate, subport_rate, subport_burst);
+    assign_rate(_pipe_rate, pipe_rate, pipe_burst);
+    _empty_note.initialize(Notifier::EMPTY_NOTIFIER, router());
+    return 0;
+}
+
+int
+HQoS::initialize(ErrorHandler *errh)
+{
+    uint32_t nqueues = total_pipes() * _nclasses * _nqueues;
+    _queues = (Queue *) CLICK_LALLOC(sizeof(Queue) * nqueues);
+    _pipes = new Pipe[total_pipes()];
+    _subports = new Subport[_nsubports];
+    if (!_queues || !_pipes || !_subports)
+	return errh->error("out of memory");
+    memset(_queues, 0, sizeof(Queue) * nqueues);
+
+    _port_tokens.set_full();
+    for (uint32_t i = 0; i < total_pipes(); i++) {
+	Pipe &pi = _pipes[i];
+	pi.tokens.set_full();
+	pi.next = none;
+	pi.subport = i / _npipes;
+	pi.state = s_idle;
+	pi.active = 0;
+	memset(pi.rr, 0, sizeof(pi.rr));
+    }
+    for (uint32_t i = 0; i < _nsubports; i++) {
+	Subport &s = _subports[i];
+	s.tokens.set_full();
+	s.next = s.head = s.tail = none;
+	s.state = s_idle;
+    }
+    for (uint32_t i = 0; i < wheel_size; i++)
+	_wheel[i] = none;
+    _wheel_now = click_jiffies();
+    _timer.initialize(this);
+    return 0;
+}
+
+void
+HQoS::cleanup(CleanupStage)
+{
+    if (_queues) {
+	uint32_t nqueues = total_pipes() * _nclasses * _nqueues;
+	for (uint32_t i = 0; i < nqueues; i++)
+	    while (Packet *p = _queues[i].head) {
+		_queues[i].head = p->next();
+		p->kill();
+	    }
+	CLICK_LFREE(_queues, sizeof(Queue) * nqueues);
+    }
+    delete[] _pipes;
+    delete[] _subports;
+}
+
+inline uint32_t &
+HQoS::link(uint32_t node)
+{
+    if (node < total_pipes())
+	return _pipes[node].next;
+    else
+	return _subports[node - total_pipes()].next;
+}
+
+void
+HQoS::activate_subport(uint32_t sid)
+{
+    Subport &s = _subports[sid];
+    s.state = s_active;
+    s.next = none;
+    if (_tail == none)
+	_head = sid;
+    else
+	_subports[_tail].next = sid;
+    _tail = sid;
+}
+
+void
+HQoS::activate_pipe(uint32_t pid)
+{
+    Pipe &pi = _pipes[pid];
+    Subport &s = _subports[pi.subport];
+    pi.state = s_active;
+    pi.next = none;
+    if (s.tail == none)
+	s.head = pid;
+    else
+	_pipes[s.tail].next = pid;
+    s.tail = pid;
+    if (s.state == s_idle)
+	activate_subport(pi.subport);
+}
+
+inline void
+HQoS::enqueue(Packet *p)
+{
+    uint32_t pid = p->anno_u32(_pipe_anno) % total_pipes();
+    uint32_t cls = p->anno_u8(_class_anno);
+    if (cls >= _nclasses)
+	cls = _nclasses - 1;
+    uint32_t q = _queue_anno >= 0 ? p->anno_u8(_queue_anno) % _nqueues : 0;
+    Queue &qu = _queues[(pid * _nclasses + cls) * _nqueues + q];
+
+    if (qu.len >= _capacity) {
+	++_stats[cls].drops;
+	p->kill();
+	return;
+    }
+    p->set_next(0);
+    if (qu.head)
+	qu.tail->set_next(p);
+    else
+	qu.head = p;
+    qu.tail = p;
+    ++qu.len;
+    ++_stats[cls].enqueued;
+    ++_stats[cls].length;
+
+    Pipe &pi = _pipes[pid];
+    pi.active |= 1 << cls;
+    if (pi.state == s_idle)
+	activate_pipe(pid);
+}
+
+void
+HQoS::push(int, Packet *p)
+{
+    _lock.acquire();
+    enqueue(p);
+    if (_head != none && !_port_blocked && !_empty_note.active())
+	_empty_note.wake();
+    _lock.release();
+}
+
+#if HAVE_BATCH
+void
+HQoS::push_batch(int, PacketBatch *batch)
+{
+    _lock.acquire();
+    FOR_EACH_PACKET_SAFE(batch, p)
+	enqueue(p);
+    if (_head != none && !_port_blocked && !_empty_note.active())
+	_empty_note.wake();
+    _lock.release();
+}
+#endif
+
+// Park @a node until its bucket holds enough tokens, @a wait jiffies from
+// now. Waits beyond the wheel's span are cut short, and the node is parked
+// again when its slot comes.
+void
+HQoS::park(uint32_t node, click_jiffies_t now, uint32_t wait)
+{
+    if (wait == 0)
+	wait = 1;
+    click_jiffies_t wake = now + wait;
+    if (wait >= wheel_size)
+	wait = wheel_size - 1;
+    uint32_t &head = _wheel[(now + wait) % wheel_size];
+    if (node < total_pipes()) {
+	_pipes[node].state = s_parked;
+	_pipes[node].wake = wake;
+    } else {
+	_subports[node - total_pipes()].state = s_parked;
+	_subports[node - total_pipes()].wake = wake;
+    }
+    link(node) = head;
+    head = node;
+    ++_parked;
+}
+
+void
+HQoS::advance_wheel(click_jiffies_t now)
+{
+    if (!_parked) {
+	_wheel_now = now;
+	return;
+    }
+    int32_t steps = now - _wheel_now;
+    if (steps > (int32_t) wheel_size)
+	steps = wheel_size;
+    for (int32_t i = 1; i <= steps; i++) {
+	uint32_t &head = _wheel[(_wheel_now + i) % wheel_size];
+	uint32_t node = head;
+	head = none;
+	while (node != none) {
+	    uint32_t next = link(node);
+	    --_parked;
+	    if (node < total_pipes()) {
+		Pipe &pi = _pipes[node];
+		if ((int32_t) (pi.wake - now) > 0)
+		    park(node, now, pi.wake - now);
+		else
+		    activate_pipe(node);
+	    } else {
+		uint32_t sid = node - total_pipes();
+		Subport &s = _subports[sid];
+		if ((int32_t) (s.wake - now) > 0)
+		    park(node, now, s.wake - now);
+		else if (s.head != none)
+		    activate_subport(sid);
+		else
+		    s.state = s_idle;
+	    }
+	    node = next;
+	}
+    }
+    _wheel_now = now;
+}
+
+// Choose the next packet of pipe @a pid: the first non-empty class, and
+// deficit round robin among its queues.
+inline Packet *
+HQoS::pick(uint32_t pid, Queue *&q, int &cls)
+{
+    Pipe &pi = _pipes[pid];
+    cls = ffs_lsb((uint32_t) pi.active) - 1;
+    Queue *base = &_queues[(pid * _nclasses + cls) * _nqueues];
+    if (_nqueues == 1) {
+	q = base;
+	return q->head;
+    }
+    uint8_t &rr = pi.rr[cls];
+    while (1) {
+	q = &base[rr];
+	if (q->len) {
+	    if (q->deficit >= (int32_t) q->head->length())
+		return q->head;
+	    q->deficit += _quantum;
+	}
+	if (++rr == _nqueues)
+	    rr = 0;
+    }
+}
+
+Packet *
+HQoS::dequeue()
+{
+    click_jiffies_t now = _wheel_now;
+    while (_head != none) {
+	uint32_t sid = _head;
+	Subport &s = _subports[sid];
+	uint32_t pid = s.head;
+	Pipe &pi = _pipes[pid];
+	Queue *q;
+	int cls;
+	Packet *p = pick(pid, q, cls);
+	uint32_t len = p->length();
+
+	if (!_pipe_rate.unlimited()) {
+	    pi.tokens.refill(_pipe_rate, now);
+	    if (!pi.tokens.contains(_pipe_rate, len)) {
+		if ((s.head = pi.next) == none) {
+		    s.tail = none;
+		    _head = s.next;
+		    if (_head == none)
+			_tail = none;
+		    s.state = s_idle;
+		}
+		park(pid, now, pi.tokens.time_until_contains(_pipe_rate, len));
+		continue;
+	    }
+	}
+	if (!_subport_rate.unlimited()) {
+	    s.tokens.refill(_subport_rate, now);
+	    if (!s.tokens.contains(_subport_rate, len)) {
+		if ((_head = s.next) == none)
+		    _tail = none;
+		park(total_pipes() + sid, now,
+		     s.tokens.time_until_contains(_subport_rate, len));
+		continue;
+	    }
+	}
+	_port_tokens.refill(_port_rate, now);
+	if (!_port_tokens.contains(_port_rate, len)) {
+	    _port_blocked = true;
+	    _blocked_len = len;
+	    return 0;
+	}
+
+	_port_tokens.remove(_port_rate, len);
+	if (!_subport_rate.unlimited())
+	    s.tokens.remove(_subport_rate, len);
+	if (!_pipe_rate.unlimited())
+	    pi.tokens.remove(_pipe_rate, len);
+
+	q->head = p->next();
+	q->deficit -= len;
+	if (--q->len == 0) {
+	    q->deficit = 0;
+	    Queue *base = &_queues[(pid * _nclasses + cls) * _nqueues];
+	    uint32_t i = 0;
+	    while (i < _nqueues && base[i].len == 0)
+		i++;
+	    if (i == _nqueues)
+		pi.active &= ~(1 << cls);
+	}
+	++_stats[cls].dequeued;
+	--_stats[cls].length;
+
+	// Serve the pipes of a subport, and the subports, round robin.
+	if ((s.head = pi.next) == none)
+	    s.tail = none;
+	if (pi.active) {
+	    pi.next = none;
+	    if (s.tail == none)
+		s.head = pid;
+	    else
+		_pipes[s.tail].next = pid;
+	    s.tail = pid;
+	} else
+	    pi.state = s_idle;
+	if ((_head = s.next) == none)
+	    _tail = none;
+	if (s.head != none)
+	    activate_subport(sid);
+	else
+	    s.state = s_idle;
+
+	p->set_next(0);
+	return p;
+    }
+    return 0;
+}
+
+// Nothing can leave now: sleep until the port has tokens again or the next
+// parked node wakes up.
+void
+HQoS::go_to_sleep(click_jiffies_t now)
+{
+    _empty_note.sleep();
+    uint32_t wait = 0;
+    if (_port_blocked) {
+	wait = _port_tokens.time_until_contains(_port_rate, _blocked_len);
+	if (wait == 0)
+	    wait = 1;
+    }
+    if (_parked)
+	for (uint32_t i = 1; i < wheel_size && (!wait || i < wait); i++)
+	    if (_wheel[(now + i) % wheel_size] != none) {
+		wait = i;
+		break;
+	    }
+    if (wait)
+	_timer.schedule_after(Timestamp::make_jiffies((click_jiffies_t) wait));
+}
+
+Packet *
+HQoS::pull(int)
+{
+    _lock.acquire();
+    click_jiffies_t now = click_jiffies();
+    advance_wheel(now);
+    Packet *p = dequeue();
+    if (!p)
+	go_to_sleep(now);
+    _lock.release();
+    return p;
+}
+
+#if HAVE_BATCH
+PacketBatch *
+HQoS::pull_batch(int, unsigned max)
+{
+    PacketBatch *batch = 0;
+    Packet *last = 0;
+    unsigned n = 0;
+
+    _lock.acquire();
+    click_jiffies_t now = click_jiffies();
+    advance_wheel(now);
+    while (n < max) {
+	Packet *p = dequeue();
+	if (!p)
+	    break;
+	if (last)
+	    last->set_next(p);
+	else
+	    batch = PacketBatch::start_head(p);
+	last = p;
+	++n;
+    }
+    if (n < max)
+	go_to_sleep(now);
+    _lock.release();
+
+    if (batch)
+	batch->make_tail(last, n);
+    return batch;
+}
+#endif
+
+void
+HQoS::run_timer(Timer *)
+{
+    _lock.acquire();
+    click_jiffies_t now = click_jiffies();
+    advance_wheel(now);
+    _port_blocked = false;
+    if (_head != none)
+	_empty_note.wake();
+    else
+	go_to_sleep(now);
+    _lock.release();
+}
+
+int
+HQoS::read_handler(int, String &s, Element *e, const Handler *h,
+		   ErrorHandler *errh)
+{
+    HQoS *hq = static_cast<HQoS *>(e);
+    int which = (intptr_t) h->read_user_data();
+    if (which == h_parked) {
+	s = String(hq->_parked);
+	return 0;
+    } else if (which == h_rate) {
+	s = BandwidthArg::unparse(hq->_port_rate.rate());
+	return 0;
+    }
+
+    uint32_t first = 0, last = hq->_nclasses;
+    if (s) {
+	if (!IntArg().parse(s, first) || first >= hq->_nclasses)
+	    return errh->error("expected class number");
+	last = first + 1;
+    }
+    uint64_t v = 0;
+    for (uint32_t i = first; i < last; i++) {
+	const ClassStats &cs = hq->_stats[i];
+	v += which == h_length ? cs.length : which == h_enqueued ? cs.enqueued
+	    : which == h_dequeued ? cs.dequeued : cs.drops;
+    }
+    s = String(v);
+    return 0;
+}
+
+void
+HQoS::add_handlers()
+{
+    set_handler("length", Handler::f_read | Handler::f_read_param, read_handler, h_length);
+    set_handler("enqueued", Handler::f_read | Handler::f_read_param, read_handler, h_enqueued);
+    set_handler("dequeued", Handler::f_read | Handler::f_read_param, read_handler, h_dequeued);
+    set_handler("drops", Handler::f_read | Handler::f_read_param, read_handler, h_drops);
+    set_handler("parked", Handler::f_read, read_handler, h_parked);
+    set_handler("rate", Handler::f_read, read_handler, h_rate);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(HQoS)
+ELEMENT_MT_SAFE(HQoS)
@@ -0,0 +1,256 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_HQOS_HH
+#define CLICK_HQOS_HH
+#include <click/batchelement.hh>
+#include <click/notifier.hh>
+#include <click/timer.hh>
+#include <click/tokenbucket.hh>
+#include <click/sync.hh>
+CLICK_DECLS
+
+/*
+=c
+
+HQoS(RATE, I<keywords> SUBPORTS, PIPES, CLASSES, QUEUES, ...)
+
+=s scheduling
+
+hierarchical traffic shaper and scheduler
+
+=d
+
+Stores packets in per-subscriber queues and emits them on pull according to a
+five-level hierarchy, as a single element: the port, SUBPORTS subports,
+PIPES pipes per subport, CLASSES traffic classes per pipe and QUEUES queues
+per traffic class.
+
+The port, every subport and every pipe are shaped by a token bucket with
+the semantics of <click/tokenbucket.hh>: a packet leaves only when its
+length in bytes is available at all three levels. Subports are served round
+robin, and so are the pipes of a subport. Within a pipe, traffic classes have
+strict priority, class 0 first; the queues of a class share it with deficit
+round robin.
+
+A packet's pipe is the 4-byte annotation at PIPE_ANNO modulo the number of
+pipes, numbered subport by subport. Its class is the 1-byte annotation at
+CLASS_ANNO, the last class if larger, and its queue the 1-byte annotation
+at QUEUE_ANNO modulo QUEUES. Packets that find their queue full are dropped.
+
+Pipes and subports that run out of tokens are parked on a timing wheel of
+one-jiffy slots until their bucket can pay for the packet that stopped them,
+so the scheduler never polls idle or throttled nodes, and a single timer
+wakes the element for the earliest of them. Queue state lives in flat arrays
+indexed by pipe, and a pull dequeues a whole batch at once.
+
+Keyword arguments are:
+
+=over 8
+
+=item RATE
+
+Bandwidth. The port rate.
+
+=item BURST
+
+Integer. The port's bucket capacity in bytes. Default is 20 milliseconds at
+RATE, but at least 16384 bytes. SUBPORT_BURST and PIPE_BURST work alike.
+
+=item SUBPORTS
+
+Integer. Number of subports. Default is 1.
+
+=item SUBPORT_RATE
+
+Bandwidth. The rate of each subport. Default is unlimited.
+
+=item PIPES
+
+Integer. Number of pipes per subport. Default is 1.
+
+=item PIPE_RATE
+
+Bandwidth. The rate of each pipe. Default is unlimited.
+
+=item CLASSES
+
+Integer between 1 and 8. Number of traffic classes per pipe. Default is 4.
+
+=item QUEUES
+
+Integer. Number of queues per traffic class. Default is 1.
+
+=item QUANTUM
+
+Integer. Deficit round robin quantum of the queues of a class, in bytes.
+Default is 1500.
+
+=item CAPACITY
+
+Integer. Maximum length of each queue, in packets. Default is 64.
+
+=item PIPE_ANNO
+
+Annotation. Default is AGGREGATE.
+
+=item CLASS_ANNO
+
+Annotation. Default is PAINT.
+
+=item QUEUE_ANNO
+
+Annotation. If not set, every class has a single queue in effect.
+
+=back
+
+HQoS may be pushed and pulled from different threads.
+
+=h length read-only
+
+Number of packets queued. With a class number as parameter, the number of
+packets queued in that class.
+
+=h enqueued read-only
+
+Number of packets enqueued, in total or, with a parameter, in one class.
+
+=h dequeued read-only
+
+Number of packets dequeued, in total or in one class.
+
+=h drops read-only
+
+Number of packets dropped, in total or in one class.
+
+=h parked read-only
+
+Number of pipes and subports waiting for tokens.
+
+=h rate read-only
+
+The port rate.
+
+=n
+
+Token buckets are refilled at jiffy granularity, as with BandwidthShaper
+and BandwidthRatedUnqueue.
+
+=a DRRSched, PrioSched, BandwidthRatedUnqueue, BandwidthShaper, Queue */
+
+class HQoS : public BatchElement { public:
+
+    HQoS() CLICK_COLD;
+    ~HQoS() CLICK_COLD;
+
+    const char *class_name() const	{ return "HQoS"; }
+    const char *port_count() const	{ return PORTS_1_1; }
+    const char *processing() const	{ return PUSH_TO_PULL; }
+    void *cast(const char *);
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+    Packet *pull(int);
+#if HAVE_BATCH
+    void push_batch(int, PacketBatch *);
+    PacketBatch *pull_batch(int, unsigned);
+#endif
+
+    void run_timer(Timer *);
+
+  private:
+
+    enum { none = 0xFFFFFFFFU, max_classes = 8, wheel_size = 256 };
+    enum { s_idle = 0, s_active, s_parked };
+
+    struct Queue {
+	Packet *head;
+	Packet *tail;
+	uint32_t len;
+	int32_t deficit;
+    };
+
+    struct Pipe {
+	TokenCounter tokens;
+	uint32_t next;
+	uint32_t wake;
+	uint32_t subport;
+	uint8_t state;
+	uint8_t active;		// bitmask of non-empty classes
+	uint8_t rr[max_classes];
+    };
+
+    struct Subport {
+	TokenCounter tokens;
+	uint32_t next;
+	uint32_t wake;
+	uint32_t head;		// FIFO of active pipes
+	uint32_t tail;
+	uint8_t state;
+    };
+
+    struct ClassStats {
+	uint64_t enqueued;
+	uint64_t dequeued;
+	uint64_t drops;
+	uint64_t length;
+    };
+
+    TokenRate _port_rate;
+    TokenRate _subport_rate;
+    TokenRate _pipe_rate;
+    TokenCounter _port_tokens;
+
+    uint32_t _nsubports;
+    uint32_t _npipes;		// per subport
+    uint32_t _nclasses;
+    uint32_t _nqueues;
+    uint32_t _capacity;
+    int32_t _quantum;
+    int _pipe_anno;
+    int _class_anno;
+    int _queue_anno;
+
+    Queue *_queues;
+    Pipe *_pipes;
+    Subport *_subports;
+    uint32_t _head;		// FIFO of active subports
+    uint32_t _tail;
+    bool _port_blocked;
+    uint32_t _blocked_len;
+
+    uint32_t _wheel[wheel_size];	// node lists; subports follow the pipes
+    click_jiffies_t _wheel_now;
+    uint32_t _parked;
+
+    ClassStats _stats[max_classes];
+
+    Spinlock _lock;
+    ActiveNotifier _empty_note;
+    Timer _timer;
+
+    inline uint32_t &link(uint32_t node);
+    inline uint32_t total_pipes() const {
+	return _nsubports * _npipes;
+    }
+
+    inline void enqueue(Packet *p);
+    Packet *dequeue();
+    inline Packet *pick(uint32_t pid, Queue *&q, int &cls);
+
+    void activate_pipe(uint32_t pid);
+    void activate_subport(uint32_t sid);
+    void park(uint32_t node, click_jiffies_t now, uint32_t wait);
+    void advance_wheel(click_jiffies_t now);
+    void go_to_sleep(click_jiffies_t now);
+
+    enum { h_length, h_enqueued, h_dequeued, h_drops, h_parked, h_rate };
+    static int read_handler(int, String &, Element *, const Handler *,
+			    ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,195 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * metrics.{cc,hh} -- export metrics in the Prometheus text format
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "metrics.hh"
+#include "counter.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/router.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+Metrics::Metrics()
+    : _prefix("click"), _counters(true)
+{
+}
+
+int
+Metrics::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (router()->attachment("MetricRegistry"))
+	return errh->error("only one Metrics element is allowed");
+    router()->set_attachment("MetricRegistry", static_cast<MetricRegistry *>(this));
+
+    if (Args(conf, this, errh)
+	.read("PREFIX", _prefix)
+	.read("COUNTERS", _counters)
+	.complete() < 0)
+	return -1;
+    for (const char *s = _prefix.begin(); s != _prefix.end(); ++s)
+	if (!isalnum((unsigned char) *s) && *s != '_' && *s != ':')
+	    return errh->error("PREFIX must be a valid metric name");
+    return 0;
+}
+
+int
+Metrics::initialize(ErrorHandler *)
+{
+    if (_counters)
+	for (int i = 0; i < router()->nelements(); i++)
+	    if (void *c = router()->element(i)->cast("CounterBase"))
+		_counter_elements.push_back(static_cast<CounterBase *>(c));
+    return 0;
+}
+
+static void
+unparse_label(StringAccum &sa, const Element *e)
+{
+    sa << "{element=\"";
+    String name = e->name();
+    for (const char *s = name.begin(); s != name.end(); ++s)
+	if (*s == '\\' || *s == '"')
+	    sa << '\\' << *s;
+	else if (*s == '\n')
+	    sa << "\\n";
+	else
+	    sa << *s;
+    sa << '"';
+}
+
+static void
+unparse_histogram(StringAccum &sa, const String &name, const Element *e,
+		  const MetricHistogram *h)
+{
+    MetricHistogram::Snapshot snap;
+    h->snapshot(snap);
+
+    int last = MetricHistogram::nbuckets - 1;
+    while (last > 0 && snap.b[last] == 0)
+	--last;
+    uint64_t limit = MetricHistogram::bucket_limit(last);
+
+    // Bucket limits fall on every power of two, so the cumulative counts
+    // are exact.
+    uint64_t cum = 0;
+    int b = 0;
+    for (int k = 0; k < 64; ++k) {
+	uint64_t le = (uint64_t) 1 << k;
+	while (b < MetricHistogram::nbuckets
+	       && MetricHistogram::bucket_limit(b) <= le)
+	    cum += snap.b[b++];
+	sa << name << "_bucket";
+	unparse_label(sa, e);
+	sa << ",le=\"" << le << "\"} " << cum << '\n';
+	if (le >= limit)
+	    break;
+    }
+    sa << name << "_bucket";
+    unparse_label(sa, e);
+    sa << ",le=\"+Inf\"} " << snap.count << '\n';
+    sa << name << "_sum";
+    unparse_label(sa, e);
+    sa << "} " << snap.sum << '\n';
+    sa << name << "_count";
+    unparse_label(sa, e);
+    sa << "} " << snap.count << '\n';
+}
+
+void
+Metrics::unparse_counters(StringAccum &sa) const
+{
+    Vector<CounterBase::stats> stats;
+    for (int i = 0; i < _counter_elements.size(); i++)
+	stats.push_back(_counter_elements[i]->read());
+
+    for (int which = 0; which < 2; ++which) {
+	String name = _prefix + (which ? "_bytes_total" : "_packets_total");
+	sa << "# HELP " << name << (which ? " Bytes" : " Packets")
+	   << " seen by counter elements.\n"
+	   << "# TYPE " << name << " counter\n";
+	for (int i = 0; i < _counter_elements.size(); i++) {
+	    sa << name;
+	    unparse_label(sa, _counter_elements[i]);
+	    sa << "} " << (which ? stats[i]._byte_count : stats[i]._count)
+	       << '\n';
+	}
+    }
+}
+
+String
+Metrics::prometheus() const
+{
+    static const char * const type_names[] = {
+	"counter", "gauge", "histogram"
+    };
+    StringAccum sa;
+    Vector<bool> done(_entries.size(), false);
+
+    // Group the entries of each name, in the order names first appear.
+    for (int i = 0; i < _entries.size(); i++) {
+	if (done[i])
+	    continue;
+	const Entry &first = _entries[i];
+	String name = _prefix + "_" + first.name;
+	if (first.help)
+	    sa << "# HELP " << name << ' ' << first.help << '\n';
+	sa << "# TYPE " << name << ' ' << type_names[first.type] << '\n';
+	for (int j = i; j < _entries.size(); j++) {
+	    const Entry &e = _entries[j];
+	    if (done[j] || e.name != first.name || e.type != first.type)
+		continue;
+	    done[j] = true;
+	    switch (e.type) {
+	    case t_counter:
+		sa << name;
+		unparse_label(sa, e.owner);
+		sa << "} " << static_cast<const MetricCounter *>(e.metric)->value()
+		   << '\n';
+		break;
+	    case t_gauge:
+		sa << name;
+		unparse_label(sa, e.owner);
+		sa << "} " << static_cast<const MetricGauge *>(e.metric)->value()
+		   << '\n';
+		break;
+	    case t_histogram:
+		unparse_histogram(sa, name, e.owner,
+				  static_cast<const MetricHistogram *>(e.metric));
+		break;
+	    }
+	}
+    }
+
+    if (_counter_elements.size())
+	unparse_counters(sa);
+    return sa.take_string();
+}
+
+String
+Metrics::read_handler(Element *e, void *)
+{
+    return static_cast<Metrics *>(e)->prometheus();
+}
+
+void
+Metrics::add_handlers()
+{
+    add_read_handler("prometheus", read_handler, 0, Handler::f_expensive);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(Metrics)
+ELEMENT_MT_SAFE(Metrics)
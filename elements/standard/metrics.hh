@@ -0,0 +1,87 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_METRICS_ELEMENT_HH
+#define CLICK_METRICS_ELEMENT_HH
+#include <click/element.hh>
+#include <click/metrics.hh>
+CLICK_DECLS
+class CounterBase;
+class StringAccum;
+
+/*
+=c
+
+Metrics([I<keywords> PREFIX, COUNTERS])
+
+=s information
+
+exports the router's metrics in the Prometheus text format
+
+=d
+
+Collects the counters, gauges and histograms that elements publish in the
+router's MetricRegistry (see <click/metrics.hh>), and renders all of them at
+once through the C<prometheus> handler. Each metric is named
+PREFIX_I<name> and labelled with the name of the element that publishes it.
+
+Metrics are kept in per-thread storage by the elements, and are summed when
+the handler is read, without stopping or locking the workers. Reading a
+single handler is much cheaper than polling one read handler per counter.
+
+Keyword arguments are:
+
+=over 8
+
+=item PREFIX
+
+String. Prefix of every metric name. Default is "click".
+
+=item COUNTERS
+
+Boolean. If true, also export the packet and byte counts of every Counter,
+CounterMP and related element, as PREFIX_packets_total and
+PREFIX_bytes_total. Default is true.
+
+=back
+
+Only one Metrics element is allowed per configuration.
+
+=h prometheus read-only
+
+Returns all metrics in the Prometheus text exposition format. Histograms have
+one bucket per power of two up to their largest value.
+
+=e
+
+Serve the metrics at http://host:9100/metrics:
+
+  metrics :: Metrics;
+  HTTPServer(9100, ALIAS_MAP metrics:metrics/prometheus);
+
+=a HTTPServer, Counter, BatchStats */
+
+class Metrics : public Element, public MetricRegistry { public:
+
+    Metrics() CLICK_COLD;
+
+    const char *class_name() const	{ return "Metrics"; }
+    int configure_phase() const		{ return CONFIGURE_PHASE_INFO; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    String prometheus() const;
+
+  private:
+
+    String _prefix;
+    bool _counters;
+    Vector<CounterBase *> _counter_elements;
+
+    void unparse_counters(StringAccum &sa) const;
+    static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
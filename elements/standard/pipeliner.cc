@@ -34,6 +34,14 @@ Pipeliner::~Pipeliner()
 
 }
 
+void *
+Pipeliner::cast(const char *n)
+{
+    if (strcmp(n, Notifier::FULL_NOTIFIER) == 0)
+        return static_cast<Notifier *>(&_full_note);
+    return BatchElement::cast(n);
+}
+
 bool
 Pipeliner::get_spawning_threads(Bitvector& b, bool, int port) {
     unsigned int thisthread = router()->home_thread_id(this);
@@ -77,6 +85,9 @@ Pipeliner::configure(Vector<String> & conf, ErrorHandler * errh)
     .complete() < 0)
         return -1;
 
+    _full_note.initialize(Notifier::FULL_NOTIFIER, router());
+    _full_note.set_active(true, false);
+
     if (_ring_size <= 0) {
         _ring_size = 1024;
     }
@@ -143,6 +154,19 @@ Pipeliner::initialize(ErrorHandler *errh)
     return 0;
 }
 
+/**
+ * Signal upstream that a ring is full. The home thread may have drained
+ * the ring between the check and sleep(), so check again. sleep() is an
+ * atomic compare-and-swap, which orders it before the reload of _tail.
+ */
+inline void
+Pipeliner::ring_full(PacketRing &s)
+{
+    _full_note.sleep();
+    if (!s.is_full())
+        _full_note.wake();
+}
+
 #if HAVE_BATCH
 void Pipeliner::push_batch(int,PacketBatch* head) {
     if (_allow_direct_traversal && click_current_cpu_id() == (unsigned)_home_thread_id) {
@@ -153,9 +177,12 @@ void Pipeliner::push_batch(int,PacketBatch* head) {
     retry:
     if (storage->insert(head)) {
         stats->count += count;
+        if (storage->is_full())
+            ring_full(*storage);
         if (sleepiness >= _sleep_threshold)
             _task.reschedule();
     } else {
+        ring_full(*storage);
         if (_block) {
             if (!_always_up && sleepiness >= _sleep_threshold)
                 _task.reschedule();
@@ -184,7 +211,10 @@ Pipeliner::push(int,Packet* p)
 retry:
     if (storage->insert(p)) {
         stats->count++;
+        if (storage->is_full())
+            ring_full(*storage);
     } else {
+        ring_full(*storage);
         if (_block) {
             if (!_always_up && sleepiness >= _sleep_threshold)
                 _task.reschedule();
@@ -218,9 +248,14 @@ Pipeliner::run_task(Task* t)
         PacketBatch* out = NULL;
 #endif
         int n = 0;
-        while (!s.is_empty() && n++ < _burst) {
+        Packet* next;
+        while (n < _burst && (next = s.extract()) != 0) {
+            n++;
+            // Prefetch the head of the following entry, that we will link
+            if (Packet* ahead = s.peek())
+                __builtin_prefetch(ahead);
 #if HAVE_BATCH
-            PacketBatch* b = static_cast<PacketBatch*>(s.extract());
+            PacketBatch* b = static_cast<PacketBatch*>(next);
             if (unlikely(!receives_batch)) {
                 if (out == NULL) {
                     b->set_tail(b);
@@ -238,12 +273,23 @@ Pipeliner::run_task(Task* t)
             }
             //WritablePacket::pool_hint(b->count(),storage.get_mapping(i));
 #else
-            Packet* p = s.extract();
-            output(0).push(p);
+            output(0).push(next);
             //WritablePacket::pool_hint(HINT_THRESHOLD,storage.get_mapping(i));
             r = true;
 #endif
         }
+        if (n == 0) {
+            // The ring is empty: a producer that slept on it can push again
+            if (unlikely(!_full_note.active()))
+                _full_note.wake();
+            continue;
+        }
+        s.publish();
+        // Order the _tail store before the notifier load; ring_full() pairs
+        // this with the barrier of sleep() before it reads _tail.
+        click_fence();
+        if (unlikely(!_full_note.active()))
+            _full_note.wake();
         if (s.count() > _highwater)
             _highwater = s.count();
 
@@ -6,6 +6,7 @@
 #include <click/task.hh>
 #include <click/ring.hh>
 #include <click/multithread.hh>
+#include <click/notifier.hh>
 
 CLICK_DECLS
 
@@ -25,6 +26,54 @@ of packets pushed to this element to another core, without the inherent
 scheduling cost of normal queues. Multiple thread can push packets to
 this queue, and the home thread of this element will push packet out.
 
+Each pushing thread has its own single-producer single-consumer ring of
+CAPACITY entries. A ring entry is a whole batch: batches are neither split
+nor rebuilt, and the home thread links the batches it extracts into one
+batch per run. The producer and consumer indexes are kept on separate
+cache lines and the home thread releases the slots of a whole burst at once,
+so cache lines cross cores per batch rather than per packet.
+
+When a ring is full, Pipeliner puts its full notifier to sleep. Upstream
+elements waiting on a full notifier, like InfiniteSource, then stop pushing
+until the home thread makes room. Packets pushed to a full ring are still
+dropped, unless BLOCKING is true. There is a single full notifier for all
+rings, as upstream elements find it through the element and not through
+their thread: a full ring stops every pushing thread until the home thread
+next polls, and any ring with room wakes them all again.
+
+Keyword arguments are:
+
+=over 8
+
+=item CAPACITY
+
+Integer. Number of entries of each ring, rounded up to a power of two.
+Default is 1024.
+
+=item BURST
+
+Integer. Maximum number of entries taken from each ring per run. Default is
+32.
+
+=item BLOCKING
+
+Boolean. If true, a thread pushing to a full ring waits for room instead of
+dropping packets. Default is false.
+
+=back
+
+=h count read-only
+
+Number of packets enqueued.
+
+=h dropped read-only
+
+Number of packets dropped.
+
+=h highwater read-only
+
+Highest ring occupancy seen by the home thread.
+
 
 =a StaticThreadSched, Queue
 
@@ -52,6 +101,8 @@ public:
         return _block;
     }
 
+    void *cast(const char *);
+
     bool get_spawning_threads(Bitvector& b, bool isoutput, int port) override;
 
 #if HAVE_BATCH
@@ -95,7 +146,7 @@ public:
     bool _always_up;
     bool _allow_direct_traversal;
     bool _verbose;
-    typedef DynamicRing<Packet*> PacketRing;
+    typedef SPSCDynamicRing<Packet*> PacketRing;
 
     per_thread_oread<PacketRing> storage;
     struct stats {
@@ -113,6 +164,9 @@ public:
   protected:
     Task _task;
     unsigned int _last_start;
+    ActiveNotifier _full_note;
+
+    inline void ring_full(PacketRing &s);
 
 
 };
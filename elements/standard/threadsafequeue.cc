@@ -22,7 +22,9 @@ CLICK_DECLS
 
 ThreadSafeQueue::ThreadSafeQueue()
 {
+    _span = 0;
     _xhead = _xtail = 0;
+    _phead = _ptail = 0;
 }
 
 void *
@@ -34,14 +36,31 @@ ThreadSafeQueue::cast(const char *n)
 	return FullNoteQueue::cast(n);
 }
 
+void
+ThreadSafeQueue::reset_counters()
+{
+    // The largest multiple of the ring size below 2^31, so add_c() cannot
+    // overflow.
+    _span = (_capacity + 1) * (0x80000000U / (_capacity + 1));
+    _xhead = _phead = head();
+    _xtail = _ptail = head() + size();
+}
+
+int
+ThreadSafeQueue::initialize(ErrorHandler *errh)
+{
+    int r = FullNoteQueue::initialize(errh);
+    reset_counters();
+    return r;
+}
+
 int
 ThreadSafeQueue::live_reconfigure(Vector<String> &conf, ErrorHandler *errh)
 {
     int r = NotifierQueue::live_reconfigure(conf, errh);
     if (r >= 0 && size() < capacity() && _q)
 	_full_note.wake();
-    _xhead = head();
-    _xtail = tail();
+    reset_counters();
     return r;
 }
 
@@ -53,64 +72,156 @@ ThreadSafeQueue::take_state(Element *e, ErrorHandler *errh)
         return;
 
     SimpleQueue::take_state(e, errh);
-    _xhead = head();
-    _xtail = tail();
+    reset_counters();
+}
+
+// Reserve up to @a n slots at the tail, starting at counter @a c. _xtail
+// runs ahead of _ptail by the slots that pushers have reserved but not yet
+// published. _phead is read after _xtail, so while _xtail is unchanged the
+// room computed is at most the real room; if _xtail moved on, the
+// compare-and-swap fails.
+inline unsigned
+ThreadSafeQueue::reserve_tail(unsigned n, uint32_t &c)
+{
+    while (1) {
+	c = _xtail.value();
+	uint32_t used = distance(_phead, c);
+	if (used > (uint32_t) _capacity) // stale _xtail, try again
+	    continue;
+	unsigned room = _capacity - used;
+	if (room == 0)
+	    return 0;
+	if (room < n)
+	    n = room;
+	if (_xtail.compare_swap(c, add_c(c, n)) == c)
+	    return n;
+    }
+}
+
+// Publish the slots [@a c, @a nc) once earlier reservations are published.
+inline void
+ThreadSafeQueue::publish_tail(uint32_t c, uint32_t nc)
+{
+    while (_ptail != c)
+	click_relax_fence();
+    Storage::index_type nt = slot(nc);
+    set_tail(nt);
+    _ptail = nc;
+
+    int s = size(head(), nt);
+    if (s > _highwater_length)
+	_highwater_length = s;
+
+    _empty_note.wake();
+
+    if (s == capacity()) {
+	_full_note.sleep();
+	// See FullNoteQueue::push_success().
+	if (size() < capacity())
+	    _full_note.wake();
+    }
+}
+
+inline unsigned
+ThreadSafeQueue::reserve_head(unsigned n, uint32_t &c)
+{
+    while (1) {
+	c = _xhead.value();
+	uint32_t avail = distance(c, _ptail);
+	if (avail > (uint32_t) _capacity) // stale _xhead, try again
+	    continue;
+	if (avail == 0)
+	    return 0;
+	if (avail < n)
+	    n = avail;
+	if (_xhead.compare_swap(c, add_c(c, n)) == c) {
+	    click_read_fence();
+	    return n;
+	}
+    }
+}
+
+inline void
+ThreadSafeQueue::publish_head(uint32_t c, uint32_t nc)
+{
+    while (_phead != c)
+	click_relax_fence();
+    set_head(slot(nc));
+    _phead = nc;
+
+    _sleepiness = 0;
+    _full_note.wake();
 }
 
 void
 ThreadSafeQueue::push(int, Packet *p)
 {
-    // Code taken from SimpleQueue::push().
-
-    // Reserve a slot by incrementing _xtail
-    Storage::index_type t, nt;
-    do {
-	t = tail();
-	nt = next_i(t);
-    } while (_xtail.compare_swap(t, nt) != t);
-    // Other pushers spin until _tail := nt (or _xtail := t)
-
-    Storage::index_type h = head();
-    if (nt != h)
-	push_success(h, t, nt, p);
-    else {
-	_xtail = t;
+    uint32_t c;
+    if (reserve_tail(1, c)) {
+	_q[slot(c)] = p;
+	publish_tail(c, add_c(c, 1));
+    } else
 	push_failure(p);
-    }
 }
 
 Packet *
 ThreadSafeQueue::pull(int)
 {
-    // Code taken from SimpleQueue::deq.
-
-    // Reserve a slot by incrementing _xhead
-    Storage::index_type h, nh;
-    do {
-	h = head();
-	nh = next_i(h);
-    } while (_xhead.compare_swap(h, nh) != h);
-    // Other pullers spin until _head := nh (or _xhead := h)
-
-    Storage::index_type t = tail();
-    if (t != h)
-	return pull_success(h, nh);
-    else {
-	_xhead = h;
+    uint32_t c;
+    if (reserve_head(1, c)) {
+	Packet *p = _q[slot(c)];
+	publish_head(c, add_c(c, 1));
+	return p;
+    } else
 	return pull_failure();
-    }
 }
 
 #if HAVE_BATCH
-void ThreadSafeQueue::push_batch(int port, PacketBatch* batch) {
-    FOR_EACH_PACKET_SAFE(batch,p) {
-        ThreadSafeQueue::push(port,p);
+void
+ThreadSafeQueue::push_batch(int, PacketBatch *batch)
+{
+    uint32_t c;
+    unsigned n = reserve_tail(batch->count(), c);
+    Packet *p = batch;
+    if (n) {
+	Storage::index_type i = slot(c);
+	for (unsigned k = 0; k < n; k++) {
+	    Packet *next = p->next();
+	    _q[i] = p;
+	    i = next_i(i);
+	    p = next;
+	}
+	publish_tail(c, add_c(c, n));
+    }
+    while (p) {
+	Packet *next = p->next();
+	p->set_next(0);
+	push_failure(p);
+	p = next;
     }
 }
 
-PacketBatch* ThreadSafeQueue::pull_batch(int port, unsigned max) {
-    PacketBatch* batch;
-    MAKE_BATCH(ThreadSafeQueue::pull(port),batch,max);
+PacketBatch *
+ThreadSafeQueue::pull_batch(int, unsigned max)
+{
+    uint32_t c;
+    unsigned n = reserve_head(max ? max : BATCH_MAX_PULL, c);
+    if (!n) {
+	pull_failure();
+	return 0;
+    }
+    Storage::index_type i = slot(c);
+    Packet *first = _q[i], *last = first;
+    for (unsigned k = 1; k < n; k++) {
+	i = next_i(i);
+	Packet *p = _q[i];
+	last->set_next(p);
+	last = p;
+    }
+    publish_head(c, add_c(c, n));
+
+    PacketBatch *batch = PacketBatch::start_head(first);
+    batch->make_tail(last, n);
     return batch;
 }
 #endif
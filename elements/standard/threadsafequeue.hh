@@ -25,6 +25,16 @@ that it supports multiple concurrent pushers and pullers.  In all respects
 other than thread safety it behaves just like Queue, and like Queue it has
 non-full and non-empty notifiers.
 
+Batches are moved in bulk: a pusher reserves room for a whole batch with a
+single compare-and-swap, copies its packets into the ring, and publishes
+them once the pushers that reserved before it have published theirs. Pullers
+work alike, so a batch costs one atomic operation on each side however many
+packets it holds, and the copies of concurrent pushers (or pullers) overlap.
+The reservation counters of pushers and pullers live on separate cache lines.
+They run modulo a large multiple of the ring size rather than wrapping with
+the ring, so a stalled thread's stale snapshot cannot be mistaken for a
+current one until some 2^31 packets have gone by.
+
 =h length read-only
 
 Returns the current number of packets in the queue.
@@ -58,6 +68,7 @@ class ThreadSafeQueue : public FullNoteQueue { public:
     const char *class_name() const		{ return "ThreadSafeQueue"; }
     void *cast(const char *);
 
+    int initialize(ErrorHandler *) CLICK_COLD;
     int live_reconfigure(Vector<String> &conf, ErrorHandler *errh);
     void take_state(Element*, ErrorHandler*);
 
@@ -70,8 +81,31 @@ class ThreadSafeQueue : public FullNoteQueue { public:
 
   private:
 
-    atomic_uint32_t _xhead;
-    atomic_uint32_t _xtail;
+    // Reservation (_x) and publication (_p) counters run modulo _span, a
+    // multiple of the ring size; counter c names slot c % (_capacity + 1).
+    uint32_t _span;
+    atomic_uint32_t _xhead CLICK_CACHE_ALIGN;
+    volatile uint32_t _phead;
+    atomic_uint32_t _xtail CLICK_CACHE_ALIGN;
+    volatile uint32_t _ptail;
+
+    inline uint32_t add_c(uint32_t c, unsigned n) const {
+	c += n;
+	return c >= _span ? c - _span : c;
+    }
+    inline uint32_t distance(uint32_t from, uint32_t to) const {
+	return to >= from ? to - from : to + _span - from;
+    }
+    inline Storage::index_type slot(uint32_t c) const {
+	return c % (_capacity + 1);
+    }
+
+    void reset_counters();
+
+    inline unsigned reserve_tail(unsigned n, uint32_t &c);
+    inline void publish_tail(uint32_t c, uint32_t nc);
+    inline unsigned reserve_head(unsigned n, uint32_t &c);
+    inline void publish_head(uint32_t c, uint32_t nc);
 
 };
 
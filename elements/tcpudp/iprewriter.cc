@@ -153,6 +153,10 @@ IPRewriter::process(int port, Packet *p_in)
     IPRewriterEntry *m = map->get(flowid);
 
     if (!m) {			// create new mapping
+	int shared_output = apply_shared(p, flowid, iph->ip_p, _annos);
+	if (shared_output >= 0)
+	    return shared_output;
+
 	IPRewriterInput &is = _input_specs.unchecked_at(port);
 	IPFlowID rewritten_flowid = IPFlowID::uninitialized_t();
 	int result = is.rewrite_flowid(flowid, rewritten_flowid, p, iph->ip_p == IP_PROTO_TCP ?
@@ -162,7 +166,7 @@ IPRewriter::process(int port, Packet *p_in)
 	if (!m) {
 	    return result;
 	} else if (_annos & 2)
-	    m->flow()->set_reply_anno(p->anno_u8(_annos >> 2));
+	    set_reply_anno(m->flow(), p->anno_u8(_annos >> 2));
     }
 
     click_jiffies_t now_j = click_jiffies();
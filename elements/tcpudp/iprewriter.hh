@@ -169,6 +169,55 @@ element, in which case this element will share the other element's capacity.
 Boolean. If true, then set the destination IP address annotation on passing
 packets to the rewritten destination address. Default is true.
 
+=item RSS_STEERING
+
+Boolean. If true, each thread chooses translated source ports (or addresses)
+such that the reply is received by that same thread, according to the NIC's
+receive-side scaling. Pattern variations are tried in the usual order and the
+first free one whose reply hashes to the current thread is used; if there is
+none, any free variation is used. Queue I<n> is assumed to be polled by
+thread I<n>. Default is false.
+
+=item RSS_PORT I<port>
+
+DPDK port on which replies are received. Its RSS key and redirection table are
+read at initialization. Only available with DPDK.
+
+=item RSS_KEY I<hex>
+
+Toeplitz key used by the NIC receiving replies, as hexadecimal bytes that may
+be separated by colons. Defaults to the Microsoft RSS key.
+
+=item RSS_QUEUES I<n>
+
+Without RSS_PORT, the number of queues spread round-robin over the
+redirection table. Defaults to the number of threads.
+
+=item RSS_RETA_SIZE I<n>
+
+Without RSS_PORT, the size of the redirection table, a power of two. Default
+is 128.
+
+=item SHARED_INDEX
+
+Boolean. If true, mappings are also published in a lock-free index shared by
+all threads. A thread that receives a packet matching no mapping of its own
+first looks it up there, and translates it if another thread owns the
+mapping. This covers replies that RSS_STEERING could not steer, or flows
+created by mappers. A mapping is not expired while other threads still
+translate its replies. Once a TCP mapping needs sequence number translation,
+for instance because of FTPPortMapper, it leaves the index and only its owner
+translates it. Replies translated by other threads do not advance the owner's
+record of the TCP connection state, so a closed connection may keep its
+mapping for the data timeout rather than the done timeout. IPRewriter,
+TCPRewriter and UDPRewriter support this option. Defaults to the value of
+RSS_STEERING.
+
+=item SHARED_INDEX_CAPACITY I<n>
+
+Number of slots of the shared index. Mappings that do not fit are not
+indexed. Default is 65536.
+
 =back
 
 =h table_size r
@@ -193,6 +242,29 @@ space-separated numbers, where the first is the capacity and the second is the
 short-term flow reservation.  When writing, the short-term reservation can be
 omitted; it is then set to the minimum of 50 and one-eighth the capacity.
 
+=h rss_steered r
+
+Returns the number of variations chosen so that their reply is received by
+the creating thread. Only available with RSS_STEERING.
+
+=h rss_unsteered r
+
+Returns the number of variations chosen without steering, because no free
+variation hashed to the creating thread.
+
+=h shared_index_size r
+
+Returns the number of mappings in the shared index. Only available with
+SHARED_INDEX.
+
+=h shared_index_hits r
+
+Returns the number of packets translated through the shared index.
+
+=h shared_index_failures r
+
+Returns the number of mappings that did not fit in the shared index.
+
 =h tcp_table read-only
 
 Returns a human-readable description of the IPRewriter's current TCP mapping
@@ -247,6 +319,13 @@ class IPRewriter : public TCPRewriter { public:
 	    return flow->expiry() +
                   udp_flow_timeout(static_cast<const UDPFlow *>(flow), _state.get()) - _state->_udp_timeouts[1];
     }
+    click_jiffies_t shared_expiry(const IPRewriterFlow *flow,
+				  click_jiffies_t used_j) {
+	if (flow->ip_p() == IP_PROTO_TCP)
+	    return TCPRewriter::shared_expiry(flow, used_j);
+	else
+	    return used_j + udp_flow_timeout(static_cast<const UDPFlow *>(flow), _state.get());
+    }
 
     void push(int, Packet *);
 #if HAVE_BATCH
@@ -64,6 +64,10 @@ TCPRewriter::TCPFlow::update_seqno_delta(bool direction,
 	}
     }
 
+    // Replies now need sequence number translation, which only the owning
+    // thread can do
+    owner()->reply_element->unshare_flow(this);
+
     // install new transition
     _dt->trigger[direction] = trigger;
     delta_transition *ndt = _dt->next();
@@ -334,6 +338,10 @@ TCPRewriter::process(int port, Packet *p_in)
     IPRewriterEntry *m = _map[click_current_cpu_id()].get(flowid);
 
     if (!m) {			// create new mapping
+	int shared_output = apply_shared(p, flowid, IP_PROTO_TCP, _annos);
+	if (shared_output >= 0)
+	    return shared_output;
+
 	IPRewriterInput &is = _input_specs.unchecked_at(port);
 	IPFlowID rewritten_flowid = IPFlowID::uninitialized_t();
 
@@ -345,7 +353,7 @@ TCPRewriter::process(int port, Packet *p_in)
 	if (!m) {
 	    return result;
 	} else if (_annos & 2) {
-	    m->flow()->set_reply_anno(p->anno_u8(_annos >> 2));
+	    set_reply_anno(m->flow(), p->anno_u8(_annos >> 2));
         }
     }
 
@@ -169,6 +169,13 @@ class TCPRewriter : public IPRewriterBase { public:
 	return flow->expiry() + tcp_flow_timeout(static_cast<const TCPFlow *>(flow)) -
                _timeouts[click_current_cpu_id()][1];
     }
+    bool shares_replies() const {
+	return true;
+    }
+    click_jiffies_t shared_expiry(const IPRewriterFlow *flow,
+				  click_jiffies_t used_j) {
+	return used_j + tcp_flow_timeout(static_cast<const TCPFlow *>(flow));
+    }
 
     void push(int, Packet *);
 #if HAVE_BATCH
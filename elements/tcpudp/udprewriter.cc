@@ -168,6 +168,10 @@ UDPRewriter::process(int port, Packet *p_in)
     IPRewriterEntry *m = _map[click_current_cpu_id()].get(flowid);
 
     if (!m) {			// create new mapping
+	int shared_output = apply_shared(p, flowid, ip_p, _annos);
+	if (shared_output >= 0)
+	    return shared_output;
+
         IPRewriterInput &is = _input_specs.unchecked_at(port);
         IPFlowID rewritten_flowid = IPFlowID::uninitialized_t();
 
@@ -179,7 +183,7 @@ UDPRewriter::process(int port, Packet *p_in)
         if (!m) {
             return result;
         } else if (_annos & 2) {
-            m->flow()->set_reply_anno(p->anno_u8(_annos >> 2));
+            set_reply_anno(m->flow(), p->anno_u8(_annos >> 2));
         }
     }
 
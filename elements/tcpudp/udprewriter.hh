@@ -199,6 +199,13 @@ class UDPRewriter : public IPRewriterBase { public:
 	return flow->expiry() + udp_flow_timeout(static_cast<const UDPFlow *>(flow)) -
                _timeouts[click_current_cpu_id()][1];
     }
+    bool shares_replies() const {
+	return true;
+    }
+    click_jiffies_t shared_expiry(const IPRewriterFlow *flow,
+				  click_jiffies_t used_j) {
+	return used_j + udp_flow_timeout(static_cast<const UDPFlow *>(flow));
+    }
 
     void push(int, Packet *);
 #if HAVE_BATCH
@@ -79,6 +79,45 @@ struct fake_modified_pcap_pkthdr {
 	uint8_t pad;		/* pad to a 4-byte boundary */
 };
 
+/* pcapng (draft-ietf-opsawg-pcapng) blocks, as far as ToDump writes them. */
+#define FAKE_PCAPNG_SHB			0x0A0D0D0A	/* Section Header Block */
+#define FAKE_PCAPNG_IDB			0x00000001	/* Interface Description */
+#define FAKE_PCAPNG_EPB			0x00000006	/* Enhanced Packet Block */
+#define FAKE_PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+#define FAKE_PCAPNG_OPT_ENDOFOPT	0
+#define FAKE_PCAPNG_IF_NAME		2
+#define FAKE_PCAPNG_IF_TSRESOL		9
+
+/* Each block ends with a copy of its 32-bit total length. */
+struct fake_pcapng_shb {
+	uint32_t block_type;
+	uint32_t block_length;
+	uint32_t byte_order_magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int64_t section_length;	/* -1: not specified */
+};
+
+struct fake_pcapng_idb {
+	uint32_t block_type;
+	uint32_t block_length;
+	uint16_t linktype;
+	uint16_t reserved;
+	uint32_t snaplen;
+	/* options follow */
+};
+
+struct fake_pcapng_epb {
+	uint32_t block_type;
+	uint32_t block_length;
+	uint32_t interface_id;
+	uint32_t ts_high;	/* in units of the interface's if_tsresol */
+	uint32_t ts_low;
+	uint32_t caplen;
+	uint32_t len;
+	/* packet data, padded to 32 bits, then options */
+};
+
 // Parsing and unparsing.
 int fake_pcap_parse_dlt(const String&);
 String fake_pcap_unparse_dlt(int);
@@ -31,7 +31,7 @@
 CLICK_DECLS
 
 FromDPDKDevice::FromDPDKDevice() :
-    _dev(0)
+    _dev(0), _rx_intr(false), _rx_intr_selected(false)
 {
 #if HAVE_BATCH
     in_batch_mode = BATCH_MODE_YES;
@@ -72,6 +72,8 @@ int FromDPDKDevice::configure(Vector<String> &conf, ErrorHandler *errh)
         .read("MAXQUEUES", maxqueues)
         .read("TIMESTAMP", set_timestamp)
         .read("PAUSE", fc_mode)
+        .read("LATENCY_TARGET", SecondsArg(6), _latency_target)
+        .read("RX_INTR", _rx_intr)
         .complete() < 0)
         return -1;
 
@@ -115,6 +117,9 @@ int FromDPDKDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     if (fc_mode != FC_UNSET)
         _dev->set_init_fc_mode(fc_mode);
 
+    if (_rx_intr)
+        _dev->set_rx_intr();
+
     if (set_timestamp) {
 #if RTE_VERSION >= RTE_VERSION_NUM(18,02,0,0)
         _dev->set_rx_offload(DEV_RX_OFFLOAD_TIMESTAMP);
@@ -175,6 +180,13 @@ int FromDPDKDevice::initialize(ErrorHandler *errh)
     ret = initialize_tasks(_active,errh);
     if (ret != 0) return ret;
 
+    initialize_adaptive(_burst);
+
+    if (_rx_intr)
+        for (int i = 0; i < usable_threads.size(); i++)
+            if (usable_threads[i])
+                master()->thread(i)->add_wakeup(arm_rx_intr, this);
+
     if (queue_share > 1)
         return errh->error(
             "Sharing queue between multiple threads is not "
@@ -206,12 +218,65 @@ int FromDPDKDevice::initialize(ErrorHandler *errh)
 
 void FromDPDKDevice::cleanup(CleanupStage)
 {
+    if (_rx_intr)
+        for (int i = 0; i < usable_threads.size(); i++)
+            if (usable_threads[i])
+                master()->thread(i)->remove_wakeup(arm_rx_intr, this);
     cleanup_tasks();
 }
 
+/* Wakeup source of an adaptive polling thread about to block. The event
+ * file descriptors of the queues are added to the thread's SelectSet the
+ * first time, as they only exist once the device is started. */
+bool FromDPDKDevice::arm_rx_intr(bool arm, void *user_data)
+{
+    FromDPDKDevice *fd = static_cast<FromDPDKDevice *>(user_data);
+    uint16_t port = fd->_dev->port_id;
+    for (int q = fd->queue_for_thisthread_begin();
+            q <= fd->queue_for_thisthread_end(); q++) {
+        if (!arm) {
+            rte_eth_dev_rx_intr_disable(port, q);
+            continue;
+        }
+#if RTE_VERSION >= RTE_VERSION_NUM(18,11,0,0)
+        if (!*fd->_rx_intr_selected) {
+            int efd = rte_eth_dev_rx_intr_ctl_q_get_fd(port, q);
+            if (efd < 0)
+                goto fail;
+            fd->master()->thread(click_current_cpu_id())->select_set()
+                .add_select(efd, fd, SELECT_READ);
+        }
+        if (rte_eth_dev_rx_intr_enable(port, q) != 0)
+            goto fail;
+        // Packets received before the interrupt was enabled
+        if (rte_eth_rx_queue_count(port, q) > 0)
+            goto fail;
+#else
+        goto fail;
+#endif
+    }
+    if (arm)
+        *fd->_rx_intr_selected = true;
+    return true;
+
+  fail:
+    arm_rx_intr(false, user_data);
+    return false;
+}
+
+void FromDPDKDevice::selected(int fd, int)
+{
+    // The task is still scheduled, just clear the event
+    uint64_t v;
+    ignore_result(read(fd, &v, sizeof(v)));
+}
+
 bool FromDPDKDevice::run_task(Task *t)
 {
     struct rte_mbuf *pkts[_burst];
+    unsigned burst = current_burst();
+    if (burst > (unsigned) _burst)
+        burst = _burst;
     int ret = 0;
 
     for (int iqueue = queue_for_thisthread_begin();
@@ -220,11 +285,14 @@ bool FromDPDKDevice::run_task(Task *t)
          PacketBatch* head = 0;
          WritablePacket *last;
 #endif
-        unsigned n = rte_eth_rx_burst(_dev->port_id, iqueue, pkts, _burst);
+        click_cycles_t start = _latency_target ? click_get_cycles() : 0;
+        unsigned n = rte_eth_rx_burst(_dev->port_id, iqueue, pkts, burst);
         for (unsigned i = 0; i < n; ++i) {
             unsigned char* data = rte_pktmbuf_mtod(pkts[i], unsigned char *);
             rte_prefetch0(data);
 #if CLICK_PACKET_USE_DPDK
+            if (i + 1 < n)
+                reinterpret_cast<Packet *>(pkts[i + 1])->prefetch_anno();
             WritablePacket *p = static_cast<WritablePacket*>(Packet::make(pkts[i]));
 #elif HAVE_ZEROCOPY
             WritablePacket *p = Packet::make(data,
@@ -277,6 +345,8 @@ bool FromDPDKDevice::run_task(Task *t)
             add_count(n);
             ret = 1;
         }
+        if (_latency_target)
+            _adaptive->rx_update(n, click_get_cycles() - start);
     }
 
     /*We reschedule directly, as we cannot know if there is actually packet
@@ -564,6 +634,7 @@ void FromDPDKDevice::add_handlers()
 
     add_read_handler("mtu",read_handler, h_mtu);
     add_data_handlers("burst", Handler::h_read | Handler::h_write, &_burst);
+    add_read_handler("operating_point", operating_point_handler, 0);
 }
 
 CLICK_ENDDECLS
@@ -63,6 +63,21 @@ true. The default is false.
 Integer.  Maximal number of packets that will be processed before rescheduling.
 The default is 32.
 
+=item LATENCY_TARGET
+
+Time, in microseconds by default. If set, each thread tunes its burst between
+1 and BURST online: the burst grows while the device queue keeps more packets
+than a burst waiting, shrinks when polls return few packets, and is capped so
+that processing a burst takes less than LATENCY_TARGET. Default is 0, a static
+BURST.
+
+=item RX_INTR
+
+Boolean. If true, enable the RX interrupts of the device, so that threads
+running click --adaptive-poll can block until packets are received instead of
+waking up periodically. Requires DPDK 18.11 and a PMD supporting RX
+interrupts. Defaults to false.
+
 =item MAXTHREADS
 
 Maximal number of threads that this element will take to read packets from
@@ -149,6 +164,11 @@ support.
 
 Returns the number of packets read by the device.
 
+=h operating_point read-only
+
+Returns the current burst of each thread and, with LATENCY_TARGET, the
+average processing cost of a packet in cycles.
+
 =h reset_count write-only
 
 Resets "count" to zero.
@@ -178,6 +198,7 @@ public:
     void add_handlers() CLICK_COLD;
     void cleanup(CleanupStage) CLICK_COLD;
     bool run_task(Task *);
+    void selected(int fd, int mask) override;
 #if HAVE_DPDK_READ_CLOCK
     static uint64_t read_clock(void* thunk);
 #endif
@@ -193,8 +214,12 @@ private:
     static int xstats_handler(int operation, String &input, Element *e,
                               const Handler *handler, ErrorHandler *errh);
 
+    static bool arm_rx_intr(bool arm, void *user_data);
+
     DPDKDevice* _dev;
     bool _set_timestamp;
+    bool _rx_intr;
+    per_thread<bool> _rx_intr_selected;
 };
 
 CLICK_ENDDECLS
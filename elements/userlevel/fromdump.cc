@@ -51,8 +51,13 @@ CLICK_DECLS
 #define MAX_MTU 9000
 
 FromDump::FromDump()
-    : _packet(0), _preload(0), _preload_head(0), _force_len(DISABLED), _end_h(0), _count(0),  _timer(this), _task(this)
+    : _packet(0), _preload(0), _preload_head(0), _force_len(DISABLED),
+      _burst(32), _parts(1), _part(0), _part_end(-1),
+      _end_h(0), _count(0),  _timer(this), _task(this)
 {
+#if HAVE_BATCH
+    in_batch_mode = BATCH_MODE_YES;
+#endif
 }
 
 FromDump::~FromDump()
@@ -66,7 +71,7 @@ FromDump::cast(const char *n)
     if (strcmp(n, Notifier::EMPTY_NOTIFIER) == 0 && !output_is_push(0))
 	return static_cast<Notifier *>(&_notifier);
     else
-	return Element::cast(n);
+	return BatchElement::cast(n);
 }
 
 String
@@ -114,9 +119,19 @@ FromDump::configure(Vector<String> &conf, ErrorHandler *errh)
 #endif
     .read("FILEPOS", _packet_filepos)
     .read("PRELOAD", _preload)
+    .read("BURST", _burst)
+    .read("PARTS", _parts)
+    .read("PART", _part)
     .complete() < 0)
 	return -1;
 
+    if (_burst == 0)
+	return errh->error("BURST must be positive");
+    if (_parts < 1 || _part < 0 || _part >= _parts)
+	return errh->error("PART must be between 0 and PARTS - 1");
+    if (_parts > 1 && (_packet_filepos || _preload))
+	return errh->error("PARTS is incompatible with FILEPOS and PRELOAD");
+
     // check sampling rate
     if (_sampling_prob > (1 << SAMPLING_SHIFT)) {
 	errh->warning("SAMPLE probability reduced to 1");
@@ -278,6 +293,7 @@ FromDump::initialize(ErrorHandler *errh)
     if (fh->version_major != FAKE_PCAP_VERSION_MAJOR)
 	return _ff.error(errh, "unknown major version %d", fh->version_major);
     _minor_version = fh->version_minor;
+    _snaplen = fh->snaplen;
     // map possible host link types to global link types
     _linktype = fake_pcap_canonical_dlt(fh->linktype, true);
 
@@ -292,7 +308,22 @@ FromDump::initialize(ErrorHandler *errh)
 
     // maybe skip ahead in the file
     int result;
-    if (_packet_filepos != 0) {
+    if (_parts > 1) {
+	off_t size = _ff.file_size();
+	if (size < 0)
+	    return _ff.error(errh, "PARTS requires an uncompressed regular file");
+	off_t data = sizeof(fake_pcap_file_header);
+	off_t start = data;
+	if (_part > 0)
+	    start = resync(data + (size - data) * _part / _parts, size, errh);
+	if (_part < _parts - 1)
+	    _part_end = resync(data + (size - data) * (_part + 1) / _parts, size, errh);
+	else
+	    _part_end = size;
+	if (start < 0 || _part_end < 0)
+	    return -1;
+	result = _ff.seek(start, errh);
+    } else if (_packet_filepos != 0) {
 	result = _ff.seek(_packet_filepos, errh);
 	_packet_filepos = 0;
     } else
@@ -350,6 +381,11 @@ FromDump::take_state(Element *e, ErrorHandler *errh)
 
     _timing_offset = o->_timing_offset;
     _packet_filepos = o->_packet_filepos;
+    _snaplen = o->_snaplen;
+    if (_parts == o->_parts && _part == o->_part)
+	_part_end = o->_part_end;
+    else
+	_ff.warning(errh, "PARTS changed; reading to the end of the file");
 }
 
 void
@@ -387,6 +423,75 @@ FromDump::prepare_times(const Timestamp &ts)
     _have_any_times = true;
 }
 
+bool
+FromDump::plausible_header(const unsigned char *data, uint32_t &caplen,
+			   Timestamp &ts) const
+{
+    fake_pcap_pkthdr swapped_ph;
+    const fake_pcap_pkthdr *ph;
+    memcpy(&swapped_ph, data, sizeof(swapped_ph));
+    if (_swapped)
+	swap_packet_header(&swapped_ph, &swapped_ph);
+    ph = &swapped_ph;
+
+    uint32_t subsec_limit = _have_nanosecond_timestamps ? 1000000000 : 1000000;
+    uint32_t snaplen = (_snaplen && _snaplen < 65535 ? _snaplen : 65535);
+    if (ph->caplen > snaplen || ph->caplen > ph->len || ph->len > 262144
+	|| (uint32_t) ph->ts.tv.tv_usec >= subsec_limit)
+	return false;
+    caplen = ph->caplen;
+    ts = fake_bpf_timeval_union::make_timestamp(&ph->ts, _have_nanosecond_timestamps);
+    return true;
+}
+
+// Returns the offset of the first packet header at or after 'offset'. A
+// record boundary is accepted when the header there, and the two headers it
+// chains to, are plausible and less than a day apart.
+off_t
+FromDump::resync(off_t offset, off_t size, ErrorHandler *errh)
+{
+    const uint32_t hlen = sizeof(fake_pcap_pkthdr) + _extra_pkthdr_crap;
+    const uint32_t chain = 3;
+    const uint32_t window = (chain + 1) * (hlen + 65535);
+    unsigned char *buf = new unsigned char[window];
+    off_t result = size;
+
+    for (off_t base = offset; base < size; base += window - chain * (hlen + 65535)) {
+	ssize_t got = _ff.pread(buf, window, base);
+	if (got < 0) {
+	    result = _ff.error(errh, "pread: %s", strerror(-got));
+	    break;
+	}
+	uint32_t limit = got < (ssize_t) window ? got : window - chain * (hlen + 65535);
+	for (uint32_t i = 0; i < limit; i++) {
+	    uint32_t pos = i, k;
+	    Timestamp first;
+	    for (k = 0; k < chain && pos + hlen <= (uint32_t) got; k++) {
+		uint32_t caplen;
+		Timestamp ts;
+		if (!plausible_header(buf + pos, caplen, ts))
+		    break;
+		if (k == 0)
+		    first = ts;
+		else if (ts > first + Timestamp(86400) || first > ts + Timestamp(86400))
+		    break;
+		pos += hlen + caplen;
+	    }
+	    // A header chain that runs exactly into the end of file counts.
+	    if (k == chain || (k > 0 && base + pos == size)) {
+		result = base + i;
+		goto done;
+	    }
+	}
+	if (got < (ssize_t) window)
+	    break;
+    }
+
+  done:
+    delete[] buf;
+    return result;
+}
+
 bool
 FromDump::read_packet(ErrorHandler *errh)
 {
@@ -405,6 +510,8 @@ FromDump::read_packet(ErrorHandler *errh)
 
     // record file position
     _packet_filepos = _ff.file_pos();
+    if (_part_end >= 0 && _packet_filepos >= _part_end)
+	return false;
 
     // read the packet header
     if (!(ph = reinterpret_cast<const fake_pcap_pkthdr *>(_ff.get_aligned(sizeof(*ph), &swapped_ph))))
@@ -587,6 +694,47 @@ FromDump::run_task(Task *)
     if (!_active)
 	return false;
 
+#if HAVE_BATCH
+    PacketBatch *head = 0;
+    Packet *last = 0;
+    unsigned n = 0, retry_count = 0;
+    bool more = true, waiting = false;
+    while (n < _burst) {
+	if (!_packet && !read_packet(0)) {
+	    more = false;
+	    break;
+	}
+	if (_packet && _timing && !check_timing(_packet)) {
+	    waiting = true;
+	    break;
+	}
+	if (_packet && _force_ip && !fake_pcap_force_ip(_packet, _linktype)) {
+	    checked_output_push(1, _packet);
+	    _packet = 0;
+	}
+	if (_packet) {
+	    if (head)
+		last->set_next(_packet);
+	    else
+		head = PacketBatch::start_head(_packet);
+	    last = _packet;
+	    _packet = 0;
+	    n++;
+	} else if (++retry_count >= 16)
+	    break;
+    }
+
+    if (n) {
+	_count += n;
+	output_push_batch(0, head->make_tail(last, n));
+    }
+    if (!more) {
+	if (_end_h)
+	    _end_h->call_write(ErrorHandler::default_handler());
+    } else if (!waiting)
+	_task.fast_reschedule();
+    return n > 0;
+#else
     int retry_count = 0;
   again:
     if (!_packet && !read_packet(0)) {
@@ -611,6 +759,7 @@ FromDump::run_task(Task *)
 	return true;
     } else
     return false;
+#endif
 }
 
 Packet *
@@ -645,6 +794,16 @@ FromDump::pull(int)
     }
 }
 
+#if HAVE_BATCH
+PacketBatch *
+FromDump::pull_batch(int port, unsigned max)
+{
+    PacketBatch *batch;
+    MAKE_BATCH(FromDump::pull(port), batch, (max > _burst ? _burst : max));
+    return batch;
+}
+#endif
+
 enum {
     H_SAMPLING_PROB, H_ACTIVE, H_ENCAP, H_STOP, H_PACKET_FILEPOS,
     H_EXTEND_INTERVAL, H_COUNT, H_RESET_COUNTS, H_RESET_TIMING
@@ -0,0 +1,242 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * latencymeter.{cc,hh} -- in-line packet latency measurement
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "latencymeter.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+static int
+configure_clock(Element *clocke, UserClockSource &clock, void *&thunk,
+		ErrorHandler *errh)
+{
+    thunk = 0;
+    if (clocke) {
+	UserClockSource *source =
+	    static_cast<UserClockSource *>(clocke->cast("UserClockSource"));
+	if (!source)
+	    return errh->error("%p{element} is not a UserClockSource", clocke);
+	clock = *source;
+	thunk = clocke;
+    }
+    return 0;
+}
+
+//
+// LatencyStamp
+//
+
+LatencyStamp::LatencyStamp()
+    : _clock_thunk(0)
+{
+}
+
+int
+LatencyStamp::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    Element *clocke = 0;
+    if (Args(conf, this, errh)
+	.read("CLOCK", clocke)
+	.complete() < 0)
+	return -1;
+    return configure_clock(clocke, _clock, _clock_thunk, errh);
+}
+
+Packet *
+LatencyStamp::simple_action(Packet *p)
+{
+    p->timestamp_anno().assignlong(now());
+    return p;
+}
+
+#if HAVE_BATCH
+PacketBatch *
+LatencyStamp::simple_action_batch(PacketBatch *batch)
+{
+    int64_t t = now();
+    FOR_EACH_PACKET(batch, p)
+	p->timestamp_anno().assignlong(t);
+    return batch;
+}
+#endif
+
+//
+// LatencyMeter
+//
+
+LatencyMeter::LatencyMeter()
+    : _clock_thunk(0), _hz(0), _reset_on_read(false)
+{
+    memset(&_base, 0, sizeof(_base));
+}
+
+int
+LatencyMeter::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    Element *clocke = 0;
+    if (Args(conf, this, errh)
+	.read("CLOCK", clocke)
+	.read("HZ", _hz)
+	.read("RESET_ON_READ", _reset_on_read)
+	.complete() < 0)
+	return -1;
+    return configure_clock(clocke, _clock, _clock_thunk, errh);
+}
+
+// Measure the frequency of the time stamp counter against the steady clock.
+static uint64_t
+tsc_hz()
+{
+    static uint64_t hz;
+    if (!hz) {
+#if HAVE_DPDK
+	hz = cycles_hz();
+#else
+	Timestamp t0 = Timestamp::now_steady(), t1;
+	click_cycles_t c0 = click_get_cycles(), c1;
+	do {
+	    t1 = Timestamp::now_steady();
+	    c1 = click_get_cycles();
+	} while ((t1 - t0).msecval() < 20);
+	hz = (uint64_t) ((c1 - c0) / (t1 - t0).doubleval());
+#endif
+    }
+    return hz;
+}
+
+int
+LatencyMeter::initialize(ErrorHandler *errh)
+{
+    if (!_hz && _clock_thunk && _clock.get_tick_hz)
+	_hz = _clock.get_tick_hz(_clock_thunk);
+    else if (!_hz && !_clock_thunk)
+	_hz = tsc_hz();
+    if (!_hz)
+	return errh->error("the frequency of the clock is unknown, set HZ");
+    if (MetricRegistry *reg = MetricRegistry::find(router()))
+	reg->add(this, "latency_ticks", "Packet latency in clock ticks.",
+		 &_latency);
+    return 0;
+}
+
+Packet *
+LatencyMeter::simple_action(Packet *p)
+{
+    record(p, now());
+    return p;
+}
+
+#if HAVE_BATCH
+PacketBatch *
+LatencyMeter::simple_action_batch(PacketBatch *batch)
+{
+    uint64_t t = now();
+    FOR_EACH_PACKET(batch, p)
+	record(p, t);
+    return batch;
+}
+#endif
+
+// Return the packets recorded since the last reset in @a snap. The threads
+// keep recording: a reset only moves the base snapshot.
+void
+LatencyMeter::interval(MetricHistogram::Snapshot &snap)
+{
+    // Under the lock, so a concurrent read cannot move the base past snap
+    _base_lock.acquire();
+    _latency.snapshot(snap);
+    for (int i = 0; i < MetricHistogram::nbuckets; i++)
+	snap.b[i] -= _base.b[i];
+    snap.count -= _base.count;
+    snap.sum -= _base.sum;
+    if (_reset_on_read) {
+	for (int i = 0; i < MetricHistogram::nbuckets; i++)
+	    _base.b[i] += snap.b[i];
+	_base.count += snap.count;
+	_base.sum += snap.sum;
+    }
+    _base_lock.release();
+}
+
+double
+LatencyMeter::ns(uint64_t ticks) const
+{
+    return ticks * 1e9 / _hz;
+}
+
+String
+LatencyMeter::read_handler(Element *e, void *thunk)
+{
+    LatencyMeter *lm = static_cast<LatencyMeter *>(e);
+    int what = (intptr_t) thunk;
+    if (what == h_invalid)
+	return String(lm->_invalid.value());
+
+    MetricHistogram::Snapshot *snap = new MetricHistogram::Snapshot;
+    lm->interval(*snap);
+    uint64_t v[h_summary];
+    v[h_count] = snap->count;
+    v[h_mean] = snap->count ? lm->ns(snap->sum) / snap->count + 0.5 : 0;
+    v[h_p50] = lm->ns(snap->quantile(0.5)) + 0.5;
+    v[h_p99] = lm->ns(snap->quantile(0.99)) + 0.5;
+    v[h_p999] = lm->ns(snap->quantile(0.999)) + 0.5;
+    v[h_max] = lm->ns(snap->quantile(1)) + 0.5;
+    delete snap;
+
+    if (what != h_summary)
+	return String(v[what]);
+    static const char * const names[] = {
+	"count", "mean", "p50", "p99", "p999", "max"
+    };
+    StringAccum sa;
+    for (int i = 0; i < h_summary; i++)
+	sa << names[i] << ' ' << v[i] << '\n';
+    return sa.take_string();
+}
+
+int
+LatencyMeter::write_handler(const String &, Element *e, void *,
+			    ErrorHandler *)
+{
+    LatencyMeter *lm = static_cast<LatencyMeter *>(e);
+    lm->_base_lock.acquire();
+    lm->_latency.snapshot(lm->_base);
+    lm->_base_lock.release();
+    return 0;
+}
+
+void
+LatencyMeter::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("mean", read_handler, h_mean);
+    add_read_handler("p50", read_handler, h_p50);
+    add_read_handler("p99", read_handler, h_p99);
+    add_read_handler("p999", read_handler, h_p999);
+    add_read_handler("max", read_handler, h_max);
+    add_read_handler("summary", read_handler, h_summary);
+    add_read_handler("invalid", read_handler, h_invalid);
+    add_write_handler("reset", write_handler, h_reset, Handler::f_button);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(LatencyStamp)
+EXPORT_ELEMENT(LatencyMeter)
+ELEMENT_MT_SAFE(LatencyStamp)
+ELEMENT_MT_SAFE(LatencyMeter)
@@ -0,0 +1,211 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_LATENCYMETER_HH
+#define CLICK_LATENCYMETER_HH
+#include <click/batchelement.hh>
+#include <click/metrics.hh>
+#include "tscclock.hh"
+CLICK_DECLS
+
+/*
+=c
+
+LatencyStamp([I<keywords> CLOCK])
+
+=s timestamps
+
+stamps packets with the current clock tick
+
+=d
+
+Stores the current tick of a clock in the timestamp annotation of every
+packet, for a LatencyMeter further down the path. The annotation then holds
+raw ticks, not a time of day, as with FromDPDKDevice's TIMESTAMP option.
+
+The clock is read once per batch, so all the packets of a batch carry the
+same stamp.
+
+Keyword arguments are:
+
+=over 8
+
+=item CLOCK
+
+Element. A clock source, such as FromDPDKDevice, to read instead of the CPU's
+time stamp counter. It must be the same as the CLOCK of the LatencyMeter.
+
+=back
+
+=a LatencyMeter, TSCClock */
+
+class LatencyStamp : public BatchElement { public:
+
+    LatencyStamp() CLICK_COLD;
+
+    const char *class_name() const	{ return "LatencyStamp"; }
+    const char *port_count() const	{ return PORTS_1_1; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+
+    Packet *simple_action(Packet *);
+#if HAVE_BATCH
+    PacketBatch *simple_action_batch(PacketBatch *);
+#endif
+
+  private:
+
+    UserClockSource _clock;
+    void *_clock_thunk;
+
+    inline uint64_t now() const {
+	return _clock_thunk ? _clock.get_current_tick(_clock_thunk)
+	    : click_get_cycles();
+    }
+
+};
+
+/*
+=c
+
+LatencyMeter([I<keywords> CLOCK, HZ, RESET_ON_READ])
+
+=s timestamps
+
+measures the latency of packets stamped by LatencyStamp
+
+=d
+
+Subtracts the tick stored in each packet's timestamp annotation, by
+LatencyStamp or by FromDPDKDevice's TIMESTAMP option, from the current tick,
+and records the difference in a log-linear histogram. Each thread records
+into its own histogram, without locks or atomic operations; the handlers sum
+them. Percentiles are accurate to within 1/16 of their value.
+
+Packets with a zero timestamp annotation, or stamped later than they are
+measured, are counted as invalid and not recorded. Packets are emitted
+unchanged.
+
+Keyword arguments are:
+
+=over 8
+
+=item CLOCK
+
+Element. The clock source that stamped the packets, such as FromDPDKDevice.
+Default is the CPU's time stamp counter.
+
+=item HZ
+
+Integer. The frequency of the clock, used to convert ticks to nanoseconds.
+Default is the frequency reported by CLOCK, or the measured frequency of the
+time stamp counter.
+
+=item RESET_ON_READ
+
+Boolean. If true, reading any statistics handler starts a new measurement
+interval, so that each read reports the packets measured since the previous
+one. Read C<summary> to get all statistics of an interval at once. Default
+is false.
+
+=back
+
+If the configuration contains a Metrics element, the histogram is also
+exported as latency_ticks. That export is never reset.
+
+=h count read-only
+
+Number of packets measured.
+
+=h mean read-only
+
+Mean latency in nanoseconds.
+
+=h p50 read-only
+
+Median latency in nanoseconds.
+
+=h p99 read-only
+
+99th percentile of latency in nanoseconds.
+
+=h p999 read-only
+
+99.9th percentile of latency in nanoseconds.
+
+=h max read-only
+
+Maximum latency in nanoseconds, given as the upper bound of the histogram
+bucket holding it. Like the percentiles, it may exceed the measured value by
+up to the bucket's width.
+
+=h summary read-only
+
+All of the above, one "NAME VALUE" pair per line.
+
+=h invalid read-only
+
+Number of packets that were not recorded.
+
+=h reset write-only
+
+Starts a new measurement interval.
+
+=e
+
+  FromDPDKDevice(0) -> LatencyStamp -> ... -> lm :: LatencyMeter -> ToDPDKDevice(1);
+
+=a LatencyStamp, TSCClock, Metrics, TimestampDiff */
+
+class LatencyMeter : public BatchElement { public:
+
+    LatencyMeter() CLICK_COLD;
+
+    const char *class_name() const	{ return "LatencyMeter"; }
+    const char *port_count() const	{ return PORTS_1_1; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    Packet *simple_action(Packet *);
+#if HAVE_BATCH
+    PacketBatch *simple_action_batch(PacketBatch *);
+#endif
+
+  private:
+
+    UserClockSource _clock;
+    void *_clock_thunk;
+    uint64_t _hz;
+    bool _reset_on_read;
+
+    MetricHistogram _latency;
+    MetricCounter _invalid;
+    MetricHistogram::Snapshot _base;
+    Spinlock _base_lock;
+
+    inline uint64_t now() const {
+	return _clock_thunk ? _clock.get_current_tick(_clock_thunk)
+	    : click_get_cycles();
+    }
+
+    inline void record(Packet *p, uint64_t now) {
+	int64_t stamp = p->timestamp_anno().longval();
+	if (likely(stamp != 0 && (uint64_t) stamp <= now))
+	    _latency.record(now - stamp);
+	else
+	    ++_invalid;
+    }
+
+    void interval(MetricHistogram::Snapshot &snap);
+    double ns(uint64_t ticks) const;
+
+    enum { h_count, h_mean, h_p50, h_p99, h_p999, h_max, h_summary,
+	   h_invalid, h_reset };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *,
+			     ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -19,6 +19,7 @@
 #include <click/config.h>
 
 #include "queuedevice.hh"
+#include <click/straccum.hh>
 
 CLICK_DECLS
 
@@ -31,7 +32,8 @@ int QueueDevice::use_nodes = 0;
 Vector<int> QueueDevice::inputs_count = Vector<int>();
 Vector<int> QueueDevice::shared_offset = Vector<int>();
 
-QueueDevice::QueueDevice() : _minqueues(0),_maxqueues(128), usable_threads(),
+QueueDevice::QueueDevice() : _minqueues(0),_maxqueues(128), _latency_target(0),
+    usable_threads(),
     queue_per_threads(1), queue_share(1), ndesc(0), allow_nonexistent(false),
     _maxthreads(-1), _minthreads(0), firstqueue(-1), lastqueue(-1), n_queues(-1),
     thread_share(1), _this_node(0), _active(true) {
@@ -515,6 +517,34 @@ String QueueDevice::dropped_handler(Element *e, void *)
     return String(tdd->n_dropped());
 }
 
+void QueueDevice::initialize_adaptive(unsigned max_burst)
+{
+    if (!_latency_target)
+        return;
+    for (unsigned i = 0; i < _adaptive.weight(); i++)
+        _adaptive.get_value(i).configure(_latency_target, 1, max_burst);
+}
+
+String QueueDevice::operating_point_handler(Element *e, void *)
+{
+    QueueDevice *tdd = static_cast<QueueDevice *>(e);
+    StringAccum sa;
+    for (unsigned i = 0; i < tdd->_thread_state.weight(); i++) {
+        if (tdd->_thread_state.get_value(i).first_queue_id == (unsigned) -1)
+            continue;
+        sa << "thread " << i << ": burst ";
+        if (!tdd->_latency_target) {
+            sa << tdd->_burst << '\n';
+            continue;
+        }
+        const AdaptiveBurst &ab = tdd->_adaptive.get_value(i);
+        sa << ab.burst() << ", cycles_per_packet " << ab.cost()
+           << ", flush_delay "
+           << (ab.flush_delay() * 1000000 / cycles_hz()) << "us\n";
+    }
+    return sa.take_string();
+}
+
 int QueueDevice::reset_count_handler(const String &, Element *e, void *,
                                 ErrorHandler *)
 {
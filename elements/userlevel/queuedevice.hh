@@ -10,10 +10,110 @@
 #include <click/multithread.hh>
 #include <click/standard/scheduleinfo.hh>
 #include <click/args.hh>
+#include <click/ewma.hh>
 #if HAVE_NUMA
 #include <click/numa.hh>
 #endif
 
+/**
+ * Burst size tuned online toward a latency target
+ *
+ * On the receive side, rx_update() gets the number of packets a poll
+ * returned and the cycles spent processing them. The burst doubles while
+ * polls come back full, as packets are then waiting in the NIC ring, and
+ * shrinks when they come back mostly empty. It never grows past the number
+ * of packets the path can process within the target.
+ *
+ * On the transmit side, tx_update() gets the number of packets enqueued.
+ * The coalescing threshold is the number of packets expected to arrive in
+ * half the target, measured over the last target period, so that a batch
+ * does not wait much longer than flush_delay(), the other half, to fill.
+ */
+class AdaptiveBurst { public:
+
+    AdaptiveBurst()
+        : _target(0), _min(1), _max(32), _burst(32),
+          _window_start(0), _window_count(0) {
+    }
+
+    /** @brief Aim for @a target_us microseconds, with bursts between
+     * @a min and @a max packets. */
+    void configure(uint32_t target_us, unsigned min, unsigned max) {
+        _target = (click_cycles_t) target_us * cycles_hz() / 1000000;
+        _min = min < 1 ? 1 : min;
+        _max = max < _min ? _min : max;
+        _burst = _max;
+        _cost.clear();
+        _window_start = click_get_cycles();
+        _window_count = 0;
+    }
+
+    bool enabled() const {
+        return _target != 0;
+    }
+
+    unsigned burst() const {
+        return _burst;
+    }
+
+    /** @brief Return the average processing cost of a packet, in cycles. */
+    unsigned cost() const {
+        return _cost.unscaled_average();
+    }
+
+    /** @brief Return how long a partial TX batch may wait, in cycles. */
+    click_cycles_t flush_delay() const {
+        return _target / 2;
+    }
+
+    inline void rx_update(unsigned n, click_cycles_t cycles);
+    inline void tx_update(unsigned n, click_cycles_t now);
+
+  private:
+
+    click_cycles_t _target;
+    unsigned _min;
+    unsigned _max;
+    unsigned _burst;
+    DirectEWMA _cost;
+    click_cycles_t _window_start;
+    uint64_t _window_count;
+
+    unsigned bound(uint64_t b) const {
+        return b < _min ? _min : (b > _max ? _max : (unsigned) b);
+    }
+
+};
+
+inline void
+AdaptiveBurst::rx_update(unsigned n, click_cycles_t cycles)
+{
+    // An empty poll says nothing of the cost, but the burst must shrink
+    if (n > 0)
+        _cost.update(cycles / n);
+    uint64_t b = _burst;
+    if (n >= _burst)
+        b *= 2;
+    else if (n < _burst / 4)
+        b -= b / 4;
+    unsigned cost = _cost.unscaled_average();
+    if (cost && b > _target / cost)
+        b = _target / cost;
+    _burst = bound(b);
+}
+
+inline void
+AdaptiveBurst::tx_update(unsigned n, click_cycles_t now)
+{
+    _window_count += n;
+    click_cycles_t elapsed = now - _window_start;
+    if (elapsed < _target)
+        return;
+    _burst = bound(_window_count * (_target / 2) / elapsed);
+    _window_start = now;
+    _window_count = 0;
+}
+
 class RXQueueDevice;
 class TXQueueDevice;
 class QueueDevice : public BatchElement {
@@ -35,6 +135,22 @@ protected:
 
 	int _burst; //Max size of burst
 
+    uint32_t _latency_target; //In microseconds, 0 for static bursts
+    per_thread<AdaptiveBurst> _adaptive;
+
+    /**
+     * Start tuning bursts between 1 and max_burst for every thread, if a
+     * latency target is set.
+     */
+    void initialize_adaptive(unsigned max_burst);
+
+    /**
+     * Burst to use by the current thread
+     */
+    inline unsigned current_burst() {
+        return _latency_target ? _adaptive->burst() : _burst;
+    }
+
 
     #define NO_LOCK 2
     /**
@@ -133,13 +249,14 @@ protected:
         }
     }
 
-    enum {h_count};
+    enum {h_count, h_operating_point};
 
     unsigned long long n_count();
     unsigned long long n_dropped();
     void reset_count();
     static String count_handler(Element *e, void *user_data);
     static String dropped_handler(Element *e, void *);
+    static String operating_point_handler(Element *e, void *);
 
     static int reset_count_handler(const String &, Element *e, void *,
                                     ErrorHandler *);
@@ -20,6 +20,8 @@
 #include <click/args.hh>
 #include <click/error.hh>
 
+#include <rte_ring.h>
+
 #include "todpdkdevice.hh"
 
 CLICK_DECLS
@@ -27,7 +29,7 @@ CLICK_DECLS
 ToDPDKDevice::ToDPDKDevice() :
     _iqueues(), _dev(0),
     _timeout(0), _congestion_warning_printed(false), _create(true),
-    _tso(0), _tco(false), _ipco(false)
+    _tso(0), _tco(false), _ipco(false), _mpsc(false)
 {
      _blocking = false;
      _burst = -1;
@@ -54,9 +56,11 @@ int ToDPDKDevice::configure(Vector<String> &conf, ErrorHandler *errh)
 
     if (Args(conf, this, errh)
         .read("TIMEOUT", _timeout)
+        .read("LATENCY_TARGET", SecondsArg(6), _latency_target)
         .read("NDESC",ndesc)
         .read("MAXQUEUES", maxqueues)
         .read("ALLOC",_create)
+        .read("MPSC", _mpsc)
 #if RTE_VERSION >= RTE_VERSION_NUM(18,02,0,0)
         .read("TSO", _tso)
         .read("IPCO", _ipco)
@@ -126,6 +130,36 @@ int ToDPDKDevice::initialize(ErrorHandler *errh)
     if (ret != 0)
         return ret;
 
+    initialize_adaptive(_burst);
+
+    // Queues with a lock are used by multiple threads
+    if (_mpsc) {
+        // Ring names are unique per instance, as on hot-swap the old
+        // element still holds its rings until cleanup
+        static unsigned instances = 0;
+        unsigned instance = instances++;
+        _shared.resize(n_queues);
+        for (int i = 0; i < n_queues; i++) {
+            if (_q_infos[i].lock.nonatomic_value() == NO_LOCK)
+                continue;
+            String ring_name = "click_tx_" + String((int)_dev->port_id) +
+                "_" + String(firstqueue + i) + "_" + String(instance);
+#ifdef RING_F_EXACT_SZ
+            _shared[i].ring = rte_ring_create(ring_name.c_str(),
+                _internal_tx_queue_size, rte_socket_id(),
+                RING_F_SC_DEQ | RING_F_EXACT_SZ);
+#else
+            // The count must be a power of two, and one slot stays unused
+            _shared[i].ring = rte_ring_create(ring_name.c_str(),
+                rte_align32pow2(_internal_tx_queue_size + 1), rte_socket_id(),
+                RING_F_SC_DEQ);
+#endif
+            if (!_shared[i].ring)
+                return errh->error("Could not create the MPSC ring of queue %d",
+                                   firstqueue + i);
+        }
+    }
+
     for (unsigned i = 0; i < _iqueues.weight(); i++) {
         _iqueues.get_value(i).pkts = new struct rte_mbuf *[_internal_tx_queue_size];
         _iqueues.get_value(i).timeout.assign(this);
@@ -151,6 +185,21 @@ void ToDPDKDevice::cleanup(CleanupStage)
     for (unsigned i = 0; i < _iqueues.weight(); i++) {
         delete[] _iqueues.get_value(i).pkts;
     }
+    for (int i = 0; i < _shared.size(); i++) {
+        SharedTXQueue &sq = _shared[i];
+        if (!sq.ring)
+            continue;
+        // Free the packets no thread got to send
+        for (unsigned j = 0; j < sq.n; j++)
+            rte_pktmbuf_free(sq.pkts[j]);
+        sq.n = 0;
+        void *m;
+        while (rte_ring_sc_dequeue(sq.ring, &m) == 0)
+            rte_pktmbuf_free((struct rte_mbuf *) m);
+#if RTE_VERSION >= RTE_VERSION_NUM(17,5,0,0)
+        rte_ring_free(sq.ring);
+#endif
+    }
 }
 
 String ToDPDKDevice::statistics_handler(Element *e, void * thunk)
@@ -175,6 +224,29 @@ String ToDPDKDevice::statistics_handler(Element *e, void * thunk)
     return 0;
 }
 
+String ToDPDKDevice::shared_handler(Element *e, void * thunk)
+{
+    ToDPDKDevice *td = static_cast<ToDPDKDevice *>(e);
+    uint64_t contended = 0, drains = 0, drain_cycles = 0;
+    for (unsigned i = 0; i < td->_shared_stats.weight(); i++) {
+        const SharedTXStats &s = td->_shared_stats.get_value(i);
+        contended += s.contended;
+        drains += s.drains;
+        drain_cycles += s.drain_cycles;
+    }
+
+    switch((uintptr_t) thunk) {
+        case h_contention:
+            return String(contended);
+        case h_drain_latency:
+            if (!drains)
+                return "0";
+            return String(drain_cycles / drains * 1000000000 / cycles_hz());
+    }
+
+    return 0;
+}
+
 void ToDPDKDevice::add_handlers()
 {
     add_read_handler("count", count_handler, 0);
@@ -184,18 +256,29 @@ void ToDPDKDevice::add_handlers()
     add_read_handler("hw_count",statistics_handler, h_opackets);
     add_read_handler("hw_bytes",statistics_handler, h_obytes);
     add_read_handler("hw_errors",statistics_handler, h_oerrors);
+    add_read_handler("operating_point", operating_point_handler, 0);
+    add_read_handler("contention", shared_handler, h_contention);
+    add_read_handler("drain_latency", shared_handler, h_drain_latency);
 }
 
 inline void ToDPDKDevice::set_flush_timer(DPDKDevice::TXInternalQueue &iqueue) {
-    if (_timeout >= 0 || iqueue.nr_pending) {
+    unsigned pending = iqueue.nr_pending;
+    //Packets of a shared queue refused by the NIC must be retried too
+    if (shared_queue()) {
+        SharedTXQueue &sq = _shared[id_for_thread()];
+        pending += sq.n + rte_ring_count(sq.ring);
+    }
+    if (_timeout >= 0 || _latency_target || pending) {
         if (iqueue.timeout.scheduled()) {
             //No more pending packets, remove timer
-            if (iqueue.nr_pending == 0)
+            if (pending == 0)
                 iqueue.timeout.unschedule();
         } else {
-            if (iqueue.nr_pending > 0) {
+            if (pending > 0) {
                 //Pending packets, set timeout to flush packets after a while even without burst
-                if (_timeout <= 0)
+                if (_latency_target)
+                    iqueue.timeout.schedule_after(Timestamp::make_usec(_latency_target / 2));
+                else if (_timeout <= 0)
                     iqueue.timeout.schedule_now();
                 else
                     iqueue.timeout.schedule_after_msec(_timeout);
@@ -206,7 +289,10 @@ inline void ToDPDKDevice::set_flush_timer(DPDKDevice::TXInternalQueue &iqueue) {
 
 void ToDPDKDevice::run_timer(Timer *)
 {
-    flush_internal_tx_queue(_iqueues.get());
+    DPDKDevice::TXInternalQueue &iqueue = _iqueues.get();
+    flush_internal_tx_queue(iqueue);
+    if (shared_queue())
+        set_flush_timer(iqueue);
 }
 
 /* Flush as much as possible packets from a given internal queue to the DPDK
@@ -223,6 +309,11 @@ void ToDPDKDevice::flush_internal_tx_queue(DPDKDevice::TXInternalQueue &iqueue)
      */
     unsigned sub_burst;
 
+    if (shared_queue()) {
+        flush_shared_tx_queue(iqueue);
+        return;
+    }
+
     lock(); // ! This is a queue lock, not a thread lock.
 
     do {
@@ -246,11 +337,95 @@ void ToDPDKDevice::flush_internal_tx_queue(DPDKDevice::TXInternalQueue &iqueue)
     add_count(sent);
 }
 
+/* Hand the packets of the internal queue over to the ring of the shared TX
+ * queue, then drain the ring if no other thread is doing it. */
+void ToDPDKDevice::flush_shared_tx_queue(DPDKDevice::TXInternalQueue &iqueue) {
+    SharedTXQueue &sq = _shared[id_for_thread()];
+    unsigned sub_burst;
+    unsigned n;
+
+    while (iqueue.nr_pending > 0) {
+        sub_burst = iqueue.nr_pending;
+        if (iqueue.index + sub_burst >= (unsigned)_internal_tx_queue_size)
+            sub_burst = _internal_tx_queue_size - iqueue.index;
+#if RTE_VERSION >= RTE_VERSION_NUM(17,5,0,0)
+        n = rte_ring_mp_enqueue_burst(sq.ring,
+            (void* const*)&iqueue.pkts[iqueue.index], sub_burst, 0);
+#else
+        n = rte_ring_mp_enqueue_burst(sq.ring,
+            (void* const*)&iqueue.pkts[iqueue.index], sub_burst);
+#endif
+        iqueue.nr_pending -= n;
+        iqueue.index += n;
+        if (iqueue.index >= (unsigned)_internal_tx_queue_size)
+            iqueue.index = 0;
+        //The ring is full, the rest stays in the internal queue
+        if (n < sub_burst)
+            break;
+    }
+
+    /* A producer failing to take the lock relies on the drainer to send its
+     * packets, so the drainer checks the ring again after releasing the
+     * lock. */
+    unsigned sent = 0;
+    while (sq.n || !rte_ring_empty(sq.ring)) {
+        if (!lock_attempt()) {
+            _shared_stats->contended++;
+            break;
+        }
+        click_cycles_t start = click_get_cycles();
+        n = drain_shared_tx_queue(sq);
+        sent += n;
+        bool stalled = sq.n > 0;
+        unlock();
+        click_fence();
+        SharedTXStats &stats = *_shared_stats;
+        stats.drains++;
+        stats.drain_cycles += click_get_cycles() - start;
+        //The NIC ring is full, the flush timer will retry
+        if (stalled)
+            break;
+    }
+
+    add_count(sent);
+}
+
+/* Send the content of a shared ring, with the queue lock held. Returns the
+ * number of packets sent. */
+unsigned ToDPDKDevice::drain_shared_tx_queue(SharedTXQueue &sq) {
+    unsigned sent = 0;
+    unsigned r;
+    while (true) {
+        if (sq.n == 0) {
+#if RTE_VERSION >= RTE_VERSION_NUM(17,5,0,0)
+            sq.n = rte_ring_sc_dequeue_burst(sq.ring, (void **)sq.pkts, 32, 0);
+#else
+            sq.n = rte_ring_sc_dequeue_burst(sq.ring, (void **)sq.pkts, 32);
+#endif
+            if (sq.n == 0)
+                break;
+        }
+        r = rte_eth_tx_burst(_dev->port_id, queue_for_thisthread_begin(),
+                             sq.pkts, sq.n);
+        sent += r;
+        if (r < sq.n) {
+            memmove(sq.pkts, sq.pkts + r, (sq.n - r) * sizeof(struct rte_mbuf *));
+            sq.n -= r;
+            break;
+        }
+        sq.n = 0;
+    }
+    return sent;
+}
+
 void ToDPDKDevice::push(int, Packet *p)
 {
     // Get the thread-local internal queue
     DPDKDevice::TXInternalQueue &iqueue = _iqueues.get();
 
+    if (_latency_target)
+        _adaptive->tx_update(1, click_get_cycles());
+
     bool congestioned;
     do {
         congestioned = false;
@@ -280,7 +455,7 @@ void ToDPDKDevice::push(int, Packet *p)
             }
         }
 
-        if ((int)iqueue.nr_pending >= _burst || congestioned) {
+        if (iqueue.nr_pending >= current_burst() || congestioned) {
             flush_internal_tx_queue(iqueue);
         }
         set_flush_timer(iqueue); //We wait until burst for sending packets, so flushing timer is especially important here
@@ -316,6 +491,9 @@ void ToDPDKDevice::push_batch(int, PacketBatch *head)
     // Get the thread-local internal queue
     DPDKDevice::TXInternalQueue &iqueue = _iqueues.get();
 
+    if (_latency_target)
+        _adaptive->tx_update(head->count(), click_get_cycles());
+
     Packet* p = head;
     Packet* next;
 
@@ -356,7 +534,7 @@ void ToDPDKDevice::push_batch(int, PacketBatch *head)
         }
 
         //Flush the queue if we have pending packets
-        if ((int)iqueue.nr_pending >= _burst || congestioned) {
+        if (iqueue.nr_pending >= current_burst() || congestioned) {
             flush_internal_tx_queue(iqueue);
         }
         set_flush_timer(iqueue);
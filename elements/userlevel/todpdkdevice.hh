@@ -82,10 +82,28 @@ internal queue will wait on average 1 ms before containing 32 packets. Defaults
 to 0 (immediate flush). The timeout will be disabled (-1) if BURST is 1, as the
 packets will never wait in the internal queue.
 
+=item LATENCY_TARGET
+
+Time, in microseconds by default. If set, each thread replaces BURST by the
+number of packets it expects to receive in half of LATENCY_TARGET, measured
+over the previous LATENCY_TARGET period and bounded by BURST, and a partial
+burst is flushed after the other half instead of TIMEOUT. Under low rates
+packets are sent nearly one by one, under high rates in full bursts. Default
+is 0, a static BURST.
+
 =item NDESC
 
 Integer.  Number of descriptors per ring. The default is 1024.
 
+=item MPSC
+
+Boolean.  When more threads push to this element than it has TX queues, let
+the threads sharing a queue hand their packets over to a lock-free
+multi-producer, single-consumer ring instead of serializing on the queue lock.
+Whichever producer finds the queue idle becomes the drainer and sends the ring
+content to the NIC, the others return immediately. Has no effect when each
+queue is used by a single thread. Defaults to false.
+
 =item ALLOW_NONEXISTENT
 
 Boolean.  Do not fail if the PORT do not existent. If it's the case the task
@@ -99,6 +117,9 @@ This element is only available at user level, when compiled with DPDK support.
 
   ... -> ToDPDKDevice(2, QUEUE 0, BLOCKING true)
 
+  // 32 threads on a 16-queue port, can be tried with --vdev=net_null0
+  ... -> ToDPDKDevice(0, MAXQUEUES 16, MPSC true)
+
 =h count read-only
 
 Returns the number of packets sent by the device.
@@ -107,10 +128,25 @@ Returns the number of packets sent by the device.
 
 Returns the number of packets dropped by the device.
 
+=h operating_point read-only
+
+Returns the current burst of each thread and, with LATENCY_TARGET, the delay
+after which a partial burst is flushed.
+
 =h reset_counts write-only
 
 Resets n_send and n_dropped counts to zero.
 
+=h contention read-only
+
+With MPSC, returns the number of times a thread handed its packets over
+because another thread was draining the queue.
+
+=h drain_latency read-only
+
+With MPSC, returns the average time in nanoseconds a drainer spent sending
+packets of a shared queue.
+
 =a DPDKInfo, FromDPDKDevice */
 
 class ToDPDKDevice : public TXQueueDevice {
@@ -136,8 +172,11 @@ public:
     static String statistics_handler(Element *e, void * thunk) CLICK_COLD;
     void add_handlers() CLICK_COLD;
 
+    static String shared_handler(Element *e, void * thunk) CLICK_COLD;
+
     enum {
-        h_opackets,h_obytes,h_oerrors
+        h_opackets,h_obytes,h_oerrors,
+        h_contention,h_drain_latency
     };
 
     void run_timer(Timer *);
@@ -154,6 +193,33 @@ private:
     inline void set_flush_timer(DPDKDevice::TXInternalQueue &iqueue);
     void flush_internal_tx_queue(DPDKDevice::TXInternalQueue &);
 
+    /**
+     * Ring shared by the threads using the same TX queue in MPSC mode.
+     * Producers enqueue without locking, the thread holding the queue lock
+     * drains it. Packets dequeued but refused by the NIC wait in pkts.
+     */
+    struct SharedTXQueue {
+        SharedTXQueue() : ring(0), n(0) { }
+        struct rte_ring *ring;
+        struct rte_mbuf *pkts[32];
+        unsigned n;
+    } CLICK_CACHE_ALIGN;
+    Vector<SharedTXQueue,CLICK_CACHE_LINE_SIZE> _shared;
+
+    struct SharedTXStats {
+        SharedTXStats() : contended(0), drains(0), drain_cycles(0) { }
+        uint64_t contended;
+        uint64_t drains;
+        uint64_t drain_cycles;
+    };
+    per_thread<SharedTXStats> _shared_stats;
+
+    inline bool shared_queue() {
+        return _shared.size() && _shared[id_for_thread()].ring;
+    }
+    void flush_shared_tx_queue(DPDKDevice::TXInternalQueue &);
+    unsigned drain_shared_tx_queue(SharedTXQueue &);
+
     per_thread<DPDKDevice::TXInternalQueue> _iqueues;
 
     DPDKDevice* _dev;
@@ -164,6 +230,7 @@ private:
     uint32_t _tso;
     bool _tco;
     bool _ipco;
+    bool _mpsc;
 
     friend class FromDPDKDevice;
 };
@@ -32,6 +32,10 @@
 #include <click/packet_anno.hh>
 #include "fakepcap.hh"
 #include <click/userutils.hh>
+#include <click/straccum.hh>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #if HAVE_PCAP
 extern "C" {
 # include <pcap.h>
@@ -40,8 +44,16 @@ extern "C" {
 CLICK_DECLS
 
 ToDump::ToDump()
-    : _fp(0), _count(0), _task(this), _use_encap_from(0)
+    : _fp(0), _async(false), _fd(-1), _writer_running(false),
+      _writer_stop(false), _write_error(false), _dbuf(0), _dlen(0),
+      _bytes(0), _count(0), _task(this), _use_encap_from(0)
 {
+    for (unsigned i = 0; i < _stages.weight(); i++) {
+	Stage &s = _stages.get_value(i);
+	memset(s.chunks, 0, sizeof(s.chunks));
+	s.fill = 0;
+	s.count = s.drops = 0;
+    }
 }
 
 ToDump::~ToDump()
@@ -53,6 +65,12 @@ ToDump::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     String encap_type;
     String use_encap_from;
+    String format = "pcap";
+    uint32_t buffer_size = 8 << 20;
+    Timestamp flush_interval(1);
+    _interfaces = 1;
+    _iface_anno = -1;
+    _async = _direct = false;
     _snaplen = 2000;
     _extra_length = true;
     _unbuffered = false;
@@ -77,9 +95,33 @@ ToDump::configure(Vector<String> &conf, ErrorHandler *errh)
         .read("PER_NODE", per_node)
 #endif
         .read("FORCE_TS", _force_ts)
+        .read("FORMAT", WordArg(), format)
+        .read("INTERFACES", _interfaces)
+        .read("IFACE_ANNO", AnnoArg(1), _iface_anno)
+        .read("ASYNC", _async)
+        .read("BUFFER_SIZE", buffer_size)
+        .read("FLUSH_INTERVAL", flush_interval)
+        .read("DIRECT", _direct)
         .complete() < 0)
             return -1;
 
+    if (format == "pcap")
+        _pcapng = false;
+    else if (format == "pcapng")
+        _pcapng = true;
+    else
+        return errh->error("FORMAT must be pcap or pcapng");
+    if (_interfaces == 0 || _interfaces > 256)
+        return errh->error("INTERFACES must be between 1 and 256");
+    if (_direct && !_async)
+        return errh->error("DIRECT requires ASYNC");
+    if (_async && compressed_filename(_filename) > 0)
+        return errh->error("ASYNC is incompatible with compressed files");
+    _chunk_size = (buffer_size / CHUNKS) & ~(DIRECT_ALIGN - 1);
+    if (_async && _chunk_size < 65536)
+        return errh->error("BUFFER_SIZE too small");
+    _flush_interval = flush_interval.msecval() * CLICK_HZ / 1000;
+
     if (_snaplen == 0)
         _snaplen = 0xFFFFFFFFU;
 
@@ -119,7 +161,8 @@ ToDump::hotswap_element() const
     if (Element *e = Element::hotswap_element())
     if (ToDump *td = (ToDump *)e->cast("ToDump"))
         if (td->_filename == _filename
-        && td->_linktype == _linktype)
+        && td->_linktype == _linktype
+        && !td->_async && !_async && td->_pcapng == _pcapng)
         return td;
     return 0;
 }
@@ -156,6 +199,11 @@ ToDump::initialize(ErrorHandler *errh)
     // skip initialization if we're hotswapping later
     if (!hotswap_element()) {
 
+    if (_async) {
+        if (initialize_async(file_header(), errh) < 0)
+            return -1;
+    } else {
+
     // prepare files
     assert(!_fp);
     if (_filename != "-") {
@@ -173,21 +221,12 @@ ToDump::initialize(ErrorHandler *errh)
     if (_unbuffered)
         setvbuf(_fp, (char *) 0, _IONBF, 0);
 
-    struct fake_pcap_file_header h;
-
-    h.magic = _nano ? FAKE_PCAP_MAGIC_NANO : FAKE_PCAP_MAGIC;
-    h.version_major = FAKE_PCAP_VERSION_MAJOR;
-    h.version_minor = FAKE_PCAP_VERSION_MINOR;
-
-    h.thiszone = 0;        // timestamps are in GMT
-    h.sigfigs = 0;        // XXX accuracy of timestamps?
-    h.snaplen = _snaplen;
-    h.linktype = _linktype;
-
-    size_t wrote_header = fwrite(&h, sizeof(h), 1, _fp);
+    String h = file_header();
+    size_t wrote_header = fwrite(h.data(), h.length(), 1, _fp);
     if (wrote_header != 1)
         return errh->error("%s: unable to write file header", _filename.c_str());
     }
+    }
 
     if (input_is_pull(0) && noutputs() == 0) {
         ScheduleInfo::join_scheduler(this, &_task, errh);
@@ -210,33 +249,137 @@ ToDump::take_state(Element *e, ErrorHandler *)
 void
 ToDump::cleanup(CleanupStage)
 {
+    if (_async)
+        finish_async();
     if (_fp && _fp != stdout)
         fclose(_fp);
     _fp = 0;
 }
 
-void
-ToDump::write_packet(Packet *p)
+static void
+pcapng_option(StringAccum &sa, uint16_t code, const void *data, uint16_t len)
+{
+    uint16_t h[2] = { code, len };
+    sa.append((const char *) h, sizeof(h));
+    sa.append((const char *) data, len);
+    while (sa.length() & 3)
+        sa << '\0';
+}
+
+String
+ToDump::file_header() const
 {
-    struct fake_pcap_pkthdr ph;
+    StringAccum sa;
+    if (!_pcapng) {
+        struct fake_pcap_file_header h;
+
+        h.magic = _nano ? FAKE_PCAP_MAGIC_NANO : FAKE_PCAP_MAGIC;
+        h.version_major = FAKE_PCAP_VERSION_MAJOR;
+        h.version_minor = FAKE_PCAP_VERSION_MINOR;
+
+        h.thiszone = 0;        // timestamps are in GMT
+        h.sigfigs = 0;        // XXX accuracy of timestamps?
+        h.snaplen = _snaplen;
+        h.linktype = _linktype;
+        sa.append((const char *) &h, sizeof(h));
+        return sa.take_string();
+    }
+
+    struct fake_pcapng_shb shb;
+    uint32_t length = sizeof(shb) + 4;
+    shb.block_type = FAKE_PCAPNG_SHB;
+    shb.block_length = length;
+    shb.byte_order_magic = FAKE_PCAPNG_BYTE_ORDER_MAGIC;
+    shb.version_major = 1;
+    shb.version_minor = 0;
+    shb.section_length = -1;
+    sa.append((const char *) &shb, sizeof(shb));
+    sa.append((const char *) &length, 4);
+
+    for (uint32_t i = 0; i < _interfaces; i++) {
+        int start = sa.length();
+        struct fake_pcapng_idb idb;
+        idb.block_type = FAKE_PCAPNG_IDB;
+        idb.block_length = 0;
+        idb.linktype = _linktype;
+        idb.reserved = 0;
+        idb.snaplen = _snaplen == 0xFFFFFFFFU ? 0 : _snaplen;
+        sa.append((const char *) &idb, sizeof(idb));
+        String ifname = name() + "/" + String(i);
+        pcapng_option(sa, FAKE_PCAPNG_IF_NAME, ifname.data(), ifname.length());
+        if (_nano) {
+            uint8_t tsresol = 9;
+            pcapng_option(sa, FAKE_PCAPNG_IF_TSRESOL, &tsresol, 1);
+        }
+        pcapng_option(sa, FAKE_PCAPNG_OPT_ENDOFOPT, 0, 0);
+        length = sa.length() - start + 4;
+        sa.append((const char *) &length, 4);
+        memcpy(sa.data() + start + 4, &length, 4);
+    }
+    return sa.take_string();
+}
 
+inline uint32_t
+ToDump::record_header(Packet *p, unsigned char *buf,
+                      uint32_t &caplen, uint32_t &total) const
+{
     Timestamp ts = p->timestamp_anno();
     if (!ts && !_force_ts)
         ts = Timestamp::now();
-    ph.ts.tv.tv_sec = ts.sec();
-    ph.ts.tv.tv_usec = _nano ? ts.nsec() : ts.usec();
 
-    unsigned to_write = p->length();
-    ph.len = to_write + (_extra_length ? EXTRA_LENGTH_ANNO(p) : 0);
-    if (_snaplen && to_write > _snaplen)
-        to_write = _snaplen;
-    ph.caplen = to_write;
+    caplen = p->length();
+    uint32_t len = caplen + (_extra_length ? EXTRA_LENGTH_ANNO(p) : 0);
+    if (_snaplen && caplen > _snaplen)
+        caplen = _snaplen;
+
+    if (!_pcapng) {
+        struct fake_pcap_pkthdr *ph = reinterpret_cast<struct fake_pcap_pkthdr *>(buf);
+        ph->ts.tv.tv_sec = ts.sec();
+        ph->ts.tv.tv_usec = _nano ? ts.nsec() : ts.usec();
+        ph->caplen = caplen;
+        ph->len = len;
+        total = sizeof(*ph) + caplen;
+        return sizeof(*ph);
+    } else {
+        struct fake_pcapng_epb *epb = reinterpret_cast<struct fake_pcapng_epb *>(buf);
+        uint64_t t = _nano ? ts.sec() * (uint64_t) 1000000000 + ts.nsec()
+            : ts.sec() * (uint64_t) 1000000 + ts.usec();
+        total = sizeof(*epb) + ((caplen + 3) & ~3) + 4;
+        epb->block_type = FAKE_PCAPNG_EPB;
+        epb->block_length = total;
+        epb->interface_id = _iface_anno >= 0 ? p->anno_u8(_iface_anno) % _interfaces : 0;
+        epb->ts_high = t >> 32;
+        epb->ts_low = t;
+        epb->caplen = caplen;
+        epb->len = len;
+        return sizeof(*epb);
+    }
+}
+
+void
+ToDump::write_packet(Packet *p)
+{
+    if (_async) {
+        stage_packet(*_stages, p);
+        return;
+    }
+
+    union {
+        struct fake_pcap_pkthdr ph;
+        struct fake_pcapng_epb epb;
+    } h;
+    uint32_t caplen, total;
+    uint32_t hlen = record_header(p, reinterpret_cast<unsigned char *>(&h), caplen, total);
+    // pcapng pads the data to 32 bits and repeats the block length
+    uint32_t trailer[2] = { 0, total };
+    uint32_t tlen = total - hlen - caplen;
 
     if (_mt)
         _lock.acquire();
     // XXX writing to pipe?
-    if (fwrite(&ph, sizeof(ph), 1, _fp) == 0
-    || (to_write > 0 && fwrite(p->data(), 1, to_write, _fp) == 0)) {
+    if (fwrite(&h, hlen, 1, _fp) == 0
+    || (caplen > 0 && fwrite(p->data(), 1, caplen, _fp) == 0)
+    || (tlen > 0 && fwrite(reinterpret_cast<char *>(&trailer[2]) - tlen, 1, tlen, _fp) == 0)) {
         if (errno != EAGAIN) {
             _active = false;
             click_chatter("ToDump(%s): %s", _filename.c_str(), strerror(errno));
@@ -247,13 +390,244 @@ ToDump::write_packet(Packet *p)
         _lock.release();
 }
 
+int
+ToDump::initialize_async(const String &header, ErrorHandler *errh)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (_direct) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        return errh->error("DIRECT is not supported on this platform");
+#endif
+    }
+    if (_filename == "-") {
+        if (_direct)
+            return errh->error("DIRECT requires a file");
+        _fd = STDOUT_FILENO;
+        _filename = "<stdout>";
+    } else if ((_fd = open(_filename.c_str(), flags, 0666)) < 0)
+        return errh->error("%s: %s", _filename.c_str(), strerror(errno));
+
+    Bitvector threads = get_passing_threads();
+    for (unsigned i = 0; i < _stages.weight(); i++) {
+        if (i >= (unsigned) threads.size() || !threads[i])
+            continue;
+        Stage &s = _stages.get_value(i);
+        for (int c = 0; c < CHUNKS; c++) {
+            void *buf;
+            if (posix_memalign(&buf, DIRECT_ALIGN, _chunk_size) != 0)
+                return errh->error("out of memory");
+            s.chunks[c] = (unsigned char *) buf;
+        }
+        s.fill = 0;
+        s.produced = 0;
+        s.consumed = 0;
+    }
+
+    if (_direct) {
+        void *buf;
+        if (posix_memalign(&buf, DIRECT_ALIGN, _chunk_size) != 0)
+            return errh->error("out of memory");
+        _dbuf = (unsigned char *) buf;
+    }
+    write_out(reinterpret_cast<const unsigned char *>(header.data()), header.length());
+    if (_write_error)
+        return errh->error("%s: unable to write file header", _filename.c_str());
+
+    _writer_stop = false;
+    if (pthread_create(&_writer, 0, writer_thread, this) != 0)
+        return errh->error("cannot create writer thread: %s", strerror(errno));
+    _writer_running = true;
+    return 0;
+}
+
+inline void
+ToDump::seal(Stage &s)
+{
+    uint32_t produced = s.produced.value();
+    s.lens[produced % CHUNKS] = s.fill;
+    s.fill = 0;
+    click_write_fence();
+    s.produced = produced + 1;
+}
+
+inline void
+ToDump::check_flush(Stage &s)
+{
+    if (s.fill && click_jiffies() - s.started >= _flush_interval)
+        seal(s);
+}
+
+inline void
+ToDump::stage_packet(Stage &s, Packet *p)
+{
+    union {
+        struct fake_pcap_pkthdr ph;
+        struct fake_pcapng_epb epb;
+    } h;
+    uint32_t caplen, total;
+    uint32_t hlen = record_header(p, reinterpret_cast<unsigned char *>(&h), caplen, total);
+
+    if (unlikely(!s.chunks[0] || total > _chunk_size)) {
+        s.drops++;
+        return;
+    }
+    if (s.fill + total > _chunk_size)
+        seal(s);
+    uint32_t produced = s.produced.value();
+    if (s.fill == 0) {
+        if (produced - s.consumed.value() >= CHUNKS) {
+            // The writer thread is behind: drop rather than wait.
+            s.drops++;
+            return;
+        }
+        s.started = click_jiffies();
+    }
+
+    unsigned char *d = s.chunks[produced % CHUNKS] + s.fill;
+    memcpy(d, &h, hlen);
+    memcpy(d + hlen, p->data(), caplen);
+    if (_pcapng) {
+        uint32_t *end = reinterpret_cast<uint32_t *>(d + total - 4);
+        memset(d + hlen + caplen, 0, total - 4 - hlen - caplen);
+        memcpy(end, &total, 4);
+    }
+    s.fill += total;
+    s.count++;
+}
+
+void *
+ToDump::writer_thread(void *arg)
+{
+    ToDump *td = static_cast<ToDump *>(arg);
+    while (!td->_writer_stop)
+        if (!td->drain_stages())
+            usleep(1000);
+    return 0;
+}
+
+bool
+ToDump::drain_stages()
+{
+    bool any = false;
+    for (unsigned i = 0; i < _stages.weight(); i++) {
+        Stage &s = _stages.get_value(i);
+        if (!s.chunks[0])
+            continue;
+        uint32_t consumed = s.consumed.value();
+        uint32_t produced = s.produced.value();
+        click_read_fence();
+        while (consumed != produced) {
+            write_out(s.chunks[consumed % CHUNKS], s.lens[consumed % CHUNKS]);
+            ++consumed;
+            click_write_fence();
+            s.consumed = consumed;
+            any = true;
+        }
+    }
+    return any;
+}
+
+bool
+ToDump::write_fully(const unsigned char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t w = ::write(_fd, data, len);
+        if (w > 0) {
+            data += w;
+            len -= w;
+        } else if (w < 0 && errno != EINTR && errno != EAGAIN) {
+            if (!_write_error)
+                click_chatter("ToDump(%s): %s", _filename.c_str(), strerror(errno));
+            _write_error = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+ToDump::write_out(const unsigned char *data, uint32_t len)
+{
+    if (_write_error)
+        return;
+    _bytes += len;
+    if (!_direct) {
+        write_fully(data, len);
+        return;
+    }
+    // O_DIRECT needs aligned buffers, offsets and lengths: gather chunks
+    // into _dbuf and write it out whenever it fills.
+    while (len > 0) {
+        uint32_t n = _chunk_size - _dlen;
+        if (n > len)
+            n = len;
+        memcpy(_dbuf + _dlen, data, n);
+        _dlen += n;
+        data += n;
+        len -= n;
+        if (_dlen == _chunk_size) {
+            if (!write_fully(_dbuf, _dlen))
+                return;
+            _dlen = 0;
+        }
+    }
+}
+
+void
+ToDump::finish_async()
+{
+    if (_writer_running) {
+        _writer_stop = true;
+        pthread_join(_writer, 0);
+        _writer_running = false;
+    }
+    // Packet threads are stopped: write what is left, in thread order.
+    for (unsigned i = 0; i < _stages.weight(); i++) {
+        Stage &s = _stages.get_value(i);
+        if (s.chunks[0] && s.fill)
+            seal(s);
+    }
+    if (_fd >= 0) {
+        drain_stages();
+        if (_direct && _dlen && !_write_error) {
+            uint32_t padded = (_dlen + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+            memset(_dbuf + _dlen, 0, padded - _dlen);
+            if (write_fully(_dbuf, padded)
+                && ftruncate(_fd, _bytes) < 0)
+                click_chatter("ToDump(%s): %s", _filename.c_str(), strerror(errno));
+        }
+        if (_fd != STDOUT_FILENO)
+            close(_fd);
+        _fd = -1;
+    }
+    for (unsigned i = 0; i < _stages.weight(); i++) {
+        Stage &s = _stages.get_value(i);
+        for (int c = 0; c < CHUNKS; c++) {
+            free(s.chunks[c]);
+            s.chunks[c] = 0;
+        }
+    }
+    free(_dbuf);
+    _dbuf = 0;
+}
+
 #if HAVE_BATCH
 void
 ToDump::push_batch(int, PacketBatch *b)
 {
     if (_active) {
-        FOR_EACH_PACKET(b,p) {
-            write_packet(p);
+        if (_async) {
+            Stage &s = *_stages;
+            check_flush(s);
+            FOR_EACH_PACKET(b,p) {
+                stage_packet(s, p);
+            }
+        } else {
+            FOR_EACH_PACKET(b,p) {
+                write_packet(p);
+            }
         }
         checked_output_push_batch(0, b);
     }
@@ -262,8 +636,11 @@ ToDump::push_batch(int, PacketBatch *b)
 void
 ToDump::push(int, Packet *p)
 {
-    if (_active)
+    if (_active) {
+        if (_async)
+            check_flush(*_stages);
         write_packet(p);
+    }
     checked_output_push(0, p);
 }
 
@@ -271,8 +648,12 @@ Packet *
 ToDump::pull(int)
 {
     Packet *p = input(0).pull();
-    if (_active && p)
-        write_packet(p);
+    if (_active) {
+        if (_async)
+            check_flush(*_stages);
+        if (p)
+            write_packet(p);
+    }
     return p;
 }
 
@@ -281,17 +662,19 @@ ToDump::run_task(Task *)
 {
     if (!_active)
         return false;
+    if (_async)
+        check_flush(*_stages);
     Packet *p = input(0).pull();
     if (p) {
         write_packet(p);
         p->kill();
-    } else if (!_signal)
-        return false;
+    } else if (!_signal && !(_async && _stages->fill))
+        return false;	// keep polling until a partial chunk is flushed
     _task.fast_reschedule();
     return p != 0;
 }
 
-enum { H_FILENAME = 0, H_COUNT = 1, H_RESET_COUNTS = 2 };
+enum { H_FILENAME = 0, H_COUNT = 1, H_RESET_COUNTS = 2, H_DROPS, H_BYTES };
 
 String
 ToDump::read_handler(Element *e, void *thunk)
@@ -301,7 +684,18 @@ ToDump::read_handler(Element *e, void *thunk)
       case H_FILENAME:
         return td->_filename;
       case H_COUNT:
-        return String(td->_count);
+      case H_DROPS: {
+        if (!td->_async)
+            return String((uintptr_t) thunk == H_COUNT ? td->_count : 0);
+        uint64_t n = 0;
+        for (unsigned i = 0; i < td->_stages.weight(); i++) {
+            Stage &s = td->_stages.get_value(i);
+            n += (uintptr_t) thunk == H_COUNT ? s.count : s.drops;
+        }
+        return String(n);
+      }
+      case H_BYTES:
+        return String(td->_bytes);
       default:
         return "<error>";
     }
@@ -312,6 +706,10 @@ ToDump::write_handler(const String &, Element *e, void *, ErrorHandler *)
 {
     ToDump *td = static_cast<ToDump *>(e);
     td->_count = 0;
+    for (unsigned i = 0; i < td->_stages.weight(); i++) {
+        Stage &s = td->_stages.get_value(i);
+        s.count = s.drops = 0;
+    }
     return 0;
 }
 
@@ -320,6 +718,8 @@ ToDump::add_handlers()
 {
     add_read_handler("filename", read_handler, H_FILENAME);
     add_read_handler("count", read_handler, H_COUNT);
+    add_read_handler("drops", read_handler, H_DROPS);
+    add_read_handler("bytes", read_handler, H_BYTES);
     add_write_handler("reset_counts", write_handler, H_RESET_COUNTS, Handler::BUTTON);
     if (input_is_pull(0) && noutputs() == 0)
         add_task_handlers(&_task);
@@ -6,13 +6,15 @@
 #include <click/task.hh>
 #include <click/notifier.hh>
 #include <click/sync.hh>
+#include <click/atomic.hh>
 #include <stdio.h>
+#include <pthread.h>
 CLICK_DECLS
 
 /*
 =c
 
-ToDump(FILENAME [, I<keywords> SNAPLEN, ENCAP, USE_ENCAP_FROM, EXTRA_LENGTH, NANO])
+ToDump(FILENAME [, I<keywords> SNAPLEN, ENCAP, USE_ENCAP_FROM, EXTRA_LENGTH, NANO, FORMAT, ASYNC, ...])
 
 =s traces
 
@@ -78,6 +80,52 @@ Boolean. Set to true to force writing a "zero" timestamp. This may be useful to
 write trace with offests relative to the first packet, that will be zero.
 Defaults to False for backward compatibility.
 
+=item FORMAT
+
+Either C<pcap> or C<pcapng>. With C<pcapng>, ToDump writes a section header,
+one interface description block per interface (see INTERFACES), and one
+enhanced packet block per packet. Timestamps have nanosecond resolution if
+NANO is true. Default is C<pcap>.
+
+=item INTERFACES
+
+Integer. Number of pcapng interfaces. Default is 1.
+
+=item IFACE_ANNO
+
+Annotation. If set, the 1-byte annotation at that offset, modulo
+INTERFACES, is the pcapng interface a packet was captured on. Interface
+I<i> is named "I<name>/I<i>", where I<name> is the element's name.
+
+=item ASYNC
+
+Boolean. If true, packets are written by a dedicated writer thread, so that
+a slow disk never stalls the threads that push packets. Each Click thread
+copies records into its own staging buffer, cut into eight chunks, without
+locking. Full chunks are handed to the writer thread and written in one
+system call each; a packet that arrives while all of its thread's chunks are
+waiting for the writer is dropped and counted (see the C<drops> handler)
+instead of blocking. Records from one thread stay in order, but records from
+different threads are interleaved chunk by chunk. Incompatible with
+compressed files. Default is false.
+
+=item BUFFER_SIZE
+
+Integer. Size of each thread's staging buffer in bytes, with ASYNC. Default
+is 8 MB.
+
+=item FLUSH_INTERVAL
+
+Time. With ASYNC, a thread's partially filled chunk is handed to the writer
+when the thread writes a packet and the chunk is older than this. Default
+is 1 second. Chunks of idle threads are written at cleanup.
+
+=item DIRECT
+
+Boolean. With ASYNC, open the file with O_DIRECT, bypassing the page cache.
+The writer thread then gathers chunks into aligned buffers of its own.
+Default is false.
+
 =back
 
 This element is only available at user level.
@@ -92,7 +140,17 @@ Returns the number of packets emitted so far.
 
 =h reset_counts write-only
 
-Resets "count" to 0.
+Resets "count" and "drops" to 0.
+
+=h drops read-only
+
+Returns the number of packets dropped because the writer thread fell
+behind, with ASYNC.
+
+=h bytes read-only
+
+Returns the number of bytes written to the file by the writer thread, with
+ASYNC.
 
 =h filename read-only
 
@@ -127,6 +185,22 @@ class ToDump : public BatchElement { public:
     bool run_task(Task *);
 
   private:
+    enum { CHUNKS = 8, DIRECT_ALIGN = 4096 };
+
+    // Staging area of one thread in ASYNC mode. The thread fills chunk
+    // 'produced % CHUNKS'; chunks from 'consumed' to 'produced' wait for
+    // the writer thread.
+    struct Stage {
+	unsigned char *chunks[CHUNKS];
+	uint32_t lens[CHUNKS];
+	uint32_t fill;
+	click_jiffies_t started;
+	atomic_uint32_t produced;	// written by the owning thread
+	atomic_uint32_t consumed;	// written by the writer thread
+	uint64_t count;
+	uint64_t drops;
+    };
+
     bool _mt;
     Spinlock _lock;
 
@@ -139,6 +213,23 @@ class ToDump : public BatchElement { public:
     bool _unbuffered;
     bool _nano;
     bool _force_ts;
+    bool _pcapng;
+    uint32_t _interfaces;
+    int _iface_anno;
+
+    bool _async;
+    bool _direct;
+    uint32_t _chunk_size;
+    click_jiffies_t _flush_interval;
+    per_thread<Stage> _stages;
+    int _fd;
+    pthread_t _writer;
+    bool _writer_running;
+    volatile bool _writer_stop;
+    bool _write_error;
+    unsigned char *_dbuf;
+    uint32_t _dlen;
+    uint64_t _bytes;
 
 #if HAVE_INT64_TYPES
     typedef uint64_t counter_t;
@@ -155,6 +246,20 @@ class ToDump : public BatchElement { public:
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
     void write_packet(Packet *);
 
+    String file_header() const;
+    inline uint32_t record_header(Packet *p, unsigned char *buf,
+				  uint32_t &caplen, uint32_t &total) const;
+
+    int initialize_async(const String &header, ErrorHandler *errh);
+    inline void stage_packet(Stage &s, Packet *p);
+    inline void check_flush(Stage &s);
+    inline void seal(Stage &s);
+    static void *writer_thread(void *);
+    bool drain_stages();
+    void write_out(const unsigned char *data, uint32_t len);
+    bool write_fully(const unsigned char *data, size_t len);
+    void finish_async();
+
 };
 
 CLICK_ENDDECLS
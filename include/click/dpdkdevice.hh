@@ -81,7 +81,8 @@ public:
             vlan_filter(false), vlan_strip(false), vlan_extend(false),
             lro(false), jumbo(false),
             n_rx_descs(0), n_tx_descs(0),
-            init_mac(), init_mtu(0), init_rss(-1), init_fc_mode(FC_UNSET), rx_offload(0), tx_offload(0) {
+            init_mac(), init_mtu(0), init_rss(-1), init_fc_mode(FC_UNSET), rx_offload(0), tx_offload(0),
+            rx_intr(false) {
             rx_queues.reserve(128);
             tx_queues.reserve(128);
         }
@@ -124,6 +125,7 @@ public:
         FlowControlMode init_fc_mode;
         uint64_t rx_offload;
         uint64_t tx_offload;
+        bool rx_intr;
     };
 
     int add_rx_queue(
@@ -143,6 +145,7 @@ public:
     void set_init_fc_mode(FlowControlMode fc);
     void set_rx_offload(uint64_t offload);
     void set_tx_offload(uint64_t offload);
+    void set_rx_intr();
 
 
     unsigned int get_nb_rxdesc();
@@ -166,6 +169,9 @@ public:
 
     static int get_port_numa_node(portid_t port_id);
 
+    static int get_rss_conf(portid_t port_id, Vector<uint8_t> &key,
+                            Vector<unsigned> &reta);
+
     static int initialize(ErrorHandler *errh);
 
     static int static_initialize(ErrorHandler *errh);
@@ -36,6 +36,8 @@ class FromFile { public:
     void take_state(FromFile &, ErrorHandler *);
 
     int seek(off_t want, ErrorHandler *);
+    off_t file_size() const;
+    ssize_t pread(void *, size_t, off_t) const;
 
     int read(void*, uint32_t, ErrorHandler * = 0);
     const uint8_t* get_unaligned(size_t, void*, ErrorHandler* = 0);
@@ -55,6 +57,8 @@ class FromFile { public:
 
     enum { BUFFER_SIZE = 32768 };
 
+    enum { READAHEAD_UNIT = 2097152 }; // 2 MB, a huge page
+
     int _fd;
     const uint8_t *_buffer;
     uint32_t _pos;
@@ -72,6 +76,12 @@ class FromFile { public:
     off_t _mmap_off;
 #endif
 
+    struct ReadAhead;
+    ReadAhead *_ra;
+    int _ra_depth;
+    uint32_t _ra_unit;
+    bool _ra_uring;
+
     String _filename;
     FILE *_pipe;
     off_t _file_offset;
@@ -82,6 +92,9 @@ class FromFile { public:
     int read_buffer_mmap(ErrorHandler *);
 #endif
     int read_buffer(ErrorHandler *);
+    int read_buffer_ahead(ErrorHandler *);
+    void start_readahead();
+    void stop_readahead();
     bool read_packet(ErrorHandler *);
     int skip_ahead(ErrorHandler *);
 
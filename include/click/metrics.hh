@@ -0,0 +1,264 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_METRICS_HH
+#define CLICK_METRICS_HH
+#include <click/glue.hh>
+#include <click/sync.hh>
+#include <click/integers.hh>
+#include <click/string.hh>
+#include <click/vector.hh>
+#include <click/router.hh>
+CLICK_DECLS
+
+/** @file <click/metrics.hh>
+ * @brief Counters, gauges and histograms that can be exported in bulk.
+ *
+ * The metric classes are updated from the data path with plain stores to
+ * per-thread, cache-aligned storage: there are no atomic operations and no
+ * shared cache lines. Reading a metric sums the per-thread values while the
+ * workers keep running, so a snapshot is not atomic across threads, but each
+ * value only ever grows between two snapshots (except for gauges).
+ *
+ * An element publishes its metrics by adding them to the router's
+ * MetricRegistry, usually in initialize():
+ *
+ * @code
+ * if (MetricRegistry *reg = MetricRegistry::find(router()))
+ *     reg->add(this, "drops_total", "Packets dropped", &_drops);
+ * @endcode
+ *
+ * The registry exists only if the configuration contains a Metrics element,
+ * which exports every registered metric in the Prometheus text format. The
+ * metrics must live as long as the router, which is the case of element
+ * members.
+ */
+
+/** @class MetricCounter
+ * @brief A monotonic counter, incremented by any thread. */
+class MetricCounter { public:
+
+    MetricCounter() : _v(0) {
+    }
+
+    inline void add(uint64_t n) {
+	*_v += n;
+    }
+    inline void operator++() {
+	++*_v;
+    }
+    inline void operator+=(uint64_t n) {
+	*_v += n;
+    }
+
+    /** @brief Return the sum of all threads' counts. */
+    uint64_t value() const {
+	uint64_t s = 0;
+	for (unsigned i = 0; i < _v.weight(); i++)
+	    s += _v.get_value(i);
+	return s;
+    }
+
+    void clear() {
+	for (unsigned i = 0; i < _v.weight(); i++)
+	    _v.set_value(i, 0);
+    }
+
+  private:
+
+    per_thread<uint64_t> _v;
+
+};
+
+/** @class MetricGauge
+ * @brief A value that can go up and down, set by a single writer. */
+class MetricGauge { public:
+
+    MetricGauge() : _v(0) {
+    }
+
+    inline void set(int64_t v) {
+	_v = v;
+    }
+    int64_t value() const {
+	return _v;
+    }
+
+  private:
+
+    volatile int64_t _v;
+
+};
+
+/** @class MetricHistogram
+ * @brief A log-linear histogram of unsigned 64-bit values.
+ *
+ * As in HdrHistogram, every power-of-two range is split into sub_buckets
+ * linear buckets, so the relative error of a quantile is below
+ * 1/sub_buckets over the whole 64-bit range. Bucket boundaries are aligned
+ * so that the number of values less than or equal to any power of two is
+ * exact.
+ *
+ * Each thread records into its own bucket array, allocated the first time
+ * it records. record() is a few instructions and touches two cache lines.
+ */
+class MetricHistogram { public:
+
+    enum {
+	sub_bits = 4,
+	sub_buckets = 1 << sub_bits,
+	nbuckets = 1 + (64 - sub_bits + 1) * sub_buckets
+    };
+
+    struct Snapshot {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t b[nbuckets];
+
+	/** @brief Return an upper bound of the @a q quantile, 0 <= q <= 1. */
+	uint64_t quantile(double q) const;
+    };
+
+    MetricHistogram() : _shards(0) {
+    }
+
+    ~MetricHistogram() {
+	for (unsigned i = 0; i < _shards.weight(); i++)
+	    if (Shard *s = _shards.get_value(i))
+		CLICK_LFREE(s, sizeof(Shard));
+    }
+
+    /** @brief Return the bucket holding @a v. */
+    static inline int bucket(uint64_t v) {
+	if (v <= sub_buckets)
+	    return v;
+	--v;
+	int e = 64 - ffs_msb(v);	// v >= sub_buckets, so e >= sub_bits
+	return 1 + (e - sub_bits + 1) * sub_buckets
+	    + ((v >> (e - sub_bits)) & (sub_buckets - 1));
+    }
+
+    /** @brief Return the largest value held by bucket @a b. */
+    static inline uint64_t bucket_limit(int b) {
+	if (b <= sub_buckets)
+	    return b;
+	--b;
+	int e = b / sub_buckets + sub_bits - 1;
+	uint64_t m = sub_buckets + b % sub_buckets + 1;
+	uint64_t limit = m << (e - sub_bits);
+	return limit ? limit : ~(uint64_t) 0;
+    }
+
+    inline void record(uint64_t v) {
+	Shard *s = *_shards;
+	if (unlikely(!s))
+	    s = make_shard();
+	s->b[bucket(v)]++;
+	s->count++;
+	s->sum += v;
+    }
+
+    /** @brief Sum all threads' buckets into @a snap. */
+    void snapshot(Snapshot &snap) const {
+	memset(&snap, 0, sizeof(snap));
+	for (unsigned i = 0; i < _shards.weight(); i++) {
+	    const Shard *s = _shards.get_value(i);
+	    if (!s)
+		continue;
+	    snap.count += s->count;
+	    snap.sum += s->sum;
+	    for (int j = 0; j < nbuckets; j++)
+		snap.b[j] += s->b[j];
+	}
+    }
+
+  private:
+
+    typedef Snapshot Shard;
+
+    per_thread<Shard *> _shards;
+
+    Shard *make_shard() {
+	Shard *s = (Shard *) CLICK_LALLOC(sizeof(Shard));
+	memset(s, 0, sizeof(Shard));
+	click_write_fence();	// readers see the buckets cleared
+	*_shards = s;
+	return s;
+    }
+
+};
+
+inline uint64_t
+MetricHistogram::Snapshot::quantile(double q) const
+{
+    // Threads record without locking, so count may not match the buckets
+    uint64_t total = 0;
+    for (int j = 0; j < nbuckets; j++)
+	total += b[j];
+    if (!total)
+	return 0;
+    uint64_t rank = (uint64_t) (q * total + 0.5), seen = 0;
+    if (rank < 1)
+	rank = 1;
+    int j = 0;
+    for (; j < nbuckets - 1; j++)
+	if ((seen += b[j]) >= rank)
+	    break;
+    return bucket_limit(j);
+}
+
+/** @class MetricRegistry
+ * @brief The set of metrics exported by a router. */
+class MetricRegistry { public:
+
+    enum type_t { t_counter, t_gauge, t_histogram };
+
+    struct Entry {
+	Element *owner;
+	String name;
+	String help;
+	type_t type;
+	const void *metric;
+    };
+
+    /** @brief Return @a router's registry, or null if metrics are not
+     * exported. */
+    static MetricRegistry *find(Router *router) {
+	return static_cast<MetricRegistry *>(router->attachment("MetricRegistry"));
+    }
+
+    /** @brief Publish @a metric under @a name, labelled with @a owner.
+     *
+     * Several elements may publish the same name, as long as they use the
+     * same type. */
+    void add(Element *owner, const String &name, const String &help,
+	     const MetricCounter *metric) {
+	add(owner, name, help, t_counter, metric);
+    }
+    void add(Element *owner, const String &name, const String &help,
+	     const MetricGauge *metric) {
+	add(owner, name, help, t_gauge, metric);
+    }
+    void add(Element *owner, const String &name, const String &help,
+	     const MetricHistogram *metric) {
+	add(owner, name, help, t_histogram, metric);
+    }
+
+    const Vector<Entry> &entries() const {
+	return _entries;
+    }
+
+  protected:
+
+    Vector<Entry> _entries;
+
+  private:
+
+    void add(Element *owner, const String &name, const String &help,
+	     type_t type, const void *metric) {
+	Entry e = {owner, name, help, type, metric};
+	_entries.push_back(e);
+    }
+
+};
+
+CLICK_ENDDECLS
+#endif
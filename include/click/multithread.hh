@@ -1323,5 +1323,167 @@ protected:
 
 };
 
+/**
+ * Epoch-based deferred reclamation for a single writer and many readers
+ *
+ * click_rcu and fast_rcu keep two copies of a small value. This class is
+ * meant for large structures, such as routing tables, that the writer updates
+ * in place or by swapping pointers: whatever the writer unlinks is handed to
+ * retire() or defer() and is released only once no reader can still hold a
+ * reference to it.
+ *
+ * Readers bracket each access with read_begin() and read_end(), which only
+ * store to a per-thread slot. After making an update visible, the writer
+ * calls commit(), which starts a new epoch and releases everything retired
+ * before the oldest epoch still announced by a reader. The writer never waits
+ * for readers, except in synchronize().
+ *
+ * Writers must be serialized by the caller.
+ */
+class epoch_rcu { public:
+    typedef void (*callback_type)(void *thunk, uintptr_t arg);
+
+    epoch_rcu() : _epochs(0), _write_epoch(1), _head(0), _tail(&_head),
+        _backlog(0), _grace_periods(0) {
+    }
+
+    /** @brief Release all retired objects. No reader may be active. */
+    ~epoch_rcu() {
+        for (unsigned i = 0; i < _epochs.weight(); i++)
+            _epochs.set_value(i, 0);
+        reclaim();
+    }
+
+    inline void read_begin() const {
+        *_epochs = _write_epoch;
+        click_fence(); //Announce our epoch before loading any pointer
+    }
+
+    inline void read_end() const {
+        click_compiler_fence(); //No load may move after the epoch is cleared
+        *_epochs = 0;
+    }
+
+    /**
+     * Call @a f(@a thunk, @a arg) once every reader that could have seen the
+     * state preceding the next commit() has finished.
+     */
+    inline void defer(callback_type f, void *thunk, uintptr_t arg) {
+        retired *r = new retired;
+        r->f = f;
+        r->thunk = thunk;
+        r->arg = arg;
+        r->epoch = _write_epoch;
+        r->next = 0;
+        *_tail = r;
+        _tail = &r->next;
+        ++_backlog;
+    }
+
+    /**
+     * Free @a p, of @a size bytes allocated with CLICK_LALLOC, after a grace
+     * period.
+     */
+    inline void retire(void *p, size_t size) {
+        defer(lfree_callback, p, size);
+    }
+
+    /**
+     * End the current update: every later read_begin() observes it. Then
+     * release what is no longer referenced.
+     */
+    inline void commit() {
+        click_fence();
+        ++_write_epoch;
+        reclaim();
+    }
+
+    /**
+     * Release objects whose grace period has elapsed.
+     * @return the number of objects released
+     */
+    inline unsigned reclaim() {
+        uint32_t safe = safe_epoch();
+        unsigned n = 0;
+        while (_head && _head->epoch < safe) {
+            retired *r = _head;
+            if (!(_head = r->next))
+                _tail = &_head;
+            r->f(r->thunk, r->arg);
+            delete r;
+            ++n;
+        }
+        if (n) {
+            _backlog -= n;
+            ++_grace_periods;
+        }
+        return n;
+    }
+
+    /**
+     * Wait until every reader has left the epochs preceding the last
+     * commit(), then release all retired objects.
+     */
+    inline void synchronize() {
+        commit();
+        while (_head) {
+            click_relax_fence();
+            reclaim();
+        }
+    }
+
+    /** @brief Return the number of objects waiting for their grace period. */
+    inline unsigned backlog() const {
+        return _backlog;
+    }
+
+    /** @brief Return the number of grace periods that released objects. */
+    inline unsigned grace_periods() const {
+        return _grace_periods;
+    }
+
+    /** @brief Return the current write epoch. */
+    inline uint32_t epoch() const {
+        return _write_epoch;
+    }
+
+    /**
+     * Return the oldest epoch any reader may still be in. Objects the writer
+     * stopped referencing during an earlier epoch are unreachable.
+     */
+    inline uint32_t safe_epoch() const {
+        click_fence();
+        uint32_t min = _write_epoch;
+        for (unsigned i = 0; i < _epochs.weight(); i++) {
+            uint32_t e = _epochs.get_value(i);
+            if (e && e < min)
+                min = e;
+        }
+        return min;
+    }
+
+protected:
+
+    struct retired {
+        retired *next;
+        callback_type f;
+        void *thunk;
+        uintptr_t arg;
+        uint32_t epoch;
+    };
+
+    mutable per_thread<volatile uint32_t> _epochs;
+    volatile uint32_t _write_epoch;
+    retired *_head;
+    retired **_tail;
+    unsigned _backlog;
+    unsigned _grace_periods;
+
+    static void lfree_callback(void *p, uintptr_t size) {
+        CLICK_LFREE(p, size);
+    }
+
+};
+
 CLICK_ENDDECLS
 #endif
@@ -38,6 +38,7 @@ CLICK_DECLS
 #endif
 
 class IP6Address;
+class ErrorHandler;
 class WritablePacket;
 class PacketBatch;
 class Packet { public:
@@ -124,7 +125,15 @@ class Packet { public:
     const struct sk_buff *skb() const	{ return (const struct sk_buff*)this; }
 #elif CLICK_PACKET_USE_DPDK
     inline void prefetch_anno() {
-        rte_prefetch0(xanno());
+        rte_prefetch0(all_anno());
+    }
+
+    /** @brief Return the size of the mbuf private area holding the Click
+     * annotations. DPDKDevice creates its mempools with this private size. */
+    static inline uint16_t mbuf_priv_size() {
+        // AllAnno holds pointers, so its size is a multiple of
+        // RTE_MBUF_PRIV_ALIGN.
+        return sizeof(AllAnno);
     }
 
     struct rte_mbuf *mb() {
@@ -394,9 +403,9 @@ class Packet { public:
     const Anno *xanno() const		{ return (const Anno *)skb()->cb; }
     Anno *xanno()			{ return (Anno *)skb()->cb; }
 #elif CLICK_PACKET_USE_DPDK
-# define ANNO_OFFSET sizeof(struct rte_mbuf)
-    const Anno *xanno() const           { return (const Anno *) ((unsigned char*)this) + ANNO_OFFSET; }
-    Anno *xanno()			{ return (Anno *) ((unsigned char*)this) + ANNO_OFFSET; }
+    // Annotations live in the mbuf private area, right after the rte_mbuf.
+    const Anno *xanno() const		{ return &all_anno()->cb; }
+    Anno *xanno()			{ return &all_anno()->cb; }
 
 #else
     inline const Anno *xanno() const		{ return &_aa.cb; }
@@ -801,30 +810,46 @@ class Packet { public:
 #if !CLICK_LINUXMODULE
     // All packet annotations are stored in AllAnno so that
     // clear_annotations(true) can memset() the structure to zero.
+# if CLICK_PACKET_USE_DPDK
+    // With DPDK packets, AllAnno is the mbuf private area. The fields used
+    // on every hop come first, so that the batch links, the header pointers
+    // and the first 24 bytes of cb (destination IP, paint, VLAN/aggregate)
+    // share the cache line that follows the rte_mbuf. The packet type and
+    // timestamp annotations go to the second line.
+    struct AllAnno {
+	Packet *next;
+	Packet *prev;
+	unsigned char *mac;
+	unsigned char *nh;
+	unsigned char *h;
+	Anno cb;
+	Packet::PacketType pkt_type;
+	char timestamp[sizeof(Timestamp)];
+    };
+# else
     struct AllAnno {
 	Anno cb;
 	unsigned char *mac;
 	unsigned char *nh;
 	unsigned char *h;
 	Packet::PacketType pkt_type;
-#if !CLICK_PACKET_USE_DPDK
 	char timestamp[sizeof(Timestamp)];
-#endif
 	Packet *next;
 	Packet *prev;
 	AllAnno()
-#if !CLICK_PACKET_USE_DPDK
-#endif
 	{
 	}
     };
+# endif
 
 # if CLICK_PACKET_USE_DPDK
     inline struct AllAnno *all_anno() {
-        return reinterpret_cast<AllAnno *>(xanno());
+        return reinterpret_cast<AllAnno *>(
+            reinterpret_cast<unsigned char *>(this) + sizeof(struct rte_mbuf));
     }
     inline const struct AllAnno *all_anno() const {
-        return reinterpret_cast<const AllAnno *>(xanno());
+        return reinterpret_cast<const AllAnno *>(
+            reinterpret_cast<const unsigned char *>(this) + sizeof(struct rte_mbuf));
     }
     static struct rte_mempool **_pktmbuf_pools;
 # endif
@@ -890,6 +915,20 @@ private:
         unsigned pcount;            // # packets in `p` list
         WritablePacket* pd;             // free data buffers, linked by pd->next
         unsigned pdcount;           // # buffers in `pd` list
+        unsigned char* buf;         // free preallocated buffers without packet
+        unsigned bufcount;          // # buffers in `buf` list
+        WritablePacket* pkeep;      // preallocated packets kept while the
+                                    //   global pool is full
+        WritablePacket* pdkeep;     // preallocated data packets kept while
+                                    //   the global pool is full
+        int node;                   // NUMA node of the thread
+        int thread;                 // thread owning the pool
+        uint64_t misses;            // packets allocated from the heap
+        uint64_t data_misses;       // buffers allocated from the heap
+        uint64_t imports;           // batches taken from the global pool
+        uint64_t remote_imports;    //   of which from another node
+        uint64_t exports;           // batches given to the global pool
+        uint64_t drops;             // packets freed, the global pool being full
     #  if HAVE_MULTITHREAD
         PacketPool* thread_pool_next; // link to next per-thread pool
     #  endif
@@ -918,6 +957,14 @@ class WritablePacket : public Packet { public:
 
 # if HAVE_CLICK_PACKET_POOL
     static PacketPool* make_local_packet_pool();
+
+    static void set_pool_size(unsigned packets, unsigned data_packets);
+    static unsigned pool_size();
+    static unsigned data_pool_size();
+#  if CLICK_USERLEVEL
+    static int pool_prealloc(unsigned count, ErrorHandler *errh);
+#  endif
+    static String pool_stats();
 # endif
 
     static void pool_transfer(int from, int to);
@@ -1015,8 +1062,12 @@ Packet::clear_annotations(bool all)
 	set_prev(0);
     }
 #elif CLICK_PACKET_USE_DPDK
-    memset(all_anno(), 0, all ? sizeof(AllAnno) : sizeof(Anno));
-    set_timestamp_anno(Timestamp());
+    if (all)
+	memset(all_anno(), 0, sizeof(AllAnno));
+    else {
+	memset(xanno(), 0, sizeof(Anno));
+	set_timestamp_anno(Timestamp());
+    }
 #else
     memset(&_aa, 0, all ? sizeof(AllAnno) : sizeof(Anno));
 #endif
@@ -1487,7 +1538,7 @@ Packet::timestamp_anno() const
     return *reinterpret_cast<const Timestamp*>(&skb()->tstamp);
 # endif
 #elif CLICK_PACKET_USE_DPDK
-    return all_anno()->timestamp;
+    return *reinterpret_cast<const Timestamp*>(&all_anno()->timestamp);
 #else
     return *reinterpret_cast<const Timestamp*>(&_aa.timestamp);
 #endif
@@ -1503,7 +1554,7 @@ Packet::timestamp_anno()
     return *reinterpret_cast<Timestamp*>(&skb()->tstamp);
 # endif
 #elif CLICK_PACKET_USE_DPDK
-    return all_anno()->timestamp;
+    return *reinterpret_cast<Timestamp*>(&all_anno()->timestamp);
 #else
     return *reinterpret_cast<Timestamp*>(&_aa.timestamp);
 #endif
@@ -1660,8 +1711,9 @@ Packet::make(struct sk_buff *skb)
  * The given mbuf must be a pktmbuf which contains only a single segment, as
  * Click requires contiguous data. NULL is returned if this is not the case.
  *
- * The returned packet's annotations and header pointers <em>are not
- * set</em>. */
+ * The annotations are stored in the mbuf private area (see
+ * mbuf_priv_size()), so no Click descriptor is involved. The returned
+ * packet's annotations and header pointers are cleared. */
 inline Packet *
 Packet::make(struct rte_mbuf *mb)
 {
@@ -1673,8 +1725,8 @@ Packet::make(struct rte_mbuf *mb)
         click_chatter("cannot convert multi-segment pktmbuf to Packet");
         return 0;
     }
-    if (unlikely(rte_pktmbuf_tailroom(mb) < DPDK_ALL_ANNO_SIZE)) {
-        click_chatter("not enough tailroom for Click annotations");
+    if (unlikely(mb->priv_size < mbuf_priv_size())) {
+        click_chatter("mbuf private area too small for Click annotations");
         return 0;
     }*/
     Packet *p = reinterpret_cast<Packet *>(mb);
@@ -149,6 +149,126 @@ public:
     }
 };
 
+/**
+ * Single-producer single-consumer ring with size set at initialization time
+ *
+ * The producer and the consumer each own a cache line holding the index they
+ * publish and a private copy of the other side's index. A side only reads the
+ * other side's line when its copy says the ring is full (or empty), so an
+ * element crosses cores once per insert and the lines do not ping-pong on
+ * every operation. The consumer publishes its index only when it calls
+ * publish(), which lets it release a whole burst of slots at once.
+ */
+template <typename T> class SPSCDynamicRing {
+public:
+    SPSCDynamicRing() : _size(0), _mask(0), ring(0) {
+        _head = 0;
+        _tail_cache = 0;
+        _tail = 0;
+        _head_cache = 0;
+        _ctail = 0;
+    }
+
+    ~SPSCDynamicRing() {
+        if (_size)
+            delete[] ring;
+    }
+
+    /** @brief Allocate at least @a size slots, rounded up to a power of
+     * two. */
+    inline void initialize(int size) {
+        _size = 1;
+        while (_size < (uint32_t) size)
+            _size <<= 1;
+        _mask = _size - 1;
+        ring = new T[_size];
+    }
+
+    inline bool initialized() {
+        return _size > 0;
+    }
+
+    /** @brief Insert @a v. Producer only.
+     * @return false if the ring is full */
+    inline bool insert(T v) {
+        uint32_t h = _head;
+        if (h - _tail_cache >= _size) {
+            _tail_cache = *(volatile uint32_t *) &_tail;
+            if (h - _tail_cache >= _size)
+                return false;
+        }
+        ring[h & _mask] = v;
+        click_write_fence();
+        *(volatile uint32_t *) &_head = h + 1;
+        return true;
+    }
+
+    /** @brief Return true if the ring has no free slot. Producer only. */
+    inline bool is_full() {
+        if (_head - _tail_cache < _size)
+            return false;
+        _tail_cache = *(volatile uint32_t *) &_tail;
+        return _head - _tail_cache >= _size;
+    }
+
+    /** @brief Extract the oldest element, or return 0 if the ring is empty.
+     * Consumer only. The slot is released by the next publish(). */
+    inline T extract() {
+        if (_ctail == _head_cache && !refresh())
+            return 0;
+        T v = ring[_ctail & _mask];
+        ++_ctail;
+        return v;
+    }
+
+    /** @brief Return the element the next extract() will return, without
+     * removing it, or 0 if none is known to be available. Consumer only. */
+    inline T peek() {
+        if (_ctail == _head_cache)
+            return 0;
+        return ring[_ctail & _mask];
+    }
+
+    /** @brief Release the slots of all extracted elements to the producer.
+     * Consumer only.
+     *
+     * The store is only ordered after the loads of the extracted slots. A
+     * consumer that then checks whether the producer went to sleep on a full
+     * ring must issue click_fence() between publish() and that check. */
+    inline void publish() {
+        click_compiler_fence();
+        *(volatile uint32_t *) &_tail = _ctail;
+    }
+
+    inline bool is_empty() {
+        return _ctail == *(volatile uint32_t *) &_head;
+    }
+
+    inline unsigned int count() {
+        return *(volatile uint32_t *) &_head - *(volatile uint32_t *) &_tail;
+    }
+
+private:
+    uint32_t _size;
+    uint32_t _mask;
+    T* ring;
+
+    // Producer line
+    uint32_t _head CLICK_CACHE_ALIGN;
+    uint32_t _tail_cache;
+
+    // Consumer line
+    uint32_t _tail CLICK_CACHE_ALIGN;
+    uint32_t _head_cache;
+    uint32_t _ctail;
+
+    inline bool refresh() {
+        _head_cache = *(volatile uint32_t *) &_head;
+        click_read_fence();
+        return _ctail != _head_cache;
+    }
+};
+
 template <typename T, size_t RING_SIZE> class Ring : public BaseRing<T,RING_SIZE> {};
 
 template <typename T> class CircleList {
@@ -402,5 +522,85 @@ public:
     }
 };
 
+/**
+ * Bounded lock-free multi-producer multi-consumer ring
+ *
+ * Each cell carries a sequence number telling whether it may be written or
+ * read at a given position, so producers and consumers only contend on the
+ * compare-and-swap of their own index (D. Vyukov's bounded MPMC queue).
+ * RING_SIZE must be a power of two. Like the other rings, extract() returns
+ * 0 when the ring is empty, so T must be convertible from 0.
+ */
+template <typename T, size_t RING_SIZE> class LockFreeMPMCRing {
+
+    static_assert((RING_SIZE & (RING_SIZE - 1)) == 0,
+                  "RING_SIZE must be a power of two");
+
+    struct cell_t {
+        atomic_uint32_t seq;
+        T value;
+    };
+
+    cell_t _cells[RING_SIZE];
+    atomic_uint32_t _head CLICK_CACHE_ALIGN;
+    atomic_uint32_t _tail CLICK_CACHE_ALIGN;
+
+public:
+
+    LockFreeMPMCRing() {
+        for (uint32_t i = 0; i < RING_SIZE; i++) {
+            _cells[i].seq = i;
+            _cells[i].value = 0;
+        }
+        _head = 0;
+        _tail = 0;
+    }
+
+    inline bool insert(T v) {
+        uint32_t pos = _head;
+        cell_t *c;
+        for (;;) {
+            c = &_cells[pos & (RING_SIZE - 1)];
+            int32_t dif = (int32_t) (c->seq - pos);
+            if (dif == 0) {
+                if (_head.compare_swap(pos, pos + 1) == pos)
+                    break;
+            } else if (dif < 0)
+                return false;
+            pos = _head;
+        }
+        c->value = v;
+        click_write_fence();
+        c->seq = pos + 1;
+        return true;
+    }
+
+    inline T extract() {
+        uint32_t pos = _tail;
+        cell_t *c;
+        for (;;) {
+            c = &_cells[pos & (RING_SIZE - 1)];
+            int32_t dif = (int32_t) (c->seq - (pos + 1));
+            if (dif == 0) {
+                if (_tail.compare_swap(pos, pos + 1) == pos)
+                    break;
+            } else if (dif < 0)
+                return 0;
+            pos = _tail;
+        }
+        click_read_fence();
+        T v = c->value;
+        click_write_fence();
+        c->seq = pos + RING_SIZE;
+        return v;
+    }
+
+    /** @brief Return the number of elements, which may be stale as soon as
+     * it is returned. */
+    inline unsigned int count() {
+        return _head - _tail;
+    }
+};
+
 CLICK_ENDDECLS
 #endif
@@ -78,6 +78,30 @@ class RouterThread { public:
 
 #if CLICK_USERLEVEL
     inline void run_signals();
+
+    /** @brief Return true if the driver backs off from polling when its
+     * scheduled tasks keep finding no work. */
+    bool adaptive_poll() const          { return _adaptive_poll; }
+    void set_adaptive_poll(bool a)      { _adaptive_poll = a; }
+    /** @brief Set the adaptive_poll() value of RouterThreads constructed
+     * from now on. Defaults to false. */
+    static void set_default_adaptive_poll(bool a);
+
+    /** @brief Function arming (if @a arm) or disarming a wakeup source.
+     *
+     * Before blocking in adaptive polling mode, a thread arms all its
+     * wakeup sources. A source returns false if it cannot be armed or
+     * already has work, and the thread then does not block. A source
+     * should make a file descriptor of the thread's SelectSet readable when
+     * it has work. */
+    typedef bool (*WakeupCallback)(bool arm, void *user_data);
+    void add_wakeup(WakeupCallback f, void *user_data);
+    void remove_wakeup(WakeupCallback f, void *user_data);
+
+    enum { IDLE_SPIN, IDLE_PAUSE, IDLE_SLEEP, IDLE_BLOCK, NIDLE };
+    /** @brief Return the time spent in each adaptive polling state and
+     * wakeup latency percentiles, as text. */
+    String idle_info() const;
 #endif
 
     enum { S_PAUSED, S_BLOCKED, S_TIMERWAIT,
@@ -172,6 +196,34 @@ class RouterThread { public:
     unsigned _iters_per_os;
   private:
 
+#if CLICK_USERLEVEL
+    enum {
+        idle_ratio_one = 65536,         // _empty_ratio of an idle thread
+        idle_ewma_shift = 5,
+        idle_pause_loops = 64,
+        idle_sleep_usec = 20,
+        idle_block_usec = 1000,         // timer fallback when blocking
+        idle_latency_buckets = 32
+    };
+    struct Wakeup {
+        WakeupCallback f;
+        void *user_data;
+    };
+    bool _adaptive_poll;
+    bool _work_done;
+    int _idle_state;
+    uint32_t _empty_ratio;              // recent share of empty iterations
+    Timestamp _idle_since;
+    Timestamp _idle_slept;
+    Timestamp _idle_time[NIDLE];
+    uint64_t _idle_latency[idle_latency_buckets]; // log2 of nanoseconds
+    Vector<Wakeup> _wakeups;
+    static bool default_adaptive_poll;
+
+    void idle_backoff();
+    inline void set_idle_state(int state);
+#endif
+
 #if CLICK_NS
     Timestamp _ns_scheduled;
     Timestamp _ns_last_active;
@@ -6,6 +6,7 @@
 #endif
 #include <click/vector.hh>
 #include <click/sync.hh>
+#include <click/timestamp.hh>
 #include <unistd.h>
 #if !HAVE_ALLOW_SELECT && !HAVE_ALLOW_POLL && !HAVE_ALLOW_KQUEUE
 # define HAVE_ALLOW_SELECT 1
@@ -44,6 +45,7 @@ class SelectSet { public:
     int remove_select(int fd, Element *element, int mask);
 
     void run_selects(RouterThread *thread);
+    void run_selects(RouterThread *thread, const Timestamp &idle_wait);
     inline void wake_immediate() {
 	_wake_pipe_pending = true;
 	ignore_result(write(_wake_pipe[1], "", 1));
@@ -67,6 +69,7 @@ class SelectSet { public:
 
     int _wake_pipe[2];
     volatile bool _wake_pipe_pending;
+    Timestamp _idle_wait;
 #if HAVE_ALLOW_KQUEUE
     int _kqueue;
 #endif
@@ -90,6 +93,7 @@ class SelectSet { public:
     void remove_pollfd(int pi, int event);
     inline void call_selected(int fd, int mask) const;
     inline bool post_select(RouterThread *thread, bool acquire);
+    inline int wait_delay(RouterThread *thread, Timestamp &t) const;
 #if HAVE_ALLOW_KQUEUE
     void run_selects_kqueue(RouterThread *thread);
 #endif
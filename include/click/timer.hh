@@ -342,6 +342,7 @@ class Timer { public:
   private:
 
     int _schedpos1;
+    int _wheelslot;		// timing wheel slot, valid if _schedpos1 > 0
     Timestamp _expiry_s;
     union {
 	TimerCallback callback;
@@ -12,6 +12,7 @@ class Timer;
 class TimerSet { public:
 
     TimerSet();
+    ~TimerSet();
 
     Timestamp timer_expiry_steady() const	{ return _timer_expiry; }
     inline Timestamp timer_expiry_steady_adjusted() const;
@@ -31,6 +32,24 @@ class TimerSet { public:
 
     inline void fence();
 
+    /** @brief Return true if this set keeps its timers in a hierarchical
+     * timing wheel rather than in a heap. */
+    bool wheel() const				{ return _wheel_shift >= 0; }
+    /** @brief Return the timing wheel tick in microseconds, or 0 if this
+     * set uses a heap. */
+    unsigned wheel_tick() const {
+	return wheel() ? 1U << _wheel_shift : 0;
+    }
+
+    /** @brief Set the timing wheel tick of TimerSets constructed from now on.
+     * @param tick_usec tick in microseconds, rounded up to a power of two;
+     * 0 selects the heap
+     *
+     * The default is CLICK_TIMER_WHEEL_TICK, 0 unless defined at build time.
+     * Call this before creating the Master. */
+    static void set_default_wheel_tick(unsigned tick_usec);
+    static unsigned default_wheel_tick()	{ return default_wheel_tick_usec; }
+
   private:
 
     struct heap_element {
@@ -72,6 +91,8 @@ class TimerSet { public:
     uint32_t _timer_check_reports;
 
     inline void run_one_timer(Timer *);
+    inline void adjust_timer_stride(const Timestamp &first_expiry);
+    void run_timer_runchunk(RouterThread *thread);
 
     void set_timer_expiry() {
 	if (_timer_heap.size())
@@ -81,6 +102,38 @@ class TimerSet { public:
     }
     void check_timer_expiry(Timer *t);
 
+    // Hierarchical timing wheel. Level l has wheel_slots slots of
+    // wheel_slots^l ticks each; timers beyond the last level wait in the
+    // overflow slot. A scheduled timer sits in _wheel[_wheelslot] at index
+    // _schedpos1 - 1, so schedule and unschedule take constant time.
+    // _timer_expiry is a lower bound on the first expiry, exact when the
+    // next timers to run are already in level 0.
+    enum {
+	wheel_bits = 6, wheel_slots = 1 << wheel_bits, wheel_levels = 6,
+	wheel_overflow = wheel_levels * wheel_slots
+    };
+
+    int _wheel_shift;
+    uint64_t _wheel_now;
+    unsigned _wheel_size;
+    uint64_t _wheel_bitmap[wheel_levels];
+    Vector<Timer *> *_wheel;
+
+    static unsigned default_wheel_tick_usec;
+
+    uint64_t wheel_tick_of(const Timestamp &t) const {
+	return (uint64_t) t.usecval() >> _wheel_shift;
+    }
+    bool wheel_insert(Timer *t);
+    void wheel_remove(Timer *t);
+    void wheel_place(Timer *t);
+    void wheel_cascade(int slot);
+    uint64_t wheel_next_tick(uint64_t from, bool &exact) const;
+    void wheel_set_timer_expiry();
+    void wheel_collect(uint64_t tick);
+    void wheel_run_timers(RouterThread *thread);
+    Timer *wheel_next_timer() const;
+
     inline void lock_timers();
     inline bool attempt_lock_timers();
     inline void unlock_timers();
@@ -153,7 +206,11 @@ inline Timer *
 TimerSet::next_timer()
 {
     lock_timers();
-    Timer *t = _timer_heap.empty() ? 0 : _timer_heap.unchecked_at(0).t;
+    Timer *t;
+    if (wheel())
+	t = wheel_next_timer();
+    else
+	t = _timer_heap.empty() ? 0 : _timer_heap.unchecked_at(0).t;
     unlock_timers();
     return t;
 }
@@ -0,0 +1,106 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_TOEPLITZ_HH
+#define CLICK_TOEPLITZ_HH
+#include <click/ipflowid.hh>
+CLICK_DECLS
+
+/** @file <click/toeplitz.hh>
+ * @brief Software model of the Toeplitz hash used for receive-side scaling.
+ *
+ * NICs spread received packets across queues by hashing their addresses and
+ * ports with the Toeplitz function and indexing a redirection table (RETA)
+ * with the low bits of the result. ToeplitzHash computes the same value in
+ * software, so that an element can predict on which queue a packet will be
+ * received.
+ */
+
+class ToeplitzHash { public:
+
+    enum {
+	default_key_size = 40,	///< Key length used by most NICs
+	ipv4_tuple_size = 12	///< Bytes hashed for a TCP/UDP over IPv4 packet
+    };
+
+    /** @brief Construct a hash using the default Microsoft RSS key. */
+    ToeplitzHash() {
+	set_key(default_key(), default_key_size);
+    }
+
+    /** @brief Return the default Microsoft RSS key, also used by many
+     * drivers when no key is configured. */
+    static const uint8_t *default_key() {
+	static const uint8_t key[default_key_size] = {
+	    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+	};
+	return key;
+    }
+
+    /** @brief Set the hash key.
+     * @param key key bytes
+     * @param len key length; must be at least ipv4_tuple_size + 4
+     * @return true on success
+     *
+     * Precomputes one table per input byte, so hash_ipv4() costs twelve
+     * table lookups. */
+    bool set_key(const uint8_t *key, int len) {
+	if (len < ipv4_tuple_size + 4)
+	    return false;
+	for (int pos = 0; pos < ipv4_tuple_size; ++pos)
+	    for (int byte = 0; byte < 256; ++byte) {
+		uint8_t b = byte;
+		_lut[pos][byte] = hash(key, len, &b, 1, pos);
+	    }
+	return true;
+    }
+
+    /** @brief Return the Toeplitz hash of @a len bytes at @a data, as if
+     * they started at byte @a offset of the hash input.
+     *
+     * This is the bit-by-bit reference implementation. */
+    static uint32_t hash(const uint8_t *key, int key_len,
+			 const uint8_t *data, int len, int offset = 0) {
+	uint32_t result = 0;
+	for (int i = 0; i < len; ++i)
+	    for (int bit = 0; bit < 8; ++bit)
+		if (data[i] & (0x80 >> bit)) {
+		    int kbit = (offset + i) * 8 + bit;
+		    result ^= key_window(key, key_len, kbit);
+		}
+	return result;
+    }
+
+    /** @brief Return the hash of a TCP/UDP over IPv4 flow.
+     *
+     * The input is source address, destination address, source port and
+     * destination port in network byte order, which is the layout of
+     * IPFlowID. */
+    uint32_t hash_ipv4(const IPFlowID &flow) const {
+	const uint8_t *d = reinterpret_cast<const uint8_t *>(&flow);
+	uint32_t h = 0;
+	for (int pos = 0; pos < ipv4_tuple_size; ++pos)
+	    h ^= _lut[pos][d[pos]];
+	return h;
+    }
+
+  private:
+
+    uint32_t _lut[ipv4_tuple_size][256];
+
+    static uint32_t key_window(const uint8_t *key, int key_len, int kbit) {
+	uint32_t w = 0;
+	for (int i = 0; i < 32; ++i) {
+	    int b = kbit + i;
+	    if (b / 8 < key_len && (key[b / 8] & (0x80 >> (b % 8))))
+		w |= 0x80000000U >> i;
+	}
+	return w;
+    }
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -83,6 +83,43 @@ int DPDKDevice::set_rss_max(int max)
 	return status;
 }
 
+/* Reads the RSS hash key and redirection table of a started port, so that
+ * elements can predict on which queue a flow will be received. */
+int DPDKDevice::get_rss_conf(portid_t port_id, Vector<uint8_t> &key,
+                             Vector<unsigned> &reta)
+{
+    struct rte_eth_dev_info dev_info;
+    rte_eth_dev_info_get(port_id, &dev_info);
+
+    uint8_t key_buf[64];
+    struct rte_eth_rss_conf rss_conf;
+    memset(&rss_conf, 0, sizeof rss_conf);
+    rss_conf.rss_key = key_buf;
+    rss_conf.rss_key_len = dev_info.hash_key_size ? dev_info.hash_key_size : 40;
+    if (rss_conf.rss_key_len > sizeof key_buf)
+        return -EINVAL;
+    int status = rte_eth_dev_rss_hash_conf_get(port_id, &rss_conf);
+    if (status != 0)
+        return status;
+    key.resize(rss_conf.rss_key_len);
+    memcpy(key.begin(), key_buf, rss_conf.rss_key_len);
+
+    uint16_t reta_size = dev_info.reta_size;
+    if (reta_size == 0 || reta_size > ETH_RSS_RETA_SIZE_512)
+        return -EINVAL;
+    struct rte_eth_rss_reta_entry64 reta_conf[RETA_CONF_SIZE];
+    memset(reta_conf, 0, sizeof(reta_conf));
+    for (unsigned i = 0; i < reta_size; i++)
+        reta_conf[i / RTE_RETA_GROUP_SIZE].mask = UINT64_MAX;
+    status = rte_eth_dev_rss_reta_query(port_id, reta_conf, reta_size);
+    if (status != 0)
+        return status;
+    reta.resize(reta_size);
+    for (unsigned i = 0; i < reta_size; i++)
+        reta[i] = reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE];
+    return 0;
+}
+
 /* Wraps rte_eth_dev_socket_id(), which may return -1 for valid ports when NUMA
  * is not well supported. This function will return 0 instead in that case. */
 int DPDKDevice::get_port_numa_node(portid_t port_id)
@@ -201,7 +238,13 @@ int DPDKDevice::alloc_pktmbufs(ErrorHandler* errh)
                         _pktmbuf_pools[i] =
 #if RTE_VERSION >= RTE_VERSION_NUM(2,2,0,0)
                         rte_pktmbuf_pool_create(name, get_nb_mbuf(i),
-                                                MBUF_CACHE_SIZE, 0, MBUF_DATA_SIZE, i);
+                                                MBUF_CACHE_SIZE,
+# if CLICK_PACKET_USE_DPDK
+                                                Packet::mbuf_priv_size(),
+# else
+                                                0,
+# endif
+                                                MBUF_DATA_SIZE, i);
 #else
                         rte_mempool_create(
                                         name, get_nb_mbuf(i), MBUF_SIZE, MBUF_CACHE_SIZE,
@@ -298,6 +341,7 @@ int DPDKDevice::initialize_device(ErrorHandler *errh)
     dev_conf.txmode.offloads = 0;
 #endif
     dev_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+    dev_conf.intr_conf.rxq = info.rx_intr;
     dev_conf.rx_adv_conf.rss_conf.rss_key = NULL;
     dev_conf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP;
     dev_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
@@ -659,6 +703,11 @@ void DPDKDevice::set_tx_offload(uint64_t offload) {
     info.tx_offload |= offload;
 }
 
+void DPDKDevice::set_rx_intr() {
+    assert(!_is_initialized);
+    info.rx_intr = true;
+}
+
 EtherAddress DPDKDevice::get_mac() {
     assert(_is_initialized);
     struct rte_ether_addr addr;
@@ -1028,6 +1077,9 @@ int DPDKDevice::MBUF_DATA_SIZE = RTE_MBUF_DEFAULT_BUF_SIZE;
 int DPDKDevice::MBUF_DATA_SIZE = 2048 + RTE_PKTMBUF_HEADROOM;
 #endif
 int DPDKDevice::MBUF_SIZE = MBUF_DATA_SIZE
+#if CLICK_PACKET_USE_DPDK
+                          + Packet::mbuf_priv_size()
+#endif
                           + sizeof (struct rte_mbuf);
 int DPDKDevice::MBUF_CACHE_SIZE = 256;
 int DPDKDevice::RX_PTHRESH = 8;
@@ -28,9 +28,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#ifdef ALLOW_MMAP
+#if defined(ALLOW_MMAP) || HAVE_LINUX_IO_URING_H
 # include <sys/mman.h>
 #endif
+#if HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+#endif
 CLICK_DECLS
 
 FromFile::FromFile()
@@ -38,6 +43,7 @@ FromFile::FromFile()
 #ifdef ALLOW_MMAP
       _mmap(true),
 #endif
+      _ra(0), _ra_depth(0), _ra_unit(READAHEAD_UNIT), _ra_uring(true),
       _filename(), _pipe(0), _landmark_pattern("%f"), _lineno(0)
 {
 }
@@ -52,8 +58,17 @@ FromFile::configure_keywords(Vector<String> &conf, Element *e, ErrorHandler *err
 #endif
     if (Args(e, errh).bind(conf)
 	.read("MMAP", mmap)
+	.read("READAHEAD", _ra_depth)
+	.read("READAHEAD_SIZE", _ra_unit)
+	.read("IO_URING", _ra_uring)
 	.consume() < 0)
 	return -1;
+    if (_ra_depth < 0 || _ra_depth > 1024)
+	return errh->error("READAHEAD must be between 0 and 1024");
+    if (_ra_unit < 4096 || _ra_unit > (1U << 30))
+	return errh->error("READAHEAD_SIZE out of range");
+    if (_ra_depth)
+	mmap = false;
 #ifdef ALLOW_MMAP
     _mmap = mmap;
 #else
@@ -170,6 +185,386 @@ FromFile::read_buffer_mmap(ErrorHandler *errh)
 }
 #endif
 
+// Read-ahead engine. DEPTH reads of UNIT bytes each are kept in flight
+// ahead of the consumer, through io_uring if the kernel supports it, and
+// otherwise as synchronous preads preceded by POSIX_FADV_WILLNEED hints so
+// that the kernel fetches the data in the background. Each buffer is handed
+// out as the data packet once its read completes, so packets cloned from
+// it keep it alive, and the slot gets a fresh buffer for the next read.
+// Buffers are huge-page aligned and advised when UNIT allows.
+
+struct FromFile::ReadAhead {
+
+    struct Slot {
+	unsigned char *buf;
+	off_t off;
+	ssize_t result;		// bytes read, or -errno
+	bool pending;
+#if HAVE_LINUX_IO_URING_H
+	struct iovec iov;
+#endif
+    };
+
+    int fd;
+    uint32_t unit;
+    int depth;
+    Slot *slots;
+    int cur;
+    off_t next_off;
+
+    ReadAhead(int fd_, uint32_t unit_, int depth_, bool uring);
+    ~ReadAhead();
+
+    unsigned char *alloc_buffer();
+    static void free_buffer(unsigned char *buf, size_t, void *);
+    void submit(Slot &s);
+    void wait(Slot &s);
+    void restart(off_t off);
+    void drain();
+
+    ssize_t read_sync(unsigned char *buf, size_t len, off_t off);
+
+#if HAVE_LINUX_IO_URING_H
+    int ring_fd;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    bool setup_uring();
+    void teardown_uring();
+    void reap();
+    bool getevents();
+#endif
+
+};
+
+FromFile::ReadAhead::ReadAhead(int fd_, uint32_t unit_, int depth_, bool uring)
+    : fd(fd_), unit(unit_), depth(depth_), cur(0), next_off(0)
+{
+#if HAVE_LINUX_IO_URING_H
+    ring_fd = -1;
+    sq_ptr = cq_ptr = MAP_FAILED;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+    if (uring && !setup_uring())
+	teardown_uring();
+#else
+    (void) uring;
+#endif
+    slots = new Slot[depth];
+    for (int i = 0; i < depth; i++) {
+	slots[i].buf = 0;
+	slots[i].pending = false;
+    }
+}
+
+FromFile::ReadAhead::~ReadAhead()
+{
+    drain();
+    for (int i = 0; i < depth; i++)
+	free_buffer(slots[i].buf, unit, 0);
+    delete[] slots;
+#if HAVE_LINUX_IO_URING_H
+    teardown_uring();
+#endif
+}
+
+unsigned char *
+FromFile::ReadAhead::alloc_buffer()
+{
+    size_t align = unit % READAHEAD_UNIT == 0 ? READAHEAD_UNIT : 4096;
+    void *buf;
+    if (posix_memalign(&buf, align, unit) != 0)
+	return 0;
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    if (align == READAHEAD_UNIT)
+	(void) madvise(buf, unit, MADV_HUGEPAGE);
+#endif
+    return (unsigned char *) buf;
+}
+
+void
+FromFile::ReadAhead::free_buffer(unsigned char *buf, size_t, void *)
+{
+    free(buf);
+}
+
+ssize_t
+FromFile::ReadAhead::read_sync(unsigned char *buf, size_t len, off_t off)
+{
+    size_t got = 0;
+    while (got < len) {
+	ssize_t r = ::pread(fd, buf + got, len - got, off + got);
+	if (r > 0)
+	    got += r;
+	else if (r == 0)
+	    break;
+	else if (errno != EINTR && errno != EAGAIN)
+	    return -errno;
+    }
+    return got;
+}
+
+#if HAVE_LINUX_IO_URING_H
+bool
+FromFile::ReadAhead::setup_uring()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (ring_fd < 0)
+	return false;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cq_len > sq_len)
+	sq_len = cq_len;
+    sq_ptr = mmap(0, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+	return false;
+    if (single)
+	cq_ptr = sq_ptr;
+    else {
+	cq_ptr = mmap(0, cq_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	if (cq_ptr == MAP_FAILED)
+	    return false;
+    }
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(0, sqes_len, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, ring_fd,
+					IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+	return false;
+
+    char *sq = (char *) sq_ptr, *cq = (char *) cq_ptr;
+    sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *) (sq + p.sq_off.array);
+    cq_head = (unsigned *) (cq + p.cq_off.head);
+    cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+}
+
+void
+FromFile::ReadAhead::teardown_uring()
+{
+    if (sqes != MAP_FAILED)
+	munmap(sqes, sqes_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+	munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED)
+	munmap(sq_ptr, sq_len);
+    if (ring_fd >= 0)
+	close(ring_fd);
+    ring_fd = -1;
+    sq_ptr = cq_ptr = MAP_FAILED;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+}
+
+void
+FromFile::ReadAhead::reap()
+{
+    unsigned head = *cq_head;
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+	struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+	Slot &s = slots[cqe->user_data];
+	s.result = cqe->res;
+	s.pending = false;
+	head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Block until a completion arrives. Returns false if the ring failed;
+// interruptions and transient shortages only mean the caller should reap
+// and try again.
+bool
+FromFile::ReadAhead::getevents()
+{
+    return syscall(__NR_io_uring_enter, ring_fd, 0, 1,
+		   IORING_ENTER_GETEVENTS, NULL, 0) >= 0
+	|| errno == EINTR || errno == EAGAIN || errno == EBUSY;
+}
+#endif
+
+void
+FromFile::ReadAhead::submit(Slot &s)
+{
+    s.pending = true;
+#if HAVE_LINUX_IO_URING_H
+    if (ring_fd >= 0) {
+	unsigned tail = *sq_tail, idx = tail & *sq_mask;
+	struct io_uring_sqe *sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	s.iov.iov_base = s.buf;
+	s.iov.iov_len = unit;
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) &s.iov;
+	sqe->len = 1;
+	sqe->off = s.off;
+	sqe->user_data = &s - slots;
+	sq_array[idx] = idx;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	while (1) {
+	    int r = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0);
+	    if (r == 1)
+		return;
+	    if (r >= 0 || (errno != EINTR && errno != EAGAIN && errno != EBUSY))
+		break;
+	    // Short of resources, or the completion queue is full: make
+	    // room and submit again.
+	    reap();
+	}
+	// The ring refused the request: let the requests it accepted finish,
+	// then read synchronously from now on.
+	s.pending = false;
+	drain();
+	teardown_uring();
+	s.pending = true;
+    }
+#endif
+#if defined(POSIX_FADV_WILLNEED)
+    (void) posix_fadvise(fd, s.off, unit, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void
+FromFile::ReadAhead::wait(Slot &s)
+{
+#if HAVE_LINUX_IO_URING_H
+    if (ring_fd >= 0) {
+	while (s.pending) {
+	    reap();
+	    if (s.pending && !getevents())
+		break;
+	}
+	if (s.pending || s.result == -EINVAL || s.result == -EOPNOTSUPP) {
+	    // The ring failed, or the kernel is too old for IORING_OP_READV:
+	    // reap what the ring accepted, then read synchronously.
+	    drain();
+	    teardown_uring();
+	    for (int i = 0; i < depth; i++)
+		slots[i].pending = (slots[i].buf != 0);
+	} else if (s.result < 0)
+	    return;
+	else {
+	    // Complete a short read, or confirm end of file.
+	    if (s.result < (ssize_t) unit) {
+		ssize_t r = read_sync(s.buf + s.result, unit - s.result,
+				      s.off + s.result);
+		s.result = r < 0 ? r : s.result + r;
+	    }
+	    return;
+	}
+    }
+#endif
+    s.result = read_sync(s.buf, unit, s.off);
+    s.pending = false;
+}
+
+void
+FromFile::ReadAhead::drain()
+{
+#if HAVE_LINUX_IO_URING_H
+    // Requests the kernel has accepted must finish before their buffers
+    // are reused or freed.
+    for (int i = 0; i < depth && ring_fd >= 0; i++)
+	while (slots[i].pending) {
+	    reap();
+	    if (slots[i].pending && !getevents())
+		break;
+	}
+#endif
+    for (int i = 0; i < depth; i++)
+	slots[i].pending = false;
+}
+
+void
+FromFile::ReadAhead::restart(off_t off)
+{
+    drain();
+    cur = 0;
+    next_off = off;
+    for (int i = 0; i < depth; i++) {
+	Slot &s = slots[i];
+	if (!s.buf)
+	    s.buf = alloc_buffer();
+	s.off = next_off;
+	next_off += unit;
+	s.result = 0;
+	if (s.buf)
+	    submit(s);
+    }
+}
+
+void
+FromFile::start_readahead()
+{
+    struct stat statbuf;
+    if (_ra_depth <= 0 || _fd < 0 || fstat(_fd, &statbuf) < 0
+	|| !S_ISREG(statbuf.st_mode))
+	return;
+    _ra = new ReadAhead(_fd, _ra_unit, _ra_depth, _ra_uring);
+    _ra->restart(0);
+}
+
+void
+FromFile::stop_readahead()
+{
+    delete _ra;
+    _ra = 0;
+}
+
+int
+FromFile::read_buffer_ahead(ErrorHandler *errh)
+{
+    ReadAhead::Slot &s = _ra->slots[_ra->cur];
+    if (!s.buf)
+	return error(errh, strerror(ENOMEM));
+    _ra->wait(s);
+    if (s.result < 0)
+	return error(errh, strerror(-s.result));
+    if (s.result == 0)
+	return 0;
+
+    _data_packet = Packet::make(s.buf, s.result, ReadAhead::free_buffer, 0);
+    if (!_data_packet)
+	return error(errh, strerror(ENOMEM));
+    _buffer = _data_packet->data();
+    _len = s.result;
+    _file_offset = s.off;
+
+    if (s.result < (ssize_t) _ra->unit) {
+	// End of file, or the file changed under us: read what follows, if
+	// anything, from a clean state.
+	s.buf = 0;
+	_ra->restart(s.off + s.result);
+    } else {
+	s.buf = _ra->alloc_buffer();
+	s.off = _ra->next_off;
+	_ra->next_off += _ra->unit;
+	if (s.buf)
+	    _ra->submit(s);
+	_ra->cur = (_ra->cur + 1) % _ra->depth;
+    }
+    return _len;
+}
+
 int
 FromFile::read_buffer(ErrorHandler *errh)
 {
@@ -185,6 +580,9 @@ FromFile::read_buffer(ErrorHandler *errh)
     if (_fd < 0)
 	return _fd == -1 ? -EBADF : _len;
 
+    if (_ra)
+	return read_buffer_ahead(errh);
+
 #ifdef ALLOW_MMAP
     if (_mmap) {
 	int result = read_buffer_mmap(errh);
@@ -316,7 +714,7 @@ int
 FromFile::seek(off_t want, ErrorHandler* errh)
 {
     if (want >= _file_offset && want < (off_t) (_file_offset + _len)) {
-	_pos = want;
+	_pos = want - _file_offset;
 	return 0;
     }
 
@@ -338,6 +736,13 @@ FromFile::seek(off_t want, ErrorHandler* errh)
     if (S_ISREG(statbuf.st_mode) && statbuf.st_size && want > statbuf.st_size)
 	return errh->error("FILEPOS out of range");
 
+    if (_ra) {
+	_ra->restart(want);
+	_pos = _len;
+	_file_offset = want - _len;
+	return 0;
+    }
+
     // try to seek
     if (lseek(_fd, want, SEEK_SET) != (off_t) -1) {
 	_pos = _len;
@@ -395,6 +800,7 @@ FromFile::initialize(ErrorHandler *errh, bool allow_nonexistent)
 #endif
     _file_offset = 0;
     _pos = _len = 0;
+    start_readahead();
     int result = read_buffer(errh);
     if (result < 0)
 	return -1;
@@ -408,6 +814,7 @@ FromFile::initialize(ErrorHandler *errh, bool allow_nonexistent)
     if (_fd == STDIN_FILENO || _pipe)
 	/* cannot handle gzip or bzip2 */;
     else if (compressed_data(_buffer, _len)) {
+	stop_readahead();
 	close(_fd);
 	_fd = -1;
 	if (!(_pipe = open_uncompress_pipe(_filename, _buffer, _len, errh)))
@@ -434,6 +841,10 @@ FromFile::take_state(FromFile &o, ErrorHandler *errh)
     _data_packet = o._data_packet;
     o._data_packet = 0;
 
+    stop_readahead();
+    _ra = o._ra;
+    o._ra = 0;
+
 #ifdef ALLOW_MMAP
     if (_mmap != o._mmap)
 	errh->warning("different MMAP states");
@@ -450,6 +861,7 @@ FromFile::take_state(FromFile &o, ErrorHandler *errh)
 void
 FromFile::cleanup()
 {
+    stop_readahead();
     if (_pipe)
 	pclose(_pipe);
     else if (_fd >= 0 && _fd != STDIN_FILENO)
@@ -461,6 +873,28 @@ FromFile::cleanup()
     _data_packet = 0;
 }
 
+off_t
+FromFile::file_size() const
+{
+    struct stat s;
+    if (_fd >= 0 && fstat(_fd, &s) >= 0 && S_ISREG(s.st_mode))
+	return s.st_size;
+    else
+	return -1;
+}
+
+ssize_t
+FromFile::pread(void *buf, size_t len, off_t off) const
+{
+    if (_fd < 0 || _pipe)
+	return -EBADF;
+    ssize_t r;
+    do {
+	r = ::pread(_fd, buf, len, off);
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -errno : r;
+}
+
 const uint8_t *
 FromFile::get_aligned(size_t size, void *buffer, ErrorHandler *errh)
 {
@@ -578,9 +1012,9 @@ String
 FromFile::filesize_handler(Element *e, void *thunk)
 {
     FromFile *fd = reinterpret_cast<FromFile *>((uint8_t *)e + (intptr_t)thunk);
-    struct stat s;
-    if (fd->_fd >= 0 && fstat(fd->_fd, &s) >= 0 && S_ISREG(s.st_mode))
-	return String(s.st_size);
+    off_t size = fd->file_size();
+    if (size >= 0)
+	return String(size);
     else
 	return "-";
 }
@@ -27,9 +27,23 @@
 #include <click/ring.hh>
 #include <click/vector.hh>
 #include <click/netmapdevice.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
 #if CLICK_USERLEVEL || CLICK_MINIOS
 # include <unistd.h>
 #endif
+#if CLICK_USERLEVEL
+# include <errno.h>
+# include <string.h>
+# include <sys/mman.h>
+# if HAVE_NUMA
+#  include <sched.h>
+extern "C" {
+#  include <numa.h>
+#  include <numaif.h>
+}
+# endif
+#endif
 #if HAVE_DPDK
 # include <rte_malloc.h>
 # include <click/dpdkdevice.hh>
@@ -191,6 +205,10 @@ CLICK_DECLS
  * Avoid writing buggy code like this!  Use WritablePacket selectively, and
  * try to avoid calling WritablePacket::clone() when possible. */
 
+#if HAVE_CLICK_PACKET_POOL
+static bool pool_release_buffer(unsigned char *buf);
+#endif
+
 Packet::~Packet()
 {
     // This is a convenient place to put static assertions.
@@ -214,6 +232,11 @@ Packet::~Packet()
 #if CLICK_LINUXMODULE
     static_assert(sizeof(Anno) <= sizeof(((struct sk_buff *)0)->cb),
 		  "Anno structure too big for Linux packet annotation area.");
+#elif CLICK_PACKET_USE_DPDK
+    static_assert(sizeof(struct rte_mbuf) % CLICK_CACHE_LINE_SIZE == 0
+		  && offsetof(AllAnno, cb) + AGGREGATE_ANNO_OFFSET + 4
+		     <= CLICK_CACHE_LINE_SIZE,
+		  "Hot annotations must share the first private cache line.");
 #endif
 
 #if CLICK_LINUXMODULE
@@ -232,6 +255,10 @@ Packet::~Packet()
     if (_head && NetmapBufQ::is_valid_netmap_packet(this)) {
         NetmapBufQ::local_pool()->insert_p(_head);
     } else
+#  endif
+#  if HAVE_CLICK_PACKET_POOL
+    if (_head && pool_release_buffer(_head)) {
+    } else
 #  endif
     if (_head) {
             delete[] _head;
@@ -254,6 +281,12 @@ Packet::~Packet()
 // pre-initialized Packet objects, either with or without data, for fast
 // reuse. It can support multithreaded deployments: each thread has its own
 // pool, with a global pool to even out imbalance.
+//
+// The global pool has one lock-free ring of batches per NUMA node; threads
+// give and take batches on their own node first. Packets and buffers may
+// also be preallocated per node, from hugepages when possible (see
+// pool_prealloc()). Preallocated memory is never freed: it stays in the pools
+// even when they are over their size limit.
 
 #if HAVE_DPDK_PACKET_POOL
 #  define CLICK_PACKET_POOL_BUFSIZ		DPDKDevice::MBUF_DATA_SIZE
@@ -261,34 +294,86 @@ Packet::~Packet()
 #  define CLICK_PACKET_POOL_BUFSIZ		2048
 #endif
 // see LIMIT in packetpool-01.testie
-#  define CLICK_PACKET_POOL_SIZE		4096 
+#ifndef CLICK_PACKET_POOL_SIZE
+#  define CLICK_PACKET_POOL_SIZE		4096
+#endif
+#ifndef CLICK_PACKET_DATA_POOL_SIZE
 #  define CLICK_PACKET_DATA_POOL_SIZE		4096
+#endif
 #  define CLICK_GLOBAL_PACKET_POOL_COUNT	32
 #if HAVE_DPDK_PACKET_POOL || HAVE_NETMAP_PACKET_POOL
 #  define CLICK_GLOBAL_PACKET_DATA_POOL_COUNT	8
-#else 
+#else
 #  define CLICK_GLOBAL_PACKET_DATA_POOL_COUNT	32
 #endif
+#  define CLICK_PACKET_POOL_MAX_NODES		8
 
+static unsigned packet_pool_size = CLICK_PACKET_POOL_SIZE;
+static unsigned packet_data_pool_size = CLICK_PACKET_DATA_POOL_SIZE;
+
+// preallocated memory, one region per node
+struct PacketPoolRegion {
+    const unsigned char *begin;
+    const unsigned char *end;
+    size_t size;
+    bool hugepages;
+};
+static PacketPoolRegion packet_pool_regions[CLICK_PACKET_POOL_MAX_NODES];
+static int packet_pool_nregions;
+static const unsigned char *packet_pool_region_begin;
+static const unsigned char *packet_pool_region_end;
+
+/** @brief Return true if @a x points into preallocated pool memory. */
+static inline bool pool_owns(const void *x) {
+    const unsigned char *c = static_cast<const unsigned char *>(x);
+    if (likely(c < packet_pool_region_begin || c >= packet_pool_region_end))
+	return false;
+    for (int i = 0; i < packet_pool_nregions; ++i)
+	if (c >= packet_pool_regions[i].begin && c < packet_pool_regions[i].end)
+	    return true;
+    return false;
+}
+
+static inline void pool_free_buffer(PacketPool &packet_pool, unsigned char *buf) {
+    *reinterpret_cast<unsigned char **>(buf) = packet_pool.buf;
+    packet_pool.buf = buf;
+    ++packet_pool.bufcount;
+}
+
+/** @brief Give @a buf back to the local pool if it is preallocated.
+ * @return true if @a buf was preallocated */
+static bool pool_release_buffer(unsigned char *buf) {
+    if (!pool_owns(buf))
+	return false;
+    pool_free_buffer(*WritablePacket::make_local_packet_pool(), buf);
+    return true;
+}
 
 #  if HAVE_MULTITHREAD
 static __thread PacketPool *thread_packet_pool;
 
-typedef MPMCRing<WritablePacket*,CLICK_GLOBAL_PACKET_POOL_COUNT> BatchPRing;
-typedef MPMCRing<WritablePacket*,CLICK_GLOBAL_PACKET_DATA_POOL_COUNT> BatchPDRing;
+typedef LockFreeMPMCRing<WritablePacket*,CLICK_GLOBAL_PACKET_POOL_COUNT> BatchPRing;
+typedef LockFreeMPMCRing<WritablePacket*,CLICK_GLOBAL_PACKET_DATA_POOL_COUNT> BatchPDRing;
 
 struct GlobalPacketPool {
-    BatchPRing pbatch;     // batches of free packets, linked by p->prev()
-                                //   p->anno_u32(0) is # packets in batch
-    BatchPDRing pdbatch;        // batches of packet with data buffers
+    struct node_pool {
+	BatchPRing pbatch;	// batches of free packets, linked by p->next()
+				//   p->anno_u32(0) is # packets in batch
+	BatchPDRing pdbatch;	// batches of packet with data buffers
+    } node[CLICK_PACKET_POOL_MAX_NODES];
+    int nnodes;
 
     PacketPool* thread_pools;   // all thread packet pools
 
     volatile uint32_t lock;
 };
 static GlobalPacketPool global_packet_pool;
+
+static inline int packet_pool_nnodes() {
+    return global_packet_pool.nnodes ? global_packet_pool.nnodes : 1;
+}
 #else
-static PacketPool global_packet_pool = {0,0,0,0};
+static PacketPool global_packet_pool;
 #  endif
 
 /** @brief Return the local packet pool for this thread.
@@ -308,6 +393,14 @@ PacketPool* WritablePacket::make_local_packet_pool() {
     PacketPool *pp = thread_packet_pool;
     if (unlikely(!pp && (pp = new PacketPool))) {
 	memset(pp, 0, sizeof(PacketPool));
+	pp->thread = click_current_cpu_id();
+#   if CLICK_USERLEVEL && HAVE_NUMA
+	if (global_packet_pool.nnodes > 1) {
+	    int cpu = sched_getcpu();
+	    int node = cpu >= 0 ? numa_node_of_cpu(cpu) : 0;
+	    pp->node = node > 0 && node < global_packet_pool.nnodes ? node : 0;
+	}
+#   endif
 	while (atomic_uint32_t::swap(global_packet_pool.lock, 1) == 1)
 	    /* do nothing */;
 	pp->thread_pool_next = global_packet_pool.thread_pools;
@@ -363,11 +456,17 @@ WritablePacket::pool_allocate()
     PacketPool& packet_pool = *make_local_packet_pool();
 
 #  if HAVE_MULTITHREAD
-    if (!packet_pool.p) {
-        WritablePacket *pp = global_packet_pool.pbatch.extract();
+    if (!packet_pool.p && !packet_pool.pkeep) {
+        WritablePacket *pp = global_packet_pool.node[packet_pool.node].pbatch.extract();
+        for (int i = 1; !pp && i < packet_pool_nnodes(); ++i) {
+            pp = global_packet_pool.node[(packet_pool.node + i) % packet_pool_nnodes()].pbatch.extract();
+            if (pp)
+                ++packet_pool.remote_imports;
+        }
         if (pp) {
             packet_pool.p = pp;
             packet_pool.pcount = pp->anno_u32(0);
+            ++packet_pool.imports;
         }
 
     }
@@ -377,8 +476,11 @@ WritablePacket::pool_allocate()
         if (p) {
         packet_pool.p = static_cast<WritablePacket*>(p->next());
         --packet_pool.pcount;
+        } else if ((p = packet_pool.pkeep)) {
+        packet_pool.pkeep = static_cast<WritablePacket*>(p->next());
         } else {
         p = new WritablePacket;
+        ++packet_pool.misses;
         }
         return p;
 
@@ -393,11 +495,17 @@ WritablePacket::pool_data_allocate()
     PacketPool& packet_pool = *make_local_packet_pool();
 
 #  if HAVE_MULTITHREAD
-    if (unlikely(!packet_pool.pd)) {
-        WritablePacket *pd = global_packet_pool.pdbatch.extract();
+    if (unlikely(!packet_pool.pd && !packet_pool.pdkeep)) {
+        WritablePacket *pd = global_packet_pool.node[packet_pool.node].pdbatch.extract();
+        for (int i = 1; !pd && i < packet_pool_nnodes(); ++i) {
+            pd = global_packet_pool.node[(packet_pool.node + i) % packet_pool_nnodes()].pdbatch.extract();
+            if (pd)
+                ++packet_pool.remote_imports;
+        }
         if (pd) {
             packet_pool.pd = pd;
             packet_pool.pdcount = pd->anno_u32(0);
+            ++packet_pool.imports;
         }
 	}
 #  endif /* HAVE_MULTITHREAD */
@@ -406,9 +514,21 @@ WritablePacket::pool_data_allocate()
     if (pd) {
         packet_pool.pd = static_cast<WritablePacket*>(pd->next());
         --packet_pool.pdcount;
+    } else if ((pd = packet_pool.pdkeep)) {
+        packet_pool.pdkeep = static_cast<WritablePacket*>(pd->next());
+    } else if (unsigned char *buf = packet_pool.buf) {
+        // reuse a preallocated buffer released by its packet
+        packet_pool.buf = *reinterpret_cast<unsigned char **>(buf);
+        --packet_pool.bufcount;
+        pd = pool_allocate();
+        pd->_head = pd->_data = pd->_tail = buf;
+        pd->_end = buf + CLICK_PACKET_POOL_BUFSIZ;
+        pd->_destructor = 0;
+        pd->_data_packet = 0;
     } else {
         pd = pool_allocate();
         pd->alloc_data(0,CLICK_PACKET_POOL_BUFSIZ,0);
+        ++packet_pool.data_misses;
     }
     return pd;
 
@@ -448,23 +568,34 @@ WritablePacket::pool_allocate(uint32_t headroom, uint32_t length,
 inline void
 WritablePacket::check_packet_pool_size(PacketPool &packet_pool) {
 #  if HAVE_MULTITHREAD
-    if (unlikely(packet_pool.p && packet_pool.pcount >= CLICK_PACKET_POOL_SIZE)) {
+    if (unlikely(packet_pool.p && packet_pool.pcount >= packet_pool_size)) {
         packet_pool.p->set_anno_u32(0, packet_pool.pcount);
-        if (!global_packet_pool.pbatch.insert(packet_pool.p)) { //Si le nombre de batch est au max -> delete
-            while (WritablePacket *p = packet_pool.p) { //On supprime le batch
+        if (global_packet_pool.node[packet_pool.node].pbatch.insert(packet_pool.p))
+            ++packet_pool.exports;
+        else { // the global pool is full, free the batch
+            // Preallocated packets cannot be freed; they move to their own
+            // list so they do not count against the pool size.
+            while (WritablePacket *p = packet_pool.p) {
                 packet_pool.p = static_cast<WritablePacket *>(p->next());
-                ::operator delete((void *) p);
+                if (pool_owns(p)) {
+                    p->set_next(packet_pool.pkeep);
+                    packet_pool.pkeep = p;
+                } else {
+                    ::operator delete((void *) p);
+                    ++packet_pool.drops;
+                }
             }
         }
         packet_pool.p = 0;
         packet_pool.pcount = 0;
     }
 #  else /* !HAVE_MULTITHREAD */
-    if (packet_pool.pcount == CLICK_PACKET_POOL_SIZE) {
+    if (packet_pool.pcount >= packet_pool_size && !pool_owns(packet_pool.p)) {
         WritablePacket* tmp = (WritablePacket*)packet_pool.p->next();
         ::operator delete((void *) packet_pool.p);
         packet_pool.p = tmp;
         packet_pool.pcount--;
+        ++packet_pool.drops;
     }
 #  endif /* HAVE_MULTITHREAD */
 }
@@ -472,11 +603,19 @@ WritablePacket::check_packet_pool_size(PacketPool &packet_pool) {
 inline void
 WritablePacket::check_data_pool_size(PacketPool &packet_pool) {
 #  if HAVE_MULTITHREAD
-    if (unlikely(packet_pool.pd && packet_pool.pdcount >= CLICK_PACKET_DATA_POOL_SIZE)) {
+    if (unlikely(packet_pool.pd && packet_pool.pdcount >= packet_data_pool_size)) {
         packet_pool.pd->set_anno_u32(0, packet_pool.pdcount);
-        if (!global_packet_pool.pdbatch.insert(packet_pool.pd)) {
+        if (global_packet_pool.node[packet_pool.node].pdbatch.insert(packet_pool.pd))
+            ++packet_pool.exports;
+        else {
             while (WritablePacket *pd = packet_pool.pd) {
                 packet_pool.pd = static_cast<WritablePacket *>(pd->next());
+                if (pool_owns(pd)) {
+                    pd->set_next(packet_pool.pdkeep);
+                    packet_pool.pdkeep = pd;
+                    continue;
+                }
+                ++packet_pool.drops;
 #if HAVE_DPDK_PACKET_POOL
                 rte_pktmbuf_free((struct rte_mbuf*)pd->destructor_argument());
 #else
@@ -485,6 +624,9 @@ WritablePacket::check_data_pool_size(PacketPool &packet_pool) {
                     NetmapBufQ::local_pool()->insert_p(pd->buffer());
                 else
 # endif
+                if (pool_owns(pd->buffer()))
+                    pool_free_buffer(packet_pool, pd->buffer());
+                else
                 {
                     ::operator delete[]((unsigned char *) pd->buffer());
                 }
@@ -497,11 +639,12 @@ WritablePacket::check_data_pool_size(PacketPool &packet_pool) {
     }
 
 #  else /* !HAVE_MULTITHREAD */
-    if (packet_pool.pdcount == CLICK_PACKET_DATA_POOL_SIZE) {
+    if (packet_pool.pdcount >= packet_data_pool_size && !pool_owns(packet_pool.pd)) {
         WritablePacket* tmp = (WritablePacket*)packet_pool.pd->next();
         ::operator delete((void *) packet_pool.pd);
         packet_pool.pd = tmp;
         packet_pool.pdcount--;
+        ++packet_pool.drops;
     }
 #  endif /* HAVE_MULTITHREAD */
 }
@@ -542,7 +685,7 @@ WritablePacket::recycle(WritablePacket *p)
         p->set_next(packet_pool.pd);
         packet_pool.pd = p;
 #if !HAVE_BATCH_RECYCLE
-        assert(packet_pool.pdcount <= CLICK_PACKET_DATA_POOL_SIZE);
+        assert(packet_pool.pdcount <= packet_data_pool_size || packet_pool_nregions);
 #endif
     } else {
 
@@ -552,7 +695,7 @@ WritablePacket::recycle(WritablePacket *p)
         p->set_next(packet_pool.p);
         packet_pool.p = p;
 #if !HAVE_BATCH_RECYCLE
-        assert(packet_pool.pcount <= CLICK_PACKET_POOL_SIZE);
+        assert(packet_pool.pcount <= packet_pool_size || packet_pool_nregions);
 #endif
     }
 
@@ -590,6 +733,206 @@ WritablePacket::recycle_data_batch(WritablePacket *head, Packet* tail, unsigned
     packet_pool.pd = head;
 }
 
+/** @brief Set the size limits of the per-thread packet pools.
+ * @param packets number of free packets without data kept by each thread
+ * @param data_packets number of free packets with data kept by each thread
+ *
+ * Beyond these limits, a thread gives a batch of free packets to the global
+ * pool, or frees it if the global pool is full. */
+void
+WritablePacket::set_pool_size(unsigned packets, unsigned data_packets)
+{
+    packet_pool_size = packets ? packets : 1;
+    packet_data_pool_size = data_packets ? data_packets : 1;
+}
+
+unsigned
+WritablePacket::pool_size()
+{
+    return packet_pool_size;
+}
+
+unsigned
+WritablePacket::data_pool_size()
+{
+    return packet_data_pool_size;
+}
+
+#  if CLICK_USERLEVEL
+static unsigned char *
+pool_map_node(size_t &size, int node, int nnodes, bool &hugepages)
+{
+    const size_t hugepage_size = 2 << 20;
+    size = (size + hugepage_size - 1) & ~(hugepage_size - 1);
+    void *mem = MAP_FAILED;
+#   ifdef MAP_HUGETLB
+    mem = mmap(0, size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#   endif
+    hugepages = (mem != MAP_FAILED);
+    if (!hugepages) {
+	mem = mmap(0, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+	    return 0;
+#   ifdef MADV_HUGEPAGE
+	// ask for transparent hugepages instead
+	madvise(mem, size, MADV_HUGEPAGE);
+#   endif
+    }
+#   if HAVE_NUMA
+    // bind before the pages are touched, so they are allocated on the node
+    if (nnodes > 1) {
+	unsigned long mask = 1UL << node;
+	mbind(mem, size, MPOL_BIND, &mask, sizeof(mask) * 8, 0);
+    }
+#   else
+    (void) node, (void) nnodes;
+#   endif
+    return static_cast<unsigned char *>(mem);
+}
+
+/** @brief Preallocate packets with data buffers for the packet pools.
+ * @param count number of packets per NUMA node
+ * @param errh error handler
+ *
+ * Packet descriptors and buffers of each node are carved from one memory
+ * region, backed by hugepages when the system has some reserved, and bound
+ * to that node. Threads then take packets from their own node's share of the
+ * global pool first, which avoids TLB misses and remote memory accesses.
+ * Preallocated memory is only returned to the system at exit. Must be called
+ * before the router is created. */
+int
+WritablePacket::pool_prealloc(unsigned count, ErrorHandler *errh)
+{
+#   if HAVE_DPDK_PACKET_POOL || HAVE_NETMAP_PACKET_POOL
+    (void) count;
+    return errh->error("packet preallocation is not available with DPDK or netmap packet pools");
+#   else
+    if (packet_pool_nregions)
+	return errh->error("packets already preallocated");
+    if (!count)
+	return 0;
+
+    int nnodes = 1;
+#    if HAVE_NUMA && HAVE_MULTITHREAD
+    if (numa_available() >= 0)
+	nnodes = numa_num_configured_nodes();
+    if (nnodes > CLICK_PACKET_POOL_MAX_NODES)
+	nnodes = CLICK_PACKET_POOL_MAX_NODES;
+    else if (nnodes < 1)
+	nnodes = 1;
+#    endif
+#    if HAVE_MULTITHREAD
+    unsigned max_count = CLICK_GLOBAL_PACKET_DATA_POOL_COUNT * packet_data_pool_size;
+    if (count > max_count) {
+	errh->warning("preallocating %u packets per node, the capacity of the global packet pool", max_count);
+	count = max_count;
+    }
+    global_packet_pool.nnodes = nnodes;
+#    else
+    // the only pool must be able to hold every preallocated packet
+    if (packet_data_pool_size < count)
+	packet_data_pool_size = count;
+#    endif
+
+    size_t desc_size = (sizeof(WritablePacket) + CLICK_CACHE_LINE_SIZE - 1)
+	& ~(size_t) (CLICK_CACHE_LINE_SIZE - 1);
+    for (int node = 0; node < nnodes; ++node) {
+	size_t size = count * (desc_size + CLICK_PACKET_POOL_BUFSIZ);
+	bool hugepages;
+	unsigned char *mem = pool_map_node(size, node, nnodes, hugepages);
+	if (!mem)
+	    return errh->error("cannot preallocate packets on node %d: %s", node, strerror(errno));
+
+	PacketPoolRegion &r = packet_pool_regions[packet_pool_nregions++];
+	r.begin = mem;
+	r.end = mem + size;
+	r.size = size;
+	r.hugepages = hugepages;
+	if (!packet_pool_region_begin || r.begin < packet_pool_region_begin)
+	    packet_pool_region_begin = r.begin;
+	if (r.end > packet_pool_region_end)
+	    packet_pool_region_end = r.end;
+
+	unsigned char *bufs = mem + count * desc_size;
+	WritablePacket *head = 0;
+	unsigned n = 0;
+	for (unsigned i = 0; i < count; ++i) {
+	    WritablePacket *p = new((void *) (mem + i * desc_size)) WritablePacket;
+	    p->initialize();
+	    p->_head = p->_data = p->_tail = bufs + i * CLICK_PACKET_POOL_BUFSIZ;
+	    p->_end = p->_head + CLICK_PACKET_POOL_BUFSIZ;
+#    if HAVE_MULTITHREAD
+	    p->set_next(head);
+	    head = p;
+	    if (++n == packet_data_pool_size || i == count - 1) {
+		head->set_anno_u32(0, n);
+		global_packet_pool.node[node].pdbatch.insert(head);
+		head = 0;
+		n = 0;
+	    }
+#    else
+	    (void) head, (void) n;
+	    p->set_next(global_packet_pool.pd);
+	    global_packet_pool.pd = p;
+	    ++global_packet_pool.pdcount;
+#    endif
+	}
+    }
+    return 0;
+#   endif
+}
+#  endif
+
+static void
+pool_stats_line(StringAccum &sa, const PacketPool *pp)
+{
+    sa << "thread " << pp->thread << " node " << pp->node
+       << " packets " << pp->pcount << " data_packets " << pp->pdcount
+       << " buffers " << pp->bufcount
+       << " misses " << pp->misses << " data_misses " << pp->data_misses
+       << " imports " << pp->imports << " remote_imports " << pp->remote_imports
+       << " exports " << pp->exports << " drops " << pp->drops << '\n';
+}
+
+/** @brief Return a report of packet pool occupancy and counters.
+ *
+ * The report has one line per thread pool, then one line per NUMA node with
+ * the number of batches in the global pool and the preallocated packets. */
+String
+WritablePacket::pool_stats()
+{
+    StringAccum sa;
+#  if HAVE_MULTITHREAD
+    while (atomic_uint32_t::swap(global_packet_pool.lock, 1) == 1)
+	/* do nothing */;
+    Vector<const PacketPool *> pools;
+    for (PacketPool *pp = global_packet_pool.thread_pools; pp; pp = pp->thread_pool_next)
+	pools.push_back(pp);
+    click_compiler_fence();
+    global_packet_pool.lock = 0;
+    for (int i = pools.size() - 1; i >= 0; --i)
+	pool_stats_line(sa, pools[i]);
+    for (int node = 0; node < packet_pool_nnodes(); ++node) {
+	sa << "global node " << node
+	   << " packet_batches " << global_packet_pool.node[node].pbatch.count()
+	   << " data_batches " << global_packet_pool.node[node].pdbatch.count();
+#  else
+    pool_stats_line(sa, &global_packet_pool);
+    for (int node = 0; node < 1; ++node) {
+	sa << "global node " << node;
+#  endif
+	if (node < packet_pool_nregions) {
+	    const PacketPoolRegion &r = packet_pool_regions[node];
+	    sa << " prealloc_bytes " << r.size
+	       << " hugepages " << (r.hugepages ? "true" : "false");
+	}
+	sa << '\n';
+    }
+    return sa.take_string();
+}
+
 # endif /* HAVE_CLICK_PACKET_POOL */
 
 inline bool
@@ -729,7 +1072,9 @@ Packet::make(uint32_t headroom, const void *data,
     if (data)
         memcpy(rte_pktmbuf_mtod(mb, void *), data, length);
     (void) tailroom;
-    return reinterpret_cast<WritablePacket *>(mb);
+    WritablePacket *q = reinterpret_cast<WritablePacket *>(mb);
+    q->clear_annotations();
+    return q;
 #else
 
 		# if HAVE_CLICK_PACKET_POOL
@@ -859,13 +1204,13 @@ Packet::clone(bool fast)
 #elif CLICK_PACKET_USE_DPDK
     Packet* p = reinterpret_cast<Packet *>(
         rte_pktmbuf_clone(mb(), DPDKDevice::get_mpool(rte_socket_id())));
-    p->copy_annotations(this,true);
-    p->shift_header_annotations(buffer(), 0);
-    click_chatter("Clone %p %p",this->mb(),p->mb());
-    click_chatter("Headroom %d %d",headroom(),p->headroom());
-    click_chatter("Tailroom %d %d",tailroom(),p->tailroom());
-    click_chatter("Length %d %d",length(),p->length());
-    click_chatter("Shared %d %d",shared(),p->shared());
+    if (!p)
+        return 0;
+    // The clone attaches to the same buffer, so the header annotations
+    // stay valid as they are.
+    memcpy(p->all_anno(), all_anno(), sizeof(AllAnno));
+    p->set_next(0);
+    p->set_prev(0);
     return p;
 #elif CLICK_USERLEVEL || CLICK_BSDMODULE || CLICK_MINIOS
 # if CLICK_BSDMODULE
@@ -970,7 +1315,6 @@ Packet::expensive_uniqueify(int32_t extra_headroom, int32_t extra_tailroom,
 #elif CLICK_PACKET_USE_DPDK /* !CLICK_LINUXMODULE */
     struct rte_mbuf *mb = this->mb();
     struct rte_mbuf *nmb = DPDKDevice::get_pkt();
-    click_chatter("Expensive uniqueify %p %p, exh = %d, ext = %d",mb,nmb,extra_headroom,extra_tailroom);
     if (!nmb) {
         click_chatter("cannot allocate new pktmbuf");
         if (free_on_failure)
@@ -987,11 +1331,6 @@ Packet::expensive_uniqueify(int32_t extra_headroom, int32_t extra_tailroom,
     memcpy(npkt->all_anno(), all_anno(), sizeof (AllAnno));
 
     npkt->shift_header_annotations(buffer(), extra_headroom);
-
-    click_chatter("Headroom %d %d",headroom(),npkt->headroom());
-    click_chatter("Tailroom %d %d",tailroom(),npkt->tailroom());
-    click_chatter("Length %d %d",length(),npkt->length());
-    click_chatter("Shared %d %d",shared(),npkt->shared());
     kill(); // Release old mbuf
     return npkt;
 #else /* !CLICK_LINUXMODULE */
@@ -1053,6 +1392,10 @@ Packet::expensive_uniqueify(int32_t extra_headroom, int32_t extra_tailroom,
       if (NetmapBufQ::is_valid_netmap_buffer(old_head)) {
         NetmapBufQ::local_pool()->insert_p(old_head);
       } else
+#  endif
+#  if HAVE_CLICK_PACKET_POOL
+      if (pool_release_buffer(old_head)) {
+      } else
 #  endif
       {
         delete[] old_head;
@@ -1259,6 +1602,28 @@ Packet::shift_data(int offset, bool free_on_failure)
 }
 
 #if HAVE_CLICK_PACKET_POOL
+static void
+cleanup_data_packet(WritablePacket *pd)
+{
+    // a preallocated descriptor may hold a heap buffer
+    if (!pool_owns(pd->buffer())) {
+#if HAVE_DPDK_PACKET_POOL
+	rte_pktmbuf_free((struct rte_mbuf*)pd->destructor_argument());
+#elif HAVE_NETMAP_PACKET_POOL
+	NetmapBufQ::local_pool()->insert_p(pd->buffer());
+#else
+# if HAVE_DPDK
+	if (dpdk_enabled)
+	    rte_free(reinterpret_cast<unsigned char *>(pd->buffer()));
+	else
+# endif
+	    delete[] reinterpret_cast<unsigned char *>(pd->buffer());
+#endif
+    }
+    if (!pool_owns(pd))
+	::operator delete((void *) pd);
+}
+
 static void
 cleanup_pool(PacketPool *pp, int global)
 {
@@ -1266,30 +1631,26 @@ cleanup_pool(PacketPool *pp, int global)
     while (WritablePacket *p = pp->p) {
 	++pcount;
 	pp->p = static_cast<WritablePacket *>(p->next());
-	::operator delete((void *) p);
+	if (!pool_owns(p))
+	    ::operator delete((void *) p);
     }
+    pp->pkeep = 0;		// preallocated, nothing to free
     while (WritablePacket *pd = pp->pd) {
-    ++pdcount;
-    pp->pd = static_cast<WritablePacket *>(pd->next());
-#if HAVE_DPDK_PACKET_POOL
-    rte_pktmbuf_free((struct rte_mbuf*)pd->destructor_argument());
-#elif HAVE_NETMAP_PACKET_POOL
-    NetmapBufQ::local_pool()->insert_p(pd->buffer());
-#else
-# if HAVE_DPDK
-    if (dpdk_enabled)
-        rte_free(reinterpret_cast<unsigned char *>(pd->buffer()));
-    else
-# endif
-        delete[] reinterpret_cast<unsigned char *>(pd->buffer());
-#endif
-    ::operator delete((void *) pd);
+	++pdcount;
+	pp->pd = static_cast<WritablePacket *>(pd->next());
+	cleanup_data_packet(pd);
+    }
+    while (WritablePacket *pd = pp->pdkeep) {
+	pp->pdkeep = static_cast<WritablePacket *>(pd->next());
+	cleanup_data_packet(pd);
     }
 #if !HAVE_BATCH_RECYCLE
-    assert(pcount <= CLICK_PACKET_POOL_SIZE);
-    assert(pdcount <= CLICK_PACKET_DATA_POOL_SIZE);
+    assert(pcount <= packet_pool_size || packet_pool_nregions);
+    assert(pdcount <= packet_data_pool_size || packet_pool_nregions);
 #endif
     assert(global || (pcount == pp->pcount && pdcount == pp->pdcount));
+    pp->buf = 0;
+    pp->bufcount = 0;
 }
 #endif
 
@@ -1297,7 +1658,7 @@ int
 Packet::max_data_pool_size()
 {
 #if HAVE_CLICK_PACKET_POOL
-	return CLICK_GLOBAL_PACKET_DATA_POOL_COUNT * CLICK_PACKET_DATA_POOL_SIZE;
+	return CLICK_GLOBAL_PACKET_DATA_POOL_COUNT * packet_data_pool_size;
 #else
 	return 0;
 #endif
@@ -1315,15 +1676,24 @@ Packet::static_cleanup()
 		}
 
 		PacketPool fake_pool;
+		memset(&fake_pool, 0, sizeof(PacketPool));
+		for (int node = 0; node < CLICK_PACKET_POOL_MAX_NODES; ++node)
 		do {
-			fake_pool.p = global_packet_pool.pbatch.extract();
-			fake_pool.pd = global_packet_pool.pdbatch.extract();
+			fake_pool.p = global_packet_pool.node[node].pbatch.extract();
+			fake_pool.pd = global_packet_pool.node[node].pdbatch.extract();
 			if (!fake_pool.p && !fake_pool.pd) break;
 			cleanup_pool(&fake_pool, 1);
 		} while(true);
 	# else
 		cleanup_pool(&global_packet_pool, 0);
 	# endif
+	# if CLICK_USERLEVEL
+		for (int i = 0; i < packet_pool_nregions; ++i)
+			munmap(const_cast<unsigned char *>(packet_pool_regions[i].begin),
+			       packet_pool_regions[i].size);
+		packet_pool_nregions = 0;
+		packet_pool_region_begin = packet_pool_region_end = 0;
+	# endif
 #endif
 }
 
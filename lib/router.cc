@@ -2264,7 +2264,8 @@ Router::configuration_string() const
 enum { GH_VERSION, GH_CONFIG, GH_FLATCONFIG, GH_LIST, GH_REQUIREMENTS,
        GH_DRIVER, GH_ACTIVE_PORTS, GH_ACTIVE_PORT_STATS, GH_STRING_PROFILE,
        GH_STRING_PROFILE_LONG, GH_SCHEDULING_PROFILE, GH_STOP,
-       GH_ELEMENT_CYCLES, GH_CLASS_CYCLES, GH_RESET_CYCLES };
+       GH_ELEMENT_CYCLES, GH_CLASS_CYCLES, GH_RESET_CYCLES, GH_PACKET_POOL,
+       GH_IDLE_STATS };
 
 #if CLICK_STATS >= 2
 struct stats_info {
@@ -2360,6 +2361,24 @@ Router::router_read_handler(Element *e, void *thunk)
         break;
 #endif
 
+#if HAVE_CLICK_PACKET_POOL
+    case GH_PACKET_POOL:
+        return WritablePacket::pool_stats();
+#endif
+
+#if CLICK_USERLEVEL
+    case GH_IDLE_STATS:
+        if (!r)
+            break;
+        for (int i = 0; i < r->master()->nthreads(); ++i) {
+            RouterThread *t = r->master()->thread(i);
+            sa << "thread " << i << ": "
+               << (t->adaptive_poll() ? "" : "(greedy) ")
+               << t->idle_info() << '\n';
+        }
+        return sa.take_string();
+#endif
+
 #if CLICK_DEBUG_MASTER || CLICK_DEBUG_SCHEDULING
     case GH_SCHEDULING_PROFILE:
         if (r)
@@ -2506,6 +2525,12 @@ Router::static_initialize()
         add_read_handler(0, "string_profile_long", router_read_handler, (void *) GH_STRING_PROFILE_LONG);
 # endif
 #endif
+#if HAVE_CLICK_PACKET_POOL
+        add_read_handler(0, "packet_pool", router_read_handler, (void *) GH_PACKET_POOL);
+#endif
+#if CLICK_USERLEVEL
+        add_read_handler(0, "idle_stats", router_read_handler, (void *) GH_IDLE_STATS);
+#endif
 #if CLICK_DEBUG_MASTER || CLICK_DEBUG_SCHEDULING
         add_read_handler(0, "scheduling_profile", router_read_handler, (void *) GH_SCHEDULING_PROFILE);
 #endif
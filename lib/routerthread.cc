@@ -40,6 +40,8 @@ CLICK_CXX_UNPROTECT
 # include <click/cxxunprotect.h>
 #elif CLICK_USERLEVEL
 # include <fcntl.h>
+# include <click/straccum.hh>
+# include <time.h>
 #endif
 CLICK_DECLS
 
@@ -58,6 +60,10 @@ CLICK_DECLS
 static unsigned long greedy_schedule_jiffies;
 #endif
 
+#if CLICK_USERLEVEL
+bool RouterThread::default_adaptive_poll = false;
+#endif
+
 /** @file routerthread.hh
  * @brief The RouterThread class implementing the Click driver loop.
  */
@@ -110,6 +116,15 @@ RouterThread::RouterThread(Master *master, int id)
     greedy_schedule_jiffies = jiffies;
 #endif
 
+#if CLICK_USERLEVEL
+    _adaptive_poll = default_adaptive_poll;
+    _work_done = false;
+    _idle_state = IDLE_SPIN;
+    _empty_ratio = 0;
+    for (int b = 0; b < idle_latency_buckets; ++b)
+        _idle_latency[b] = 0;
+#endif
+
 #if CLICK_NS
     _ns_scheduled = _ns_last_active = Timestamp(-1, 0);
     _ns_active_iter = 0;
@@ -390,6 +405,9 @@ RouterThread::run_tasks(int ntasks)
 
         t->_status.is_scheduled = false;
         work_done = t->fire();
+#if CLICK_USERLEVEL
+        _work_done |= work_done;
+#endif
 
 #if HAVE_TASK_STATS
         if (runs > PROFILE_ELEMENT) {
@@ -549,6 +567,160 @@ RouterThread::process_pending()
     }
 }
 
+#if CLICK_USERLEVEL
+void
+RouterThread::set_default_adaptive_poll(bool a)
+{
+    default_adaptive_poll = a;
+}
+
+/** @brief Register a wakeup source for adaptive polling.
+ * @param f arming function
+ * @param user_data passed to @a f
+ *
+ * Must be called from this thread, or before the driver starts. */
+void
+RouterThread::add_wakeup(WakeupCallback f, void *user_data)
+{
+    Wakeup w;
+    w.f = f;
+    w.user_data = user_data;
+    _wakeups.push_back(w);
+}
+
+void
+RouterThread::remove_wakeup(WakeupCallback f, void *user_data)
+{
+    for (int i = 0; i < _wakeups.size(); ++i)
+        if (_wakeups[i].f == f && _wakeups[i].user_data == user_data) {
+            _wakeups[i] = _wakeups.back();
+            _wakeups.pop_back();
+            return;
+        }
+}
+
+inline void
+RouterThread::set_idle_state(int state)
+{
+    if (state != _idle_state) {
+        Timestamp now = Timestamp::now_steady();
+        if (_idle_since)
+            _idle_time[_idle_state] += now - _idle_since;
+        _idle_state = state;
+        _idle_since = now;
+    } else if (!_idle_since)
+        _idle_since = Timestamp::now_steady();
+}
+
+/* Called after each driver iteration in adaptive polling mode. The share of
+ * recent iterations where no task did any work selects how hard to back
+ * off: keep spinning, spin on pause instructions, sleep for a few
+ * microseconds, or block in the SelectSet until a wakeup source fires or a
+ * short timeout expires. Any work returns the thread to spinning at once.
+ *
+ * When a back-off is followed by work, packets may have waited for all of
+ * it, so its length is recorded as a wakeup latency sample. */
+void
+RouterThread::idle_backoff()
+{
+    if (_work_done) {
+        _empty_ratio -= _empty_ratio >> idle_ewma_shift;
+        if (_idle_slept) {
+            uint64_t ns = _idle_slept.nsecval();
+            int b = 0;
+            while (ns > 1 && b < idle_latency_buckets - 1) {
+                ns >>= 1;
+                ++b;
+            }
+            ++_idle_latency[b];
+            _idle_slept = Timestamp();
+        }
+        set_idle_state(IDLE_SPIN);
+        return;
+    }
+
+    _empty_ratio += (idle_ratio_one - _empty_ratio) >> idle_ewma_shift;
+    int state;
+    if (_empty_ratio < idle_ratio_one / 2)
+        state = IDLE_SPIN;
+    else if (_empty_ratio < idle_ratio_one / 10 * 9)
+        state = IDLE_PAUSE;
+    else if (_empty_ratio < idle_ratio_one / 100 * 99)
+        state = IDLE_SLEEP;
+    else
+        state = IDLE_BLOCK;
+    set_idle_state(state);
+
+    if (state == IDLE_SPIN) {
+        _idle_slept = Timestamp();
+        return;
+    }
+    Timestamp before = Timestamp::now_steady();
+    if (state == IDLE_PAUSE) {
+        for (int i = 0; i < idle_pause_loops; ++i)
+            click_relax_fence();
+    } else {
+        driver_unlock_tasks();
+        int armed = 0;
+        if (state == IDLE_BLOCK)
+            for (; armed < _wakeups.size(); ++armed)
+                if (!_wakeups[armed].f(true, _wakeups[armed].user_data))
+                    break;
+        if (state == IDLE_BLOCK && armed == _wakeups.size())
+            select_set().run_selects(this, Timestamp::make_usec(idle_block_usec));
+        else {
+            struct timespec ts = { 0, idle_sleep_usec * 1000 };
+            nanosleep(&ts, 0);
+        }
+        while (--armed >= 0)
+            _wakeups[armed].f(false, _wakeups[armed].user_data);
+        driver_lock_tasks();
+    }
+    _idle_slept = Timestamp::now_steady() - before;
+}
+
+String
+RouterThread::idle_info() const
+{
+    static const char * const names[] = { "spin", "pause", "sleep", "block" };
+    StringAccum sa;
+    Timestamp time[NIDLE];
+    Timestamp total;
+    for (int s = 0; s < NIDLE; ++s) {
+        time[s] = _idle_time[s];
+        if (s == _idle_state && _idle_since)
+            time[s] += Timestamp::now_steady() - _idle_since;
+        total += time[s];
+    }
+    for (int s = 0; s < NIDLE; ++s)
+        sa << names[s] << ' ' << time[s] << "s "
+           << (total ? time[s].usecval() * 100 / total.usecval() : 0) << "% ";
+
+    uint64_t samples = 0;
+    for (int b = 0; b < idle_latency_buckets; ++b)
+        samples += _idle_latency[b];
+    static const int permille[] = { 500, 990, 999 };
+    static const char * const pnames[] = { "p50", "p99", "p99.9" };
+    for (int p = 0; p < 3; ++p) {
+        uint64_t rank = samples * permille[p] / 1000;
+        uint64_t seen = 0;
+        int b = 0;
+        for (; b < idle_latency_buckets - 1; ++b) {
+            seen += _idle_latency[b];
+            if (seen > rank)
+                break;
+        }
+        sa << pnames[p] << ' ';
+        if (samples)
+            sa << ((uint64_t) 1 << b) << "ns ";
+        else
+            sa << "- ";
+    }
+    sa << "wakeups " << samples;
+    return sa.take_string();
+}
+#endif
+
 void
 RouterThread::driver()
 {
@@ -609,6 +781,9 @@ RouterThread::driver()
 #if HAVE_ADAPTIVE_SCHEDULER
             if (PASS_GT(_clients[C_CLICK].pass, _clients[C_KERNEL].pass))
                 break;
+#endif
+#if CLICK_USERLEVEL
+            _work_done = false;
 #endif
             run_tasks(_tasks_per_iter);
         } while (0);
@@ -645,6 +820,12 @@ RouterThread::driver()
             run_os();
         } while (0);
 
+#if CLICK_USERLEVEL
+        // back off if polling tasks keep finding nothing to do
+        if (_adaptive_poll && active())
+            idle_backoff();
+#endif
+
 #if CLICK_NS || BSD_NETISRSCHED
         // Everyone except the NS driver stays in driver() until the driver is
         // stopped.
@@ -352,6 +352,20 @@ SelectSet::post_select(RouterThread *thread, bool acquire)
     return false;
 }
 
+inline int
+SelectSet::wait_delay(RouterThread *thread, Timestamp &t) const
+{
+    if (!_idle_wait)
+	return thread->timer_set().next_timer_delay(thread->active(), t);
+    // Idle threads block despite their scheduled tasks, but not for long
+    int delay_type = thread->timer_set().next_timer_delay(false, t);
+    if (delay_type < 0 || (delay_type > 0 && t > _idle_wait)) {
+	t = _idle_wait;
+	delay_type = 1;
+    }
+    return delay_type;
+}
+
 inline void
 SelectSet::call_selected(int fd, int mask) const
 {
@@ -390,7 +404,7 @@ SelectSet::run_selects_kqueue(RouterThread *thread)
     // Decide how long to wait.
     struct timespec wait, *wait_ptr = &wait;
     Timestamp t;
-    int delay_type = thread->timer_set().next_timer_delay(thread->active(), t);
+    int delay_type = wait_delay(thread, t);
     if (delay_type == 0)
 	wait.tv_sec = wait.tv_nsec = 0;
     else if (delay_type > 0)
@@ -441,7 +455,7 @@ SelectSet::run_selects_poll(RouterThread *thread)
     // Decide how long to wait.
     int timeout;
     Timestamp t;
-    int delay_type = thread->timer_set().next_timer_delay(thread->active(), t);
+    int delay_type = wait_delay(thread, t);
     if (delay_type == 0)
 	timeout = 0;
     else if (delay_type > 0)
@@ -497,7 +511,7 @@ SelectSet::run_selects_select(RouterThread *thread)
     // Decide how long to wait.
     struct timeval wait, *wait_ptr = &wait;
     Timestamp t;
-    int delay_type = thread->timer_set().next_timer_delay(thread->active(), t);
+    int delay_type = wait_delay(thread, t);
     if (delay_type == 0)
 	timerclear(&wait);
     else if (delay_type > 0)
@@ -590,4 +604,43 @@ SelectSet::run_selects(RouterThread *thread)
 #endif
 }
 
+/** @brief Wait at most @a idle_wait for input or timers, even if @a thread
+ * has scheduled tasks, and call relevant elements' selected() methods. */
+void
+SelectSet::run_selects(RouterThread *thread, const Timestamp &idle_wait)
+{
+#if HAVE_MULTITHREAD
+    if (!_select_lock.attempt())
+	return;
+#endif
+
+    if (thread->master()->paused() || thread->stop_flag()) {
+#if HAVE_MULTITHREAD
+	_select_lock.release();
+#endif
+	return;
+    }
+
+    _idle_wait = idle_wait;
+    do {
+#if HAVE_ALLOW_KQUEUE
+	if (_kqueue >= 0) {
+	    run_selects_kqueue(thread);
+	    break;
+	}
+#endif
+#if HAVE_ALLOW_POLL
+	run_selects_poll(thread);
+#else
+	run_selects_select(thread);
+#endif
+    } while (0);
+    _idle_wait = Timestamp();
+
+#if HAVE_MULTITHREAD
+    _select_processor = click_invalid_processor();
+    _select_lock.release();
+#endif
+}
+
 CLICK_ENDDECLS
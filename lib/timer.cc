@@ -163,7 +163,10 @@ CLICK_DECLS
 
  The Click core stores timers in a heap, so most timer operations (including
  scheduling and unscheduling) take @e O(log @e n) time and Click can handle
- very large numbers of timers.
+ very large numbers of timers.  Alternatively, each thread's TimerSet can keep
+ its timers in a hierarchical timing wheel, where scheduling and unscheduling
+ take constant time and timers expiring during the same tick are run as one
+ batch; see TimerSet::set_default_wheel_tick().
 
  Timers generally run in increasing order by expiration time.  That is, if
  timer @a a's expiry() is less than timer @a b's expiry(), then @a a will
@@ -284,6 +287,17 @@ Timer::schedule_at_steady(const Timestamp &when)
     // manipulate list; this is essentially a "decrease-key" operation
     // any reschedule removes a timer from the runchunk (XXX -- even backwards
     // reschedulings)
+    if (ts.wheel()) {
+	if (_schedpos1 < 0)
+	    ts._timer_runchunk[-_schedpos1 - 1] = 0;
+	else if (_schedpos1 > 0)
+	    ts.wheel_remove(this);
+	if (ts.wheel_insert(this))
+	    _thread->wake();
+	ts.unlock_timers();
+	return;
+    }
+
     int old_schedpos1 = _schedpos1;
     if (_schedpos1 <= 0) {
 	if (_schedpos1 < 0)
@@ -320,7 +334,9 @@ Timer::unschedule()
     TimerSet &ts = _thread->timer_set();
     ts.lock_timers();
     int old_schedpos1 = _schedpos1;
-    if (_schedpos1 > 0) {
+    if (_schedpos1 > 0 && ts.wheel())
+	ts.wheel_remove(this);
+    else if (_schedpos1 > 0) {
 	remove_heap<4>(ts._timer_heap.begin(), ts._timer_heap.end(),
 		       ts._timer_heap.begin() + _schedpos1 - 1,
 		       TimerSet::heap_less(), TimerSet::heap_place());
@@ -24,8 +24,15 @@
 #include <click/routerthread.hh>
 #include <click/heap.hh>
 #include <click/master.hh>
+#include <click/integers.hh>
 CLICK_DECLS
 
+#ifndef CLICK_TIMER_WHEEL_TICK
+# define CLICK_TIMER_WHEEL_TICK 0
+#endif
+
+unsigned TimerSet::default_wheel_tick_usec = CLICK_TIMER_WHEEL_TICK;
+
 TimerSet::TimerSet()
 {
 #if CLICK_NS
@@ -48,6 +55,34 @@ TimerSet::TimerSet()
 #endif
     _timer_check = Timestamp::now_steady();
     _timer_check_reports = 0;
+
+    _wheel_shift = -1;
+    _wheel_now = 0;
+    _wheel_size = 0;
+    _wheel = 0;
+    if (default_wheel_tick_usec) {
+	_wheel_shift = 0;
+	while ((1U << _wheel_shift) < default_wheel_tick_usec
+	       && _wheel_shift < 30)
+	    ++_wheel_shift;
+	_wheel = new Vector<Timer *>[wheel_overflow + 1];
+	memset(_wheel_bitmap, 0, sizeof(_wheel_bitmap));
+	_wheel_now = wheel_tick_of(_timer_check);
+    }
+}
+
+TimerSet::~TimerSet()
+{
+    delete[] _wheel;
+}
+
+void
+TimerSet::set_default_wheel_tick(unsigned tick_usec)
+{
+    unsigned tick = tick_usec ? 1 : 0;
+    while (tick && tick < tick_usec && tick < (1U << 30))
+	tick <<= 1;
+    default_wheel_tick_usec = tick;
 }
 
 void
@@ -55,6 +90,20 @@ TimerSet::kill_router(Router *router)
 {
     lock_timers();
     assert(!_timer_runchunk.size());
+    if (wheel()) {
+	for (int slot = 0; slot <= wheel_overflow; ++slot)
+	    for (int i = 0; i < _wheel[slot].size(); ) {
+		Timer *t = _wheel[slot][i];
+		if (t->router() == router) {
+		    wheel_remove(t);
+		    t->_owner = 0;
+		} else
+		    ++i;
+	    }
+	wheel_set_timer_expiry();
+	unlock_timers();
+	return;
+    }
     for (heap_element *thp = _timer_heap.end();
 	 thp > _timer_heap.begin(); ) {
 	--thp;
@@ -110,12 +159,28 @@ TimerSet::run_one_timer(Timer *t)
 #endif
 }
 
+inline void
+TimerSet::adjust_timer_stride(const Timestamp &first_expiry)
+{
+    Timestamp adj_expiry = first_expiry + Timer::adjustment();
+    if (adj_expiry <= _timer_check) {
+	_timer_count = 0;
+	if (_timer_stride > 1)
+	    _timer_stride = (_timer_stride * 4) / 5;
+    } else if (++_timer_count >= 12) {
+	_timer_count = 0;
+	if (++_timer_stride >= _max_timer_stride)
+	    _timer_stride = _max_timer_stride;
+    }
+}
+
 void
 TimerSet::run_timers(RouterThread *thread, Master *master)
 {
     if (!_timer_lock.attempt())
 	return;
-    if (!master->paused() && _timer_heap.size() > 0 && !thread->stop_flag()) {
+    if (!master->paused() && (wheel() ? _wheel_size : _timer_heap.size()) > 0
+	&& !thread->stop_flag()) {
 	thread->set_thread_state(RouterThread::S_RUNTIMER);
 #if CLICK_LINUXMODULE
 	_timer_task = current;
@@ -125,18 +190,11 @@ TimerSet::run_timers(RouterThread *thread, Master *master)
 	_timer_check = Timestamp::now_steady();
 	heap_element *th = _timer_heap.begin();
 
-	if (th->expiry_s <= _timer_check) {
-	    // potentially adjust timer stride
-	    Timestamp adj_expiry = th->expiry_s + Timer::adjustment();
-	    if (adj_expiry <= _timer_check) {
-		_timer_count = 0;
-		if (_timer_stride > 1)
-		    _timer_stride = (_timer_stride * 4) / 5;
-	    } else if (++_timer_count >= 12) {
-		_timer_count = 0;
-		if (++_timer_stride >= _max_timer_stride)
-		    _timer_stride = _max_timer_stride;
-	    }
+	if (wheel()) {
+	    if (_timer_expiry <= _timer_check)
+		wheel_run_timers(thread);
+	} else if (th->expiry_s <= _timer_check) {
+	    adjust_timer_stride(th->expiry_s);
 
 	    // actually run timers
 	    int max_timers = 64;
@@ -171,20 +229,7 @@ TimerSet::run_timers(RouterThread *thread, Master *master)
 			 && (th = _timer_heap.begin(), th->expiry_s <= _timer_check));
 		set_timer_expiry();
 
-		Vector<Timer*>::iterator i = _timer_runchunk.begin();
-		for (; !thread->stop_flag() && i != _timer_runchunk.end(); ++i)
-		    if (*i) {
-			(*i)->_schedpos1 = 0;
-			run_one_timer(*i);
-		    }
-
-		// reschedule unrun timers if stopped early
-		for (; i != _timer_runchunk.end(); ++i)
-		    if (*i) {
-			(*i)->_schedpos1 = 0;
-			(*i)->schedule_at_steady((*i)->_expiry_s);
-		    }
-		_timer_runchunk.clear();
+		run_timer_runchunk(thread);
 	    }
 	}
 
@@ -197,4 +242,265 @@ TimerSet::run_timers(RouterThread *thread, Master *master)
     _timer_lock.release();
 }
 
+void
+TimerSet::run_timer_runchunk(RouterThread *thread)
+{
+    Vector<Timer*>::iterator i = _timer_runchunk.begin();
+    for (; !thread->stop_flag() && i != _timer_runchunk.end(); ++i)
+	if (*i) {
+	    (*i)->_schedpos1 = 0;
+	    run_one_timer(*i);
+	}
+
+    // reschedule unrun timers if stopped early
+    for (; i != _timer_runchunk.end(); ++i)
+	if (*i) {
+	    (*i)->_schedpos1 = 0;
+	    (*i)->schedule_at_steady((*i)->_expiry_s);
+	}
+    _timer_runchunk.clear();
+}
+
+
+// Timing wheel
+
+void
+TimerSet::wheel_place(Timer *t)
+{
+    uint64_t e = wheel_tick_of(t->_expiry_s);
+    int slot;
+    if (e <= _wheel_now)
+	slot = _wheel_now & (wheel_slots - 1);
+    else {
+	uint64_t delta = e - _wheel_now;
+	int l = 0;
+	while (l < wheel_levels
+	       && delta >= (uint64_t) 1 << (wheel_bits * (l + 1)))
+	    ++l;
+	if (l < wheel_levels)
+	    slot = l * wheel_slots
+		+ ((e >> (wheel_bits * l)) & (wheel_slots - 1));
+	else
+	    slot = wheel_overflow;
+    }
+    Vector<Timer *> &v = _wheel[slot];
+    v.push_back(t);
+    t->_wheelslot = slot;
+    t->_schedpos1 = v.size();
+    if (slot < wheel_overflow)
+	_wheel_bitmap[slot >> wheel_bits] |=
+	    (uint64_t) 1 << (slot & (wheel_slots - 1));
+}
+
+bool
+TimerSet::wheel_insert(Timer *t)
+{
+    wheel_place(t);
+    ++_wheel_size;
+    if (!_timer_expiry || t->_expiry_s < _timer_expiry) {
+	_timer_expiry = t->_expiry_s;
+	return true;
+    } else
+	return false;
+}
+
+void
+TimerSet::wheel_remove(Timer *t)
+{
+    Vector<Timer *> &v = _wheel[t->_wheelslot];
+    int i = t->_schedpos1 - 1;
+    Timer *last = v.back();
+    v[i] = last;
+    last->_schedpos1 = i + 1;
+    v.pop_back();
+    if (v.empty() && t->_wheelslot < wheel_overflow)
+	_wheel_bitmap[t->_wheelslot >> wheel_bits] &=
+	    ~((uint64_t) 1 << (t->_wheelslot & (wheel_slots - 1)));
+    t->_schedpos1 = 0;
+    --_wheel_size;
+}
+
+void
+TimerSet::wheel_cascade(int slot)
+{
+    Vector<Timer *> v;
+    v.swap(_wheel[slot]);
+    if (slot < wheel_overflow)
+	_wheel_bitmap[slot >> wheel_bits] &=
+	    ~((uint64_t) 1 << (slot & (wheel_slots - 1)));
+    for (Timer **tp = v.begin(); tp != v.end(); ++tp)
+	wheel_place(*tp);
+    // keep the slot's storage
+    if (_wheel[slot].empty()) {
+	v.clear();
+	v.swap(_wheel[slot]);
+    }
+}
+
+static inline uint64_t
+rotate_right(uint64_t x, int n)
+{
+    return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+/** Return the first tick at or after @a from at which a level-0 slot must
+ * be run or a higher slot cascaded. Sets @a exact if that is a level-0
+ * slot, whose timers all belong to that tick. */
+uint64_t
+TimerSet::wheel_next_tick(uint64_t from, bool &exact) const
+{
+    uint64_t best = ~(uint64_t) 0;
+    exact = false;
+    if (uint64_t bm = _wheel_bitmap[0]) {
+	uint64_t r = rotate_right(bm, from & (wheel_slots - 1));
+	best = from + ffs_lsb(r) - 1;
+	exact = true;
+    }
+    // A higher slot is cascaded when _wheel_now reaches its first tick. The
+    // slot matching @a from's block was already cascaded, unless @a from
+    // is that first tick and _wheel_now has not reached it yet.
+    for (int l = 1; l <= wheel_levels; ++l) {
+	int shift = wheel_bits * l;
+	bool pending = !(from & (((uint64_t) 1 << shift) - 1))
+	    && from != _wheel_now;
+	uint64_t base = from >> shift, d;
+	if (l == wheel_levels) {
+	    if (_wheel[wheel_overflow].empty())
+		continue;
+	    d = pending ? 0 : 1;
+	} else if (uint64_t bm = _wheel_bitmap[l]) {
+	    uint64_t r = rotate_right(bm, base & (wheel_slots - 1));
+	    if (pending && (r & 1))
+		d = 0;
+	    else if (r & ~(uint64_t) 1)
+		d = ffs_lsb(r & ~(uint64_t) 1) - 1;
+	    else
+		d = wheel_slots;
+	} else
+	    continue;
+	uint64_t tick = (base + d) << shift;
+	if (tick <= best) {
+	    best = tick;
+	    exact = false;
+	}
+    }
+    return best;
+}
+
+void
+TimerSet::wheel_set_timer_expiry()
+{
+    if (!_wheel_size) {
+	_timer_expiry = Timestamp();
+	return;
+    }
+    bool exact;
+    uint64_t tick = wheel_next_tick(_wheel_now, exact);
+    if (exact) {
+	Vector<Timer *> &v = _wheel[tick & (wheel_slots - 1)];
+	Timestamp e = v[0]->_expiry_s;
+	for (int i = 1; i < v.size(); ++i)
+	    if (v[i]->_expiry_s < e)
+		e = v[i]->_expiry_s;
+	_timer_expiry = e;
+    } else
+	_timer_expiry = Timestamp::make_usec((Timestamp::value_type) (tick << _wheel_shift));
+}
+
+void
+TimerSet::wheel_collect(uint64_t tick)
+{
+    Vector<Timer *> &v = _wheel[tick & (wheel_slots - 1)];
+    for (int i = 0; i < v.size(); ) {
+	Timer *t = v[i];
+	if (t->_expiry_s <= _timer_check) {
+	    wheel_remove(t);
+	    _timer_runchunk.push_back(t);
+	} else
+	    ++i;
+    }
+}
+
+static int
+timer_expiry_compar(const void *a, const void *b, void *)
+{
+    const Timestamp &ea = (*reinterpret_cast<Timer * const *>(a))->expiry_steady();
+    const Timestamp &eb = (*reinterpret_cast<Timer * const *>(b))->expiry_steady();
+    return ea < eb ? -1 : (eb < ea ? 1 : 0);
+}
+
+void
+TimerSet::wheel_run_timers(RouterThread *thread)
+{
+    adjust_timer_stride(_timer_expiry);
+
+    // advance the wheel to the current tick, cascading higher slots and
+    // collecting expired timers
+    uint64_t target = wheel_tick_of(_timer_check);
+    uint64_t from = _wheel_now;
+    bool exact;
+    while (_wheel_size) {
+	uint64_t tick = wheel_next_tick(from, exact);
+	if (tick > target)
+	    break;
+	if (tick != _wheel_now) {
+	    _wheel_now = tick;
+	    for (int l = 1; l < wheel_levels; ++l) {
+		int shift = wheel_bits * l;
+		if (tick & (((uint64_t) 1 << shift) - 1))
+		    break;
+		wheel_cascade(l * wheel_slots
+			      + ((tick >> shift) & (wheel_slots - 1)));
+	    }
+	    if (!(tick & (((uint64_t) 1 << (wheel_bits * wheel_levels)) - 1)))
+		wheel_cascade(wheel_overflow);
+	}
+	wheel_collect(tick);
+	if (tick == target)
+	    break;
+	from = tick + 1;
+    }
+    if (_wheel_now < target)
+	_wheel_now = target;
+    wheel_set_timer_expiry();
+
+    // run the batch in expiry order
+    if (_timer_runchunk.size() > 1)
+	click_qsort(_timer_runchunk.begin(), _timer_runchunk.size(),
+		    sizeof(Timer *), timer_expiry_compar);
+    for (int i = 0; i < _timer_runchunk.size(); ++i)
+	_timer_runchunk[i]->_schedpos1 = -i - 1;
+    run_timer_runchunk(thread);
+}
+
+/** Return the timer that expires first. The slots of a level cover
+ * disjoint, increasing ranges of ticks, so each level's earliest timer is in
+ * its first occupied slot; only those slots are scanned, plus the overflow
+ * slot, which is normally empty. */
+Timer *
+TimerSet::wheel_next_timer() const
+{
+    Timer *first = 0;
+    for (int l = 0; l < wheel_levels; ++l) {
+	uint64_t bm = _wheel_bitmap[l];
+	if (!bm)
+	    continue;
+	// Level 0 starts at the current tick. On higher levels, the slot of
+	// the current block was cascaded, so it can only hold timers one turn
+	// later and comes last.
+	uint64_t start = (_wheel_now >> (wheel_bits * l)) + (l ? 1 : 0);
+	int slot = (start + ffs_lsb(rotate_right(bm, start & (wheel_slots - 1))) - 1)
+	    & (wheel_slots - 1);
+	const Vector<Timer *> &v = _wheel[l * wheel_slots + slot];
+	for (Timer * const *tp = v.begin(); tp != v.end(); ++tp)
+	    if (!first || (*tp)->_expiry_s < first->_expiry_s)
+		first = *tp;
+    }
+    for (Timer * const *tp = _wheel[wheel_overflow].begin();
+	 tp != _wheel[wheel_overflow].end(); ++tp)
+	if (!first || (*tp)->_expiry_s < first->_expiry_s)
+	    first = *tp;
+    return first;
+}
+
 CLICK_ENDDECLS
@@ -85,11 +85,17 @@ CLICK_USING_DECLS
 #define SIMTICK_OPT             321
 #define NAME_OPT                322
 #define LOG_TIMESTAMP_OPT       323
+#define TIMER_WHEEL_OPT         324
+#define PACKET_POOL_OPT         325
+#define PACKET_PREALLOC_OPT     326
+#define DEVIRTUALIZE_OPT        327
+#define ADAPTIVE_POLL_OPT       328
 
 static const Clp_Option options[] = {
     { "allow-reconfigure", 'R', ALLOW_RECONFIG_OPT, 0, Clp_Negate },
     { "clickpath", 'C', CLICKPATH_OPT, Clp_ValString, 0 },
     { "expression", 'e', EXPRESSION_OPT, Clp_ValString, 0 },
+    { "devirtualize", 0, DEVIRTUALIZE_OPT, 0, Clp_Negate },
     { "dpdk", 0, DPDK_OPT, 0, 0 },
     { "file", 'f', ROUTER_OPT, Clp_ValString, 0 },
     { "handler", 'h', HANDLER_OPT, Clp_ValString, 0 },
@@ -101,6 +107,10 @@ static const Clp_Option options[] = {
     { "simtime", 0, SIMTIME_OPT, Clp_ValDouble, Clp_Optional },
     { "simulation-time", 0, SIMTIME_OPT, Clp_ValDouble, Clp_Optional },
     { "simtick", 0, SIMTICK_OPT, Clp_ValUnsignedLong, Clp_Mandatory },
+    { "timer-wheel", 0, TIMER_WHEEL_OPT, Clp_ValUnsigned, Clp_Optional | Clp_Negate },
+    { "adaptive-poll", 0, ADAPTIVE_POLL_OPT, 0, Clp_Negate },
+    { "packet-pool", 0, PACKET_POOL_OPT, Clp_ValUnsigned, 0 },
+    { "packet-prealloc", 0, PACKET_PREALLOC_OPT, Clp_ValUnsigned, 0 },
     { "threads", 'j', THREADS_OPT, Clp_ValInt, 0 },
     { "cpu", 0, THREADS_AFF_OPT, Clp_ValInt, Clp_Optional | Clp_Negate },
     { "affinity", 'a', THREADS_AFF_OPT, Clp_ValInt, Clp_Optional | Clp_Negate },
@@ -138,6 +148,11 @@ Options:\n\
   -f, --file FILE               Read router configuration from FILE.\n\
   -e, --expression EXPR         Use EXPR as router configuration.\n\
   -j, --threads N               Start N threads (default 1).\n", program_name);
+#if HAVE_DYNAMIC_LINKING
+    printf("\
+      --devirtualize            Compile the configuration with\n\
+                                click-devirtualize before running it.\n");
+#endif
 #if HAVE_DPDK
     printf("\
       --dpdk DPDK_ARGS --       Enable DPDK and give DPDK's own arguments.\n");
@@ -160,6 +175,12 @@ Options:\n\
   -w, --no-warnings             Do not print warnings.\n\
       --simtime                 Run in simulation time.\n\
       --simtick                 Amount of subseconds to add in warp time.\n\
+      --timer-wheel[=USEC]      Keep timers in timing wheels with USEC ticks\n\
+                                (default 1024) instead of heaps.\n\
+      --adaptive-poll           Back off from polling to sleeping when idle.\n\
+      --packet-pool N           Keep up to N free packets per thread.\n\
+      --packet-prealloc N       Preallocate N packets per NUMA node, from\n\
+                                hugepages when available.\n\
   -C, --clickpath PATH          Use PATH for CLICKPATH.\n\
       --help                    Print this message and exit.\n\
   -v, --version                 Print version number and exit.\n\
@@ -357,6 +378,27 @@ click_driver_control_socket_name(int number)
         return "click_driver@@ControlSocket@" + String(number);
 }
 
+#if HAVE_DYNAMIC_LINKING
+// Run click-devirtualize on the configuration. The result is an archive
+// whose package click_read_router() compiles and loads as usual.
+static String
+devirtualize_configuration(const char *router_file, bool file_is_expr,
+                           ErrorHandler *errh)
+{
+    int before_errors = errh->nerrors();
+    String text = file_is_expr ? String(router_file)
+        : file_string(router_file, errh);
+    String prog = clickpath_find_file("click-devirtualize", "bin", CLICK_BINDIR, errh);
+    if (errh->nerrors() != before_errors || !prog)
+        return String();
+    String archive = shell_command_output_string(shell_quote(prog), text, errh);
+    if (errh->nerrors() == before_errors
+        && (archive.length() == 0 || archive[0] != '!'))
+        errh->error("click-devirtualize failed");
+    return errh->nerrors() == before_errors ? archive : String();
+}
+#endif
+
 static Router *
 parse_configuration(const String &text, bool text_is_expr, bool hotswap,
                     ErrorHandler *errh)
@@ -532,6 +574,8 @@ main(int argc, char **argv)
   program_name = Clp_ProgramName(clp);
 
   const char *router_file = 0;
+  unsigned packet_prealloc = 0;
+  bool devirtualize = false;
   bool file_is_expr = false;
   const char *output_file = 0;
   bool quit_immediately = false;
@@ -678,6 +722,28 @@ main(int argc, char **argv)
         Timestamp::set_warp_tick(clp->val.ul);
         break;
     }
+    case PACKET_POOL_OPT:
+#if HAVE_CLICK_PACKET_POOL
+        WritablePacket::set_pool_size(clp->val.u, clp->val.u);
+#else
+        errh->warning("Click was built without a packet pool, ignoring --packet-pool");
+#endif
+        break;
+    case PACKET_PREALLOC_OPT:
+        packet_prealloc = clp->val.u;
+        break;
+    case DEVIRTUALIZE_OPT:
+        devirtualize = !clp->negated;
+        break;
+    case ADAPTIVE_POLL_OPT:
+        RouterThread::set_default_adaptive_poll(!clp->negated);
+        break;
+    case TIMER_WHEEL_OPT:
+        if (clp->negated)
+            TimerSet::set_default_wheel_tick(0);
+        else
+            TimerSet::set_default_wheel_tick(clp->have_val ? clp->val.u : 1024);
+        break;
      case CLICKPATH_OPT:
       set_clickpath(clp->vstr);
       break;
@@ -736,6 +802,15 @@ particular purpose.\n");
     }
 #endif
 
+  if (packet_prealloc) {
+#if HAVE_CLICK_PACKET_POOL
+      if (WritablePacket::pool_prealloc(packet_prealloc, errh) < 0)
+          return cleanup(clp, 1);
+#else
+      errh->warning("Click was built without a packet pool, ignoring --packet-prealloc");
+#endif
+  }
+
   // provide hotconfig handler if asked
   if (allow_reconfigure)
       Router::add_write_handler(0, "hotconfig", hotconfig_handler, 0, Handler::f_raw | Handler::f_nonexclusive);
@@ -743,6 +818,20 @@ particular purpose.\n");
   if (Timestamp::warp_class() != Timestamp::warp_simulation)
       Router::add_write_handler(0, "timewarp", timewarp_write_handler, 0);
 
+  // compile configuration
+  String devirtualized;
+  if (devirtualize) {
+#if HAVE_DYNAMIC_LINKING
+      devirtualized = devirtualize_configuration(router_file, file_is_expr, errh);
+      if (!devirtualized)
+          return cleanup(clp, 1);
+      router_file = devirtualized.c_str();
+      file_is_expr = true;
+#else
+      errh->warning("Click was built without dynamic linking, ignoring --devirtualize");
+#endif
+  }
+
   // parse configuration
   click_master = new Master(click_nthreads);
   click_router = parse_configuration(router_file, file_is_expr, false, errh);